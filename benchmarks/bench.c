@@ -0,0 +1,340 @@
+/*
+ * Minimal harness for C microbenchmarks
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "ubx.h"
+#include "bench.h"
+
+#define DEF_SAMPLES	1000
+#define DEF_ITERS	1000
+#define DEF_WARMUP	10000
+
+static void usage(const char *prog, const char *extra_usage)
+{
+	fprintf(stderr,
+		"usage: %s [OPTIONS] %s\n"
+		"   -c <cpu>       pin to CPU (def: the current CPU, -1: don't pin)\n"
+		"   -s <samples>   number of timed samples (def: %u)\n"
+		"   -n <iters>     operations per sample (def: %u)\n"
+		"   -w <warmup>    untimed operations before sampling (def: %u)\n"
+		"   -f <filter>    only run benchmarks containing <filter>\n"
+		"   -M <moddir>    directory to load modules from (def: %s)\n"
+		"   -o <file>      write results as JSON to <file>\n"
+		"   -h             show this help\n",
+		prog, extra_usage ? extra_usage : "",
+		DEF_SAMPLES, DEF_ITERS, DEF_WARMUP, UBX_MODDIR);
+}
+
+/**
+ * bench_init - parse the common options and setup the benchmark
+ *
+ * @opts: options to initialize
+ * @suite: name of the benchmark suite (for JSON output)
+ * @extra_usage: usage of program specific positional arguments
+ * @return index of the first positional argument or -1 on error
+ */
+int bench_init(struct bench_opts *opts, int argc, char **argv,
+	       const char *suite, const char *extra_usage)
+{
+	int opt;
+	const char *json = NULL;
+
+	memset(opts, 0, sizeof(struct bench_opts));
+
+	opts->cpu = sched_getcpu();
+	opts->samples = DEF_SAMPLES;
+	opts->iters = DEF_ITERS;
+	opts->warmup = DEF_WARMUP;
+	opts->moddir = UBX_MODDIR;
+
+	while ((opt = getopt(argc, argv, "c:s:n:w:f:M:o:h")) != -1) {
+		switch (opt) {
+		case 'c':
+			opts->cpu = atoi(optarg);
+			break;
+		case 's':
+			opts->samples = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			opts->iters = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			opts->warmup = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			opts->filter = optarg;
+			break;
+		case 'M':
+			opts->moddir = optarg;
+			break;
+		case 'o':
+			json = optarg;
+			break;
+		case 'h':
+		default:
+			usage(argv[0], extra_usage);
+			return -1;
+		}
+	}
+
+	if (opts->samples == 0 || opts->iters == 0) {
+		fprintf(stderr, "error: samples and iters must be > 0\n");
+		return -1;
+	}
+
+	if (opts->cpu >= 0 && bench_pin(opts->cpu) != 0)
+		return -1;
+
+	opts->out = fdopen(dup(STDOUT_FILENO), "w");
+
+	if (opts->out == NULL) {
+		fprintf(stderr, "error: failed to dup stdout: %s\n", strerror(errno));
+		return -1;
+	}
+
+	if (json != NULL) {
+		opts->json = fopen(json, "w");
+
+		if (opts->json == NULL) {
+			fprintf(stderr, "error: failed to open %s: %s\n",
+				json, strerror(errno));
+			return -1;
+		}
+
+		fprintf(opts->json,
+			"{\n  \"suite\": \"%s\",\n  \"cpu\": %d,\n  \"results\": [",
+			suite, opts->cpu);
+	}
+
+	fprintf(opts->out, "%s: cpu %d\n", suite, opts->cpu);
+	fprintf(opts->out, "%-36s %10s %10s %10s %10s %10s %10s  [ns]\n",
+		"benchmark", "min", "mean", "p50", "p90", "p99", "max");
+
+	return optind;
+}
+
+/**
+ * bench_finish - close the output and finalize the JSON output
+ */
+void bench_finish(struct bench_opts *opts)
+{
+	if (opts->out != NULL) {
+		fclose(opts->out);
+		opts->out = NULL;
+	}
+
+	if (opts->json == NULL)
+		return;
+
+	fprintf(opts->json, "\n  ]\n}\n");
+	fclose(opts->json);
+	opts->json = NULL;
+}
+
+/**
+ * bench_pin - pin the calling thread to a CPU
+ *
+ * @cpu: CPU to pin to
+ * @return 0 if OK, -1 otherwise
+ */
+int bench_pin(int cpu)
+{
+	int ret;
+	cpu_set_t cpuset;
+
+	CPU_ZERO(&cpuset);
+	CPU_SET(cpu, &cpuset);
+
+	ret = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+
+	if (ret != 0) {
+		fprintf(stderr, "error: failed to pin to CPU %d: %s\n",
+			cpu, strerror(ret));
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * bench_now - monotonic time in ns
+ */
+uint64_t bench_now(void)
+{
+	struct ubx_timespec ts;
+
+	ubx_clock_mono_gettime(&ts);
+	return ubx_ts_to_ns(&ts);
+}
+
+/**
+ * bench_enabled - check if a benchmark is selected by the filter
+ */
+int bench_enabled(const struct bench_opts *opts, const char *name)
+{
+	return opts->filter == NULL || strstr(name, opts->filter) != NULL;
+}
+
+/**
+ * bench_run - run and report a benchmark
+ *
+ * @opts: options
+ * @name: name of the benchmark
+ * @fn: function carrying out the given number of operations
+ * @arg: argument passed to @fn
+ * @return 0 if OK (or filtered), -1 otherwise
+ */
+int bench_run(struct bench_opts *opts, const char *name, bench_fn_t fn, void *arg)
+{
+	double *samples;
+	uint64_t start, end;
+	struct bench_result res;
+
+	if (!bench_enabled(opts, name))
+		return 0;
+
+	samples = malloc(opts->samples * sizeof(double));
+
+	if (samples == NULL) {
+		fprintf(stderr, "error: %s: failed to alloc samples\n", name);
+		return -1;
+	}
+
+	if (opts->warmup > 0)
+		fn(arg, opts->warmup);
+
+	for (unsigned int i = 0; i < opts->samples; i++) {
+		start = bench_now();
+		fn(arg, opts->iters);
+		end = bench_now();
+		samples[i] = (double)(end - start) / opts->iters;
+	}
+
+	bench_summarize(samples, opts->samples, &res);
+	res.name = name;
+	res.iters = opts->iters;
+
+	bench_report(opts, &res);
+	free(samples);
+	return 0;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	const double *x = a, *y = b;
+
+	return (*x > *y) - (*x < *y);
+}
+
+/* nearest rank percentile of sorted samples */
+static double percentile(const double *sorted, unsigned int num, double p)
+{
+	unsigned int rank = (unsigned int)ceil(p / 100 * num);
+
+	return sorted[(rank > 0) ? rank - 1 : 0];
+}
+
+/**
+ * bench_summarize - compute the statistics of samples
+ *
+ * @samples: samples, will be sorted
+ * @num: number of samples (> 0)
+ * @res: result to fill in (except name and iters)
+ */
+void bench_summarize(double *samples, unsigned int num, struct bench_result *res)
+{
+	double sum = 0;
+
+	qsort(samples, num, sizeof(double), cmp_double);
+
+	for (unsigned int i = 0; i < num; i++)
+		sum += samples[i];
+
+	res->samples = num;
+	res->min = samples[0];
+	res->max = samples[num - 1];
+	res->mean = sum / num;
+	res->p50 = percentile(samples, num, 50);
+	res->p90 = percentile(samples, num, 90);
+	res->p99 = percentile(samples, num, 99);
+	res->hist = NULL;
+	res->lost = 0;
+}
+
+/* print the non-empty range of a histogram */
+static void hist_print(FILE *out, const unsigned long *hist)
+{
+	int first = -1, last = -1;
+	unsigned long max = 0;
+
+	for (int i = 0; i < BENCH_HIST_LEN; i++) {
+		if (hist[i] == 0)
+			continue;
+		if (first < 0)
+			first = i;
+		last = i;
+		max = MAX(max, hist[i]);
+	}
+
+	for (int i = first; i >= 0 && i <= last; i++) {
+		fprintf(out, "    [%12llu, %12llu) ns %10lu  ",
+			1ULL << i, 1ULL << (i + 1), hist[i]);
+
+		for (unsigned long j = 0; j < (hist[i] * 40 + max - 1) / max; j++)
+			fputc('#', out);
+
+		fputc('\n', out);
+	}
+}
+
+/**
+ * bench_report - print a result and append it to the JSON output
+ *
+ * The histogram is only printed and written if @res->hist is set.
+ */
+void bench_report(struct bench_opts *opts, const struct bench_result *res)
+{
+	fprintf(opts->out, "%-36s %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+		res->name, res->min, res->mean, res->p50, res->p90, res->p99, res->max);
+
+	if (res->hist) {
+		fprintf(opts->out, "    %u samples, %lu lost\n", res->samples, res->lost);
+		hist_print(opts->out, res->hist);
+	}
+
+	if (opts->json == NULL)
+		return;
+
+	fprintf(opts->json,
+		"%s\n    { \"name\": \"%s\", \"unit\": \"ns\", \"samples\": %u, \"iters\": %lu, "
+		"\"min\": %.1f, \"mean\": %.1f, \"p50\": %.1f, \"p90\": %.1f, "
+		"\"p99\": %.1f, \"max\": %.1f",
+		(opts->num_results > 0) ? "," : "",
+		res->name, res->samples, res->iters,
+		res->min, res->mean, res->p50, res->p90, res->p99, res->max);
+
+	if (res->hist) {
+		fprintf(opts->json, ", \"lost\": %lu, \"hist_log2_ns\": [", res->lost);
+
+		for (int i = 0; i < BENCH_HIST_LEN; i++)
+			fprintf(opts->json, "%s%lu", (i > 0) ? ", " : "", res->hist[i]);
+
+		fprintf(opts->json, "]");
+	}
+
+	fprintf(opts->json, " }");
+	opts->num_results++;
+}
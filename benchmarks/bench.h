@@ -0,0 +1,88 @@
+/*
+ * Minimal harness for C microbenchmarks
+ *
+ * A benchmark function is called with the number of operations to
+ * carry out. After a warmup, it is timed for a number of samples of
+ * a fixed number of operations each. The per-operation times of all
+ * samples are summarized as percentiles, printed and optionally
+ * written to a JSON file.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/**
+ * struct bench_opts - options common to all benchmark programs
+ * @cpu: CPU to pin the benchmark thread to (-1: don't pin)
+ * @samples: number of timed samples
+ * @iters: number of operations per sample
+ * @warmup: number of untimed operations before sampling
+ * @filter: only run benchmarks whose name contains this string
+ * @moddir: directory to load modules from
+ * @out: stream to print results to (a dup of stdout, which benchmarks may redirect)
+ * @json: JSON output file (NULL if disabled)
+ * @num_results: number of results written to @json so far
+ */
+struct bench_opts {
+	int cpu;
+	unsigned int samples;
+	unsigned long iters;
+	unsigned long warmup;
+	const char *filter;
+	const char *moddir;
+	FILE *out;
+	FILE *json;
+	unsigned int num_results;
+};
+
+/* number of buckets of a log2 histogram of ns values */
+#define BENCH_HIST_LEN		40
+
+/**
+ * struct bench_result - summary of a benchmark [ns per operation]
+ * @hist: optional log2 histogram, hist[i] counts values in [2^i, 2^(i+1)) ns
+ * @lost: number of lost samples (only reported along with @hist)
+ */
+struct bench_result {
+	const char *name;
+	unsigned int samples;
+	unsigned long iters;
+	double min;
+	double mean;
+	double p50;
+	double p90;
+	double p99;
+	double max;
+	const unsigned long *hist;
+	unsigned long lost;
+};
+
+/* bucket of value [ns] in a log2 histogram */
+static inline unsigned int bench_hist_bucket(uint64_t val)
+{
+	unsigned int i = (val > 0) ? 63 - __builtin_clzll(val) : 0;
+
+	return (i < BENCH_HIST_LEN) ? i : BENCH_HIST_LEN - 1;
+}
+
+typedef void (*bench_fn_t)(void *arg, unsigned long num);
+
+int bench_init(struct bench_opts *opts, int argc, char **argv,
+	       const char *suite, const char *extra_usage);
+void bench_finish(struct bench_opts *opts);
+
+int bench_pin(int cpu);
+uint64_t bench_now(void);
+int bench_enabled(const struct bench_opts *opts, const char *name);
+
+int bench_run(struct bench_opts *opts, const char *name, bench_fn_t fn, void *arg);
+
+void bench_summarize(double *samples, unsigned int num, struct bench_result *res);
+void bench_report(struct bench_opts *opts, const struct bench_result *res);
+
+#endif /* BENCH_H */
@@ -0,0 +1,71 @@
+#!/usr/bin/luajit
+--
+-- Measure the per block dispatch overhead of trigger chains.
+--
+-- A trig block triggers a chain of N trivial cconst blocks (which
+-- write to an unconnected port). The time per block is compared to
+-- stepping the same blocks with ubx_cblock_step from a (JIT
+-- compiled) loop, which performs all checks on every step.
+--
+-- usage: bench_chain_dispatch.lua [num_blocks] [iterations]
+--
+
+local ffi = require("ffi")
+local ubx = require("ubx")
+local bd = require("blockdiagram")
+
+local NUM_BLOCKS = tonumber(arg[1]) or 500
+local ITERATIONS = tonumber(arg[2]) or 10000
+
+local function gen_sys()
+   local blocks, configs, chain = {}, {}, {}
+
+   for i=1,NUM_BLOCKS do
+      local name = "c"..tostring(i)
+      blocks[#blocks+1] = { name=name, type="consts/cconst" }
+      configs[#configs+1] = { name=name, config = { type_name="int", value=i } }
+      chain[#chain+1] = { b="#"..name }
+   end
+
+   blocks[#blocks+1] = { name="trig", type="std_triggers/trig" }
+   configs[#configs+1] = { name="trig", config = { chain0=chain } }
+
+   return bd.system {
+      imports = { "stdtypes", "cconst", "trig" },
+      blocks = blocks,
+      configurations = configs,
+   }
+end
+
+local function measure(name, func)
+   local ts_start = ffi.new("struct ubx_timespec")
+   local ts_end = ffi.new("struct ubx_timespec")
+
+   -- warm up caches and JIT
+   for _=1,100 do func() end
+
+   ubx.clock_mono_gettime(ts_start)
+   for _=1,ITERATIONS do func() end
+   ubx.clock_mono_gettime(ts_end)
+
+   local dur = ts_end - ts_start
+   print(string.format("%-20s %10.3f s %10.2f ns/block", name, dur,
+		       dur * 1e9 / (ITERATIONS * NUM_BLOCKS)))
+end
+
+local sys = gen_sys()
+local nd = sys:launch{ nodename="bench_chain_dispatch", loglevel=0 }
+
+local trig = nd:b("trig")
+local blks = {}
+for i=1,NUM_BLOCKS do blks[i] = nd:b("c"..tostring(i)) end
+
+print(string.format("%d blocks, %d iterations", NUM_BLOCKS, ITERATIONS))
+
+measure("ubx_cblock_step", function()
+	   for i=1,NUM_BLOCKS do ubx.cblock_step(blks[i]) end
+end)
+
+measure("ubx_chain_trigger", function() ubx.cblock_step(trig) end)
+
+sys:pulldown(nd)
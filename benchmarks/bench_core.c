@@ -0,0 +1,701 @@
+/*
+ * Microbenchmarks of the libubx core hot paths
+ *
+ * Measures port I/O through the bundled iblocks, the typed port
+ * accessors, block stepping and chain triggering in each tstats
+ * mode, port and config lookups, logging and reading the time. The
+ * port benchmarks use a trivial cblock "bench/dummy" registered by
+ * this program, the iblocks are loaded from the module directory.
+ * Benchmarks of iblocks whose module fails to load are skipped.
+ *
+ * The large_ring benchmarks cycle large arrays through a large
+ * lfds_cyclic ring backed by regular or huge pages. To see the
+ * effect on the TLB, run these under perf, e.g.
+ * perf stat -e dTLB-load-misses,dTLB-store-misses bench_core -f large_ring/regular
+ *
+ * The ring_chain benchmarks write and read a chain of small rings in
+ * turn, as a trigger chain would. The rings are either allocated
+ * separately with unrelated allocations in between or contiguously
+ * in a memory arena, e.g.
+ * perf stat -e L1-dcache-load-misses,dTLB-load-misses bench_core -f ring_chain/arena
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "ubx.h"
+#include "trig_utils.h"
+#include "bench.h"
+
+#define ARR_LEN		8
+#define CHAIN_LEN	16
+#define BUFFER_LEN	8
+#define RING_LEN	2048
+#define RING_DATA_LEN	1024
+#define NUM_RINGS	CHAIN_LEN
+#define NOISE_SIZE	1024
+
+static ubx_node_t nd;
+static unsigned long num_steps;
+static const void *volatile sink;
+
+ubx_proto_config_t dummy_config[] = {
+	{ .name = "c0", .type_name = "int" },
+	{ .name = "c1", .type_name = "int" },
+	{ .name = "c2", .type_name = "int" },
+	{ .name = "c3", .type_name = "int" },
+	{ .name = "c4", .type_name = "int" },
+	{ .name = "c5", .type_name = "int" },
+	{ .name = "c6", .type_name = "int" },
+	{ .name = "c7", .type_name = "int" },
+	{ 0 },
+};
+
+ubx_proto_port_t dummy_ports[] = {
+	{ .name = "out", .out_type_name = "double" },
+	{ .name = "in", .in_type_name = "double" },
+	{ .name = "out_arr", .out_type_name = "double", .out_data_len = ARR_LEN },
+	{ .name = "in_arr", .in_type_name = "double", .in_data_len = ARR_LEN },
+	{ .name = "out_big", .out_type_name = "double", .out_data_len = RING_DATA_LEN },
+	{ .name = "in_big", .in_type_name = "double", .in_data_len = RING_DATA_LEN },
+	{ 0 },
+};
+
+static void dummy_step(ubx_block_t *b)
+{
+	(void)b;
+	num_steps++;
+}
+
+ubx_proto_block_t dummy_comp = {
+	.name = "bench/dummy",
+	.type = BLOCK_TYPE_COMPUTATION,
+	.configs = dummy_config,
+	.ports = dummy_ports,
+	.step = dummy_step,
+};
+
+/* iblocks to benchmark port I/O through */
+struct iblock_spec {
+	const char *module;
+	const char *type;
+	int sink;
+	int (*config)(ubx_block_t *ib, long data_len);
+};
+
+static int config_cyclic(ubx_block_t *ib, long data_len)
+{
+	uint32_t len = data_len, buffer_len = BUFFER_LEN;
+
+	return cfg_set_char(ib, "type_name", "double", strlen("double") + 1) ||
+		cfg_set_uint32(ib, "data_len", &len, 1) ||
+		cfg_set_uint32(ib, "buffer_len", &buffer_len, 1);
+}
+
+static int config_mqueue(ubx_block_t *ib, long data_len)
+{
+	char mq_id[32];
+	long buffer_len = BUFFER_LEN;
+	uint32_t blocking = 0;
+
+	snprintf(mq_id, sizeof(mq_id), "bench_core_%d", getpid());
+
+	return cfg_set_char(ib, "mq_id", mq_id, strlen(mq_id) + 1) ||
+		cfg_set_char(ib, "type_name", "double", strlen("double") + 1) ||
+		cfg_set_long(ib, "data_len", &data_len, 1) ||
+		cfg_set_long(ib, "buffer_len", &buffer_len, 1) ||
+		cfg_set_uint32(ib, "blocking", &blocking, 1);
+}
+
+static int config_fifo(ubx_block_t *ib, long data_len)
+{
+	uint32_t size = BUFFER_LEN * 64 * data_len;
+
+	return cfg_set_uint32(ib, "fifo_size", &size, 1);
+}
+
+static const struct iblock_spec iblocks[] = {
+	{ "lfds_cyclic", "lfds_buffers/cyclic", 0, config_cyclic },
+	{ "mqueue", "mqueue", 0, config_mqueue },
+	{ "simple_fifo", "examples/simple_fifo", 0, config_fifo },
+	{ "hexdump", "hexdump/hexdump", 1, NULL },
+	{ 0 },
+};
+
+struct port_ctx {
+	ubx_block_t *b;
+	ubx_port_t *out, *in;
+	ubx_port_t *out_arr, *in_arr;
+	ubx_data_t *wdata, *rdata;
+	double arr[ARR_LEN];
+};
+
+struct rings_ctx {
+	ubx_block_t *ib[NUM_RINGS];
+	ubx_data_t *wdata, *rdata;
+};
+
+struct chain_ctx {
+	struct ubx_triggee triggees[CHAIN_LEN];
+	struct ubx_chain chain;
+};
+
+static int load_module(const struct bench_opts *opts, const char *name)
+{
+	char path[PATH_MAX];
+
+	snprintf(path, sizeof(path), "%s/%s.so", opts->moddir, name);
+
+	if (ubx_module_get(&nd, path) != NULL)
+		return 0;
+
+	if (ubx_module_load(&nd, path) != 0) {
+		fprintf(stderr, "warning: failed to load %s\n", path);
+		return -1;
+	}
+
+	return 0;
+}
+
+static ubx_block_t *block_create(const char *type, const char *name)
+{
+	ubx_block_t *b = ubx_block_create(&nd, type, name);
+
+	if (b == NULL)
+		fprintf(stderr, "error: failed to create block %s of type %s\n", name, type);
+
+	return b;
+}
+
+/* create and start an iblock and connect out to in (if not a sink) */
+static ubx_block_t *conn_create(const struct iblock_spec *spec,
+				ubx_port_t *out, ubx_port_t *in, long data_len)
+{
+	ubx_block_t *ib;
+
+	ib = block_create(spec->type, "ib");
+
+	if (ib == NULL)
+		return NULL;
+
+	if ((spec->config && spec->config(ib, data_len) != 0) ||
+	    ubx_block_init(ib) != 0 ||
+	    ubx_block_start(ib) != 0) {
+		fprintf(stderr, "error: failed to setup %s\n", spec->type);
+		goto out_rm;
+	}
+
+	if (spec->sink) {
+		if (ubx_port_connect_out(out, ib) == 0)
+			return ib;
+	} else {
+		if (ubx_ports_connect(out, in, ib) == 0)
+			return ib;
+	}
+
+	fprintf(stderr, "error: failed to connect %s\n", spec->type);
+
+ out_rm:
+	ubx_block_rm(&nd, "ib");
+	return NULL;
+}
+
+static void conn_destroy(const struct iblock_spec *spec, ubx_block_t *ib,
+			 ubx_port_t *out, ubx_port_t *in)
+{
+	if (spec->sink)
+		ubx_port_disconnect_out(out, ib);
+	else
+		ubx_ports_disconnect(out, in, ib);
+
+	ubx_block_stop(ib);
+	ubx_block_cleanup(ib);
+	ubx_block_rm(&nd, "ib");
+}
+
+/* benchmark functions */
+static void bm_port_rw(void *arg, unsigned long num)
+{
+	struct port_ctx *c = arg;
+
+	for (unsigned long i = 0; i < num; i++) {
+		__port_write(c->out, c->wdata);
+		__port_read(c->in, c->rdata);
+	}
+}
+
+static void bm_port_write(void *arg, unsigned long num)
+{
+	struct port_ctx *c = arg;
+
+	for (unsigned long i = 0; i < num; i++)
+		__port_write(c->out, c->wdata);
+}
+
+static void bm_typed_rw(void *arg, unsigned long num)
+{
+	double val = 0;
+	struct port_ctx *c = arg;
+
+	for (unsigned long i = 0; i < num; i++) {
+		write_double(c->out, &val);
+		read_double(c->in, &val);
+	}
+}
+
+static void bm_typed_rw_arr(void *arg, unsigned long num)
+{
+	struct port_ctx *c = arg;
+
+	for (unsigned long i = 0; i < num; i++) {
+		write_double_array(c->out_arr, c->arr, ARR_LEN);
+		read_double_array(c->in_arr, c->arr, ARR_LEN);
+	}
+}
+
+static void bm_cblock_step(void *arg, unsigned long num)
+{
+	struct port_ctx *c = arg;
+
+	for (unsigned long i = 0; i < num; i++)
+		ubx_cblock_step(c->b);
+}
+
+static void bm_chain_trigger(void *arg, unsigned long num)
+{
+	struct chain_ctx *c = arg;
+
+	for (unsigned long i = 0; i < num; i++)
+		ubx_chain_trigger(&c->chain);
+}
+
+static void bm_port_get(void *arg, unsigned long num)
+{
+	struct port_ctx *c = arg;
+
+	for (unsigned long i = 0; i < num; i++)
+		sink = ubx_port_get(c->b, "in_arr");
+}
+
+static void bm_config_get(void *arg, unsigned long num)
+{
+	struct port_ctx *c = arg;
+
+	for (unsigned long i = 0; i < num; i++)
+		sink = ubx_config_get(c->b, "c7");
+}
+
+static void bm_log_filtered(void *arg, unsigned long num)
+{
+	(void)arg;
+
+	for (unsigned long i = 0; i < num; i++)
+		ubx_log(UBX_LOGLEVEL_DEBUG, &nd, "bench", "iteration %lu", i);
+}
+
+static void bm_log(void *arg, unsigned long num)
+{
+	(void)arg;
+
+	for (unsigned long i = 0; i < num; i++)
+		__ubx_log(UBX_LOGLEVEL_DEBUG, &nd, "bench", "iteration %lu", i);
+}
+
+static void bm_gettime(void *arg, unsigned long num)
+{
+	struct ubx_timespec ts;
+
+	(void)arg;
+
+	for (unsigned long i = 0; i < num; i++)
+		ubx_gettime(&ts);
+}
+
+static void bm_node_gettime(void *arg, unsigned long num)
+{
+	struct ubx_timespec ts;
+
+	(void)arg;
+
+	for (unsigned long i = 0; i < num; i++)
+		ubx_node_gettime(&nd, &ts);
+}
+
+/* run a benchmark with stdout redirected to /dev/null */
+static int bench_run_quiet(struct bench_opts *opts, const char *name,
+			   bench_fn_t fn, void *arg)
+{
+	int ret, fd, saved;
+
+	if (!bench_enabled(opts, name))
+		return 0;
+
+	fflush(stdout);
+	saved = dup(STDOUT_FILENO);
+	fd = open("/dev/null", O_WRONLY);
+
+	if (saved < 0 || fd < 0 || dup2(fd, STDOUT_FILENO) < 0) {
+		fprintf(stderr, "error: %s: failed to redirect stdout\n", name);
+		ret = -1;
+		goto out;
+	}
+
+	ret = bench_run(opts, name, fn, arg);
+
+	fflush(stdout);
+	dup2(saved, STDOUT_FILENO);
+
+ out:
+	if (fd >= 0)
+		close(fd);
+	if (saved >= 0)
+		close(saved);
+	return ret;
+}
+
+static int bench_ports(struct bench_opts *opts, struct port_ctx *c)
+{
+	int ret = 0;
+	ubx_block_t *ib;
+	char name[64];
+
+	ret |= bench_run(opts, "port_write/unconnected", bm_port_write, c);
+
+	for (const struct iblock_spec *spec = iblocks; spec->module; spec++) {
+		snprintf(name, sizeof(name), "%s/%s",
+			 spec->sink ? "port_write" : "port_rw", spec->module);
+
+		if (!bench_enabled(opts, name))
+			continue;
+
+		if (load_module(opts, spec->module) != 0)
+			continue;
+
+		ib = conn_create(spec, c->out, c->in, 1);
+
+		if (ib == NULL) {
+			ret = -1;
+			continue;
+		}
+
+		if (spec->sink)
+			ret |= bench_run_quiet(opts, name, bm_port_write, c);
+		else
+			ret |= bench_run(opts, name, bm_port_rw, c);
+
+		conn_destroy(spec, ib, c->out, c->in);
+	}
+
+	return ret;
+}
+
+static int bench_typed(struct bench_opts *opts, struct port_ctx *c)
+{
+	int ret = 0;
+	ubx_block_t *ib;
+	const struct iblock_spec *spec = &iblocks[0];
+
+	if (!bench_enabled(opts, "typed_rw") || load_module(opts, spec->module) != 0)
+		return 0;
+
+	ib = conn_create(spec, c->out, c->in, 1);
+
+	if (ib == NULL)
+		return -1;
+
+	ret |= bench_run(opts, "typed_rw/double", bm_typed_rw, c);
+	conn_destroy(spec, ib, c->out, c->in);
+
+	ib = conn_create(spec, c->out_arr, c->in_arr, ARR_LEN);
+
+	if (ib == NULL)
+		return -1;
+
+	ret |= bench_run(opts, "typed_rw/double[8]", bm_typed_rw_arr, c);
+	conn_destroy(spec, ib, c->out_arr, c->in_arr);
+
+	return ret;
+}
+
+/*
+ * write num samples, then read these back. Unlike alternating
+ * writes and reads, which reuse the same ring element, this touches
+ * min(num, RING_LEN) elements.
+ */
+static void bm_ring_cycle(void *arg, unsigned long num)
+{
+	struct port_ctx *c = arg;
+
+	for (unsigned long i = 0; i < num; i++)
+		__port_write(c->out, c->wdata);
+
+	for (unsigned long i = 0; i < num; i++)
+		__port_read(c->in, c->rdata);
+}
+
+static int bench_large_ring(struct bench_opts *opts)
+{
+	int ret = 0, huge;
+	char name[64];
+	ubx_block_t *b, *ib;
+	struct port_ctx c;
+	uint32_t len = RING_DATA_LEN, buffer_len = RING_LEN;
+	static const char *pages[] = { "regular", "huge" };
+
+	if (!bench_enabled(opts, "large_ring") || load_module(opts, "lfds_cyclic") != 0)
+		return 0;
+
+	memset(&c, 0, sizeof(c));
+	b = ubx_block_get(&nd, "dummy");
+	c.out = ubx_port_get(b, "out_big");
+	c.in = ubx_port_get(b, "in_big");
+	c.wdata = ubx_data_alloc(&nd, "double", RING_DATA_LEN);
+	c.rdata = ubx_data_alloc(&nd, "double", RING_DATA_LEN);
+
+	if (c.wdata == NULL || c.rdata == NULL) {
+		ret = -1;
+		goto out;
+	}
+
+	for (huge = 0; huge <= 1; huge++) {
+		snprintf(name, sizeof(name), "large_ring/%s/%dx%d", pages[huge],
+			 RING_LEN, RING_DATA_LEN);
+
+		if (!bench_enabled(opts, name))
+			continue;
+
+		ib = block_create("lfds_buffers/cyclic", "ib");
+
+		if (ib == NULL ||
+		    cfg_set_char(ib, "type_name", "double", strlen("double") + 1) ||
+		    cfg_set_uint32(ib, "data_len", &len, 1) ||
+		    cfg_set_uint32(ib, "buffer_len", &buffer_len, 1) ||
+		    cfg_set_int(ib, "hugepages", &huge, 1) ||
+		    ubx_block_init(ib) != 0 ||
+		    ubx_block_start(ib) != 0 ||
+		    ubx_ports_connect(c.out, c.in, ib) != 0) {
+			fprintf(stderr, "error: failed to setup %s\n", name);
+			ubx_block_rm(&nd, "ib");
+			ret = -1;
+			continue;
+		}
+
+		/* the first iteration prefaults the ring */
+		ret |= bench_run(opts, name, bm_ring_cycle, &c);
+
+		ubx_ports_disconnect(c.out, c.in, ib);
+		ubx_block_stop(ib);
+		ubx_block_cleanup(ib);
+		ubx_block_rm(&nd, "ib");
+	}
+
+ out:
+	ubx_data_free(c.wdata);
+	ubx_data_free(c.rdata);
+	return ret;
+}
+
+/* write and read each ring of the chain in turn */
+static void bm_ring_chain(void *arg, unsigned long num)
+{
+	struct rings_ctx *c = arg;
+
+	for (unsigned long i = 0; i < num; i++) {
+		for (int j = 0; j < NUM_RINGS; j++) {
+			c->ib[j]->write(c->ib[j], c->wdata);
+			c->ib[j]->read(c->ib[j], c->rdata);
+		}
+	}
+}
+
+static int bench_ring_chain(struct bench_opts *opts)
+{
+	int ret = 0, n;
+	char name[64], ibname[32];
+	struct rings_ctx c;
+	struct ubx_mem_arena *arena;
+	void *noise[NUM_RINGS];
+	uint32_t len = ARR_LEN, buffer_len = BUFFER_LEN;
+	static const char *layouts[] = { "scattered", "arena" };
+
+	if (!bench_enabled(opts, "ring_chain") || load_module(opts, "lfds_cyclic") != 0)
+		return 0;
+
+	memset(&c, 0, sizeof(c));
+	c.wdata = ubx_data_alloc(&nd, "double", ARR_LEN);
+	c.rdata = ubx_data_alloc(&nd, "double", ARR_LEN);
+
+	if (c.wdata == NULL || c.rdata == NULL) {
+		ret = -1;
+		goto out;
+	}
+
+	for (int layout = 0; layout <= 1; layout++) {
+		snprintf(name, sizeof(name), "ring_chain/%s/%d", layouts[layout], NUM_RINGS);
+
+		if (!bench_enabled(opts, name))
+			continue;
+
+		arena = NULL;
+
+		if (layout == 1) {
+			arena = ubx_mem_arena_create(&nd, name, NUM_RINGS * 4096);
+
+			if (arena == NULL) {
+				ret = -1;
+				continue;
+			}
+		}
+
+		for (n = 0; n < NUM_RINGS; n++) {
+			snprintf(ibname, sizeof(ibname), "ring%d", n);
+			c.ib[n] = block_create("lfds_buffers/cyclic", ibname);
+
+			if (c.ib[n] == NULL)
+				break;
+
+			if (cfg_set_char(c.ib[n], "type_name", "double", strlen("double") + 1) ||
+			    cfg_set_uint32(c.ib[n], "data_len", &len, 1) ||
+			    cfg_set_uint32(c.ib[n], "buffer_len", &buffer_len, 1) ||
+			    ubx_block_mem_arena_set(c.ib[n], arena) != 0 ||
+			    ubx_block_init(c.ib[n]) != 0 ||
+			    ubx_block_start(c.ib[n]) != 0) {
+				ubx_block_rm(&nd, ibname);
+				break;
+			}
+
+			/* unrelated allocations between the rings */
+			noise[n] = malloc(NOISE_SIZE);
+
+			if (noise[n] != NULL)
+				memset(noise[n], 0, NOISE_SIZE);
+		}
+
+		if (n == NUM_RINGS) {
+			ret |= bench_run(opts, name, bm_ring_chain, &c);
+		} else {
+			fprintf(stderr, "error: failed to setup %s\n", name);
+			ret = -1;
+		}
+
+		while (n-- > 0) {
+			snprintf(ibname, sizeof(ibname), "ring%d", n);
+			ubx_block_stop(c.ib[n]);
+			ubx_block_cleanup(c.ib[n]);
+			ubx_block_rm(&nd, ibname);
+			free(noise[n]);
+		}
+	}
+
+ out:
+	ubx_data_free(c.wdata);
+	ubx_data_free(c.rdata);
+	return ret;
+}
+
+static int bench_chain(struct bench_opts *opts)
+{
+	int ret = 0;
+	char name[64];
+	struct chain_ctx c;
+	static const char *modes[] = { "disabled", "global", "perblock" };
+
+	memset(&c, 0, sizeof(c));
+
+	for (int i = 0; i < CHAIN_LEN; i++) {
+		snprintf(name, sizeof(name), "chain%d", i);
+		c.triggees[i].b = block_create(dummy_comp.name, name);
+
+		if (c.triggees[i].b == NULL ||
+		    ubx_block_init(c.triggees[i].b) != 0 ||
+		    ubx_block_start(c.triggees[i].b) != 0)
+			return -1;
+	}
+
+	for (int mode = TSTATS_DISABLED; mode <= TSTATS_PERBLOCK; mode++) {
+		snprintf(name, sizeof(name), "chain_trigger/%s/%d", modes[mode], CHAIN_LEN);
+
+		c.chain.triggees = c.triggees;
+		c.chain.triggees_len = CHAIN_LEN;
+		c.chain.tstats_mode = mode;
+
+		if (ubx_chain_init(&c.chain, "bench", 0) != 0) {
+			fprintf(stderr, "error: failed to init chain\n");
+			return -1;
+		}
+
+		ret |= bench_run(opts, name, bm_chain_trigger, &c);
+		ubx_chain_cleanup(&c.chain);
+	}
+
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	int ret = EXIT_FAILURE;
+	struct port_ctx c;
+	struct bench_opts opts;
+
+	if (bench_init(&opts, argc, argv, "core", "") < 0)
+		exit(EXIT_FAILURE);
+
+	memset(&c, 0, sizeof(c));
+
+	nd.loglevel = UBX_LOGLEVEL_WARN;
+
+	if (ubx_node_init(&nd, "bench_core", 0) != 0)
+		exit(EXIT_FAILURE);
+
+	if (load_module(&opts, "stdtypes") != 0)
+		goto out;
+
+	if (ubx_block_register(&nd, &dummy_comp) != 0)
+		goto out;
+
+	c.b = block_create(dummy_comp.name, "dummy");
+
+	if (c.b == NULL || ubx_block_init(c.b) != 0 || ubx_block_start(c.b) != 0)
+		goto out_unregister;
+
+	c.out = ubx_port_get(c.b, "out");
+	c.in = ubx_port_get(c.b, "in");
+	c.out_arr = ubx_port_get(c.b, "out_arr");
+	c.in_arr = ubx_port_get(c.b, "in_arr");
+	c.wdata = ubx_data_alloc(&nd, "double", 1);
+	c.rdata = ubx_data_alloc(&nd, "double", 1);
+
+	if (c.wdata == NULL || c.rdata == NULL)
+		goto out_free;
+
+	ret = 0;
+	ret |= bench_ports(&opts, &c);
+	ret |= bench_typed(&opts, &c);
+	ret |= bench_large_ring(&opts);
+	ret |= bench_ring_chain(&opts);
+	ret |= bench_run(&opts, "cblock_step", bm_cblock_step, &c);
+	ret |= bench_chain(&opts);
+	ret |= bench_run(&opts, "ubx_port_get", bm_port_get, &c);
+	ret |= bench_run(&opts, "ubx_config_get", bm_config_get, &c);
+	ret |= bench_run(&opts, "ubx_log/filtered", bm_log_filtered, NULL);
+	ret |= bench_run(&opts, "__ubx_log", bm_log, NULL);
+	ret |= bench_run(&opts, "ubx_gettime", bm_gettime, NULL);
+	ret |= bench_run(&opts, "ubx_node_gettime", bm_node_gettime, NULL);
+
+	ret = (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+ out_free:
+	ubx_data_free(c.wdata);
+	ubx_data_free(c.rdata);
+	ubx_node_clear(&nd);
+ out_unregister:
+	ubx_block_unregister(&nd, dummy_comp.name);
+ out:
+	bench_finish(&opts);
+	ubx_node_rm(&nd);
+	exit(ret);
+}
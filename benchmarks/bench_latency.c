@@ -0,0 +1,683 @@
+/*
+ * End-to-end latency of samples between triggers
+ *
+ * A producer block triggered by one ptrig stamps each sample with
+ * ubx_gettime and a sequence number and writes it to an iblock. A
+ * consumer block triggered by a second ptrig reads all pending
+ * samples and records their age on receipt. Hence the latency
+ * includes the time a sample waits in the iblock until the consumer
+ * is triggered, which is what matters for control loops, and not
+ * just the execution time measured by tstats. With the iblock
+ * "mqueue_proc", the producer runs in a separate process.
+ *
+ * The parameters are given as comma separated lists and all
+ * combinations are run, e.g.
+ *
+ *   bench_latency iblock=lfds_cyclic,mqueue payload=64,4096 cpus=0:1,1:1
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+
+#include "ubx.h"
+#include "bench.h"
+#include "triggee.h"
+#include "ptrig_period.h"
+
+#define MAX_VALS		16
+#define MAX_SAMPLES		(10 * 1000 * 1000)
+
+#define PRODUCER_BLOCK_NAME	"bench/producer"
+#define CONSUMER_BLOCK_NAME	"bench/consumer"
+
+static ubx_node_t nd;
+
+/* header of each sample */
+struct lat_stamp {
+	struct ubx_timespec ts;
+	uint64_t seq;
+};
+
+/* sweep parameters */
+enum {
+	P_IBLOCK, P_BUFFER_LEN, P_PAYLOAD, P_RATE, P_CONSUMER_RATE, P_CPUS,
+	P_DURATION, P_PRIO, P_SKIP, P_NUM,
+};
+
+struct param {
+	const char *key;
+	const char *def;
+	const char *doc;
+	char *vals[MAX_VALS];
+	int num;
+};
+
+static struct param params[P_NUM] = {
+	[P_IBLOCK] = { "iblock", "lfds_cyclic", "lfds_cyclic, mqueue or mqueue_proc" },
+	[P_BUFFER_LEN] = { "buffer_len", "8", "buffer length of the iblock" },
+	[P_PAYLOAD] = { "payload", "64", "sample size [bytes]" },
+	[P_RATE] = { "rate", "1000", "producer rate [Hz]" },
+	[P_CONSUMER_RATE] = { "consumer_rate", "0", "consumer rate [Hz] (0: same as producer)" },
+	[P_CPUS] = { "cpus", "0:1", "producer:consumer CPU (-1: any)" },
+	[P_DURATION] = { "duration", "1", "duration of each run [s]" },
+	[P_PRIO] = { "prio", "0", "SCHED_FIFO priority of the ptrigs (0: SCHED_OTHER)" },
+	[P_SKIP] = { "skip", "10", "number of initial samples to discard" },
+};
+
+/* configuration of a single run */
+struct run_cfg {
+	const char *iblock;
+	long buffer_len;
+	long payload;
+	double rate;
+	double consumer_rate;
+	int pcpu;
+	int ccpu;
+	double duration;
+	int prio;
+	unsigned long skip;
+};
+
+/**
+ * producer block
+ */
+struct producer_info {
+	const ubx_port_t *p_out;
+	ubx_data_t *data;
+	uint64_t seq;
+};
+
+static struct producer_info producer;
+
+static void producer_step(ubx_block_t *b)
+{
+	struct lat_stamp stamp;
+	struct producer_info *inf = (struct producer_info *)b->private_data;
+
+	stamp.seq = inf->seq++;
+	ubx_gettime(&stamp.ts);
+	memcpy(inf->data->data, &stamp, sizeof(stamp));
+
+	__port_write(inf->p_out, inf->data);
+}
+
+ubx_proto_block_t producer_comp = {
+	.name = PRODUCER_BLOCK_NAME,
+	.type = BLOCK_TYPE_COMPUTATION,
+	.step = producer_step,
+};
+
+/**
+ * consumer block
+ */
+struct consumer_info {
+	const ubx_port_t *p_in;
+	ubx_data_t *data;
+	uint64_t next_seq;
+	unsigned long skip;
+	unsigned long lost;
+	unsigned long hist[BENCH_HIST_LEN];
+	double *samples;
+	unsigned long num_samples;
+	unsigned long max_samples;
+};
+
+static struct consumer_info consumer;
+
+static void consumer_step(ubx_block_t *b)
+{
+	uint64_t age;
+	struct ubx_timespec now;
+	struct lat_stamp stamp;
+	struct consumer_info *inf = (struct consumer_info *)b->private_data;
+
+	while (__port_read(inf->p_in, inf->data) > 0) {
+		ubx_gettime(&now);
+		memcpy(&stamp, inf->data->data, sizeof(stamp));
+
+		age = ubx_ts_to_ns(&now) - ubx_ts_to_ns(&stamp.ts);
+
+		if (stamp.seq > inf->next_seq)
+			inf->lost += stamp.seq - inf->next_seq;
+
+		inf->next_seq = stamp.seq + 1;
+
+		if (inf->skip > 0) {
+			inf->skip--;
+			continue;
+		}
+
+		inf->hist[bench_hist_bucket(age)]++;
+
+		if (inf->num_samples < inf->max_samples)
+			inf->samples[inf->num_samples++] = age;
+	}
+}
+
+ubx_proto_block_t consumer_comp = {
+	.name = CONSUMER_BLOCK_NAME,
+	.type = BLOCK_TYPE_COMPUTATION,
+	.step = consumer_step,
+};
+
+/* set a config of any type */
+static int cfg_set_raw(ubx_block_t *b, const char *name, const void *val, long len)
+{
+	ubx_config_t *c = ubx_config_get(b, name);
+
+	if (c == NULL || ubx_data_resize(c->value, len) != 0) {
+		fprintf(stderr, "error: failed to set config %s.%s\n", b->name, name);
+		return -1;
+	}
+
+	memcpy(c->value->data, val, len * c->type->size);
+	return 0;
+}
+
+static void sleep_sec(double sec)
+{
+	struct timespec ts;
+
+	ts.tv_sec = (time_t)sec;
+	ts.tv_nsec = (long)((sec - ts.tv_sec) * NSEC_PER_SEC);
+
+	while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+		;
+}
+
+static int load_modules(const char *moddir, const char *iblock_mod)
+{
+	char path[PATH_MAX];
+	const char *mods[] = { "stdtypes", "ptrig", iblock_mod, NULL };
+
+	for (int i = 0; mods[i] != NULL; i++) {
+		snprintf(path, sizeof(path), "%s/%s.so", moddir, mods[i]);
+
+		if (ubx_module_get(&nd, path) != NULL)
+			continue;
+
+		if (ubx_module_load(&nd, path) != 0) {
+			fprintf(stderr, "error: failed to load %s\n", path);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static const char *iblock_module(const char *iblock)
+{
+	return (strncmp(iblock, "mqueue", strlen("mqueue")) == 0) ? "mqueue" : "lfds_cyclic";
+}
+
+/* create the iblock transporting the samples */
+static ubx_block_t *iblock_create(const struct run_cfg *rc, const char *mq_id, uint32_t unlink)
+{
+	int ret;
+	ubx_block_t *ib;
+	uint32_t len32 = rc->payload, buffer_len32 = rc->buffer_len, blocking = 0;
+
+	if (mq_id == NULL) {
+		ib = ubx_block_create(&nd, "lfds_buffers/cyclic", "ib");
+
+		if (ib == NULL)
+			return NULL;
+
+		ret = cfg_set_char(ib, "type_name", "uint8_t", strlen("uint8_t") + 1) ||
+			cfg_set_uint32(ib, "data_len", &len32, 1) ||
+			cfg_set_uint32(ib, "buffer_len", &buffer_len32, 1);
+	} else {
+		ib = ubx_block_create(&nd, "mqueue", "ib");
+
+		if (ib == NULL)
+			return NULL;
+
+		ret = cfg_set_char(ib, "mq_id", mq_id, strlen(mq_id) + 1) ||
+			cfg_set_char(ib, "type_name", "uint8_t", strlen("uint8_t") + 1) ||
+			cfg_set_long(ib, "data_len", &rc->payload, 1) ||
+			cfg_set_long(ib, "buffer_len", &rc->buffer_len, 1) ||
+			cfg_set_uint32(ib, "blocking", &blocking, 1) ||
+			cfg_set_uint32(ib, "unlink", &unlink, 1);
+	}
+
+	if (ret != 0 || ubx_block_init(ib) != 0) {
+		fprintf(stderr, "error: failed to setup iblock\n");
+		return NULL;
+	}
+
+	return ib;
+}
+
+/* create a ptrig triggering b */
+static ubx_block_t *ptrig_create(const char *name, ubx_block_t *b, double rate, int cpu, int prio)
+{
+	ubx_block_t *trig;
+	struct ptrig_period period;
+	struct ubx_triggee triggee = { .b = b, .num_steps = 1 };
+	unsigned long usec = USEC_PER_SEC / rate;
+	const char *policy = "SCHED_FIFO";
+	int num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int cpus[num_cpus];
+
+	trig = ubx_block_create(&nd, "std_triggers/ptrig", name);
+
+	if (trig == NULL)
+		return NULL;
+
+	period.sec = usec / USEC_PER_SEC;
+	period.usec = usec % USEC_PER_SEC;
+
+	if (cfg_set_raw(trig, "period", &period, 1) != 0)
+		return NULL;
+
+	/* -1: any CPU, as ptrig would inherit the affinity of this thread */
+	for (int i = 0; i < num_cpus; i++)
+		cpus[i] = i;
+
+	if (cpu >= 0 ? cfg_set_int(trig, "affinity", &cpu, 1) :
+	    cfg_set_int(trig, "affinity", cpus, num_cpus))
+		return NULL;
+
+	if (prio > 0 &&
+	    (cfg_set_char(trig, "sched_policy", policy, strlen(policy) + 1) ||
+	     cfg_set_int(trig, "sched_priority", &prio, 1)))
+		return NULL;
+
+	if (ubx_block_init(trig) != 0)
+		return NULL;
+
+	/* chain configs are added in init */
+	if (cfg_set_raw(trig, "chain0", &triggee, 1) != 0)
+		return NULL;
+
+	return trig;
+}
+
+/* create the producer block with its ptrig */
+static ubx_block_t *producer_create(const struct run_cfg *rc, ubx_block_t *ib)
+{
+	ubx_block_t *b;
+
+	b = ubx_block_create(&nd, PRODUCER_BLOCK_NAME, "producer");
+
+	if (b == NULL ||
+	    ubx_outport_add(b, "out", "stamped samples", 0, "uint8_t", rc->payload) != 0)
+		return NULL;
+
+	memset(&producer, 0, sizeof(producer));
+	producer.p_out = ubx_port_get(b, "out");
+	producer.data = ubx_data_alloc(&nd, "uint8_t", rc->payload);
+
+	if (producer.data == NULL)
+		return NULL;
+
+	memset(producer.data->data, 0, rc->payload);
+	b->private_data = &producer;
+
+	if (ubx_block_init(b) != 0 ||
+	    ubx_port_connect_out(ubx_port_get(b, "out"), ib) != 0)
+		return NULL;
+
+	return ptrig_create("ptrig_producer", b, rc->rate, rc->pcpu, rc->prio);
+}
+
+/* create the consumer block with its ptrig */
+static ubx_block_t *consumer_create(const struct run_cfg *rc, ubx_block_t *ib)
+{
+	ubx_block_t *b;
+
+	b = ubx_block_create(&nd, CONSUMER_BLOCK_NAME, "consumer");
+
+	if (b == NULL ||
+	    ubx_inport_add(b, "in", "stamped samples", 0, "uint8_t", rc->payload) != 0)
+		return NULL;
+
+	memset(&consumer, 0, sizeof(consumer));
+	consumer.p_in = ubx_port_get(b, "in");
+	consumer.data = ubx_data_alloc(&nd, "uint8_t", rc->payload);
+	consumer.skip = rc->skip;
+	consumer.max_samples = MIN(rc->rate * rc->duration * 1.1 + 1000, MAX_SAMPLES);
+	consumer.samples = malloc(consumer.max_samples * sizeof(double));
+
+	if (consumer.data == NULL || consumer.samples == NULL)
+		return NULL;
+
+	b->private_data = &consumer;
+
+	if (ubx_block_init(b) != 0 ||
+	    ubx_port_connect_in(ubx_port_get(b, "in"), ib) != 0)
+		return NULL;
+
+	return ptrig_create("ptrig_consumer", b, rc->consumer_rate, rc->ccpu, rc->prio);
+}
+
+/* start the iblock, the triggered block and the ptrig */
+static int start_all(ubx_block_t *ib, ubx_block_t *trig, const char *bname)
+{
+	if (ib->block_state != BLOCK_STATE_ACTIVE && ubx_block_start(ib) != 0)
+		return -1;
+
+	if (ubx_block_start(ubx_block_get(&nd, bname)) != 0)
+		return -1;
+
+	return ubx_block_start(trig);
+}
+
+/* spawn the producer of an mqueue_proc run */
+static pid_t spawn_producer(const char *moddir, const struct run_cfg *rc, const char *mq_id)
+{
+	pid_t pid;
+	char args[6][32];
+
+	snprintf(args[0], sizeof(args[0]), "%ld", rc->payload);
+	snprintf(args[1], sizeof(args[1]), "%ld", rc->buffer_len);
+	snprintf(args[2], sizeof(args[2]), "%f", rc->rate);
+	snprintf(args[3], sizeof(args[3]), "%d", rc->pcpu);
+	snprintf(args[4], sizeof(args[4]), "%d", rc->prio);
+	snprintf(args[5], sizeof(args[5]), "%f", rc->duration);
+
+	fflush(stdout);
+	pid = fork();
+
+	if (pid == 0) {
+		execl("/proc/self/exe", "bench_latency", "--producer", moddir, mq_id,
+		      args[0], args[1], args[2], args[3], args[4], args[5], NULL);
+		fprintf(stderr, "error: failed to exec producer: %s\n", strerror(errno));
+		_exit(EXIT_FAILURE);
+	}
+
+	if (pid < 0)
+		fprintf(stderr, "error: fork failed: %s\n", strerror(errno));
+
+	return pid;
+}
+
+/* producer process of an mqueue_proc run */
+static int producer_main(int argc, char **argv)
+{
+	int ret = EXIT_FAILURE;
+	struct run_cfg rc;
+	ubx_block_t *ib, *trig;
+
+	if (argc != 8)
+		return EXIT_FAILURE;
+
+	memset(&rc, 0, sizeof(rc));
+	rc.payload = atol(argv[2]);
+	rc.buffer_len = atol(argv[3]);
+	rc.rate = atof(argv[4]);
+	rc.pcpu = atoi(argv[5]);
+	rc.prio = atoi(argv[6]);
+	rc.duration = atof(argv[7]);
+
+	nd.loglevel = UBX_LOGLEVEL_WARN;
+
+	if (ubx_node_init(&nd, "bench_latency_producer", 0) != 0)
+		return EXIT_FAILURE;
+
+	if (load_modules(argv[0], "mqueue") != 0 ||
+	    ubx_block_register(&nd, &producer_comp) != 0)
+		goto out;
+
+	ib = iblock_create(&rc, argv[1], 0);
+
+	if (ib == NULL)
+		goto out_clear;
+
+	trig = producer_create(&rc, ib);
+
+	if (trig == NULL || start_all(ib, trig, "producer") != 0)
+		goto out_clear;
+
+	sleep_sec(rc.duration);
+	ret = EXIT_SUCCESS;
+
+ out_clear:
+	ubx_node_clear(&nd);
+	ubx_data_free(producer.data);
+	ubx_block_unregister(&nd, PRODUCER_BLOCK_NAME);
+ out:
+	ubx_node_rm(&nd);
+	return ret;
+}
+
+/* run one configuration and report the result */
+static int run(struct bench_opts *opts, const struct run_cfg *rc, int id)
+{
+	int ret = -1, status;
+	pid_t pid = -1;
+	char name[128], mq_id[64];
+	const char *mq = NULL;
+	ubx_block_t *ib, *ptrig_c, *ptrig_p = NULL;
+	struct bench_result res;
+
+	snprintf(name, sizeof(name), "%s/b%ld/p%ld/r%g:%g/c%d:%d",
+		 rc->iblock, rc->buffer_len, rc->payload, rc->rate,
+		 rc->consumer_rate, rc->pcpu, rc->ccpu);
+
+	if (!bench_enabled(opts, name))
+		return 0;
+
+	if (strcmp(rc->iblock, "lfds_cyclic") != 0) {
+		snprintf(mq_id, sizeof(mq_id), "bench_lat_%d_%d", getpid(), id);
+		mq = mq_id;
+	}
+
+	if (load_modules(opts->moddir, iblock_module(rc->iblock)) != 0)
+		return -1;
+
+	ib = iblock_create(rc, mq, 1);
+
+	if (ib == NULL)
+		goto out;
+
+	ptrig_c = consumer_create(rc, ib);
+
+	if (ptrig_c == NULL)
+		goto out;
+
+	if (strcmp(rc->iblock, "mqueue_proc") != 0) {
+		ptrig_p = producer_create(rc, ib);
+
+		if (ptrig_p == NULL)
+			goto out;
+	}
+
+	if (start_all(ib, ptrig_c, "consumer") != 0)
+		goto out;
+
+	if (ptrig_p) {
+		if (start_all(ib, ptrig_p, "producer") != 0)
+			goto out;
+
+		sleep_sec(rc->duration);
+		ubx_block_stop(ptrig_p);
+	} else {
+		pid = spawn_producer(opts->moddir, rc, mq_id);
+
+		if (pid < 0)
+			goto out;
+
+		if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+		    WEXITSTATUS(status) != EXIT_SUCCESS) {
+			fprintf(stderr, "error: %s: producer process failed\n", name);
+			goto out;
+		}
+	}
+
+	/* let the consumer drain the iblock */
+	sleep_sec(2 / rc->consumer_rate);
+	ubx_block_stop(ptrig_c);
+
+	if (consumer.num_samples == 0) {
+		fprintf(stderr, "error: %s: no samples received\n", name);
+		goto out;
+	}
+
+	bench_summarize(consumer.samples, consumer.num_samples, &res);
+	res.name = name;
+	res.iters = 1;
+	res.hist = consumer.hist;
+	res.lost = consumer.lost;
+	bench_report(opts, &res);
+
+	ret = 0;
+ out:
+	ubx_node_clear(&nd);
+	ubx_data_free(producer.data);
+	ubx_data_free(consumer.data);
+	free(consumer.samples);
+	producer.data = NULL;
+	consumer.data = NULL;
+	consumer.samples = NULL;
+	return ret;
+}
+
+static int parse_params(int argc, char **argv)
+{
+	char *key, *vals, *saveptr;
+
+	for (int i = 0; i < argc; i++) {
+		key = argv[i];
+		vals = strchr(key, '=');
+
+		if (vals == NULL)
+			goto out_inval;
+
+		*vals++ = '\0';
+
+		for (int j = 0; j < P_NUM; j++) {
+			if (strcmp(params[j].key, key) != 0)
+				continue;
+
+			params[j].num = 0;
+
+			for (char *v = strtok_r(vals, ",", &saveptr); v != NULL;
+			     v = strtok_r(NULL, ",", &saveptr)) {
+				if (params[j].num == MAX_VALS)
+					goto out_inval;
+				params[j].vals[params[j].num++] = v;
+			}
+
+			goto next;
+		}
+
+	out_inval:
+		fprintf(stderr, "error: invalid parameter %s\n", argv[i]);
+		return -1;
+	next:
+		;
+	}
+
+	for (int j = 0; j < P_NUM; j++) {
+		if (params[j].num == 0) {
+			params[j].vals[0] = (char *)params[j].def;
+			params[j].num = 1;
+		}
+	}
+
+	return 0;
+}
+
+/* fill in the run configuration for the value indices idx */
+static int run_cfg_get(struct run_cfg *rc, const int *idx)
+{
+	const char *cpus = params[P_CPUS].vals[idx[P_CPUS]];
+
+	rc->iblock = params[P_IBLOCK].vals[idx[P_IBLOCK]];
+	rc->buffer_len = atol(params[P_BUFFER_LEN].vals[idx[P_BUFFER_LEN]]);
+	rc->payload = atol(params[P_PAYLOAD].vals[idx[P_PAYLOAD]]);
+	rc->rate = atof(params[P_RATE].vals[idx[P_RATE]]);
+	rc->consumer_rate = atof(params[P_CONSUMER_RATE].vals[idx[P_CONSUMER_RATE]]);
+	rc->duration = atof(params[P_DURATION].vals[idx[P_DURATION]]);
+	rc->prio = atoi(params[P_PRIO].vals[idx[P_PRIO]]);
+	rc->skip = strtoul(params[P_SKIP].vals[idx[P_SKIP]], NULL, 0);
+
+	if (sscanf(cpus, "%d:%d", &rc->pcpu, &rc->ccpu) != 2) {
+		fprintf(stderr, "error: invalid cpus %s\n", cpus);
+		return -1;
+	}
+
+	if (rc->consumer_rate == 0)
+		rc->consumer_rate = rc->rate;
+
+	rc->payload = MAX(rc->payload, (long)sizeof(struct lat_stamp));
+
+	if (strcmp(rc->iblock, "lfds_cyclic") != 0 &&
+	    strcmp(rc->iblock, "mqueue") != 0 &&
+	    strcmp(rc->iblock, "mqueue_proc") != 0) {
+		fprintf(stderr, "error: invalid iblock %s\n", rc->iblock);
+		return -1;
+	}
+
+	if (rc->buffer_len <= 0 || rc->rate <= 0 || rc->consumer_rate <= 0 ||
+	    rc->duration <= 0) {
+		fprintf(stderr, "error: invalid buffer_len, rate or duration\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int argi, ret = 0, id = 0, idx[P_NUM] = { 0 };
+	char usage[1024];
+	struct run_cfg rc;
+	struct bench_opts opts;
+
+	if (argc > 1 && strcmp(argv[1], "--producer") == 0)
+		return producer_main(argc - 2, argv + 2);
+
+	snprintf(usage, sizeof(usage), "[key=val[,val...]...]\n");
+
+	for (int j = 0; j < P_NUM; j++) {
+		size_t len = strlen(usage);
+
+		snprintf(usage + len, sizeof(usage) - len, "   %-14s %s (def: %s)\n",
+			 params[j].key, params[j].doc, params[j].def);
+	}
+
+	argi = bench_init(&opts, argc, argv, "latency", usage);
+
+	if (argi < 0 || parse_params(argc - argi, argv + argi) != 0)
+		exit(EXIT_FAILURE);
+
+	nd.loglevel = UBX_LOGLEVEL_WARN;
+
+	if (ubx_node_init(&nd, "bench_latency", 0) != 0)
+		exit(EXIT_FAILURE);
+
+	if (ubx_block_register(&nd, &producer_comp) != 0 ||
+	    ubx_block_register(&nd, &consumer_comp) != 0) {
+		ret = -1;
+		goto out;
+	}
+
+	/* iterate over all combinations of the parameter values */
+	while (1) {
+		int j;
+
+		if (run_cfg_get(&rc, idx) != 0 || run(&opts, &rc, id++) != 0)
+			ret = -1;
+
+		for (j = 0; j < P_NUM; j++) {
+			if (++idx[j] < params[j].num)
+				break;
+			idx[j] = 0;
+		}
+
+		if (j == P_NUM)
+			break;
+	}
+
+ out:
+	ubx_block_unregister(&nd, CONSUMER_BLOCK_NAME);
+	ubx_block_unregister(&nd, PRODUCER_BLOCK_NAME);
+	bench_finish(&opts);
+	ubx_node_rm(&nd);
+	exit((ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE);
+}
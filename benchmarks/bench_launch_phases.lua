@@ -0,0 +1,79 @@
+#!/usr/bin/luajit
+--
+-- Measure the startup time of launching a usc model, split into
+-- loading ubx.lua (FFI headers) and the system.launch phases.
+--
+-- The model is launched (without starting it) in fresh processes
+-- with a cold and a warm FFI header cache and with eager and lazy
+-- type loading.
+--
+-- usage: bench_launch_phases.lua [usc file] [runs]
+--
+
+local ffi = require("ffi")
+
+-- private declarations, to not collide with the ubx headers
+ffi.cdef [[
+struct bench_timespec { long sec; long nsec; };
+int bench_clock_gettime(int clk_id, struct bench_timespec *tp) __asm__("clock_gettime");
+]]
+
+local CLOCK_MONOTONIC = 1
+
+local function now()
+   local ts = ffi.new("struct bench_timespec")
+   ffi.C.bench_clock_gettime(CLOCK_MONOTONIC, ts)
+   return tonumber(ts.sec) + tonumber(ts.nsec) * 1e-9
+end
+
+local USC = arg[1] or "examples/usc/pid/pid.usc"
+local RUNS = tonumber(arg[2]) or 5
+local MODE = arg[3]
+
+-- child: launch once and print "phase duration" lines
+if MODE then
+   local t0 = now()
+   local ubx = require("ubx")
+   local bd = require("blockdiagram")
+   print("load_ubx", now() - t0)
+
+   ubx.lazy_types = (MODE == "lazy")
+   local conf = { nostart=true, timing=true, loglevel=0 }
+   local nd = bd.load(USC):launch(conf)
+   for _,p in ipairs(conf.phases) do print(p.name, p.dur) end
+   ubx.node_cleanup(nd)
+   os.exit(0)
+end
+
+local cache_dir = os.tmpname()
+os.remove(cache_dir)
+
+local function run(mode, cold)
+   local res, order = {}, {}
+   for _=1,RUNS do
+      if cold then os.execute("rm -rf "..cache_dir) end
+      local f = assert(io.popen(string.format("UBX_FFI_CACHE=%s luajit %s %s %d %s",
+					      cache_dir, arg[0], USC, RUNS, mode)))
+      for name, dur in f:read("*a"):gmatch("(%S+)%s+(%S+)\n") do
+	 if not res[name] then res[name] = 0; order[#order+1] = name end
+	 res[name] = res[name] + tonumber(dur) / RUNS
+      end
+      f:close()
+   end
+   return res, order
+end
+
+print(string.format("model: %s, runs: %d", USC, RUNS))
+
+for _,m in ipairs{ {"eager", true}, {"eager", false}, {"lazy", false} } do
+   local res, order = run(m[1], m[2])
+   local total = 0
+   print(string.format("\n%s types, %s FFI cache", m[1], m[2] and "cold" or "warm"))
+   for _,name in ipairs(order) do
+      print(string.format("  %-20s %10.3f ms", name, res[name] * 1000))
+      total = total + res[name]
+   end
+   print(string.format("  %-20s %10.3f ms", "total", total * 1000))
+end
+
+os.execute("rm -rf "..cache_dir)
@@ -0,0 +1,106 @@
+#!/usr/bin/luajit
+--
+-- Measure how launching scales with the model size.
+--
+-- For each size, a synthetic model is generated with gen_model.lua
+-- and loaded and launched in a fresh process. The duration and the
+-- memory use (Lua heap and RSS) at the end of each launch phase are
+-- averaged over the runs. A model launches in linear time if the
+-- per block times in the last column stay constant.
+--
+-- usage: bench_launch_scaling.lua [sizes] [runs] [subsystems]
+--   sizes: comma separated list of block numbers
+--
+
+local ffi = require("ffi")
+
+-- private declarations, to not collide with the ubx headers
+ffi.cdef [[
+struct bench_timespec { long sec; long nsec; };
+int bench_clock_gettime(int clk_id, struct bench_timespec *tp) __asm__("clock_gettime");
+]]
+
+local CLOCK_MONOTONIC = 1
+
+local function rss_kib()
+   local f = assert(io.open("/proc/self/status"))
+   local rss = string.match(f:read("*a"), "VmRSS:%s*(%d+)")
+   f:close()
+   return tonumber(rss) or 0
+end
+
+local function now()
+   local ts = ffi.new("struct bench_timespec")
+   ffi.C.bench_clock_gettime(CLOCK_MONOTONIC, ts)
+   return tonumber(ts.sec) + tonumber(ts.nsec) * 1e-9
+end
+
+local SIZES = arg[1] or "100,1000,5000,10000,20000"
+local RUNS = tonumber(arg[2]) or 3
+local SUBSYS = tonumber(arg[3]) or 10
+local MODEL = arg[4]
+
+-- child: load and launch the model once and print
+-- "phase duration lua_mem rss" lines
+if MODEL then
+   local ubx = require("ubx")
+   local bd = require("blockdiagram")
+
+   local t0 = now()
+   local sys = bd.load(MODEL)
+   print("load", now() - t0, collectgarbage("count"), rss_kib())
+
+   local conf = { timing=true, loglevel=0 }
+   local nd = sys:launch(conf)
+   for _,p in ipairs(conf.phases) do print(p.name, p.dur, p.lua_mem, p.rss) end
+   ubx.node_cleanup(nd)
+   os.exit(0)
+end
+
+local dir = arg[0]:match("(.*/)") or "./"
+
+local function run(size)
+   local model = os.tmpname()..".usc"
+   assert(os.execute(string.format("luajit %sgen_model.lua %d %d %s",
+				   dir, size, SUBSYS, model)) == 0)
+
+   local res, order = {}, {}
+   for _=1,RUNS do
+      local f = assert(io.popen(string.format("luajit %s %s %d %d %s",
+					      arg[0], SIZES, RUNS, SUBSYS, model)))
+      for name, dur, mem, rss in f:read("*a"):gmatch("(%S+)%s+(%S+)%s+(%S+)%s+(%S+)\n") do
+	 if not res[name] then
+	    res[name] = { dur=0, mem=0, rss=0 }
+	    order[#order+1] = name
+	 end
+	 res[name].dur = res[name].dur + tonumber(dur) / RUNS
+	 res[name].mem = res[name].mem + tonumber(mem) / RUNS
+	 res[name].rss = res[name].rss + tonumber(rss) / RUNS
+      end
+      f:close()
+   end
+
+   if #order == 0 then error("launching model of size "..size.." failed") end
+
+   os.remove(model)
+   return res, order
+end
+
+print(string.format("subsystems: %d, runs: %d", SUBSYS, RUNS))
+
+for size in SIZES:gmatch("%d+") do
+   size = tonumber(size)
+   local res, order = run(size)
+   local total = 0
+
+   print(string.format("\n%d blocks", size))
+   print(string.format("  %-20s %10s %10s %10s %10s", "phase", "[ms]", "lua [KiB]", "rss [KiB]", "[us/block]"))
+
+   for _,name in ipairs(order) do
+      local r = res[name]
+      print(string.format("  %-20s %10.3f %10d %10d %10.3f",
+			  name, r.dur * 1000, r.mem, r.rss, r.dur * 1e6 / size))
+      total = total + r.dur
+   end
+   print(string.format("  %-20s %10.3f %10s %10s %10.3f", "total", total * 1000, "", "", total * 1e6 / size))
+end
@@ -0,0 +1,113 @@
+#!/usr/bin/luajit
+--
+-- Compare the throughput of Lua port I/O via the classic
+-- ubx.port_read/port_write functions and via pre-bound port objects.
+--
+-- Each variant runs inside the step function of a luablock, which
+-- writes and reads back a sample through a lfds_cyclic loopback
+-- buffer ITERATIONS times per step.
+--
+-- usage: bench_lua_port_io.lua [steps] [iterations]
+--
+
+local ffi=require"ffi"
+local ubx=require"ubx"
+
+local STEPS = tonumber(arg[1]) or 100
+local ITERATIONS = tonumber(arg[2]) or 10000
+
+local bench_tmpl = [[
+local ubx=require "ubx"
+local ffi=require "ffi"
+
+local ITERATIONS = $ITERATIONS
+local p_out, p_in, rd, wr, po_out, po_in
+
+function init(b)
+   b=ffi.cast("ubx_block_t*", b)
+   ubx.outport_add(b, "val_out", "", 0, "double", 1)
+   ubx.inport_add(b, "val_in", "", 0, "double", 1)
+   return true
+end
+
+function start(b)
+   b=ffi.cast("ubx_block_t*", b)
+   p_out = ubx.port_get(b, "val_out")
+   p_in = ubx.port_get(b, "val_in")
+   rd = ubx.port_alloc_read_sample(p_in)
+   wr = ubx.port_alloc_write_sample(p_out)
+   po_out = ubx.port_bind(p_out)
+   po_in = ubx.port_bind(p_in)
+   return true
+end
+
+-- classic path with a preallocated read sample
+local function step_classic()
+   for i=1,ITERATIONS do
+      ubx.port_write(p_out, i)
+      ubx.port_read(p_in, rd)
+   end
+end
+
+-- classic path with preallocated samples and data_set
+local function step_classic_prealloc()
+   for i=1,ITERATIONS do
+      wr:set(i)
+      ubx.port_write(p_out, wr)
+      ubx.port_read(p_in, rd)
+   end
+end
+
+-- pre-bound port objects
+local function step_bound()
+   for i=1,ITERATIONS do
+      po_out:write(i)
+      po_in:read()
+   end
+end
+
+step = step_$VARIANT
+]]
+
+local variants = { "classic", "classic_prealloc", "bound" }
+
+local nd = ubx.node_create("bench_lua_port_io")
+ubx.load_module(nd, "stdtypes")
+ubx.load_module(nd, "luablock")
+ubx.load_module(nd, "lfds_cyclic")
+
+local function setup(variant)
+   local code = bench_tmpl:gsub("%$ITERATIONS", tostring(ITERATIONS)):gsub("%$VARIANT", variant)
+   local lb = ubx.block_create(nd, "lua/luablock", "lb_"..variant, { lua_str=code })
+   assert(ubx.block_init(lb) == 0)
+
+   local buf = ubx.block_create(nd, "lfds_buffers/cyclic", "buf_"..variant,
+				{ type_name="double", data_len=1, buffer_len=4 })
+   assert(ubx.block_init(buf) == 0)
+   assert(ubx.block_start(buf) == 0)
+   assert(ubx.port_connect_out(ubx.port_get(lb, "val_out"), buf) == 0)
+   assert(ubx.port_connect_in(ubx.port_get(lb, "val_in"), buf) == 0)
+
+   assert(ubx.block_start(lb) == 0)
+   return lb
+end
+
+local ts_start = ffi.new("struct ubx_timespec")
+local ts_end = ffi.new("struct ubx_timespec")
+
+print(string.format("%-20s %15s %12s", "variant", "calls/s", "ns/call"))
+
+for _,v in ipairs(variants) do
+   local lb = setup(v)
+   ubx.cblock_step(lb) -- warmup
+
+   ubx.clock_mono_gettime(ts_start)
+   for _=1,STEPS do ubx.cblock_step(lb) end
+   ubx.clock_mono_gettime(ts_end)
+
+   local dur = ts_end - ts_start
+   local calls = STEPS * ITERATIONS * 2
+   print(string.format("%-20s %15.0f %12.1f", v, calls/dur, dur/calls*1e9))
+end
+
+ubx.node_cleanup(nd)
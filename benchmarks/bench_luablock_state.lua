@@ -0,0 +1,74 @@
+#!/usr/bin/luajit
+--
+-- Compare init time and memory of N luablocks which each load
+-- ubx.lua, with one lua_State per block and with a single shared
+-- lua_State (lua_state config).
+--
+-- usage: bench_luablock_state.lua [num_blocks]
+--
+-- Each mode is run in a separate process, so that the RSS
+-- measurements don't influence each other.
+--
+
+local ffi=require"ffi"
+local ubx=require"ubx"
+
+local NUM_BLOCKS = tonumber(arg[1]) or 60
+local MODE = arg[2]
+
+local block_code = [[
+local ubx = require("ubx")
+local ffi = require("ffi")
+
+function init(b)
+   b = ffi.cast("ubx_block_t*", b)
+   ubx.ffi_load_types(b.nd)
+   return true
+end
+]]
+
+-- resident set size in kB
+local function rss_kb()
+   local f = assert(io.open("/proc/self/statm", "r"))
+   local _, rss = f:read("*n", "*n")
+   f:close()
+   return rss * 4096 / 1024
+end
+
+local function run(mode)
+   local ts_start = ffi.new("struct ubx_timespec")
+   local ts_end = ffi.new("struct ubx_timespec")
+
+   local nd = ubx.node_create("bench_luablock_state")
+   ubx.load_module(nd, "stdtypes")
+   ubx.load_module(nd, "luablock")
+
+   local rss_start = rss_kb()
+   ubx.clock_mono_gettime(ts_start)
+
+   for i=1,NUM_BLOCKS do
+      local conf = { lua_str=block_code }
+      if mode == "shared" then conf.lua_state = "bench" end
+      local b = ubx.block_create(nd, "lua/luablock", "lb"..tostring(i), conf)
+      assert(ubx.block_init(b) == 0)
+   end
+
+   ubx.clock_mono_gettime(ts_end)
+
+   print(string.format("%-10s %8d %12.3f %14d", mode, NUM_BLOCKS,
+		       ts_end - ts_start, rss_kb() - rss_start))
+   ubx.node_cleanup(nd)
+end
+
+if MODE then
+   run(MODE)
+   os.exit(0)
+end
+
+print(string.format("%-10s %8s %12s %14s", "mode", "blocks", "init [s]", "RSS delta [kB]"))
+
+for _,m in ipairs{ "separate", "shared" } do
+   local f = assert(io.popen(string.format("luajit %s %d %s", arg[0], NUM_BLOCKS, m)))
+   io.write(f:read("*a"))
+   f:close()
+end
@@ -0,0 +1,100 @@
+#!/usr/bin/luajit
+--
+-- Generate a synthetic usc model for launch benchmarks
+--
+-- The model consists of <subsystems> subsystems with a total of
+-- <blocks> math_double blocks. The blocks of each subsystem are
+-- chained via their x and y ports and triggered by a trig block in
+-- the subsystem. A ptrig in the root system triggers the subsystem
+-- triggers. Every math block is configured with a mix of regular
+-- and node configuration values.
+--
+-- usage: gen_model.lua <blocks> [subsystems] [outfile]
+--
+
+local fmt = string.format
+
+local NUM_BLOCKS = tonumber(arg[1])
+local NUM_SUBSYS = tonumber(arg[2]) or 10
+local OUTFILE = arg[3]
+
+if not NUM_BLOCKS or NUM_BLOCKS < 1 or NUM_SUBSYS < 1 then
+   io.stderr:write("usage: gen_model.lua <blocks> [subsystems] [outfile]\n")
+   os.exit(1)
+end
+
+NUM_SUBSYS = math.min(NUM_SUBSYS, NUM_BLOCKS)
+
+local out = {}
+local function add(...) out[#out+1] = fmt(...) end
+
+local function gen_subsys(k, num)
+   add("subsys[%d] = function()\n", k)
+   add("   return bd.system {\n")
+
+   add("      blocks = {\n")
+   add("         { name=\"trig\", type=\"std_triggers/trig\" },\n")
+   for i=1,num do
+      add("         { name=\"m%d\", type=\"math_double\" },\n", i)
+   end
+   add("      },\n")
+
+   add("      configurations = {\n")
+   for i=1,num do
+      add("         { name=\"m%d\", config = { func=\"sin\", data_len=\"&data_len\", mul=%d, add=%g } },\n",
+	  i, i, i / 10)
+   end
+   add("         { name=\"trig\", config = { chain0 = {\n")
+   for i=1,num do
+      add("            { b=\"#m%d\", num_steps=1 },\n", i)
+   end
+   add("         } } },\n")
+   add("      },\n")
+
+   add("      connections = {\n")
+   for i=2,num do
+      add("         { src=\"m%d.y\", tgt=\"m%d.x\" },\n", i-1, i)
+   end
+   add("      },\n")
+
+   add("   }\n")
+   add("end\n\n")
+end
+
+add("-- synthetic model: %d blocks in %d subsystems (generated by gen_model.lua)\n\n",
+    NUM_BLOCKS, NUM_SUBSYS)
+add("local subsys = {}\n\n")
+
+-- distribute the blocks evenly over the subsystems
+local per_subsys = math.floor(NUM_BLOCKS / NUM_SUBSYS)
+local rest = NUM_BLOCKS % NUM_SUBSYS
+
+for k=1,NUM_SUBSYS do
+   gen_subsys(k, per_subsys + ((k <= rest) and 1 or 0))
+end
+
+add("return bd.system {\n")
+add("   imports = { \"stdtypes\", \"trig\", \"ptrig\", \"lfds_cyclic\", \"math_double\" },\n")
+
+add("   subsystems = {\n")
+for k=1,NUM_SUBSYS do add("      s%d = subsys[%d](),\n", k, k) end
+add("   },\n")
+
+add("   blocks = {\n")
+add("      { name=\"ptrig\", type=\"std_triggers/ptrig\" },\n")
+add("   },\n")
+
+add("   node_configurations = {\n")
+add("      data_len = { type='long', config=1 },\n")
+add("   },\n")
+
+add("   configurations = {\n")
+add("      { name=\"ptrig\", config = { period = { sec=1, usec=0 }, chain0 = {\n")
+for k=1,NUM_SUBSYS do add("         { b=\"#s%d/trig\", num_steps=1 },\n", k) end
+add("      } } },\n")
+add("   },\n")
+add("}\n")
+
+local f = OUTFILE and assert(io.open(OUTFILE, "w")) or io.stdout
+f:write(table.concat(out))
+if OUTFILE then f:close() end
@@ -0,0 +1,7 @@
+#!/bin/bash
+
+for b in benchmarks/bench_*.lua; do
+    echo "running $b"
+    luajit $b || exit $?
+    echo "----------------------------------------------------------------"
+done
@@ -70,7 +70,7 @@ int platform_2dof_start(ubx_block_t *b)
 {
 	struct platform_2dof_info *inf = (struct platform_2dof_info*) b->private_data;
 	ubx_info(b, "platform_2dof start");
-	ubx_gettime(&inf->last_time);
+	ubx_node_gettime(b->nd, &inf->last_time);
 	return 0;
 }
 
@@ -89,7 +89,7 @@ void platform_2dof_step(ubx_block_t *b)
 	struct platform_2dof_info *inf = (struct platform_2dof_info*) b->private_data;
 
 	/* compute time from last call */
-	ubx_gettime(&current_time);
+	ubx_node_gettime(b->nd, &current_time);
 	ubx_ts_sub(&current_time, &inf->last_time, &difference);
 	inf->last_time = current_time;
 	double time_passed = ubx_ts_to_double(&difference);
@@ -0,0 +1,98 @@
+/*
+ * microblx: allocation counting for realtime checks
+ *
+ * This library is intended to be preloaded (LD_PRELOAD) and
+ * interposes the glibc allocator to count the allocations and frees
+ * of each thread. The counters are read by the rtcheck tstats mode
+ * of the trigger chains (see trig_utils.c) via
+ * ubx_rtcheck_alloc_counts, which is looked up at runtime, so that
+ * libubx does not depend on this library.
+ *
+ * The counters use the initial-exec TLS model, as the general
+ * dynamic model may allocate on first access from within malloc.
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ */
+
+#include <stdlib.h>
+#include <malloc.h>
+#include <errno.h>
+
+/* glibc allocator entry points */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void *ptr);
+
+static __thread unsigned long num_mallocs __attribute__((tls_model("initial-exec")));
+static __thread unsigned long num_frees __attribute__((tls_model("initial-exec")));
+
+/**
+ * ubx_rtcheck_alloc_counts - get the allocation counters of the calling thread
+ *
+ * @mallocs: number of allocations
+ * @frees: number of frees
+ */
+void ubx_rtcheck_alloc_counts(unsigned long *mallocs, unsigned long *frees)
+{
+	*mallocs = num_mallocs;
+	*frees = num_frees;
+}
+
+void *malloc(size_t size)
+{
+	num_mallocs++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	num_mallocs++;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	num_mallocs++;
+	return __libc_realloc(ptr, size);
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+	num_mallocs++;
+	return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+	num_mallocs++;
+	return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+	void *ptr;
+
+	if (alignment % sizeof(void *) != 0 ||
+	    (alignment & (alignment - 1)) != 0)
+		return EINVAL;
+
+	num_mallocs++;
+	ptr = __libc_memalign(alignment, size);
+
+	if (ptr == NULL)
+		return ENOMEM;
+
+	*memptr = ptr;
+	return 0;
+}
+
+void free(void *ptr)
+{
+	if (ptr == NULL)
+		return;
+
+	num_frees++;
+	__libc_free(ptr);
+}
@@ -182,6 +182,17 @@ int ubx_log_init(struct ubx_node *nd)
 
 	inf.frame_size = sizeof(struct ubx_log_msg);
 
+	/* reduce TLB misses when logging. Effective only if shmem
+	 * transparent huge pages are enabled (shmem_enabled=advise) */
+	if (nd->attrs & ND_HUGEPAGES) {
+		if (madvise((void *)inf.buf_ptr, inf.shm_size, MADV_HUGEPAGE) != 0)
+			fprintf(stderr, "%s: madvise MADV_HUGEPAGE of log shm failed: %m\n", __func__);
+		else
+			ubx_log(UBX_LOGLEVEL_INFO, nd, __func__,
+				"advised %u KiB log shm to use transparent huge pages",
+				inf.shm_size / 1024);
+	}
+
 	ret = 0;
 	goto out;
 
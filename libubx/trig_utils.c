@@ -4,11 +4,14 @@
  * SPDX-License-Identifier: MPL-2.0
  */
 
+#define _GNU_SOURCE
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <limits.h>
 #include <inttypes.h>
+#include <dlfcn.h>
+#include <sys/resource.h>
 #include "trig_utils.h"
 
 
@@ -16,8 +19,14 @@ static const char *FILE_HDR = "block, cnt, min_us, max_us, avg_us\n";
 static const char *FILE_FMT = "%s, %" PRIu64 ", %" PRIu64 ", %" PRIu64 ", %" PRIu64 "\n";
 static const char *LOG_FMT = "TSTAT: %s: cnt %" PRIu64 ", min %" PRIu64 " us, max %" PRIu64 " us, avg %" PRIu64 " us";
 static const char *TSTAT_TOTALS = "#total#";
+static const char *RTCHECK_FMT = "RTCHECK: %s: %lu of %lu steps violating: %lu minor, %lu major faults, %lu mallocs, %lu frees";
+
+/* provided by the preloaded libubxrtcheck.so (if any) */
+static const char *ALLOC_COUNTS_SYM = "ubx_rtcheck_alloc_counts";
+static void (*alloc_counts)(unsigned long *mallocs, unsigned long *frees);
 
 def_port_accessors(tstat, struct ubx_tstat);
+def_port_accessors(rtcheck, struct ubx_rtcheck);
 def_cfg_getptr_fun(cfg_getptr_triggee, struct ubx_triggee);
 
 void tstat_init2(struct ubx_tstat *ts, const char *block_name, const char *chain_id)
@@ -104,14 +113,144 @@ void tstat_log(const ubx_block_t *b, const struct ubx_tstat *stats)
 		 ubx_ts_to_us(&avg));
 }
 
+/*
+ * realtime checks
+ */
+
+void rtcheck_init(struct ubx_rtcheck *rc, const char *block_name, const char *chain_id)
+{
+	memset(rc, 0, sizeof(struct ubx_rtcheck));
+
+	snprintf(rc->id, UBX_TSTAT_ID_MAXLEN, "%s%s%s",
+		 (chain_id == NULL) ? "" : chain_id,
+		 (chain_id == NULL) ? "" : ",",
+		 block_name);
+
+	if (alloc_counts == NULL)
+		*(void **) (&alloc_counts) = dlsym(RTLD_DEFAULT, ALLOC_COUNTS_SYM);
+}
+
+void rtcheck_sample(struct ubx_rtcheck_sample *s)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_THREAD, &ru);
+	s->minflt = ru.ru_minflt;
+	s->majflt = ru.ru_majflt;
+
+	if (alloc_counts != NULL) {
+		alloc_counts(&s->mallocs, &s->frees);
+	} else {
+		s->mallocs = 0;
+		s->frees = 0;
+	}
+}
+
+int rtcheck_update(struct ubx_rtcheck *rc,
+		   const struct ubx_rtcheck_sample *start,
+		   const struct ubx_rtcheck_sample *end)
+{
+	unsigned long minflt = end->minflt - start->minflt;
+	unsigned long majflt = end->majflt - start->majflt;
+	unsigned long mallocs = end->mallocs - start->mallocs;
+	unsigned long frees = end->frees - start->frees;
+
+	rc->steps++;
+
+	if (minflt == 0 && majflt == 0 && mallocs == 0 && frees == 0)
+		return 0;
+
+	rc->minflt += minflt;
+	rc->majflt += majflt;
+	rc->mallocs += mallocs;
+	rc->frees += frees;
+	rc->viol++;
+
+	return 1;
+}
+
+void rtcheck_log(const ubx_block_t *b, const struct ubx_rtcheck *rc)
+{
+	ubx_warn(b, RTCHECK_FMT, rc->id, rc->viol, rc->steps,
+		 rc->minflt, rc->majflt, rc->mallocs, rc->frees);
+}
+
 /*
  * chain API
  */
 
+/**
+ * chain_compile - validate the triggees and build the step table
+ *
+ * This moves all checks of ubx_cblock_step except for the block
+ * state out of the trigger loop and stores the step hooks in a
+ * contiguous array.
+ */
+static int chain_compile(struct ubx_chain *chain)
+{
+	long len = 0;
+	ubx_block_t *b;
+	struct ubx_chain_step *steps;
+
+	steps = realloc(chain->steps,
+			chain->triggees_len * sizeof(struct ubx_chain_step));
+
+	if (chain->triggees_len > 0 && steps == NULL)
+		return EOUTOFMEM;
+
+	chain->steps = steps;
+
+	for (int i = 0; i < chain->triggees_len; i++) {
+		b = chain->triggees[i].b;
+
+		if (b == NULL) {
+			ERR("triggee %i: block is NULL", i);
+			return EINVALID_BLOCK;
+		}
+
+		if (b->type != BLOCK_TYPE_COMPUTATION) {
+			ubx_err(b, "triggee %i: invalid block type %u", i, b->type);
+			return EINVALID_BLOCK_TYPE;
+		}
+
+		if (chain->triggees[i].num_steps < 0 ||
+		    (b->step == NULL && b->step_batch == NULL))
+			continue;
+
+		steps[len].step = b->step;
+		steps[len].step_batch = NULL;
+
+		if (b->step_batch != NULL &&
+		    (chain->triggees[i].num_steps > 1 || b->step == NULL))
+			steps[len].step_batch = b->step_batch;
+
+		steps[len].b = b;
+		steps[len].priv = b->private_data;
+		steps[len].num_steps = chain->triggees[i].num_steps;
+		steps[len].idx = i;
+		len++;
+	}
+
+	chain->steps_len = len;
+	return 0;
+}
+
 int ubx_chain_init(struct ubx_chain *chain,
 		   const char *chain_id,
 		   double tstats_output_rate)
 {
+	int ret;
+
+	/* let num_steps default to 1 */
+	for (int i = 0; i < chain->triggees_len; i++) {
+		if (chain->triggees[i].num_steps == 0)
+			((struct ubx_triggee*) &chain->triggees[i])->num_steps = 1;
+	}
+
+	ret = chain_compile(chain);
+	if (ret != 0)
+		return ret;
+
 	chain->tstats_output_rate = tstats_output_rate * NSEC_PER_SEC;
 	chain->tstats_output_last_msg = 0;
 	chain->tstats_output_idx = 0;
@@ -130,10 +269,28 @@ int ubx_chain_init(struct ubx_chain *chain,
 			tstat_init2(&chain->blk_tstats[i], chain->triggees[i].b->name, chain_id);
 	}
 
-	/* let num_steps default to 1 */
-	for (int i = 0; i < chain->triggees_len; i++) {
-		if (chain->triggees[i].num_steps == 0)
-			((struct ubx_triggee*) &chain->triggees[i])->num_steps = 1;
+	if (chain->tstats_mode == TSTATS_RTCHECK) {
+		chain->blk_rtcheck = realloc(
+			chain->blk_rtcheck,
+			chain->triggees_len * sizeof(struct ubx_rtcheck));
+
+		if (!chain->blk_rtcheck)
+			return EOUTOFMEM;
+
+		for (int i = 0; i < chain->triggees_len; i++)
+			rtcheck_init(&chain->blk_rtcheck[i], chain->triggees[i].b->name, chain_id);
+
+		if (alloc_counts == NULL && chain->triggees_len > 0) {
+			ubx_notice(chain->triggees[0].b,
+				   "rtcheck: %s not found, allocations are not checked (preload libubxrtcheck.so)",
+				   ALLOC_COUNTS_SYM);
+		}
+	}
+
+	/* register as a reader of published configs */
+	if (chain->cfg_nd == NULL && chain->triggees_len > 0) {
+		chain->cfg_nd = chain->triggees[0].b->nd;
+		ubx_cfg_reader_register(chain->cfg_nd, &chain->cfg_reader);
 	}
 
 	return 0;
@@ -141,7 +298,20 @@ int ubx_chain_init(struct ubx_chain *chain,
 
 void ubx_chain_cleanup(struct ubx_chain *chain)
 {
+	if (chain->cfg_nd) {
+		ubx_cfg_reader_unregister(chain->cfg_nd, &chain->cfg_reader);
+		chain->cfg_nd = NULL;
+	}
+
 	free(chain->blk_tstats);
+	chain->blk_tstats = NULL;
+
+	free(chain->blk_rtcheck);
+	chain->blk_rtcheck = NULL;
+
+	free(chain->steps);
+	chain->steps = NULL;
+	chain->steps_len = 0;
 }
 
 
@@ -177,36 +347,105 @@ static void tstats_output_throttled(struct ubx_chain *chain, uint64_t now)
 }
 
 
+/**
+ * chain_step - step a compiled chain entry
+ *
+ * @return 0 if OK, -1 if the block is not active
+ */
+static inline int chain_step(const struct ubx_chain_step *s)
+{
+	ubx_block_t *b = s->b;
+
+	if (s->step_batch != NULL) {
+		if (b->block_state != BLOCK_STATE_ACTIVE) {
+			ubx_cblock_step(b);
+			return -1;
+		}
+
+		s->step_batch(b, s->num_steps);
+		b->stat_num_steps += s->num_steps;
+		return 0;
+	}
+
+	for (int steps = 0; steps < s->num_steps; steps++) {
+		if (b->block_state != BLOCK_STATE_ACTIVE) {
+			/* let ubx_cblock_step report the error */
+			ubx_cblock_step(b);
+			return -1;
+		}
+
+		s->step(b);
+		b->stat_num_steps++;
+	}
+
+	return 0;
+}
+
+/* prefetch the block and private data of the given step */
+static inline void chain_prefetch(const struct ubx_chain *chain, long i)
+{
+	if (i >= chain->steps_len)
+		return;
+
+	__builtin_prefetch(&chain->steps[i].b->block_state);
+	__builtin_prefetch(&chain->steps[i].b->stat_num_steps, 1);
+	__builtin_prefetch(chain->steps[i].priv);
+}
+
+/**
+ * rtcheck_violation - report a step with page faults or allocations
+ *
+ * The first violation of a block is logged, every violation is
+ * output on the rtcheck port.
+ */
+static void rtcheck_violation(struct ubx_chain *chain, const struct ubx_chain_step *s)
+{
+	const struct ubx_rtcheck *rc = &chain->blk_rtcheck[s->idx];
+
+	if (rc->viol == 1)
+		rtcheck_log(s->b, rc);
+
+	if (chain->p_rtcheck != NULL)
+		write_rtcheck(chain->p_rtcheck, rc);
+}
+
 /**
  * trig_stats_perblock
  *
- * trigger the given chain and aquire per-block statistics
+ * trigger the given chain and aquire per-block statistics. If
+ * rtcheck is set, additionally check the steps for page faults and
+ * allocations.
  */
-static int trig_stats_perblock(struct ubx_chain *chain)
+static inline int trig_stats_perblock(struct ubx_chain *chain, const int rtcheck)
 {
 	int ret = 0;
 	uint64_t ts_end_ns;
 	struct ubx_timespec ts_start, ts_end, blk_ts_start, blk_ts_end;
+	struct ubx_rtcheck_sample rc_start, rc_end;
 
 	ubx_gettime(&ts_start);
 
 	/* trigger all blocks */
-	for (int i = 0; i < chain->triggees_len; i++) {
+	for (long i = 0; i < chain->steps_len; i++) {
+		const struct ubx_chain_step *s = &chain->steps[i];
+
+		chain_prefetch(chain, i + 1);
 
-		const struct ubx_triggee *trig = &chain->triggees[i];
+		if (rtcheck)
+			rtcheck_sample(&rc_start);
 
 		ubx_gettime(&blk_ts_start);
+		if (chain_step(s) != 0)
+			ret = -1;
+		ubx_gettime(&blk_ts_end);
 
-		/* step block */
-		for (int steps = 0; steps < trig->num_steps; steps++) {
-			if (ubx_cblock_step(trig->b) != 0) {
-				ret = -1;
-				break; /* next block */
-			}
-		}
+		if (rtcheck)
+			rtcheck_sample(&rc_end);
 
-		ubx_gettime(&blk_ts_end);
-		tstat_update(&chain->blk_tstats[i], &blk_ts_start, &blk_ts_end);
+		tstat_update(&chain->blk_tstats[s->idx], &blk_ts_start, &blk_ts_end);
+
+		if (rtcheck && rtcheck_update(&chain->blk_rtcheck[s->idx], &rc_start, &rc_end))
+			rtcheck_violation(chain, s);
 	}
 
 	/* finalize global measurement,	output stats */
@@ -234,17 +473,10 @@ static int trig_stats_global(struct ubx_chain *chain)
 	ubx_gettime(&ts_start);
 
 	/* trigger all blocks */
-	for (int i = 0; i < chain->triggees_len; i++) {
-
-		const struct ubx_triggee *trig = &chain->triggees[i];
-
-		/* step block */
-		for (int steps = 0; steps < trig->num_steps; steps++) {
-			if (ubx_cblock_step(trig->b) != 0) {
-				ret = -1;
-				break; /* next block */
-			}
-		}
+	for (long i = 0; i < chain->steps_len; i++) {
+		chain_prefetch(chain, i + 1);
+		if (chain_step(&chain->steps[i]) != 0)
+			ret = -1;
 	}
 
 	/* finalize global measurement,	output stats */
@@ -267,23 +499,16 @@ static int trig_stats_disabled(struct ubx_chain *chain)
 {
 	int ret = 0;
 	/* trigger all blocks */
-	for (int i = 0; i < chain->triggees_len; i++) {
-
-		const struct ubx_triggee *trig = &chain->triggees[i];
-
-		/* step block */
-		for (int steps = 0; steps < trig->num_steps; steps++) {
-			if (ubx_cblock_step(trig->b) != 0) {
-				ret = -1;
-				break; /* next block */
-			}
-		}
+	for (long i = 0; i < chain->steps_len; i++) {
+		chain_prefetch(chain, i + 1);
+		if (chain_step(&chain->steps[i]) != 0)
+			ret = -1;
 	}
 
 	return ret;
 }
 
-int ubx_chain_trigger(struct ubx_chain *chain)
+static int __chain_trigger(struct ubx_chain *chain)
 {
 	if (chain->tstats_skip_first > 0) {
 		chain->tstats_skip_first--;
@@ -296,13 +521,121 @@ int ubx_chain_trigger(struct ubx_chain *chain)
 	case TSTATS_GLOBAL:
 		return trig_stats_global(chain);
 	case TSTATS_PERBLOCK:
-		return trig_stats_perblock(chain);
+		return trig_stats_perblock(chain, 0);
+	case TSTATS_RTCHECK:
+		return trig_stats_perblock(chain, 1);
 	default:
 		ERR("invalid TSTATS_MODE %i", chain->tstats_mode);
 		return -1;
 	}
 }
 
+int ubx_chain_trigger(struct ubx_chain *chain)
+{
+	int ret;
+
+	if (chain->cfg_nd == NULL)
+		return __chain_trigger(chain);
+
+	ubx_cfg_read_enter(chain->cfg_nd, &chain->cfg_reader);
+	ret = __chain_trigger(chain);
+	ubx_cfg_read_exit(&chain->cfg_reader);
+
+	return ret;
+}
+
+/*
+ * throughput mode
+ */
+
+/**
+ * block_ready - number of steps a block can make without losing data
+ *
+ * This is limited by the number of samples pending on flow controlled
+ * in-ports and by the credits of flow controlled out-ports.
+ *
+ * @b: block to check
+ * @max: maximum number of steps
+ * @flowctrl: set to 1 if the block has a flow controlled port
+ * @return number of steps, 0 if the block is not ready
+ */
+static long block_ready(const ubx_block_t *b, long max, int *flowctrl)
+{
+	long n = max, m;
+	const ubx_port_t *p;
+
+	*flowctrl = 0;
+
+	DL_FOREACH(b->ports, p) {
+		if (port_is_in(p)) {
+			m = ubx_port_pending(p);
+			*flowctrl |= (m != LONG_MAX);
+			n = MIN(n, m);
+		}
+
+		if (port_is_out(p)) {
+			m = ubx_port_credits(p);
+			*flowctrl |= (m != LONG_MAX);
+			n = MIN(n, m);
+		}
+
+		if (n <= 0)
+			return 0;
+	}
+
+	return n;
+}
+
+static long __chain_trigger_ready(struct ubx_chain *chain)
+{
+	long n, steps = 0;
+	int flowctrl;
+	ubx_block_t *b;
+
+	for (long i = 0; i < chain->steps_len; i++) {
+		const struct ubx_chain_step *s = &chain->steps[i];
+		b = s->b;
+
+		if (b->block_state != BLOCK_STATE_ACTIVE)
+			continue;
+
+		n = block_ready(b, s->num_steps, &flowctrl);
+
+		if (n == 0)
+			continue;
+
+		if (b->step_batch != NULL && (n > 1 || s->step == NULL)) {
+			b->step_batch(b, n);
+		} else {
+			for (long k = 0; k < n; k++)
+				s->step(b);
+		}
+
+		b->stat_num_steps += n;
+
+		/* blocks without flow control are always ready, so
+		 * they do not count as progress */
+		if (flowctrl)
+			steps += n;
+	}
+
+	return steps;
+}
+
+long ubx_chain_trigger_ready(struct ubx_chain *chain)
+{
+	long ret;
+
+	if (chain->cfg_nd == NULL)
+		return __chain_trigger_ready(chain);
+
+	ubx_cfg_read_enter(chain->cfg_nd, &chain->cfg_reader);
+	ret = __chain_trigger_ready(chain);
+	ubx_cfg_read_exit(&chain->cfg_reader);
+
+	return ret;
+}
+
 /*
  * chain logging and writing to ports and files
  */
@@ -312,6 +645,9 @@ void ubx_chain_tstats_log(ubx_block_t *b, struct ubx_chain *chain)
 	switch (chain->tstats_mode) {
 	case TSTATS_DISABLED:
 		break;
+	case TSTATS_RTCHECK:
+		ubx_chain_rtcheck_log(b, chain);
+		/* fall through */
 	case TSTATS_PERBLOCK:
 		for (int i = 0; i < chain->triggees_len; i++)
 			tstat_log(b, &chain->blk_tstats[i]);
@@ -324,11 +660,34 @@ void ubx_chain_tstats_log(ubx_block_t *b, struct ubx_chain *chain)
 	}
 }
 
+long ubx_chain_rtcheck_log(ubx_block_t *b, struct ubx_chain *chain)
+{
+	long num_viol = 0;
+
+	if (chain->blk_rtcheck == NULL)
+		return 0;
+
+	for (int i = 0; i < chain->triggees_len; i++) {
+		if (chain->blk_rtcheck[i].viol == 0)
+			continue;
+
+		rtcheck_log(b, &chain->blk_rtcheck[i]);
+		num_viol++;
+	}
+
+	if (num_viol == 0)
+		ubx_info(b, "RTCHECK: no page faults or allocations in %ld blocks",
+			 chain->triggees_len);
+
+	return num_viol;
+}
+
 void ubx_chain_tstats_output(ubx_block_t *b, struct ubx_chain *chain)
 {
 	switch (chain->tstats_mode) {
 	case TSTATS_DISABLED:
 		return;
+	case TSTATS_RTCHECK:
 	case TSTATS_PERBLOCK:
 		for(int i=0; i<chain->triggees_len; i++)
 			write_tstat(chain->p_tstats, &chain->blk_tstats[i]);
@@ -430,6 +789,7 @@ int ubx_chain_tstats_fwrite(ubx_block_t *b, FILE *fp, struct ubx_chain *chain)
 		return 0;
 
 	switch (chain->tstats_mode) {
+	case TSTATS_RTCHECK:
 	case TSTATS_PERBLOCK:
 		for (int i = 0; i < chain->triggees_len; i++)
 			tstat_fwrite(fp, &chain->blk_tstats[i]);
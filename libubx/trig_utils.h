@@ -13,11 +13,13 @@
 #include "ubx.h"
 #include "triggee.h"
 #include "tstat.h"
+#include "rtcheck.h"
 
 enum tstats_mode {
 	TSTATS_DISABLED=0,
 	TSTATS_GLOBAL,
-	TSTATS_PERBLOCK
+	TSTATS_PERBLOCK,
+	TSTATS_RTCHECK
 };
 
 /* helper to retrieve config */
@@ -31,6 +33,10 @@ int write_tstat(const ubx_port_t *p, const struct ubx_tstat *val);
 long read_tstat_array(const ubx_port_t* p, struct ubx_tstat* val, const long len);
 int write_tstat_array(const ubx_port_t* p, const struct ubx_tstat* val, const long len);
 
+/* rtcheck port read/write helpers */
+long read_rtcheck(const ubx_port_t* p, struct ubx_rtcheck* val);
+int write_rtcheck(const ubx_port_t *p, const struct ubx_rtcheck *val);
+
 /**
  * tstat_init - initialize a tstats structure
  * @ts tstat to initialize
@@ -72,6 +78,70 @@ void tstat_log(const ubx_block_t *b, const struct ubx_tstat *stats);
  */
 int tstat_fwrite(FILE *fp, struct ubx_tstat *stats);
 
+/**
+ * struct ubx_rtcheck_sample - fault and allocation counters of a thread
+ */
+struct ubx_rtcheck_sample {
+	unsigned long minflt;
+	unsigned long majflt;
+	unsigned long mallocs;
+	unsigned long frees;
+};
+
+/**
+ * rtcheck_init - initialize a rtcheck structure
+ * @rc rtcheck to initialize
+ * @block_name name of the checked block
+ * @chain_id chain id this block is part of (if NULL will be omitted)
+ */
+void rtcheck_init(struct ubx_rtcheck *rc, const char *block_name, const char *chain_id);
+
+/**
+ * rtcheck_sample - sample the counters of the calling thread
+ *
+ * Page faults are sampled with getrusage(RUSAGE_THREAD). Allocations
+ * are only counted if libubxrtcheck.so is preloaded and are zero
+ * otherwise.
+ *
+ * @s: sample to fill in
+ */
+void rtcheck_sample(struct ubx_rtcheck_sample *s);
+
+/**
+ * rtcheck_update - account the counters of a step
+ * @rc rtcheck to update
+ * @start sample taken before the step
+ * @end sample taken after the step
+ * @return 1 if the step faulted or allocated, 0 otherwise
+ */
+int rtcheck_update(struct ubx_rtcheck *rc,
+		   const struct ubx_rtcheck_sample *start,
+		   const struct ubx_rtcheck_sample *end);
+
+/**
+ * rtcheck_log - log a rtcheck
+ */
+void rtcheck_log(const ubx_block_t *b, const struct ubx_rtcheck *rc);
+
+
+/**
+ * struct ubx_chain_step - compiled entry of a chain
+ *
+ * @step: step hook of the block
+ * @step_batch: step_batch hook of the block (if num_steps > 1 or no step hook)
+ * @b: block to step
+ * @priv: private_data of the block (for prefetching)
+ * @num_steps: number of times to step the block
+ * @idx: index of the corresponding triggee
+ */
+struct ubx_chain_step {
+	void (*step)(ubx_block_t *b);
+	void (*step_batch)(ubx_block_t *b, unsigned int n);
+	ubx_block_t *b;
+	const void *priv;
+	int num_steps;
+	int idx;
+};
 
 /**
  * struct ubx_chain
@@ -90,6 +160,12 @@ int tstat_fwrite(FILE *fp, struct ubx_tstat *stats);
  * @tstats_output_rate:	output rate
  * @tstats_output_last_msg: timestamp of last message
  * @tstats_output_idx: index of last output sample
+ * @p_rtcheck: rtcheck output port (optional, TSTATS_RTCHECK only)
+ * @blk_rtcheck: per block realtime violations (TSTATS_RTCHECK only)
+ * @steps: compiled step table (s. ubx_chain_init)
+ * @steps_len: length of the step table
+ * @cfg_nd: node the cfg_reader is registered with (NULL if unregistered)
+ * @cfg_reader: config reader, each trigger is a read section
  */
 struct ubx_chain {
 	/* public fields to be configured directly */
@@ -106,6 +182,15 @@ struct ubx_chain {
 	uint64_t tstats_output_rate;
 	uint64_t tstats_output_last_msg;
 	long tstats_output_idx;
+
+	ubx_port_t *p_rtcheck;
+	struct ubx_rtcheck *blk_rtcheck;
+
+	struct ubx_chain_step *steps;
+	long steps_len;
+
+	ubx_node_t *cfg_nd;
+	struct ubx_cfg_reader cfg_reader;
 };
 
 /**
@@ -116,7 +201,21 @@ struct ubx_chain {
  * start), as it will resize existing buffers appropriately.
  *
  * Before initializing, make sure to set the @triggees, @triggees_len
- * @tstats_mode and optionally the tstats output port @p_tstats.
+ * @tstats_mode and optionally the tstats output port @p_tstats and
+ * rtcheck output port @p_rtcheck.
+ *
+ * The TSTATS_RTCHECK mode acquires per block statistics and
+ * additionally checks each step for page faults and allocations
+ * (s. rtcheck_sample). The first violation of each block is logged
+ * as a warning and the rtcheck of a block is written to @p_rtcheck
+ * after each violating step. Like the timing statistics, the checks
+ * only start after @tstats_skip_first triggers.
+ *
+ * The triggees are validated and compiled into a contiguous step
+ * table, hence changes to the triggees only take effect after
+ * rerunning ubx_chain_init. Triggees with num_steps < 0 and blocks
+ * without a step or step_batch hook are omitted. Blocks with a
+ * step_batch hook are stepped num_steps times with a single call.
  *
  * @chain: chain to initialized
  * @chain_id: id for this chain (used as id of global stats and
@@ -142,12 +241,45 @@ void ubx_chain_cleanup(struct ubx_chain* chain);
  * ubx_chain_trigger - trigger a ubx_chain
  *
  * trigger the given chain according to the configured tstats_mode.
+ * The trigger is a config read section, hence configs published
+ * with ubx_config_publish while the chain is running are picked up
+ * by the triggered blocks at the start of the next trigger and
+ * replaced values are released after the current one.
  *
  * @chain: chain to trigger
  * @return 0 if successfull, <0 otherwise
  */
 int ubx_chain_trigger(struct ubx_chain* chain);
 
+/**
+ * ubx_chain_trigger_ready - step the ready blocks of a ubx_chain
+ *
+ * Throughput mode: instead of stepping all blocks unconditionally,
+ * only step blocks that can make progress without losing data. A
+ * block is ready if all its flow controlled in-ports (i.e. connected
+ * to iblocks with a pending hook) have data and all its flow
+ * controlled out-ports (i.e. connected to iblocks with a credits
+ * hook) have credits left. Each block is stepped at most num_steps
+ * times per call, but never more than the available samples and
+ * credits permit. This assumes that blocks write at most one sample
+ * per out-port and step.
+ *
+ * Blocks without any flow controlled ports are always ready and are
+ * stepped num_steps times per call, but these steps are not counted
+ * in the return value. Hence callers that trigger until no more
+ * progress is made terminate once the flow controlled blocks are
+ * blocked.
+ *
+ * Inactive blocks are skipped and no timing statistics are
+ * acquired. Like ubx_chain_trigger, each call is a config read
+ * section.
+ *
+ * @chain: chain to trigger
+ * @return number of steps of flow controlled blocks, 0 if no progress
+ *         was made
+ */
+long ubx_chain_trigger_ready(struct ubx_chain* chain);
+
 /**
  * ubx_chain_tstats_log - log all tstats
  *
@@ -156,6 +288,15 @@ int ubx_chain_trigger(struct ubx_chain* chain);
  */
 void ubx_chain_tstats_log(ubx_block_t *b, struct ubx_chain *chain);
 
+/**
+ * ubx_chain_rtcheck_log - log the rtchecks of all violating blocks
+ *
+ * @b ubx_block in whose context to log
+ * @chain chain to log
+ * @return number of blocks with violations
+ */
+long ubx_chain_rtcheck_log(ubx_block_t *b, struct ubx_chain *chain);
+
 /**
  * ubx_chain_tstats_output - write _all_ current stats to the tstats port
  *
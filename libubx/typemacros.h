@@ -70,6 +70,47 @@ long FUNCNAME(const ubx_port_t* p, TYPENAME* val)			\
 {									\
 	return FUNCNAME ## _array(p, val, 1);				\
 }									\
+									\
+long FUNCNAME ## _batch(const ubx_port_t* p, TYPENAME* val,		\
+			const long len, const long num)			\
+{									\
+	ubx_data_t data;						\
+	static ubx_type_t *type = NULL;					\
+									\
+	if (p == NULL || p->block == NULL) {				\
+		ERR("invalid input port");				\
+		return EINVALID_PORT;					\
+	} else if (p->in_type == NULL) {				\
+		ubx_err(p->block, "%s: port %s not an input port", __func__, p->name); \
+		return EINVALID_PORT_DIR;				\
+	}								\
+									\
+	if (p->in_type != type) {					\
+		type = ubx_type_get(p->block->nd, QUOTE(TYPENAME));	\
+									\
+		if (type == NULL) {					\
+			ubx_err(p->block, "%s: unregistered type " QUOTE(TYPENAME), __func__); \
+			return EINVALID_TYPE;				\
+		}							\
+									\
+		if (p->in_type != type) {				\
+			ubx_err(p->block, "%s: ETYPE_MISMATCH: expected %s but port %s is %s", \
+				__func__, QUOTE(TYPENAME), p->name, p->in_type->name); \
+			return ETYPE_MISMATCH;				\
+		}							\
+	}								\
+									\
+	if (len > p->in_data_len) {					\
+		ubx_err(p->block, "%s: EINVALID_DATA_LEN: data: %lu, port: %lu", \
+			__func__, len, p->in_data_len);			\
+		return EINVALID_DATA_LEN;				\
+	}								\
+									\
+	data.data = (void*) val;					\
+	data.type = type;						\
+	data.len = len;							\
+	return __port_read_batch(p, &data, num);			\
+}									\
 
 /*
  * Define port write functions
@@ -123,6 +164,48 @@ int FUNCNAME(const ubx_port_t *p, const TYPENAME *val)			\
 {									\
 	return FUNCNAME ## _array(p, val, 1);				\
 }									\
+									\
+int FUNCNAME ## _batch(const ubx_port_t *p, const TYPENAME *val,	\
+		       const long len, const long num)			\
+{									\
+	ubx_data_t data;						\
+	static ubx_type_t *type = NULL;					\
+									\
+	if (p == NULL || p->block == NULL) {				\
+		ERR("invalid output port");				\
+		return EINVALID_PORT;					\
+	} else if (p->out_type == NULL) {				\
+		ubx_err(p->block, "%s: port %s not an output port", __func__, p->name); \
+		return EINVALID_PORT_DIR;				\
+	}								\
+									\
+	if (p->out_type != type) {					\
+		type = ubx_type_get(p->block->nd, QUOTE(TYPENAME));	\
+									\
+		if (type == NULL) {					\
+			ubx_err(p->block, "%s: unregistered type " QUOTE(TYPENAME), __func__); \
+			return EINVALID_TYPE;				\
+		}							\
+									\
+		if (p->out_type != type) {				\
+			ubx_err(p->block, "%s: ETYPE_MISMATCH: expected %s but port %s is %s", \
+				__func__, QUOTE(TYPENAME), p->name, p->out_type->name); \
+			return ETYPE_MISMATCH;				\
+		}							\
+	}								\
+									\
+	if (len > p->out_data_len) {					\
+		ubx_err(p->block, "%s: EINVALID_DATA_LEN: data: %lu, port: %lu", \
+			__func__, len, p->out_data_len);		\
+		return EINVALID_DATA_LEN;				\
+	}								\
+									\
+	data.data = (void*) val;					\
+	data.type = type;						\
+	data.len = len;							\
+	__port_write_batch(p, &data, num);				\
+	return 0;							\
+}									\
 
 
 #define def_cfg_getptr_fun(FUNCNAME, TYPENAME)				\
@@ -221,6 +304,8 @@ int write_ ## SUFFIX(const ubx_port_t *p, const TYPENAME *val);		\
 int write_ ## SUFFIX ## _array(const ubx_port_t *p, const TYPENAME *val, const long len); \
 long read_ ## SUFFIX(const ubx_port_t *p, TYPENAME *val);		\
 long read_ ## SUFFIX ##_array(const ubx_port_t *p, TYPENAME *val, const long len); \
+int write_ ## SUFFIX ## _batch(const ubx_port_t *p, const TYPENAME *val, const long len, const long num); \
+long read_ ## SUFFIX ## _batch(const ubx_port_t *p, TYPENAME *val, const long len, const long num); \
 long cfg_getptr_ ## SUFFIX(const ubx_block_t *b, const char *cfg_name, const TYPENAME **valptr); \
 int cfg_set_ ## SUFFIX(const ubx_block_t *b, const char *cfg_name, const TYPENAME *valptr, const long len);
 
@@ -256,6 +256,7 @@ int ubx_node_init(ubx_node_t *nd, const char *name, uint32_t attrs)
 
 	nd->loglevel = (nd->loglevel == 0) ?
 		UBX_LOGLEVEL_DEFAULT : nd->loglevel;
+	nd->attrs = attrs;
 
 	if (ubx_log_init(nd)) {
 		fprintf(stderr, "Error: failed to initalize logging.");
@@ -291,12 +292,17 @@ int ubx_node_init(ubx_node_t *nd, const char *name, uint32_t attrs)
 	logf_info(nd, "TSC timesource enabled");
 #endif
 
-	nd->attrs = attrs;
 	nd->blocks = NULL;
 	nd->types = NULL;
 	nd->modules = NULL;
 	nd->cur_seqid = 0;
 
+	if (ubx_cfg_rcu_init(nd))
+		goto out;
+
+	if (ubx_clock_init(nd))
+		goto out;
+
 	ret = 0;
  out:
 	return ret;
@@ -360,6 +366,10 @@ void ubx_node_cleanup(ubx_node_t *nd)
 
 	ubx_node_clear(nd);
 
+	/* free config values retired by removed blocks */
+	if (nd->cfg_rcu)
+		ubx_config_reclaim(nd);
+
 	/* cleanup all modules */
 	HASH_ITER(hh, nd->modules, m, mtmp)
 		ubx_module_cleanup(nd, m->id);
@@ -395,6 +405,10 @@ void ubx_node_rm(ubx_node_t *nd)
 {
 	logf_info(nd, "removing node %s", nd->name);
 	ubx_node_cleanup(nd);
+	ubx_cfg_rcu_cleanup(nd);
+	ubx_clock_cleanup(nd);
+	ubx_data_pool_cleanup(nd);
+	ubx_mem_arena_cleanup(nd);
 	ubx_log_cleanup(nd);
 	memset((char*) nd->name, 0, UBX_NODE_NAME_MAXLEN);
 }
@@ -497,10 +511,15 @@ int ubx_block_register(ubx_node_t *nd, struct ubx_proto_block *prot)
 	switch (prot->type) {
 	case BLOCK_TYPE_COMPUTATION:
 		newb->step = prot->step;
+		newb->step_batch = prot->step_batch;
 		break;
 	case BLOCK_TYPE_INTERACTION:
 		newb->read = prot->read;
 		newb->write = prot->write;
+		newb->read_batch = prot->read_batch;
+		newb->write_batch = prot->write_batch;
+		newb->credits = prot->credits;
+		newb->pending = prot->pending;
 		break;
 	}
 
@@ -774,13 +793,13 @@ ubx_data_t *__ubx_data_alloc(const ubx_type_t *typ, const long array_len)
 	if (typ == NULL)
 		goto out;
 
-	d = calloc(1, sizeof(ubx_data_t));
+	d = ubx_data_pool_alloc(typ->nd, sizeof(ubx_data_t));
 
 	if (d == NULL)
 		goto out;
 
 	if (array_len > 0) {
-		d->data = calloc(array_len, typ->size);
+		d->data = ubx_data_pool_alloc(typ->nd, array_len * typ->size);
 		if (d->data == NULL)
 			goto out_free;
 	}
@@ -792,7 +811,7 @@ ubx_data_t *__ubx_data_alloc(const ubx_type_t *typ, const long array_len)
 	goto out;
 
 out_free:
-	free(d);
+	ubx_data_pool_free(d);
 	d = NULL;
 out:
 	return d;
@@ -841,7 +860,7 @@ int ubx_data_resize(ubx_data_t *d, long newlen)
 	void *ptr;
 	unsigned int newsz = newlen * d->type->size;
 
-	ptr = realloc(d->data, newsz);
+	ptr = ubx_data_pool_realloc(d->type->nd, d->data, newsz);
 	if (ptr == NULL)
 		goto out;
 
@@ -864,8 +883,8 @@ void ubx_data_free(ubx_data_t *d)
 	d->refcnt--;
 
 	if (d->refcnt < 0) {
-		free(d->data);
-		free(d);
+		ubx_data_pool_free(d->data);
+		ubx_data_pool_free(d);
 	}
 }
 
@@ -980,6 +999,7 @@ void ubx_block_free(ubx_block_t *b)
 		ubx_port_free(p);
 	}
 
+	ubx_block_mem_clear(b);
 	free(b);
 }
 
@@ -1038,10 +1058,15 @@ static ubx_block_t *ubx_block_clone(ubx_block_t *prot, const char *name)
 	switch (prot->type) {
 	case BLOCK_TYPE_COMPUTATION:
 		newb->step = prot->step;
+		newb->step_batch = prot->step_batch;
 		break;
 	case BLOCK_TYPE_INTERACTION:
 		newb->read = prot->read;
 		newb->write = prot->write;
+		newb->read_batch = prot->read_batch;
+		newb->write_batch = prot->write_batch;
+		newb->credits = prot->credits;
+		newb->pending = prot->pending;
 		break;
 	}
 
@@ -1182,68 +1207,133 @@ int ubx_block_rm(ubx_node_t *nd, const char *name)
 }
 
 /**
- * array_block_add - add a block to an array
+ * array_publish - replace an interaction array
  *
- * grow/shrink the array if necessary.
+ * The arrays are iterated by __port_read and __port_write without
+ * locking, possibly while the port is being connected or
+ * disconnected. Therefore they are never modified in place: the new
+ * array is published with a release store and the old one is freed
+ * once all readers have passed a quiescent point (see ubx_rcu.c).
+ *
+ * @param nd node
+ * @param arr array to update
+ * @param newarr new array (or NULL)
+ */
+static void array_publish(ubx_node_t *nd, const ubx_block_t ***arr,
+			  const ubx_block_t **newarr)
+{
+	const ubx_block_t **old = *arr;
+
+	__atomic_store_n(arr, newarr, __ATOMIC_RELEASE);
+
+	if (old)
+		ubx_rcu_retire(nd, old, free);
+}
+
+/* return the number of blocks in a NULL terminated array */
+static long array_block_len(const ubx_block_t **arr)
+{
+	long len = 0;
+
+	if (arr != NULL)
+		while (arr[len] != NULL)
+			len++;
+
+	return len;
+}
+
+/**
+ * array_block_add - add a block to an array
  *
+ * @param nd node
  * @param arr
  * @param newblock
  *
  * @return < 0 in case of error, 0 otherwise.
  */
-static int array_block_add(const ubx_block_t ***arr, const ubx_block_t *newblock)
+static int array_block_add(ubx_node_t *nd,
+			   const ubx_block_t ***arr,
+			   const ubx_block_t *newblock)
 {
-	int ret;
-	long newlen; /* new length of array including NULL element */
-	const ubx_block_t **tmpb;
-
-	/*
-	 * determine newlen
-	 * with one element, the array is size two to hold the terminating NULL
-	 * element.
-	 */
-	if (*arr == NULL)
-		newlen = 2;
-	else
-		for (tmpb = *arr, newlen = 2; *tmpb != NULL; tmpb++, newlen++)
-			;
+	int ret = 0;
+	long len;
+	const ubx_block_t **newarr;
+
+	ubx_rcu_write_lock(nd);
+
+	len = array_block_len(*arr);
 
-	*arr = realloc(*arr, sizeof(ubx_block_t *) * newlen);
-	if (*arr == NULL) {
+	/* add one for the new block and one for the terminating NULL */
+	newarr = malloc(sizeof(ubx_block_t *) * (len + 2));
+
+	if (newarr == NULL) {
 		ret = EOUTOFMEM;
 		goto out;
 	}
 
-	(*arr)[newlen - 2] = newblock;
-	(*arr)[newlen - 1] = NULL;
-	ret = 0;
- out:
+	if (len > 0)
+		memcpy(newarr, *arr, sizeof(ubx_block_t *) * len);
+
+	newarr[len] = newblock;
+	newarr[len + 1] = NULL;
+
+	array_publish(nd, arr, newarr);
+out:
+	ubx_rcu_write_unlock(nd);
 	return ret;
 }
 
-static int array_block_rm(const ubx_block_t ***arr, const ubx_block_t *rmblock)
+/**
+ * array_block_rm - remove a block from an array
+ *
+ * If the last block is removed, the array is set to NULL.
+ *
+ * @param nd node
+ * @param arr
+ * @param rmblock
+ *
+ * @return < 0 in case of error, 0 otherwise.
+ */
+static int array_block_rm(ubx_node_t *nd,
+			  const ubx_block_t ***arr,
+			  const ubx_block_t *rmblock)
 {
-	int ret = -1, cnt, match = -1;
-	const ubx_block_t **tmpb;
+	int ret = 0;
+	long len, i, j;
+	const ubx_block_t **newarr = NULL;
+
+	ubx_rcu_write_lock(nd);
 
-	for (tmpb = *arr, cnt = 0; *tmpb != NULL; tmpb++, cnt++) {
-		if (*tmpb == rmblock)
-			match = cnt;
+	len = array_block_len(*arr);
+
+	for (i = 0; i < len; i++) {
+		if ((*arr)[i] == rmblock)
+			break;
 	}
 
-	if (match == -1)
+	if (i == len) {
+		ret = -1;
 		goto out;
+	}
+
+	if (len > 1) {
+		newarr = malloc(sizeof(ubx_block_t *) * len);
 
-	/* case 1: remove last */
-	if (match == cnt - 1)
-		(*arr)[match] = NULL;
-	else {
-		(*arr)[match] = (*arr)[cnt - 1];
-		(*arr)[cnt - 1] = NULL;
+		if (newarr == NULL) {
+			ret = EOUTOFMEM;
+			goto out;
+		}
+
+		for (i = 0, j = 0; i < len; i++) {
+			if ((*arr)[i] != rmblock)
+				newarr[j++] = (*arr)[i];
+		}
+		newarr[j] = NULL;
 	}
 
-	ret = 0;
+	array_publish(nd, arr, newarr);
 out:
+	ubx_rcu_write_unlock(nd);
 	return ret;
 }
 
@@ -1260,7 +1350,7 @@ int ubx_port_connect_out(ubx_port_t *p, const ubx_block_t *iblock)
 	int ret = -1;
 
 	if (port_is_out(p)) {
-		ret = array_block_add(&p->out_interaction, iblock);
+		ret = array_block_add(iblock->nd, &p->out_interaction, iblock);
 		if (ret != 0)
 			goto out;
 	} else {
@@ -1287,7 +1377,7 @@ int ubx_port_connect_in(ubx_port_t *p, const ubx_block_t *iblock)
 	int ret;
 
 	if (port_is_in(p)) {
-		ret = array_block_add(&p->in_interaction, iblock);
+		ret = array_block_add(iblock->nd, &p->in_interaction, iblock);
 		if (ret != 0)
 			goto out;
 	} else {
@@ -1360,7 +1450,7 @@ int ubx_port_disconnect_out(ubx_port_t *out_port, const ubx_block_t *iblock)
 	int ret = -1;
 
 	if (port_is_out(out_port)) {
-		ret = array_block_rm(&out_port->out_interaction, iblock);
+		ret = array_block_rm(iblock->nd, &out_port->out_interaction, iblock);
 		if (ret != 0)
 			goto out;
 	} else {
@@ -1389,7 +1479,7 @@ int ubx_port_disconnect_in(ubx_port_t *in_port, const ubx_block_t *iblock)
 	int ret = -1;
 
 	if (port_is_in(in_port)) {
-		ret = array_block_rm(&in_port->in_interaction, iblock);
+		ret = array_block_rm(iblock->nd, &in_port->in_interaction, iblock);
 		if (ret != 0)
 			goto out;
 	} else {
@@ -2060,10 +2150,14 @@ int ubx_block_init(ubx_block_t *b)
 	ret = b->init(b);
 	if (ret != 0) {
 		ubx_err(b, "init failed");
+		ubx_block_mem_clear(b);
 		goto out;
 	}
 
  out_ok:
+	if (b->type == BLOCK_TYPE_COMPUTATION)
+		ubx_cfg_reader_register(b->nd, &b->cfg_reader);
+
 	b->block_state = BLOCK_STATE_INACTIVE;
 	ret = 0;
 
@@ -2187,12 +2281,20 @@ int ubx_block_cleanup(ubx_block_t *b)
 		goto out;
 	}
 
+	/* a port may still be writing to or reading from this iblock */
+	if (b->type == BLOCK_TYPE_INTERACTION)
+		ubx_rcu_synchronize(b->nd);
+
 	if (b->cleanup == NULL)
 		goto out_ok;
 
 	b->cleanup(b);
 
  out_ok:
+	if (b->type == BLOCK_TYPE_COMPUTATION)
+		ubx_cfg_reader_unregister(b->nd, &b->cfg_reader);
+
+	ubx_block_mem_clear(b);
 	b->block_state = BLOCK_STATE_PREINIT;
 	ret = 0;
 
@@ -2202,13 +2304,20 @@ int ubx_block_cleanup(ubx_block_t *b)
 
 
 /**
- * Step a cblock
+ * Step a cblock n times
+ *
+ * Uses the step_batch hook if available (and n > 1 or there is no
+ * step hook), otherwise calls the step hook n times. The steps run
+ * in a config read section of the block, so that config values
+ * loaded with ubx_config_acquire remain valid even if the block is
+ * not stepped by a ubx_chain.
  *
  * @param b
+ * @param n number of steps
  *
  * @return 0 if OK, else -1
  */
-int ubx_cblock_step(ubx_block_t *b)
+int ubx_cblock_step_batch(ubx_block_t *b, unsigned int n)
 {
 	int ret;
 
@@ -2229,11 +2338,20 @@ int ubx_cblock_step(ubx_block_t *b)
 		goto out;
 	}
 
-	if (b->step == NULL)
+	if (n == 0 || (b->step == NULL && b->step_batch == NULL))
 		goto out_ok;
 
-	b->step(b);
-	b->stat_num_steps++;
+	ubx_cfg_read_enter(b->nd, &b->cfg_reader);
+
+	if (b->step_batch != NULL && (n > 1 || b->step == NULL)) {
+		b->step_batch(b, n);
+	} else {
+		for (unsigned int i = 0; i < n; i++)
+			b->step(b);
+	}
+
+	ubx_cfg_read_exit(&b->cfg_reader);
+	b->stat_num_steps += n;
 
 out_ok:
 	ret = 0;
@@ -2242,6 +2360,18 @@ out:
 	return ret;
 }
 
+/**
+ * Step a cblock
+ *
+ * @param b
+ *
+ * @return 0 if OK, else -1
+ */
+int ubx_cblock_step(ubx_block_t *b)
+{
+	return ubx_cblock_step_batch(b, 1);
+}
+
 
 /**
  * @brief
@@ -2286,11 +2416,13 @@ long __port_read(const ubx_port_t *port, ubx_data_t *data)
 		goto out;
 	}
 
+	iaptr = (ubx_block_t**)__atomic_load_n(&port->in_interaction, __ATOMIC_ACQUIRE);
+
 	/* port completely unconnected? */
-	if (port->in_interaction == NULL)
+	if (iaptr == NULL)
 		goto out;
 
-	for (iaptr = (ubx_block_t**)port->in_interaction; *iaptr != NULL; iaptr++) {
+	for (; *iaptr != NULL; iaptr++) {
 		if ((*iaptr)->block_state == BLOCK_STATE_ACTIVE) {
 			ret = (*iaptr)->read(*iaptr, data);
 			if (ret > 0) {
@@ -2335,12 +2467,14 @@ void __port_write(const ubx_port_t *port, const ubx_data_t *data)
 		goto out;
 	}
 
+	iaptr = (ubx_block_t**)__atomic_load_n(&port->out_interaction, __ATOMIC_ACQUIRE);
+
 	/* port completely unconnected? */
-	if (port->out_interaction == NULL)
+	if (iaptr == NULL)
 		goto out;
 
 	/* pump it out */
-	for (iaptr = (ubx_block_t**)port->out_interaction; *iaptr != NULL; iaptr++) {
+	for (; *iaptr != NULL; iaptr++) {
 		if ((*iaptr)->block_state == BLOCK_STATE_ACTIVE) {
 			(*iaptr)->write(*iaptr, data);
 			(*iaptr)->stat_num_writes++;
@@ -2351,6 +2485,258 @@ void __port_write(const ubx_port_t *port, const ubx_data_t *data)
 	return;
 }
 
+/*
+ * read up to num samples from an iblock, falling back to looping
+ * over read if the iblock has no read_batch hook.
+ */
+static long iblock_read_batch(ubx_block_t *ib, ubx_data_t *data, long num)
+{
+	long ret = 0, n;
+	ubx_data_t sample = *data;
+	const long size = data_size(data);
+
+	if (ib->read_batch != NULL)
+		return ib->read_batch(ib, data, num);
+
+	for (n = 0; n < num; n++) {
+		sample.data = (uint8_t *)data->data + n * size;
+		ret = ib->read(ib, &sample);
+
+		if (ret <= 0)
+			break;
+	}
+
+	return (n > 0) ? n : ret;
+}
+
+/*
+ * write num samples to an iblock, falling back to looping over write
+ * if the iblock has no write_batch hook.
+ */
+static void iblock_write_batch(ubx_block_t *ib, const ubx_data_t *data, long num)
+{
+	ubx_data_t sample = *data;
+	const long size = data_size(data);
+
+	if (ib->write_batch != NULL) {
+		ib->write_batch(ib, data, num);
+		return;
+	}
+
+	for (long n = 0; n < num; n++) {
+		sample.data = (uint8_t *)data->data + n * size;
+		ib->write(ib, &sample);
+	}
+}
+
+/**
+ * __port_read_batch - read up to num samples from a port
+ *
+ * @param port port from which to read
+ * @param data ubx_data_t describing a single sample (type and array
+ *             length). data->data must hold num such samples.
+ * @param num maximum number of samples to read
+ *
+ * Like __port_read, samples are read from the first active iblock
+ * that has data. Samples shorter than data->len only fill the start
+ * of their slot.
+ *
+ * @return number of samples read, 0 if no data or < 0 in case of error
+ */
+long __port_read_batch(const ubx_port_t *port, ubx_data_t *data, long num)
+{
+	long ret = 0;
+	ubx_block_t **iaptr;
+
+	if (port == NULL) {
+		ERR("port is NULL");
+		ret = EINVALID_PORT;
+		goto out;
+	}
+
+	if (!data || data->len <= 0 || num <= 0) {
+		ret = EINVALID_ARG;
+		goto out;
+	}
+
+	if (!port_is_in(port)) {
+		ret = EINVALID_PORT_DIR;
+		goto out;
+	};
+
+	if (port->in_type != data->type) {
+		ret = ETYPE_MISMATCH;
+		ubx_err(port->block, "port_read_batch %s: type mismatch: data: %s, port: %s",
+			port->name,
+			get_typename(data),
+			port->in_type->name);
+		goto out;
+	}
+
+	iaptr = (ubx_block_t**)__atomic_load_n(&port->in_interaction, __ATOMIC_ACQUIRE);
+
+	/* port completely unconnected? */
+	if (iaptr == NULL)
+		goto out;
+
+	for (; *iaptr != NULL; iaptr++) {
+		if ((*iaptr)->block_state == BLOCK_STATE_ACTIVE) {
+			ret = iblock_read_batch(*iaptr, data, num);
+			if (ret > 0) {
+				(*iaptr)->stat_num_reads += ret;
+				goto out;
+			}
+		}
+	}
+
+ out:
+	return ret;
+}
+
+/**
+ * __port_write_batch - write num samples to a port
+ *
+ * @param port
+ * @param data ubx_data_t describing a single sample (type and array
+ *             length). data->data must hold num such samples.
+ * @param num number of samples to write
+ *
+ * This function will check if the type matches.
+ */
+void __port_write_batch(const ubx_port_t *port, const ubx_data_t *data, long num)
+{
+	ubx_block_t **iaptr;
+
+	if (port == NULL) {
+		ERR("port is NULL");
+		goto out;
+	}
+
+	if (num <= 0)
+		goto out;
+
+	if (!port_is_out(port)) {
+		ubx_err(port->block, "not an OUT-port");
+		goto out;
+	};
+
+	if (port->out_type != data->type) {
+		ubx_err(port->block,
+			"port_write_batch %s: type mismatch: data: %s, port: %s",
+			port->name, get_typename(data), port->out_type->name);
+		goto out;
+	}
+
+	iaptr = (ubx_block_t**)__atomic_load_n(&port->out_interaction, __ATOMIC_ACQUIRE);
+
+	/* port completely unconnected? */
+	if (iaptr == NULL)
+		goto out;
+
+	for (; *iaptr != NULL; iaptr++) {
+		if ((*iaptr)->block_state == BLOCK_STATE_ACTIVE) {
+			iblock_write_batch(*iaptr, data, num);
+			(*iaptr)->stat_num_writes += num;
+		}
+	}
+
+ out:
+	return;
+}
+
+/**
+ * ubx_port_credits - number of samples that can be written losslessly
+ *
+ * Only iblocks that implement the credits hook are considered, all
+ * others are assumed to have unlimited capacity (i.e. they are not
+ * flow controlled).
+ *
+ * @param port out-port
+ * @return minimum credits of all active connected iblocks, LONG_MAX if
+ *         the port is not flow controlled or < 0 in case of error
+ */
+long ubx_port_credits(const ubx_port_t *port)
+{
+	long ret = LONG_MAX, credits;
+	ubx_block_t **iaptr;
+
+	if (port == NULL) {
+		ERR("port is NULL");
+		ret = EINVALID_PORT;
+		goto out;
+	}
+
+	if (!port_is_out(port)) {
+		ret = EINVALID_PORT_DIR;
+		goto out;
+	}
+
+	iaptr = (ubx_block_t**)__atomic_load_n(&port->out_interaction, __ATOMIC_ACQUIRE);
+
+	if (iaptr == NULL)
+		goto out;
+
+	for (; *iaptr != NULL; iaptr++) {
+		if ((*iaptr)->block_state != BLOCK_STATE_ACTIVE ||
+		    (*iaptr)->credits == NULL)
+			continue;
+
+		credits = (*iaptr)->credits(*iaptr);
+		ret = MIN(ret, credits);
+	}
+
+ out:
+	return ret;
+}
+
+/**
+ * ubx_port_pending - number of samples available for reading
+ *
+ * Only iblocks that implement the pending hook are considered.
+ *
+ * @param port in-port
+ * @return sum of the pending samples of all active connected
+ *         iblocks, LONG_MAX if the port is not flow controlled or < 0
+ *         in case of error
+ */
+long ubx_port_pending(const ubx_port_t *port)
+{
+	long ret = LONG_MAX, pending = 0;
+	int flowctrl = 0;
+	ubx_block_t **iaptr;
+
+	if (port == NULL) {
+		ERR("port is NULL");
+		ret = EINVALID_PORT;
+		goto out;
+	}
+
+	if (!port_is_in(port)) {
+		ret = EINVALID_PORT_DIR;
+		goto out;
+	}
+
+	iaptr = (ubx_block_t**)__atomic_load_n(&port->in_interaction, __ATOMIC_ACQUIRE);
+
+	if (iaptr == NULL)
+		goto out;
+
+	for (; *iaptr != NULL; iaptr++) {
+		if ((*iaptr)->block_state != BLOCK_STATE_ACTIVE ||
+		    (*iaptr)->pending == NULL)
+			continue;
+
+		pending += (*iaptr)->pending(*iaptr);
+		flowctrl = 1;
+	}
+
+	if (flowctrl)
+		ret = pending;
+
+ out:
+	return ret;
+}
+
 /**
  * ubx_version - return ubx version
  *
@@ -155,6 +155,7 @@ typedef struct ubx_proto_block {
 		/* COMP_TYPE_COMPUTATION */
 		struct {
 			void (*step)(struct ubx_block *cblock);
+			void (*step_batch)(struct ubx_block *cblock, unsigned int n);
 			unsigned long stat_num_steps;
 		};
 
@@ -164,6 +165,12 @@ typedef struct ubx_proto_block {
 				     ubx_data_t *value);
 			void (*write)(struct ubx_block *iblock,
 				      const ubx_data_t *value);
+			long (*read_batch)(struct ubx_block *iblock,
+					   ubx_data_t *value, long num);
+			void (*write_batch)(struct ubx_block *iblock,
+					    const ubx_data_t *value, long num);
+			long (*credits)(struct ubx_block *iblock);
+			long (*pending)(struct ubx_block *iblock);
 			unsigned long stat_num_reads;
 			unsigned long stat_num_writes;
 		};
@@ -0,0 +1,311 @@
+/*
+ * microblx: node clocks
+ *
+ * All time based activity of a node (e.g. the ptrig period) uses the
+ * node clock (ubx_node_gettime, ubx_node_nanosleep). By default, this
+ * is the system clock (ubx_gettime, ubx_nanosleep).
+ *
+ * Nodes created with ND_VIRTUAL_TIME use a virtual clock instead,
+ * which only advances when all threads driven by it are sleeping:
+ * threads that periodically sleep on the node clock attach to it
+ * (ubx_node_clock_attach) while running. Once all attached threads
+ * are blocked in ubx_node_nanosleep, time jumps to the earliest
+ * wakeup time of all sleeping threads, releasing the respective
+ * threads. Threads that are not attached (e.g. a thread waiting for
+ * a simulation to reach a certain time) can sleep on the virtual
+ * clock too, but never hold back time. Hence a composition
+ * runs as fast as possible, but with the same sequence of triggers
+ * as in real time.
+ *
+ * Copyright (C) 2020 Markus Klotzbuecher <mk@mkio.de>
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ */
+
+#undef UBX_DEBUG
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "ubx.h"
+
+#define logf_err(nd, fmt, ...)		ubx_log(UBX_LOGLEVEL_ERR,    nd, __func__, fmt, ##__VA_ARGS__)
+#define logf_info(nd, fmt, ...)		ubx_log(UBX_LOGLEVEL_INFO,   nd, __func__, fmt, ##__VA_ARGS__)
+
+/*
+ * system clock
+ */
+static int sys_gettime(ubx_node_t *nd, struct ubx_timespec *uts)
+{
+	(void)nd;
+	return ubx_gettime(uts);
+}
+
+static int sys_nanosleep(ubx_node_t *nd, int flags, struct ubx_timespec *uts)
+{
+	(void)nd;
+	return ubx_nanosleep(flags, uts);
+}
+
+const struct ubx_clock ubx_clock_system = {
+	.name = "system",
+	.gettime = sys_gettime,
+	.nanosleep = sys_nanosleep,
+};
+
+/*
+ * virtual clock
+ *
+ * @now: current virtual time
+ * @clients: number of attached threads
+ * @sleeping: number of threads blocked in nanosleep
+ * @sleeping_clients: number of attached threads blocked in nanosleep
+ * @gen: incremented each time the clock advances
+ * @contrib: number of sleepers that have contributed their wakeup
+ *	     time to @next in the current generation
+ * @next: earliest wakeup time of the sleepers
+ */
+struct vclock {
+	pthread_mutex_t mtx;
+	pthread_cond_t cond;
+
+	struct ubx_timespec now;
+	int clients;
+	int sleeping;
+	int sleeping_clients;
+
+	unsigned long gen;
+	int contrib;
+	struct ubx_timespec next;
+};
+
+static int vclock_gettime(ubx_node_t *nd, struct ubx_timespec *uts)
+{
+	struct vclock *vc = (struct vclock *)nd->clock_data;
+
+	if (uts == NULL)
+		return EINVALID_ARG;
+
+	pthread_mutex_lock(&vc->mtx);
+	*uts = vc->now;
+	pthread_mutex_unlock(&vc->mtx);
+
+	return 0;
+}
+
+/* is the current thread attached to a virtual clock? */
+static __thread int vclock_attached;
+
+/* cancellation cleanup handler of vclock_nanosleep */
+static void vclock_sleep_cleanup(void *arg)
+{
+	struct vclock *vc = (struct vclock *)arg;
+
+	vc->sleeping--;
+	vc->sleeping_clients -= vclock_attached;
+
+	/* let the remaining sleepers contribute again */
+	vc->gen++;
+	vc->contrib = 0;
+
+	pthread_cond_broadcast(&vc->cond);
+	pthread_mutex_unlock(&vc->mtx);
+}
+
+static int vclock_nanosleep(ubx_node_t *nd, int flags, struct ubx_timespec *uts)
+{
+	unsigned long gen;
+	struct ubx_timespec wakeup;
+	struct vclock *vc = (struct vclock *)nd->clock_data;
+
+	if (uts == NULL)
+		return EINVALID_ARG;
+
+	pthread_mutex_lock(&vc->mtx);
+
+	if (flags & TIMER_ABSTIME)
+		wakeup = *uts;
+	else
+		ubx_ts_add(&vc->now, uts, &wakeup);
+
+	vc->sleeping++;
+	vc->sleeping_clients += vclock_attached;
+	gen = vc->gen - 1;
+
+	pthread_cleanup_push(vclock_sleep_cleanup, vc);
+
+	while (ubx_ts_cmp(&vc->now, &wakeup) < 0) {
+		/* contribute wakeup time once per generation */
+		if (gen != vc->gen) {
+			if (vc->contrib == 0 || ubx_ts_cmp(&wakeup, &vc->next) < 0)
+				vc->next = wakeup;
+			vc->contrib++;
+			gen = vc->gen;
+		}
+
+		/* all attached threads sleeping: advance */
+		if (vc->sleeping_clients == vc->clients && vc->contrib == vc->sleeping) {
+			vc->now = vc->next;
+			vc->gen++;
+			vc->contrib = 0;
+			pthread_cond_broadcast(&vc->cond);
+			continue;
+		}
+
+		pthread_cond_wait(&vc->cond, &vc->mtx);
+	}
+
+	pthread_cleanup_pop(0);
+
+	vc->sleeping--;
+	vc->sleeping_clients -= vclock_attached;
+	pthread_mutex_unlock(&vc->mtx);
+
+	return 0;
+}
+
+static void vclock_attach(ubx_node_t *nd)
+{
+	struct vclock *vc = (struct vclock *)nd->clock_data;
+
+	pthread_mutex_lock(&vc->mtx);
+	vc->clients++;
+	vclock_attached = 1;
+	pthread_mutex_unlock(&vc->mtx);
+}
+
+static void vclock_detach(ubx_node_t *nd)
+{
+	struct vclock *vc = (struct vclock *)nd->clock_data;
+
+	pthread_mutex_lock(&vc->mtx);
+	vc->clients--;
+	vclock_attached = 0;
+	/* the remaining sleepers may now be able to advance */
+	pthread_cond_broadcast(&vc->cond);
+	pthread_mutex_unlock(&vc->mtx);
+}
+
+const struct ubx_clock ubx_clock_virtual = {
+	.name = "virtual",
+	.gettime = vclock_gettime,
+	.nanosleep = vclock_nanosleep,
+	.attach = vclock_attach,
+	.detach = vclock_detach,
+};
+
+/**
+ * ubx_clock_init - initialize the node clock
+ *
+ * Uses the virtual clock if the node has the ND_VIRTUAL_TIME
+ * attribute set, the system clock otherwise. The virtual time starts
+ * at the current system time.
+ *
+ * @nd: node
+ * @return 0 or EOUTOFMEM
+ */
+int ubx_clock_init(ubx_node_t *nd)
+{
+	struct vclock *vc;
+
+	if (!(nd->attrs & ND_VIRTUAL_TIME)) {
+		nd->clock = &ubx_clock_system;
+		nd->clock_data = NULL;
+		return 0;
+	}
+
+	vc = calloc(1, sizeof(struct vclock));
+
+	if (vc == NULL) {
+		logf_err(nd, "EOUTOFMEM: failed to alloc vclock");
+		return EOUTOFMEM;
+	}
+
+	pthread_mutex_init(&vc->mtx, NULL);
+	pthread_cond_init(&vc->cond, NULL);
+	ubx_gettime(&vc->now);
+
+	nd->clock = &ubx_clock_virtual;
+	nd->clock_data = vc;
+
+	logf_info(nd, "virtual time enabled");
+
+	return 0;
+}
+
+/**
+ * ubx_clock_cleanup - release the node clock
+ * @nd: node
+ */
+void ubx_clock_cleanup(ubx_node_t *nd)
+{
+	struct vclock *vc;
+
+	if (nd->clock != &ubx_clock_virtual)
+		goto out;
+
+	vc = (struct vclock *)nd->clock_data;
+
+	pthread_cond_destroy(&vc->cond);
+	pthread_mutex_destroy(&vc->mtx);
+	free(vc);
+
+ out:
+	nd->clock = NULL;
+	nd->clock_data = NULL;
+}
+
+/**
+ * ubx_node_gettime - get the current time of the node clock
+ * @nd: node
+ * @uts: result
+ * @return 0 if OK, non-zero otherwise
+ */
+int ubx_node_gettime(ubx_node_t *nd, struct ubx_timespec *uts)
+{
+	if (nd->clock == NULL)
+		return ubx_gettime(uts);
+
+	return nd->clock->gettime(nd, uts);
+}
+
+/**
+ * ubx_node_nanosleep - sleep on the node clock
+ * @nd: node
+ * @flags: 0 (relative) or TIMER_ABSTIME
+ * @uts: time to sleep or to sleep until
+ * @return 0 if OK, non-zero otherwise
+ */
+int ubx_node_nanosleep(ubx_node_t *nd, int flags, struct ubx_timespec *uts)
+{
+	if (nd->clock == NULL)
+		return ubx_nanosleep(flags, uts);
+
+	return nd->clock->nanosleep(nd, flags, uts);
+}
+
+/**
+ * ubx_node_clock_attach - attach the calling thread to the node clock
+ *
+ * Threads that periodically sleep on the node clock must be attached
+ * while they are running, so that a virtual clock does not advance
+ * while they are busy.
+ *
+ * @nd: node
+ */
+void ubx_node_clock_attach(ubx_node_t *nd)
+{
+	if (nd->clock != NULL && nd->clock->attach != NULL)
+		nd->clock->attach(nd);
+}
+
+/**
+ * ubx_node_clock_detach - detach the calling thread from the node clock
+ * @nd: node
+ */
+void ubx_node_clock_detach(ubx_node_t *nd)
+{
+	if (nd->clock != NULL && nd->clock->detach != NULL)
+		nd->clock->detach(nd);
+}
@@ -25,6 +25,9 @@ void ubx_node_clear(ubx_node_t *nd);
 void ubx_node_cleanup(ubx_node_t *nd);
 void ubx_node_rm(ubx_node_t *nd);
 
+int ubx_node_snapshot(ubx_node_t *nd, const char *file);
+int ubx_node_restore(ubx_node_t *nd, const char *file);
+
 int ubx_num_blocks(ubx_node_t *nd);
 int ubx_num_types(ubx_node_t *nd);
 int ubx_num_modules(ubx_node_t *nd);
@@ -41,6 +44,7 @@ int ubx_block_start(ubx_block_t *b);
 int ubx_block_stop(ubx_block_t *b);
 int ubx_block_cleanup(ubx_block_t *b);
 int ubx_cblock_step(ubx_block_t *b);
+int ubx_cblock_step_batch(ubx_block_t *b, unsigned int n);
 
 /* modules and registration */
 int ubx_module_load(ubx_node_t *nd, const char *lib);
@@ -107,6 +111,10 @@ void ubx_port_free(ubx_port_t *p);
 
 long __port_read(const ubx_port_t *port, ubx_data_t *data);
 void __port_write(const ubx_port_t *port, const ubx_data_t *data);
+long __port_read_batch(const ubx_port_t *port, ubx_data_t *data, long num);
+void __port_write_batch(const ubx_port_t *port, const ubx_data_t *data, long num);
+long ubx_port_credits(const ubx_port_t *port);
+long ubx_port_pending(const ubx_port_t *port);
 
 /* configs (ubx_config_t) */
 ubx_config_t *ubx_config_get(const ubx_block_t *b, const char *name);
@@ -118,6 +126,52 @@ int ubx_config_add2(ubx_block_t *b, const char *name, const char *doc, const cha
 int ubx_config_add(ubx_block_t *b, const char *name, const char *doc, const char *type_name);
 int ubx_config_rm(ubx_block_t *b, const char *name);
 
+/* lock-free config updates */
+int ubx_cfg_rcu_init(ubx_node_t *nd);
+void ubx_cfg_rcu_cleanup(ubx_node_t *nd);
+void ubx_cfg_reader_register(ubx_node_t *nd, struct ubx_cfg_reader *r);
+void ubx_cfg_reader_unregister(ubx_node_t *nd, struct ubx_cfg_reader *r);
+void ubx_cfg_read_enter(const ubx_node_t *nd, struct ubx_cfg_reader *r);
+void ubx_cfg_read_exit(struct ubx_cfg_reader *r);
+long ubx_config_acquire(const ubx_config_t *c, const void **ptr);
+int ubx_config_publish(ubx_config_t *c, ubx_data_t *d);
+int ubx_config_publish_copy(ubx_config_t *c, const void *val, long len);
+int ubx_config_reclaim(ubx_node_t *nd);
+int ubx_rcu_retire(ubx_node_t *nd, void *ptr, void (*free_fn)(void *ptr));
+void ubx_rcu_write_lock(ubx_node_t *nd);
+void ubx_rcu_write_unlock(ubx_node_t *nd);
+void ubx_rcu_synchronize(ubx_node_t *nd);
+
+/* ubx_data pool */
+int ubx_data_pool_init(ubx_node_t *nd, size_t budget);
+void ubx_data_pool_cleanup(ubx_node_t *nd);
+void ubx_data_pool_seal(ubx_node_t *nd);
+size_t ubx_data_pool_prefault(ubx_node_t *nd);
+int ubx_data_pool_stats(ubx_node_t *nd, struct ubx_data_pool_stats *stats);
+void *ubx_data_pool_alloc(ubx_node_t *nd, size_t size);
+void *ubx_data_pool_realloc(ubx_node_t *nd, void *ptr, size_t size);
+void ubx_data_pool_free(void *ptr);
+
+/* node clock */
+int ubx_clock_init(ubx_node_t *nd);
+void ubx_clock_cleanup(ubx_node_t *nd);
+int ubx_node_gettime(ubx_node_t *nd, struct ubx_timespec *uts);
+int ubx_node_nanosleep(ubx_node_t *nd, int flags, struct ubx_timespec *uts);
+void ubx_node_clock_attach(ubx_node_t *nd);
+void ubx_node_clock_detach(ubx_node_t *nd);
+
+/* preparing for realtime */
+int ubx_block_mem_register(ubx_block_t *b, void *addr, size_t len);
+void ubx_block_mem_unregister(ubx_block_t *b, void *addr);
+void ubx_block_mem_clear(ubx_block_t *b);
+void *ubx_block_mem_alloc(ubx_block_t *b, size_t len, uint32_t attrs);
+void ubx_block_mem_free(ubx_block_t *b, void *addr);
+size_t ubx_hugepage_size(void);
+struct ubx_mem_arena *ubx_mem_arena_create(ubx_node_t *nd, const char *name, size_t len);
+int ubx_block_mem_arena_set(ubx_block_t *b, struct ubx_mem_arena *arena);
+void ubx_mem_arena_cleanup(ubx_node_t *nd);
+long ubx_node_prepare_rt(ubx_node_t *nd, size_t heap_reserve);
+
 /* connecting ports */
 int ubx_port_connect_out(ubx_port_t *p, const ubx_block_t *iblock);
 int ubx_port_connect_in(ubx_port_t *p, const ubx_block_t *iblock);
@@ -0,0 +1,475 @@
+/*
+ * microblx: realtime memory pool for ubx_data
+ *
+ * ubx_data_t headers and payloads are allocated with calloc, which
+ * is not permitted in realtime threads. If a node is given a pool
+ * budget (ubx_data_pool_init), these are allocated from a per node
+ * arena of that size instead:
+ *
+ * Allocations are rounded up to a power of two size class (including
+ * a small header recording the class). Freed blocks are pushed onto
+ * a lock-free free list per size class (a Treiber stack, with a
+ * generation tag in the upper half of the head to avoid ABA). If a
+ * free list is empty, a new block is carved from the arena by
+ * atomically advancing the arena offset. Blocks are never returned
+ * to the arena or coalesced, so the arena usage is the high-water
+ * mark of the allocations per class.
+ *
+ * If a request can not be served from the pool (too large for the
+ * largest class or arena exhausted), it falls back to calloc,
+ * unless the pool is sealed, in which case it fails. Pools are
+ * sealed by ubx_node_prepare_rt, so that no system allocation
+ * happens after starting.
+ *
+ * As ubx_data may be freed after the node (e.g. by the Lua garbage
+ * collector), frees identify pool memory by address range and the
+ * arena is unmapped only after the last block has been freed.
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ */
+
+#undef UBX_DEBUG
+
+#include <stdlib.h>
+#include <malloc.h>
+#include <sys/mman.h>
+
+#include "ubx.h"
+
+#define logf_err(nd, fmt, ...)		ubx_log(UBX_LOGLEVEL_ERR,    nd, __func__, fmt, ##__VA_ARGS__)
+#define logf_info(nd, fmt, ...)		ubx_log(UBX_LOGLEVEL_INFO,   nd, __func__, fmt, ##__VA_ARGS__)
+
+#define POOL_MAX		8	/* max number of pools per process */
+#define POOL_MIN_SHIFT		5	/* smallest class: 32 bytes */
+#define POOL_NUM_CLASSES	16	/* largest class: 1 MiB */
+#define POOL_ALIGN		16
+
+/*
+ * block header
+ * @cls: size class
+ * @next: free list link (index of next free block + 1), only valid
+ *	  while the block is free
+ */
+struct pool_hdr {
+	uint32_t cls;
+	uint32_t next;
+	uint64_t pad;
+};
+
+/**
+ * struct ubx_data_pool - a ubx_data pool
+ *
+ * @arena: start of arena
+ * @end: end of arena (0 if the slot is unused)
+ * @size: size of arena
+ * @off: arena offset up to which blocks were carved
+ * @free: per class free lists: generation << 32 | (index + 1)
+ * @refs: 1 for the node + number of allocated blocks
+ * @sealed: fail instead of falling back to calloc
+ * @in_use: bytes allocated (including headers)
+ * @peak: high-water mark of in_use
+ * @allocs: number of allocations served by the pool
+ * @sys_allocs: number of allocations served by calloc
+ * @failed: number of failed allocations
+ */
+struct ubx_data_pool {
+	uint8_t *arena;
+	uintptr_t end;
+	size_t size;
+	size_t off;
+	uint64_t free[POOL_NUM_CLASSES];
+	long refs;
+	int sealed;
+	size_t in_use;
+	size_t peak;
+	unsigned long allocs;
+	unsigned long sys_allocs;
+	unsigned long failed;
+};
+
+/* pools are never freed, so that looking up the pool of a pointer
+ * never accesses freed memory. */
+static struct ubx_data_pool pools[POOL_MAX];
+
+static inline size_t class_size(uint32_t cls)
+{
+	return (size_t)1 << (cls + POOL_MIN_SHIFT);
+}
+
+/* size class for a request of size bytes or -1 if too large */
+static int size_class(size_t size)
+{
+	size_t total = size + sizeof(struct pool_hdr);
+
+	for (int cls = 0; cls < POOL_NUM_CLASSES; cls++) {
+		if (class_size(cls) >= total)
+			return cls;
+	}
+
+	return -1;
+}
+
+/* return the pool containing ptr or NULL */
+static struct ubx_data_pool *pool_of(const void *ptr)
+{
+	uintptr_t p = (uintptr_t)ptr;
+
+	for (int i = 0; i < POOL_MAX; i++) {
+		uintptr_t end = __atomic_load_n(&pools[i].end, __ATOMIC_ACQUIRE);
+
+		if (end != 0 && p >= (uintptr_t)pools[i].arena && p < end)
+			return &pools[i];
+	}
+
+	return NULL;
+}
+
+static void pool_put(struct ubx_data_pool *pool)
+{
+	if (__atomic_sub_fetch(&pool->refs, 1, __ATOMIC_ACQ_REL) > 0)
+		return;
+
+	/* last reference: release the slot after unmapping */
+	__atomic_store_n(&pool->end, 0, __ATOMIC_RELEASE);
+	munmap(pool->arena, pool->size);
+	__atomic_store_n(&pool->arena, NULL, __ATOMIC_RELEASE);
+}
+
+static struct pool_hdr *pool_pop(struct ubx_data_pool *pool, uint32_t cls)
+{
+	uint64_t head, newhead;
+	struct pool_hdr *hdr;
+
+	head = __atomic_load_n(&pool->free[cls], __ATOMIC_ACQUIRE);
+
+	while ((uint32_t)head != 0) {
+		hdr = (struct pool_hdr *)(pool->arena + ((uint32_t)head - 1) * POOL_ALIGN);
+
+		/* next may be stale if hdr was popped concurrently, but
+		 * then the generation changed and the CAS fails */
+		newhead = ((head >> 32) + 1) << 32 |
+			__atomic_load_n(&hdr->next, __ATOMIC_RELAXED);
+
+		if (__atomic_compare_exchange_n(&pool->free[cls], &head, newhead, 0,
+						__ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+			return hdr;
+	}
+
+	return NULL;
+}
+
+static void pool_push(struct ubx_data_pool *pool, struct pool_hdr *hdr)
+{
+	uint64_t head, newhead;
+	uint32_t idx = ((uint8_t *)hdr - pool->arena) / POOL_ALIGN + 1;
+
+	head = __atomic_load_n(&pool->free[hdr->cls], __ATOMIC_RELAXED);
+
+	do {
+		__atomic_store_n(&hdr->next, (uint32_t)head, __ATOMIC_RELAXED);
+		newhead = ((head >> 32) + 1) << 32 | idx;
+	} while (!__atomic_compare_exchange_n(&pool->free[hdr->cls], &head, newhead, 0,
+					      __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/* carve a new block of class cls from the arena */
+static struct pool_hdr *pool_carve(struct ubx_data_pool *pool, uint32_t cls)
+{
+	size_t off = __atomic_load_n(&pool->off, __ATOMIC_RELAXED);
+
+	do {
+		if (off + class_size(cls) > pool->size)
+			return NULL;
+	} while (!__atomic_compare_exchange_n(&pool->off, &off, off + class_size(cls), 0,
+					      __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+	return (struct pool_hdr *)(pool->arena + off);
+}
+
+static void *pool_alloc(struct ubx_data_pool *pool, size_t size)
+{
+	int cls = size_class(size);
+	size_t in_use, peak;
+	struct pool_hdr *hdr = NULL;
+
+	if (cls >= 0) {
+		hdr = pool_pop(pool, cls);
+
+		if (hdr == NULL)
+			hdr = pool_carve(pool, cls);
+	}
+
+	if (hdr == NULL)
+		return NULL;
+
+	hdr->cls = cls;
+	__atomic_add_fetch(&pool->refs, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&pool->allocs, 1, __ATOMIC_RELAXED);
+
+	in_use = __atomic_add_fetch(&pool->in_use, class_size(cls), __ATOMIC_RELAXED);
+	peak = __atomic_load_n(&pool->peak, __ATOMIC_RELAXED);
+
+	while (in_use > peak &&
+	       !__atomic_compare_exchange_n(&pool->peak, &peak, in_use, 0,
+					    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+
+	return hdr + 1;
+}
+
+/**
+ * ubx_data_pool_alloc - allocate zeroed memory for ubx_data
+ *
+ * @nd: node (may be NULL)
+ * @size: number of bytes
+ * @return pointer to memory or NULL if out of memory
+ */
+void *ubx_data_pool_alloc(ubx_node_t *nd, size_t size)
+{
+	void *ptr;
+	struct ubx_data_pool *pool = (nd) ? nd->data_pool : NULL;
+
+	if (pool == NULL)
+		return calloc(1, size);
+
+	ptr = pool_alloc(pool, size);
+
+	if (ptr != NULL) {
+		memset(ptr, 0, size);
+		return ptr;
+	}
+
+	if (__atomic_load_n(&pool->sealed, __ATOMIC_RELAXED)) {
+		__atomic_add_fetch(&pool->failed, 1, __ATOMIC_RELAXED);
+		return NULL;
+	}
+
+	__atomic_add_fetch(&pool->sys_allocs, 1, __ATOMIC_RELAXED);
+	return calloc(1, size);
+}
+
+/**
+ * ubx_data_pool_free - free memory allocated with ubx_data_pool_alloc
+ *
+ * @ptr: memory to free (may be NULL)
+ */
+void ubx_data_pool_free(void *ptr)
+{
+	struct pool_hdr *hdr;
+	struct ubx_data_pool *pool;
+
+	if (ptr == NULL)
+		return;
+
+	pool = pool_of(ptr);
+
+	if (pool == NULL) {
+		free(ptr);
+		return;
+	}
+
+	hdr = (struct pool_hdr *)ptr - 1;
+	__atomic_sub_fetch(&pool->in_use, class_size(hdr->cls), __ATOMIC_RELAXED);
+	pool_push(pool, hdr);
+	pool_put(pool);
+}
+
+/**
+ * ubx_data_pool_realloc - resize memory allocated with ubx_data_pool_alloc
+ *
+ * Like realloc, the contents are preserved up to the minimum of the
+ * old and new size and memory beyond is not initialized.
+ *
+ * @nd: node (may be NULL)
+ * @ptr: memory to resize (may be NULL)
+ * @size: new size in bytes
+ * @return pointer to memory or NULL if out of memory, in which case
+ *	   ptr is unchanged.
+ */
+void *ubx_data_pool_realloc(ubx_node_t *nd, void *ptr, size_t size)
+{
+	void *newptr;
+	size_t oldsize;
+	struct pool_hdr *hdr;
+	struct ubx_data_pool *pool = (ptr) ? pool_of(ptr) : NULL;
+
+	if (pool == NULL && (nd == NULL || nd->data_pool == NULL))
+		return realloc(ptr, size);
+
+	if (pool != NULL) {
+		hdr = (struct pool_hdr *)ptr - 1;
+		oldsize = class_size(hdr->cls) - sizeof(struct pool_hdr);
+
+		/* still fits */
+		if (size <= oldsize && size > oldsize / 2)
+			return ptr;
+	} else {
+		oldsize = (ptr) ? malloc_usable_size(ptr) : 0;
+	}
+
+	newptr = ubx_data_pool_alloc(nd, size);
+
+	if (newptr == NULL)
+		return NULL;
+
+	if (ptr != NULL)
+		memcpy(newptr, ptr, MIN(oldsize, size));
+
+	ubx_data_pool_free(ptr);
+	return newptr;
+}
+
+/**
+ * ubx_data_pool_init - create the ubx_data pool of a node
+ *
+ * ubx_data allocated before remain allocated with calloc. Should
+ * be called right after ubx_node_init.
+ *
+ * @nd: node
+ * @budget: size of the pool in bytes
+ * @return 0 if OK, < 0 otherwise
+ */
+int ubx_data_pool_init(ubx_node_t *nd, size_t budget)
+{
+	void *arena;
+	struct ubx_data_pool *pool = NULL;
+
+	if (nd->data_pool != NULL) {
+		logf_err(nd, "node already has a data pool");
+		return EALREADY_REGISTERED;
+	}
+
+	arena = mmap(NULL, budget, PROT_READ | PROT_WRITE,
+		     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (arena == MAP_FAILED) {
+		logf_err(nd, "EOUTOFMEM: failed to map %zu bytes data pool: %m", budget);
+		return EOUTOFMEM;
+	}
+
+	/* claim a free slot */
+	for (int i = 0; i < POOL_MAX; i++) {
+		void *expected = NULL;
+
+		if (__atomic_compare_exchange_n(&pools[i].arena, &expected, arena, 0,
+						__ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+			pool = &pools[i];
+			break;
+		}
+	}
+
+	if (pool == NULL) {
+		logf_err(nd, "max number of data pools (%d) reached", POOL_MAX);
+		munmap(arena, budget);
+		return EOUTOFMEM;
+	}
+
+	pool->size = budget;
+	pool->off = 0;
+	memset(pool->free, 0, sizeof(pool->free));
+	pool->refs = 1;
+	pool->sealed = 0;
+	pool->in_use = pool->peak = 0;
+	pool->allocs = pool->sys_allocs = pool->failed = 0;
+	__atomic_store_n(&pool->end, (uintptr_t)arena + budget, __ATOMIC_RELEASE);
+
+	nd->data_pool = pool;
+	logf_info(nd, "created %zu KiB data pool", budget / 1024);
+
+	return 0;
+}
+
+/**
+ * ubx_data_pool_seal - disable the fallback to calloc
+ *
+ * @nd: node
+ */
+void ubx_data_pool_seal(ubx_node_t *nd)
+{
+	if (nd->data_pool == NULL)
+		return;
+
+	__atomic_store_n(&nd->data_pool->sealed, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * ubx_data_pool_prefault - write to every page of the pool
+ *
+ * Only the pages that have not been carved yet are prefaulted, as
+ * carved blocks are in use and already faulted in. This must not be
+ * called while blocks may allocate concurrently.
+ *
+ * @nd: node
+ * @return number of bytes prefaulted
+ */
+size_t ubx_data_pool_prefault(ubx_node_t *nd)
+{
+	size_t pagesize = sysconf(_SC_PAGESIZE);
+	size_t off;
+	uint8_t *p;
+	struct ubx_data_pool *pool = nd->data_pool;
+
+	if (pool == NULL)
+		return 0;
+
+	/* start with the first page after the carved blocks */
+	off = __atomic_load_n(&pool->off, __ATOMIC_RELAXED);
+	off = (off + pagesize - 1) & ~(pagesize - 1);
+
+	if (off >= pool->size)
+		return 0;
+
+	/* the uncarved pages are still zero */
+	for (p = pool->arena + off; p < pool->arena + pool->size; p += pagesize)
+		*(volatile uint8_t *)p = 0;
+
+	return pool->size - off;
+}
+
+/**
+ * ubx_data_pool_stats - get the statistics of the data pool
+ *
+ * @nd: node
+ * @stats: statistics to fill in
+ * @return 0 if OK, ENOSUCHENT if the node has no data pool
+ */
+int ubx_data_pool_stats(ubx_node_t *nd, struct ubx_data_pool_stats *stats)
+{
+	struct ubx_data_pool *pool = nd->data_pool;
+
+	if (pool == NULL)
+		return ENOSUCHENT;
+
+	stats->size = pool->size;
+	stats->used = __atomic_load_n(&pool->off, __ATOMIC_RELAXED);
+	stats->in_use = __atomic_load_n(&pool->in_use, __ATOMIC_RELAXED);
+	stats->peak = __atomic_load_n(&pool->peak, __ATOMIC_RELAXED);
+	stats->allocs = __atomic_load_n(&pool->allocs, __ATOMIC_RELAXED);
+	stats->sys_allocs = __atomic_load_n(&pool->sys_allocs, __ATOMIC_RELAXED);
+	stats->failed = __atomic_load_n(&pool->failed, __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+/**
+ * ubx_data_pool_cleanup - release the data pool of a node
+ *
+ * The arena is unmapped once all ubx_data allocated from it have
+ * been freed.
+ *
+ * @nd: node
+ */
+void ubx_data_pool_cleanup(ubx_node_t *nd)
+{
+	struct ubx_data_pool_stats st;
+
+	if (ubx_data_pool_stats(nd, &st) != 0)
+		return;
+
+	logf_info(nd, "data pool: peak %zu KiB of %zu KiB (%zu KiB carved), %lu allocs, %lu system allocs, %lu failed",
+		  st.peak / 1024, st.size / 1024, st.used / 1024,
+		  st.allocs, st.sys_allocs, st.failed);
+
+	pool_put(nd->data_pool);
+	nd->data_pool = NULL;
+}
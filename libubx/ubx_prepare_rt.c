@@ -0,0 +1,592 @@
+/*
+ * microblx: preparing a node for realtime
+ *
+ * mlockall(MCL_FUTURE) (ND_MLOCK_ALL) only locks memory once it is
+ * touched for the first time, hence buffers allocated during init
+ * still page fault during the first cycles. ubx_node_prepare_rt is
+ * intended to be called between configuring and starting a node and
+ *
+ *  - tunes malloc to neither return memory to the system nor use
+ *    mmap for large allocations, and to use a single arena,
+ *  - optionally reserves heap memory for later allocations,
+ *  - prefaults the memory regions registered by blocks via
+ *    ubx_block_mem_register.
+ *
+ * The stacks of trigger threads can only safely be prefaulted by
+ * the threads themselves, so this is done by the trigger blocks
+ * (see ptrig) if the node is created with ND_PREPARE_RT.
+ *
+ * Large buffers can be allocated with ubx_block_mem_alloc, which
+ * optionally backs these with huge pages to reduce TLB pressure:
+ * explicit huge pages (MAP_HUGETLB) are used if available, otherwise
+ * the region is aligned to the huge page size and transparent huge
+ * pages are requested with madvise(MADV_HUGEPAGE). If neither is
+ * available, regular pages are used.
+ *
+ * The buffers of several blocks can be placed contiguously in a
+ * memory arena (ubx_mem_arena_create), typically one per trigger
+ * thread holding the buffers of the iblocks used by its chains in
+ * execution order (see the blockdiagram launch option mem_plan).
+ * Blocks assigned to an arena with ubx_block_mem_arena_set get the
+ * buffers allocated with ubx_block_mem_alloc carved from the arena,
+ * aligned to cache lines. If the arena is exhausted, the buffer is
+ * allocated separately.
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ */
+
+#undef UBX_DEBUG
+
+#include <stdlib.h>
+#include <malloc.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "ubx.h"
+
+#define logf_err(nd, fmt, ...)		ubx_log(UBX_LOGLEVEL_ERR,    nd, __func__, fmt, ##__VA_ARGS__)
+#define logf_notice(nd, fmt, ...)	ubx_log(UBX_LOGLEVEL_NOTICE, nd, __func__, fmt, ##__VA_ARGS__)
+#define logf_info(nd, fmt, ...)		ubx_log(UBX_LOGLEVEL_INFO,   nd, __func__, fmt, ##__VA_ARGS__)
+
+#define HUGEPAGE_SIZE_DEFAULT	(2 * 1024 * 1024)
+#define CACHELINE_SIZE		64
+
+#define CACHELINE_ALIGN(x)	(((x) + CACHELINE_SIZE - 1) & ~((size_t)CACHELINE_SIZE - 1))
+
+static int mem_region_add(ubx_block_t *b, void *addr, size_t len, uint32_t attrs)
+{
+	struct ubx_mem_region *r = calloc(1, sizeof(struct ubx_mem_region));
+
+	if (r == NULL) {
+		ubx_err(b, "EOUTOFMEM: failed to alloc mem_region");
+		return EOUTOFMEM;
+	}
+
+	r->addr = addr;
+	r->len = len;
+	r->attrs = attrs;
+	LL_PREPEND(b->mem_regions, r);
+
+	return 0;
+}
+
+/* release the memory of an owned region */
+static void mem_region_release(struct ubx_mem_region *r)
+{
+	if (r->attrs & MEM_ATTR_MMAP)
+		munmap(r->addr, r->len);
+	else if (r->attrs & MEM_ATTR_MALLOC)
+		free(r->addr);
+}
+
+/* carve a zeroed, cache line aligned buffer from an arena */
+static void *arena_alloc(struct ubx_mem_arena *a, size_t len)
+{
+	uint8_t *addr;
+
+	if (CACHELINE_ALIGN(len) > a->len - a->used)
+		return NULL;
+
+	addr = a->addr + a->used;
+	a->used += CACHELINE_ALIGN(len);
+	memset(addr, 0, len);
+
+	return addr;
+}
+
+/* return a buffer to its arena. Only the last buffer can be returned,
+ * others remain carved until the arena is freed. */
+static void arena_release(struct ubx_mem_arena *a, struct ubx_mem_region *r)
+{
+	if ((uint8_t *)r->addr + CACHELINE_ALIGN(r->len) == a->addr + a->used)
+		a->used = (uint8_t *)r->addr - a->addr;
+}
+
+/**
+ * ubx_block_mem_register - register a buffer for prefaulting
+ *
+ * Typically called from the init hook for buffers allocated there.
+ * All regions of a block are dropped when it is cleaned up, so
+ * these only need to be unregistered if freed before.
+ *
+ * @b: block owning the buffer
+ * @addr: start of buffer
+ * @len: length of buffer in bytes
+ * @return 0 if OK, EOUTOFMEM if allocation failed
+ */
+int ubx_block_mem_register(ubx_block_t *b, void *addr, size_t len)
+{
+	return mem_region_add(b, addr, len, 0);
+}
+
+/**
+ * ubx_block_mem_unregister - unregister a buffer
+ *
+ * The memory is not freed, use ubx_block_mem_free for buffers
+ * allocated with ubx_block_mem_alloc.
+ *
+ * @b: block owning the buffer
+ * @addr: start of buffer as passed to ubx_block_mem_register
+ */
+void ubx_block_mem_unregister(ubx_block_t *b, void *addr)
+{
+	struct ubx_mem_region *r, *tmp;
+
+	LL_FOREACH_SAFE(b->mem_regions, r, tmp) {
+		if (r->addr != addr)
+			continue;
+		LL_DELETE(b->mem_regions, r);
+		free(r);
+		return;
+	}
+}
+
+/**
+ * ubx_block_mem_clear - unregister all buffers of a block
+ *
+ * Buffers allocated with ubx_block_mem_alloc are freed.
+ *
+ * @b: block
+ */
+void ubx_block_mem_clear(ubx_block_t *b)
+{
+	struct ubx_mem_region *r, *tmp;
+
+	/* regions are prepended, so arena buffers are released in the
+	 * reverse order of allocation */
+	LL_FOREACH_SAFE(b->mem_regions, r, tmp) {
+		LL_DELETE(b->mem_regions, r);
+
+		if (r->attrs & MEM_ATTR_ARENA)
+			arena_release(b->mem_arena, r);
+		else
+			mem_region_release(r);
+
+		free(r);
+	}
+}
+
+/**
+ * ubx_hugepage_size - get the default huge page size
+ *
+ * @return huge page size in bytes
+ */
+size_t ubx_hugepage_size(void)
+{
+	static size_t hps;
+	unsigned long kib;
+	char line[128];
+	FILE *f;
+
+	if (hps > 0)
+		return hps;
+
+	hps = HUGEPAGE_SIZE_DEFAULT;
+	f = fopen("/proc/meminfo", "r");
+
+	if (f == NULL)
+		return hps;
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (sscanf(line, "Hugepagesize: %lu kB", &kib) == 1) {
+			hps = kib * 1024;
+			break;
+		}
+	}
+
+	fclose(f);
+	return hps;
+}
+
+/*
+ * map a region backed by huge pages if possible
+ *
+ * @len: requested length, updated to the mapped length
+ * @attrs: set to the MEM_ATTR_* of the region
+ */
+static void *huge_map(size_t *len, uint32_t *attrs)
+{
+	uint8_t *addr;
+	size_t hps = ubx_hugepage_size();
+	size_t maplen = (*len + hps - 1) & ~(hps - 1);
+	size_t head;
+
+	addr = mmap(NULL, maplen, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+	if (addr != MAP_FAILED) {
+		*attrs = MEM_ATTR_MMAP | MEM_ATTR_HUGETLB;
+		goto out;
+	}
+
+	/* no explicit huge pages available: map aligned to the huge
+	 * page size and ask for transparent huge pages */
+	addr = mmap(NULL, maplen + hps, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (addr == MAP_FAILED)
+		return NULL;
+
+	head = ((uintptr_t)addr + hps - 1) / hps * hps - (uintptr_t)addr;
+
+	if (head > 0)
+		munmap(addr, head);
+
+	munmap(addr + head + maplen, hps - head);
+
+	addr += head;
+	*attrs = MEM_ATTR_MMAP;
+
+	if (madvise(addr, maplen, MADV_HUGEPAGE) == 0)
+		*attrs |= MEM_ATTR_THP;
+ out:
+	*len = maplen;
+	return addr;
+}
+
+static const char *mem_backing_str(uint32_t attrs)
+{
+	if (attrs & MEM_ATTR_HUGETLB)
+		return "hugetlb";
+	if (attrs & MEM_ATTR_THP)
+		return "transparent huge";
+	return "regular";
+}
+
+/**
+ * ubx_block_mem_alloc - allocate a zeroed buffer for a block
+ *
+ * The buffer is registered for prefaulting and freed with
+ * ubx_block_mem_free or after the block's cleanup hook.
+ *
+ * If the block is assigned to an arena and MEM_ATTR_HUGE is not
+ * given, the buffer is carved from the arena if it fits.
+ *
+ * Otherwise, huge pages are used if MEM_ATTR_HUGE is given or if the
+ * node was created with ND_HUGEPAGES and the buffer is at least one
+ * huge page large. As the buffer is then rounded up to the huge page
+ * size, this is only sensible for large buffers.
+ *
+ * @b: block owning the buffer
+ * @len: length in bytes
+ * @attrs: MEM_ATTR_HUGE or 0
+ * @return pointer to buffer or NULL in case of error
+ */
+void *ubx_block_mem_alloc(ubx_block_t *b, size_t len, uint32_t attrs)
+{
+	void *addr;
+
+	if (b->mem_arena != NULL && !(attrs & MEM_ATTR_HUGE)) {
+		addr = arena_alloc(b->mem_arena, len);
+
+		if (addr != NULL) {
+			attrs = MEM_ATTR_ARENA |
+				(b->mem_arena->attrs & (MEM_ATTR_HUGETLB | MEM_ATTR_THP));
+			goto out_register;
+		}
+
+		ubx_notice(b, "arena %s exhausted, allocating %zu bytes separately",
+			   b->mem_arena->name, len);
+	}
+
+	if ((b->nd->attrs & ND_HUGEPAGES) && len >= ubx_hugepage_size())
+		attrs |= MEM_ATTR_HUGE;
+
+	if (attrs & MEM_ATTR_HUGE) {
+		addr = huge_map(&len, &attrs);
+	} else {
+		addr = calloc(1, len);
+		attrs = MEM_ATTR_MALLOC;
+	}
+
+	if (addr == NULL) {
+		ubx_err(b, "EOUTOFMEM: failed to alloc %zu bytes", len);
+		return NULL;
+	}
+
+	if (attrs & MEM_ATTR_MMAP)
+		ubx_info(b, "allocated %zu KiB backed by %s pages",
+			 len / 1024, mem_backing_str(attrs));
+
+ out_register:
+	if (mem_region_add(b, addr, len, attrs) != 0) {
+		struct ubx_mem_region r = { .addr = addr, .len = len, .attrs = attrs };
+
+		if (attrs & MEM_ATTR_ARENA)
+			arena_release(b->mem_arena, &r);
+		else
+			mem_region_release(&r);
+		return NULL;
+	}
+
+	return addr;
+}
+
+/**
+ * ubx_block_mem_free - free a buffer allocated with ubx_block_mem_alloc
+ *
+ * @b: block owning the buffer
+ * @addr: buffer
+ */
+void ubx_block_mem_free(ubx_block_t *b, void *addr)
+{
+	struct ubx_mem_region *r, *tmp;
+
+	LL_FOREACH_SAFE(b->mem_regions, r, tmp) {
+		if (r->addr != addr)
+			continue;
+		LL_DELETE(b->mem_regions, r);
+
+		if (r->attrs & MEM_ATTR_ARENA)
+			arena_release(b->mem_arena, r);
+		else
+			mem_region_release(r);
+
+		free(r);
+		return;
+	}
+
+	ubx_err(b, "no buffer %p to free", addr);
+}
+
+/**
+ * ubx_mem_arena_create - create a memory arena
+ *
+ * The arena is backed by huge pages if the node was created with
+ * ND_HUGEPAGES and the arena is at least one huge page large. It is
+ * freed by ubx_node_rm.
+ *
+ * @nd: node
+ * @name: name of the arena
+ * @len: length in bytes
+ * @return arena or NULL in case of error
+ */
+struct ubx_mem_arena *ubx_mem_arena_create(ubx_node_t *nd, const char *name, size_t len)
+{
+	size_t pagesize = sysconf(_SC_PAGESIZE);
+	struct ubx_mem_arena *a;
+
+	a = calloc(1, sizeof(struct ubx_mem_arena));
+
+	if (a == NULL)
+		goto out_err;
+
+	strncpy(a->name, name, UBX_BLOCK_NAME_MAXLEN);
+
+	if ((nd->attrs & ND_HUGEPAGES) && len >= ubx_hugepage_size()) {
+		a->len = len;
+		a->addr = huge_map(&a->len, &a->attrs);
+	} else {
+		a->len = (len + pagesize - 1) & ~(pagesize - 1);
+		a->addr = mmap(NULL, a->len, PROT_READ | PROT_WRITE,
+			       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		a->attrs = MEM_ATTR_MMAP;
+
+		if (a->addr == MAP_FAILED)
+			a->addr = NULL;
+	}
+
+	if (a->addr == NULL)
+		goto out_free;
+
+	LL_PREPEND(nd->mem_arenas, a);
+
+	logf_info(nd, "created arena %s of %zu KiB backed by %s pages",
+		  a->name, a->len / 1024, mem_backing_str(a->attrs));
+
+	return a;
+
+out_free:
+	free(a);
+out_err:
+	logf_err(nd, "EOUTOFMEM: failed to create arena %s of %zu bytes", name, len);
+	return NULL;
+}
+
+/**
+ * ubx_block_mem_arena_set - assign a block to an arena
+ *
+ * Subsequent ubx_block_mem_alloc calls of the block carve the buffers
+ * from the arena. Must be called before the block is initialized.
+ *
+ * @b: block
+ * @arena: arena (or NULL to allocate buffers separately)
+ * @return 0 if OK, EWRONG_STATE if the block is already initialized
+ */
+int ubx_block_mem_arena_set(ubx_block_t *b, struct ubx_mem_arena *arena)
+{
+	if (b->block_state != BLOCK_STATE_PREINIT) {
+		ubx_err(b, "EWRONG_STATE: arena can only be set in state preinit");
+		return EWRONG_STATE;
+	}
+
+	b->mem_arena = arena;
+	return 0;
+}
+
+/**
+ * ubx_mem_arena_cleanup - free the arenas of a node
+ *
+ * Must be called after all blocks using the arenas have been removed.
+ *
+ * @nd: node
+ */
+void ubx_mem_arena_cleanup(ubx_node_t *nd)
+{
+	struct ubx_mem_arena *a, *tmp;
+
+	LL_FOREACH_SAFE(nd->mem_arenas, a, tmp) {
+		LL_DELETE(nd->mem_arenas, a);
+		munmap(a->addr, a->len);
+		free(a);
+	}
+}
+
+/* write to every page of a region without changing its contents */
+static size_t prefault(void *addr, size_t len, size_t pagesize)
+{
+	volatile char *p = addr;
+	volatile char *end = p + len;
+	size_t pages = 0;
+
+	if (len == 0)
+		return 0;
+
+	for (; p < end; pages++) {
+		*p = *p;
+		p = (char *)(((uintptr_t)p & ~(pagesize - 1)) + pagesize);
+	}
+
+	return pages * pagesize;
+}
+
+/*
+ * request transparent huge pages for large config arrays (e.g.
+ * lookup tables). As these are allocated with malloc, only the huge
+ * page aligned part can be advised.
+ */
+static size_t advise_huge_configs(ubx_block_t *b, size_t hps)
+{
+	ubx_config_t *c;
+	uintptr_t start, end;
+	size_t advised = 0;
+
+	DL_FOREACH(b->configs, c) {
+		if (c->value == NULL || c->value->data == NULL)
+			continue;
+
+		start = ((uintptr_t)c->value->data + hps - 1) & ~(hps - 1);
+		end = ((uintptr_t)c->value->data + data_size(c->value)) & ~(hps - 1);
+
+		if (end <= start)
+			continue;
+
+		if (madvise((void *)start, end - start, MADV_HUGEPAGE) != 0) {
+			ubx_notice(b, "config %s: madvise MADV_HUGEPAGE failed: %s",
+				   c->name, strerror(errno));
+			continue;
+		}
+
+		ubx_info(b, "config %s: advised %zu KiB transparent huge pages",
+			 c->name, (end - start) / 1024);
+		advised += end - start;
+	}
+
+	return advised;
+}
+
+/**
+ * ubx_node_prepare_rt - prepare a node for realtime operation
+ *
+ * Regions of active blocks are skipped, as these may be accessed
+ * concurrently. If the node was created with ND_HUGEPAGES, large
+ * config arrays are advised to use transparent huge pages. The data
+ * pool of the node (if any) is prefaulted (unless a block is active)
+ * and sealed, so that allocating ubx_data fails instead of calling
+ * calloc. Note that this affects all later ubx_data allocations of
+ * the node, including those made from Lua, which fail once the pool
+ * is exhausted.
+ *
+ * @nd: node
+ * @heap_reserve: number of bytes of heap to reserve for allocations
+ *		  after starting (0 for none)
+ * @return number of bytes prefaulted or < 0 in case of error
+ */
+long ubx_node_prepare_rt(ubx_node_t *nd, size_t heap_reserve)
+{
+	void *heap;
+	ubx_block_t *b, *btmp;
+	struct ubx_mem_region *r;
+	struct ubx_mem_arena *a;
+	size_t pagesize = sysconf(_SC_PAGESIZE);
+	size_t bufs = 0, reserved = 0, huge = 0, pool;
+	long num_regions = 0;
+
+	/* keep freed memory and serve all allocations from the
+	 * (prefaulted) main heap */
+	if (mallopt(M_MMAP_MAX, 0) != 1 ||
+	    mallopt(M_TRIM_THRESHOLD, -1) != 1 ||
+	    mallopt(M_ARENA_MAX, 1) != 1) {
+		logf_err(nd, "mallopt failed");
+		return -1;
+	}
+
+	if (heap_reserve > 0) {
+		heap = malloc(heap_reserve);
+
+		if (heap == NULL) {
+			logf_err(nd, "EOUTOFMEM: failed to reserve %zu bytes of heap",
+				 heap_reserve);
+			return EOUTOFMEM;
+		}
+
+		reserved = prefault(heap, heap_reserve, pagesize);
+		free(heap);
+	}
+
+	HASH_ITER(hh, nd->blocks, b, btmp) {
+		if (nd->attrs & ND_HUGEPAGES)
+			huge += advise_huge_configs(b, ubx_hugepage_size());
+
+		if (b->mem_regions == NULL)
+			continue;
+
+		if (b->block_state == BLOCK_STATE_ACTIVE) {
+			logf_notice(nd, "block %s active, not prefaulting its buffers", b->name);
+			continue;
+		}
+
+		LL_FOREACH(b->mem_regions, r) {
+			bufs += prefault(r->addr, r->len, pagesize);
+			num_regions++;
+
+			if (r->attrs & (MEM_ATTR_HUGETLB | MEM_ATTR_THP))
+				huge += r->len;
+		}
+	}
+
+	LL_FOREACH(nd->mem_arenas, a) {
+		logf_info(nd, "arena %s: %zu of %zu KiB used", a->name,
+			  a->used / 1024, a->len / 1024);
+	}
+
+	/* active blocks may carve from the pool concurrently */
+	pool = 0;
+	HASH_ITER(hh, nd->blocks, b, btmp) {
+		if (b->block_state == BLOCK_STATE_ACTIVE)
+			break;
+	}
+
+	if (b == NULL)
+		pool = ubx_data_pool_prefault(nd);
+	else
+		logf_notice(nd, "block %s active, not prefaulting the data pool", b->name);
+
+	ubx_data_pool_seal(nd);
+
+	logf_info(nd, "prefaulted %zu KiB: %zu KiB heap, %zu KiB in %ld block buffers (%zu KiB huge pages), %zu KiB data pool",
+		  (reserved + bufs + pool) / 1024, reserved / 1024, bufs / 1024,
+		  num_regions, huge / 1024, pool / 1024);
+
+	return reserved + bufs + pool;
+}
@@ -0,0 +1,443 @@
+/*
+ * microblx: lock-free runtime config updates
+ *
+ * Configs of running blocks are updated by publishing a new ubx_data
+ * instead of modifying the current one in place. Publishing swaps
+ * the config value pointer with release semantics, so that a reader
+ * loading it (with ubx_config_acquire) always sees a completely
+ * initialized value.
+ *
+ * The replaced values are reclaimed using epoch based reclamation:
+ * readers (typically one per trigger chain, see ubx_chain_trigger)
+ * announce the current node epoch when entering a read section and
+ * clear it when leaving. Publishing increments the epoch and retires
+ * the old value with the new epoch. A retired value is freed as soon
+ * as no reader is in a read section that was entered before it was
+ * retired, i.e. after all registered readers have completed a
+ * trigger cycle.
+ *
+ * The same mechanism is used for the interaction arrays of ports
+ * (see array_block_add in ubx.c), so that connections can be added
+ * and removed while the chains writing to them are running.
+ *
+ * Writers serialize on per node mutexes (see ubx_rcu_write_lock),
+ * readers never block.
+ *
+ * Copyright (C) 2020 Markus Klotzbuecher <mk@mkio.de>
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ */
+
+#undef UBX_DEBUG
+
+#include <stdlib.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "ubx.h"
+
+#define logf_err(nd, fmt, ...)		ubx_log(UBX_LOGLEVEL_ERR,    nd, __func__, fmt, ##__VA_ARGS__)
+#define logf_debug(nd, fmt, ...)	ubx_log(UBX_LOGLEVEL_DEBUG,  nd, __func__, fmt, ##__VA_ARGS__)
+
+/* a replaced config value or array waiting to be freed */
+struct cfg_retired {
+	void *ptr;
+	void (*free)(void *ptr);
+	unsigned long epoch;
+	struct cfg_retired *next;
+};
+
+struct ubx_cfg_rcu {
+	pthread_mutex_t lock;
+	pthread_mutex_t write_lock;	/* serializes array updates */
+	unsigned long epoch;
+	struct ubx_cfg_reader *readers;
+	struct cfg_retired *retired;
+};
+
+int ubx_cfg_rcu_init(ubx_node_t *nd)
+{
+	struct ubx_cfg_rcu *rcu;
+
+	rcu = calloc(1, sizeof(struct ubx_cfg_rcu));
+
+	if (rcu == NULL) {
+		logf_err(nd, "EOUTOFMEM");
+		return EOUTOFMEM;
+	}
+
+	pthread_mutex_init(&rcu->lock, NULL);
+	pthread_mutex_init(&rcu->write_lock, NULL);
+	rcu->epoch = 1;
+	nd->cfg_rcu = rcu;
+	return 0;
+}
+
+void ubx_cfg_rcu_cleanup(ubx_node_t *nd)
+{
+	struct ubx_cfg_rcu *rcu = nd->cfg_rcu;
+
+	if (rcu == NULL)
+		return;
+
+	if (rcu->readers)
+		logf_err(nd, "readers still registered");
+
+	/* without readers, all retired values are freed */
+	rcu->readers = NULL;
+	ubx_config_reclaim(nd);
+
+	pthread_mutex_destroy(&rcu->lock);
+	pthread_mutex_destroy(&rcu->write_lock);
+	free(rcu);
+	nd->cfg_rcu = NULL;
+}
+
+/* return the lowest epoch of all readers in a read section */
+static unsigned long readers_min_epoch(struct ubx_cfg_rcu *rcu)
+{
+	unsigned long e, min = ULONG_MAX;
+	struct ubx_cfg_reader *r;
+
+	for (r = rcu->readers; r != NULL; r = r->next) {
+		e = __atomic_load_n(&r->epoch, __ATOMIC_SEQ_CST);
+		if (e != 0 && e < min)
+			min = e;
+	}
+
+	return min;
+}
+
+/* free all retired values that are no longer reachable by readers
+ * (must be called with the lock held) */
+static int __reclaim(struct ubx_cfg_rcu *rcu)
+{
+	int cnt = 0;
+	unsigned long min;
+	struct cfg_retired **pp = &rcu->retired, *ret;
+
+	/* pairs with the fence in ubx_cfg_read_enter */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	min = readers_min_epoch(rcu);
+
+	while (*pp != NULL) {
+		ret = *pp;
+
+		if (ret->epoch <= min) {
+			*pp = ret->next;
+			ret->free(ret->ptr);
+			free(ret);
+			cnt++;
+		} else {
+			pp = &ret->next;
+		}
+	}
+
+	return cnt;
+}
+
+/* retire ptr with the next epoch (must be called with the lock held) */
+static void __retire(struct ubx_cfg_rcu *rcu, struct cfg_retired *ret,
+		     void *ptr, void (*free_fn)(void *ptr))
+{
+	ret->ptr = ptr;
+	ret->free = free_fn;
+	ret->epoch = __atomic_add_fetch(&rcu->epoch, 1, __ATOMIC_SEQ_CST);
+	ret->next = rcu->retired;
+	rcu->retired = ret;
+}
+
+/**
+ * ubx_rcu_retire - free memory after a grace period
+ *
+ * Free @ptr using @free_fn once no reader can access it anymore. The
+ * pointer must have been unpublished (i.e. replaced with a release
+ * store) before calling this function.
+ *
+ * @param nd node
+ * @param ptr memory to free
+ * @param free_fn function to free ptr
+ * @return 0 if OK, EOUTOFMEM otherwise (in this case ptr is leaked)
+ */
+int ubx_rcu_retire(ubx_node_t *nd, void *ptr, void (*free_fn)(void *ptr))
+{
+	struct cfg_retired *ret;
+	struct ubx_cfg_rcu *rcu = nd->cfg_rcu;
+
+	ret = malloc(sizeof(struct cfg_retired));
+
+	if (ret == NULL) {
+		logf_err(nd, "EOUTOFMEM: leaking %p", ptr);
+		return EOUTOFMEM;
+	}
+
+	pthread_mutex_lock(&rcu->lock);
+	__retire(rcu, ret, ptr, free_fn);
+	__reclaim(rcu);
+	pthread_mutex_unlock(&rcu->lock);
+
+	return 0;
+}
+
+/**
+ * ubx_rcu_write_lock - serialize read-copy-update writers
+ *
+ * Writers that copy a published value, modify and republish it (such
+ * as array_block_add in ubx.c) must hold this lock from reading the
+ * old value until the new one is published, otherwise concurrent
+ * updates are lost. Readers are not affected.
+ *
+ * @param nd node
+ */
+void ubx_rcu_write_lock(ubx_node_t *nd)
+{
+	pthread_mutex_lock(&nd->cfg_rcu->write_lock);
+}
+
+/**
+ * ubx_rcu_write_unlock - release the lock taken by ubx_rcu_write_lock
+ *
+ * @param nd node
+ */
+void ubx_rcu_write_unlock(ubx_node_t *nd)
+{
+	pthread_mutex_unlock(&nd->cfg_rcu->write_lock);
+}
+
+/**
+ * ubx_config_reclaim - free retired config values and arrays
+ *
+ * This is called by ubx_config_publish, but can be called
+ * additionally to release memory sooner.
+ *
+ * @param nd node
+ * @return number of freed values
+ */
+int ubx_config_reclaim(ubx_node_t *nd)
+{
+	int cnt;
+	struct ubx_cfg_rcu *rcu = nd->cfg_rcu;
+
+	pthread_mutex_lock(&rcu->lock);
+	cnt = __reclaim(rcu);
+	pthread_mutex_unlock(&rcu->lock);
+
+	if (cnt > 0)
+		logf_debug(nd, "reclaimed %i config values", cnt);
+
+	return cnt;
+}
+
+/**
+ * ubx_rcu_synchronize - wait for a grace period
+ *
+ * Wait until all readers that are currently in a read section have
+ * left it. This must not be called from within a read section (e.g.
+ * from a block triggered by a chain), as it would never return.
+ *
+ * @param nd node
+ */
+void ubx_rcu_synchronize(ubx_node_t *nd)
+{
+	unsigned long target;
+	struct ubx_cfg_rcu *rcu = nd->cfg_rcu;
+	struct timespec ts = { .tv_sec = 0, .tv_nsec = 100000 };
+
+	pthread_mutex_lock(&rcu->lock);
+	target = __atomic_add_fetch(&rcu->epoch, 1, __ATOMIC_SEQ_CST);
+
+	while (readers_min_epoch(rcu) < target) {
+		pthread_mutex_unlock(&rcu->lock);
+		nanosleep(&ts, NULL);
+		pthread_mutex_lock(&rcu->lock);
+	}
+
+	__reclaim(rcu);
+	pthread_mutex_unlock(&rcu->lock);
+}
+
+/**
+ * ubx_cfg_reader_register - register a config reader
+ *
+ * Registered readers must bracket all accesses to config values of
+ * running blocks with ubx_cfg_read_enter and ubx_cfg_read_exit.
+ *
+ * @param nd node
+ * @param r reader to register
+ */
+void ubx_cfg_reader_register(ubx_node_t *nd, struct ubx_cfg_reader *r)
+{
+	struct ubx_cfg_rcu *rcu = nd->cfg_rcu;
+
+	r->epoch = 0;
+
+	pthread_mutex_lock(&rcu->lock);
+	r->next = rcu->readers;
+	rcu->readers = r;
+	pthread_mutex_unlock(&rcu->lock);
+}
+
+/**
+ * ubx_cfg_reader_unregister - unregister a config reader
+ *
+ * @param nd node
+ * @param r reader to unregister
+ */
+void ubx_cfg_reader_unregister(ubx_node_t *nd, struct ubx_cfg_reader *r)
+{
+	struct ubx_cfg_reader **pp;
+	struct ubx_cfg_rcu *rcu = nd->cfg_rcu;
+
+	pthread_mutex_lock(&rcu->lock);
+
+	for (pp = &rcu->readers; *pp != NULL; pp = &(*pp)->next) {
+		if (*pp == r) {
+			*pp = r->next;
+			break;
+		}
+	}
+
+	__reclaim(rcu);
+	pthread_mutex_unlock(&rcu->lock);
+}
+
+/**
+ * ubx_cfg_read_enter - enter a read section
+ *
+ * After this, config values loaded with ubx_config_acquire remain
+ * valid until ubx_cfg_read_exit is called. This function is wait
+ * free and may be called from real-time context.
+ *
+ * @param nd node
+ * @param r registered reader
+ */
+void ubx_cfg_read_enter(const ubx_node_t *nd, struct ubx_cfg_reader *r)
+{
+	unsigned long e = __atomic_load_n(&nd->cfg_rcu->epoch, __ATOMIC_SEQ_CST);
+
+	__atomic_store_n(&r->epoch, e, __ATOMIC_SEQ_CST);
+
+	/* announce the epoch before loading any config value */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/**
+ * ubx_cfg_read_exit - leave a read section
+ *
+ * @param r registered reader
+ */
+void ubx_cfg_read_exit(struct ubx_cfg_reader *r)
+{
+	__atomic_store_n(&r->epoch, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * ubx_config_acquire - load the current value of a config
+ *
+ * In contrast to ubx_config_get_data, this is safe against
+ * concurrent ubx_config_publish. The returned pointer remains valid
+ * until the end of the current read section.
+ *
+ * @param c config
+ * @param ptr pointer to store the data pointer into
+ * @return array length of the config value
+ */
+long ubx_config_acquire(const ubx_config_t *c, const void **ptr)
+{
+	const ubx_data_t *d = __atomic_load_n(&c->value, __ATOMIC_ACQUIRE);
+
+	*ptr = (d->len > 0) ? d->data : NULL;
+	return d->len;
+}
+
+static void data_free(void *d)
+{
+	ubx_data_free((ubx_data_t *)d);
+}
+
+/**
+ * ubx_config_publish - atomically replace the value of a config
+ *
+ * The new value must be fully initialized and must not be modified
+ * after publishing. Like ubx_config_assign, this takes a reference
+ * to @d. The previous value is released when no reader can access it
+ * anymore.
+ *
+ * @param c config
+ * @param d new value
+ * @return 0 if OK, ETYPE_MISMATCH or EINVALID_CONFIG_LEN if the new
+ *	   value is not valid for this config
+ */
+int ubx_config_publish(ubx_config_t *c, ubx_data_t *d)
+{
+	struct cfg_retired *ret;
+	struct ubx_cfg_rcu *rcu = c->block->nd->cfg_rcu;
+	ubx_data_t *old;
+
+	if (c->type != d->type) {
+		ubx_err(c->block, "ETYPE_MISMATCH: config %s: %s vs %s",
+			c->name, c->type->name, d->type->name);
+		return ETYPE_MISMATCH;
+	}
+
+	if ((c->min != 0 || c->max != 0) &&
+	    (d->len < c->min || d->len > c->max)) {
+		ubx_err(c->block, "EINVALID_CONFIG_LEN: config %s len %lu not in min/max [%u/%u]",
+			c->name, d->len, c->min, c->max);
+		return EINVALID_CONFIG_LEN;
+	}
+
+	ret = malloc(sizeof(struct cfg_retired));
+
+	if (ret == NULL) {
+		ubx_err(c->block, "EOUTOFMEM");
+		return EOUTOFMEM;
+	}
+
+	d->refcnt++;
+
+	pthread_mutex_lock(&rcu->lock);
+
+	old = c->value;
+	__atomic_store_n(&c->value, d, __ATOMIC_RELEASE);
+
+	/* readers entering from now on load the new value */
+	__retire(rcu, ret, old, data_free);
+
+	__reclaim(rcu);
+	pthread_mutex_unlock(&rcu->lock);
+
+	ubx_debug(c->block, "published %s", c->name);
+	return 0;
+}
+
+/**
+ * ubx_config_publish_copy - publish a copy of the given value
+ *
+ * @param c config
+ * @param val pointer to the new value
+ * @param len array length of the new value
+ * @return 0 if OK, <0 otherwise
+ */
+int ubx_config_publish_copy(ubx_config_t *c, const void *val, long len)
+{
+	int ret;
+	ubx_data_t *d;
+
+	d = __ubx_data_alloc(c->type, len);
+
+	if (d == NULL) {
+		ubx_err(c->block, "EOUTOFMEM");
+		return EOUTOFMEM;
+	}
+
+	if (len > 0)
+		memcpy(d->data, val, len * c->type->size);
+
+	ret = ubx_config_publish(c, d);
+
+	/* drop our reference */
+	ubx_data_free(d);
+	return ret;
+}
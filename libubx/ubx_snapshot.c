@@ -0,0 +1,961 @@
+/*
+ * microblx: snapshot and restore of configured nodes
+ *
+ * A snapshot is a binary image of a configured (but not started)
+ * node. It contains the list of loaded modules, the block instances,
+ * the contents of all configs (keyed by the type hash) and the
+ * connections. Restoring maps the image and replays module loading,
+ * block creation, configuration, initialization and connecting
+ * without involving the scripting layer.
+ *
+ * Block pointer members of known config types (see snap_ptr_members,
+ * e.g. the struct ubx_triggee of trigger chains) are stored as
+ * relocations and resolved to the restored blocks. Other pointers can
+ * not be restored.
+ *
+ * The image uses the native byte order and is only valid for the
+ * same architecture.
+ *
+ * Copyright (C) 2020 Markus Klotzbuecher <mk@mkio.de>
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ */
+
+#undef UBX_DEBUG
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "ubx.h"
+#include "triggee.h"
+
+#define logf_err(nd, fmt, ...)		ubx_log(UBX_LOGLEVEL_ERR,    nd, __func__, fmt, ##__VA_ARGS__)
+#define logf_info(nd, fmt, ...)		ubx_log(UBX_LOGLEVEL_INFO,   nd, __func__, fmt, ##__VA_ARGS__)
+
+#define SNAP_MAGIC		"UBXSNAP"
+#define SNAP_VERSION		1
+#define SNAP_NONE		UINT32_MAX
+#define SNAP_ALIGN		8
+
+enum {
+	SNAP_CONN_IN,
+	SNAP_CONN_OUT,
+};
+
+/*
+ * on-disk format. All offsets are relative to the start of the
+ * image. Strings are offsets into the string table.
+ */
+struct snap_hdr {
+	char magic[8];
+	uint32_t version;
+	uint32_t ptr_size;
+	uint32_t num_modules;
+	uint32_t num_blocks;
+	uint32_t num_configs;
+	uint32_t num_conns;
+	uint32_t num_relocs;
+	uint32_t pad;
+	uint64_t modules_off;
+	uint64_t blocks_off;
+	uint64_t configs_off;
+	uint64_t conns_off;
+	uint64_t relocs_off;
+	uint64_t strtab_off;
+	uint64_t strtab_len;
+	uint64_t data_off;
+	uint64_t data_len;
+};
+
+struct snap_module {
+	uint32_t id;
+};
+
+struct snap_block {
+	uint32_t type;
+	uint32_t name;
+	uint32_t state;
+};
+
+/**
+ * struct snap_config
+ * @block: index of block
+ * @name: config name
+ * @hash: type hash
+ * @shared: index of config whose data this config shares or SNAP_NONE
+ * @type_size: size of type
+ * @len: array length
+ * @data: offset of the data in the data section
+ */
+struct snap_config {
+	uint32_t block;
+	uint32_t name;
+	uint8_t hash[UBX_TYPE_HASH_LEN];
+	uint32_t shared;
+	int64_t type_size;
+	int64_t len;
+	uint64_t data;
+};
+
+struct snap_conn {
+	uint32_t block;
+	uint32_t port;
+	uint32_t iblock;
+	uint32_t dir;
+};
+
+/**
+ * struct snap_reloc - block pointer within config data
+ * @config: index of config
+ * @block: index of block pointed to
+ * @offset: offset of the pointer within the config data
+ */
+struct snap_reloc {
+	uint32_t config;
+	uint32_t block;
+	uint64_t offset;
+};
+
+/* block pointer members of config types */
+static const struct snap_ptr_member {
+	const char *type_name;
+	size_t type_size;
+	size_t offset;
+} snap_ptr_members[] = {
+	{ "struct ubx_triggee", sizeof(struct ubx_triggee), offsetof(struct ubx_triggee, b) },
+};
+
+/* growable buffer for assembling the image sections */
+struct snap_buf {
+	uint8_t *data;
+	size_t len;
+	size_t size;
+};
+
+/* block pointer to index mapping, sorted by ptr */
+struct snap_blkref {
+	const ubx_block_t *b;
+	uint32_t idx;
+};
+
+struct snap_writer {
+	struct snap_buf modules;
+	struct snap_buf blocks;
+	struct snap_buf configs;
+	struct snap_buf conns;
+	struct snap_buf relocs;
+	struct snap_buf strtab;
+	struct snap_buf data;
+
+	const ubx_block_t **blks;
+	struct snap_blkref *blkrefs;
+	uint32_t num_blocks;
+
+	const ubx_data_t **cfgdata;
+	uint32_t num_configs;
+};
+
+/**
+ * sbuf_add - append to buffer
+ * @sb: buffer
+ * @p: data to append. If NULL, the new space is zeroed.
+ * @len: length of data
+ * @return offset at which the data was added or -1 if out of memory
+ */
+static long sbuf_add(struct snap_buf *sb, const void *p, size_t len)
+{
+	long off = sb->len;
+	size_t newsize;
+	uint8_t *tmp;
+
+	if (sb->len + len > sb->size) {
+		newsize = (sb->size == 0) ? 256 : sb->size;
+
+		while (newsize < sb->len + len)
+			newsize *= 2;
+
+		tmp = realloc(sb->data, newsize);
+
+		if (tmp == NULL)
+			return -1;
+
+		sb->data = tmp;
+		sb->size = newsize;
+	}
+
+	if (p)
+		memcpy(sb->data + sb->len, p, len);
+	else
+		memset(sb->data + sb->len, 0, len);
+
+	sb->len += len;
+	return off;
+}
+
+/* pad buffer to SNAP_ALIGN */
+static int sbuf_align(struct snap_buf *sb)
+{
+	size_t pad = (SNAP_ALIGN - (sb->len % SNAP_ALIGN)) % SNAP_ALIGN;
+
+	return (sbuf_add(sb, NULL, pad) < 0) ? -1 : 0;
+}
+
+static long sbuf_addstr(struct snap_buf *sb, const char *s)
+{
+	return sbuf_add(sb, s, strlen(s) + 1);
+}
+
+static int blkref_cmp(const void *a, const void *b)
+{
+	const ubx_block_t *pa = ((const struct snap_blkref *)a)->b;
+	const ubx_block_t *pb = ((const struct snap_blkref *)b)->b;
+
+	return (pa > pb) - (pa < pb);
+}
+
+static long snap_block_idx(const struct snap_writer *sw, const void *ptr)
+{
+	struct snap_blkref key, *ref;
+
+	key.b = ptr;
+	ref = bsearch(&key, sw->blkrefs, sw->num_blocks, sizeof(key), blkref_cmp);
+
+	return (ref == NULL) ? -1 : (long)ref->idx;
+}
+
+static int snap_add_blocks(ubx_node_t *nd, struct snap_writer *sw)
+{
+	ubx_block_t *b, *btmp;
+	struct snap_block sb;
+	long type, name;
+	uint32_t i = 0;
+
+	HASH_ITER(hh, nd->blocks, b, btmp) {
+		if (blk_is_instance(b))
+			sw->num_blocks++;
+	}
+
+	sw->blks = calloc(sw->num_blocks, sizeof(ubx_block_t *));
+	sw->blkrefs = calloc(sw->num_blocks, sizeof(struct snap_blkref));
+
+	if (sw->blks == NULL || sw->blkrefs == NULL)
+		return EOUTOFMEM;
+
+	HASH_ITER(hh, nd->blocks, b, btmp) {
+		if (!blk_is_instance(b))
+			continue;
+
+		if (b->block_state == BLOCK_STATE_ACTIVE) {
+			logf_err(nd, "block %s is active", b->name);
+			return EWRONG_STATE;
+		}
+
+		type = sbuf_addstr(&sw->strtab, b->prototype->name);
+		name = sbuf_addstr(&sw->strtab, b->name);
+
+		if (type < 0 || name < 0)
+			return EOUTOFMEM;
+
+		sb.type = type;
+		sb.name = name;
+		sb.state = b->block_state;
+
+		if (sbuf_add(&sw->blocks, &sb, sizeof(sb)) < 0)
+			return EOUTOFMEM;
+
+		sw->blks[i] = b;
+		sw->blkrefs[i].b = b;
+		sw->blkrefs[i].idx = i;
+		i++;
+	}
+
+	qsort(sw->blkrefs, sw->num_blocks, sizeof(struct snap_blkref), blkref_cmp);
+	return 0;
+}
+
+/* add a relocation for the block pointer at offset i of the config
+ * data at off, if it points to a block of the node */
+static int snap_add_reloc(struct snap_writer *sw, long off, size_t i)
+{
+	long bidx;
+	struct snap_reloc rel;
+	void *ptr;
+
+	memcpy(&ptr, sw->data.data + off + i, sizeof(void *));
+
+	if (ptr == NULL)
+		return 0;
+
+	bidx = snap_block_idx(sw, ptr);
+
+	if (bidx < 0)
+		return 0;
+
+	rel.config = sw->num_configs;
+	rel.block = bidx;
+	rel.offset = i;
+
+	if (sbuf_add(&sw->relocs, &rel, sizeof(rel)) < 0)
+		return EOUTOFMEM;
+
+	/* keep the image independent of addresses */
+	memset(sw->data.data + off + i, 0, sizeof(void *));
+	return 0;
+}
+
+/* add the config data and relocations for block pointers in it */
+static int snap_add_config_data(struct snap_writer *sw, const ubx_config_t *c,
+				struct snap_config *sc)
+{
+	int ret;
+	long off;
+	size_t i, j, size = data_size(c->value);
+	const struct snap_ptr_member *pm;
+
+	if (sbuf_align(&sw->data))
+		return EOUTOFMEM;
+
+	off = sbuf_add(&sw->data, c->value->data, size);
+
+	if (off < 0)
+		return EOUTOFMEM;
+
+	sc->data = off;
+
+	for (j = 0; j < ARRAY_SIZE(snap_ptr_members); j++) {
+		pm = &snap_ptr_members[j];
+
+		if (strcmp(c->type->name, pm->type_name) != 0 ||
+		    (size_t)c->type->size != pm->type_size)
+			continue;
+
+		for (i = 0; i + pm->type_size <= size; i += pm->type_size) {
+			ret = snap_add_reloc(sw, off, i + pm->offset);
+			if (ret)
+				return ret;
+		}
+	}
+
+	return 0;
+}
+
+static int snap_add_configs(struct snap_writer *sw)
+{
+	int ret;
+	long name;
+	uint32_t i, j, num = 0;
+	const ubx_config_t *c;
+	struct snap_config sc;
+
+	for (i = 0; i < sw->num_blocks; i++)
+		DL_FOREACH(sw->blks[i]->configs, c)
+			num++;
+
+	sw->cfgdata = calloc(num, sizeof(ubx_data_t *));
+
+	if (sw->cfgdata == NULL && num > 0)
+		return EOUTOFMEM;
+
+	for (i = 0; i < sw->num_blocks; i++) {
+		DL_FOREACH(sw->blks[i]->configs, c) {
+			if (c->value == NULL || c->value->len == 0)
+				continue;
+
+			memset(&sc, 0x0, sizeof(sc));
+
+			name = sbuf_addstr(&sw->strtab, c->name);
+
+			if (name < 0)
+				return EOUTOFMEM;
+
+			sc.block = i;
+			sc.name = name;
+			sc.shared = SNAP_NONE;
+			sc.type_size = c->type->size;
+			sc.len = c->value->len;
+			memcpy(sc.hash, c->type->hash, UBX_TYPE_HASH_LEN);
+
+			/* node configs: data shared with a previous config */
+			for (j = 0; j < sw->num_configs; j++) {
+				if (sw->cfgdata[j] == c->value) {
+					sc.shared = j;
+					break;
+				}
+			}
+
+			if (sc.shared == SNAP_NONE) {
+				ret = snap_add_config_data(sw, c, &sc);
+				if (ret)
+					return ret;
+			}
+
+			if (sbuf_add(&sw->configs, &sc, sizeof(sc)) < 0)
+				return EOUTOFMEM;
+
+			sw->cfgdata[sw->num_configs++] = c->value;
+		}
+	}
+
+	return 0;
+}
+
+static int snap_add_conn(struct snap_writer *sw, uint32_t bidx, long port,
+			 const ubx_block_t **ibs, uint32_t dir)
+{
+	struct snap_conn conn;
+	long ibidx;
+
+	if (ibs == NULL)
+		return 0;
+
+	for (; *ibs != NULL; ibs++) {
+		ibidx = snap_block_idx(sw, *ibs);
+
+		if (ibidx < 0)
+			return ENOSUCHENT;
+
+		conn.block = bidx;
+		conn.port = port;
+		conn.iblock = ibidx;
+		conn.dir = dir;
+
+		if (sbuf_add(&sw->conns, &conn, sizeof(conn)) < 0)
+			return EOUTOFMEM;
+	}
+
+	return 0;
+}
+
+static int snap_add_conns(struct snap_writer *sw)
+{
+	int ret;
+	long port;
+	uint32_t i;
+	const ubx_port_t *p;
+
+	for (i = 0; i < sw->num_blocks; i++) {
+		DL_FOREACH(sw->blks[i]->ports, p) {
+			if (p->in_interaction == NULL && p->out_interaction == NULL)
+				continue;
+
+			port = sbuf_addstr(&sw->strtab, p->name);
+
+			if (port < 0)
+				return EOUTOFMEM;
+
+			ret = snap_add_conn(sw, i, port, p->in_interaction, SNAP_CONN_IN);
+			if (ret)
+				return ret;
+
+			ret = snap_add_conn(sw, i, port, p->out_interaction, SNAP_CONN_OUT);
+			if (ret)
+				return ret;
+		}
+	}
+
+	return 0;
+}
+
+static int snap_write(const char *file, struct snap_writer *sw)
+{
+	int ret = EOUTOFMEM;
+	unsigned int i;
+	uint64_t off;
+	FILE *fp;
+	struct snap_hdr hdr;
+	struct snap_buf *secs[] = {
+		&sw->modules, &sw->blocks, &sw->configs, &sw->conns,
+		&sw->relocs, &sw->strtab, &sw->data,
+	};
+	uint64_t *offs[] = {
+		&hdr.modules_off, &hdr.blocks_off, &hdr.configs_off, &hdr.conns_off,
+		&hdr.relocs_off, &hdr.strtab_off, &hdr.data_off,
+	};
+
+	memset(&hdr, 0x0, sizeof(hdr));
+	memcpy(hdr.magic, SNAP_MAGIC, sizeof(hdr.magic));
+	hdr.version = SNAP_VERSION;
+	hdr.ptr_size = sizeof(void *);
+	hdr.num_modules = sw->modules.len / sizeof(struct snap_module);
+	hdr.num_blocks = sw->num_blocks;
+	hdr.num_configs = sw->num_configs;
+	hdr.num_conns = sw->conns.len / sizeof(struct snap_conn);
+	hdr.num_relocs = sw->relocs.len / sizeof(struct snap_reloc);
+	hdr.strtab_len = sw->strtab.len;
+	hdr.data_len = sw->data.len;
+
+	off = sizeof(hdr);
+
+	for (i = 0; i < ARRAY_SIZE(secs); i++) {
+		if (sbuf_align(secs[i]))
+			goto out;
+		*offs[i] = off;
+		off += secs[i]->len;
+	}
+
+	ret = EINVALID_ARG;
+	fp = fopen(file, "w");
+
+	if (fp == NULL)
+		goto out;
+
+	if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1)
+		goto out_close;
+
+	for (i = 0; i < ARRAY_SIZE(secs); i++) {
+		if (secs[i]->len == 0)
+			continue;
+		if (fwrite(secs[i]->data, secs[i]->len, 1, fp) != 1)
+			goto out_close;
+	}
+
+	ret = 0;
+
+out_close:
+	if (fclose(fp) != 0)
+		ret = EINVALID_ARG;
+out:
+	return ret;
+}
+
+/**
+ * ubx_node_snapshot - write a snapshot image of a node
+ *
+ * All block instances must be in state preinit or inactive.
+ *
+ * @nd: node to snapshot
+ * @file: file to write the image to
+ * @return 0 or <0 in case of error
+ */
+int ubx_node_snapshot(ubx_node_t *nd, const char *file)
+{
+	int ret = EOUTOFMEM;
+	ubx_module_t *m, *mtmp;
+	struct snap_writer sw;
+	struct snap_module sm;
+	long id;
+
+	memset(&sw, 0x0, sizeof(sw));
+
+	HASH_ITER(hh, nd->modules, m, mtmp) {
+		id = sbuf_addstr(&sw.strtab, m->id);
+		if (id < 0)
+			goto out;
+		sm.id = id;
+		if (sbuf_add(&sw.modules, &sm, sizeof(sm)) < 0)
+			goto out;
+	}
+
+	ret = snap_add_blocks(nd, &sw);
+	if (ret)
+		goto out;
+
+	ret = snap_add_configs(&sw);
+	if (ret)
+		goto out;
+
+	ret = snap_add_conns(&sw);
+	if (ret) {
+		logf_err(nd, "failed to add connections: %d", ret);
+		goto out;
+	}
+
+	ret = snap_write(file, &sw);
+	if (ret) {
+		logf_err(nd, "failed to write %s: %m", file);
+		goto out;
+	}
+
+	logf_info(nd, "wrote snapshot %s: %u blocks, %u configs",
+		  file, sw.num_blocks, sw.num_configs);
+out:
+	free(sw.modules.data);
+	free(sw.blocks.data);
+	free(sw.configs.data);
+	free(sw.conns.data);
+	free(sw.relocs.data);
+	free(sw.strtab.data);
+	free(sw.data.data);
+	free(sw.blks);
+	free(sw.blkrefs);
+	free(sw.cfgdata);
+	return ret;
+}
+
+
+/*
+ * restore
+ */
+
+struct snap_reader {
+	ubx_node_t *nd;
+	const uint8_t *img;
+	size_t size;
+	const struct snap_hdr *hdr;
+	const struct snap_module *modules;
+	const struct snap_block *blocks;
+	const struct snap_config *configs;
+	const struct snap_conn *conns;
+	const struct snap_reloc *relocs;
+
+	ubx_block_t **blks;
+	ubx_config_t **cfgs;
+};
+
+/* check that [off, off+num*size) is within the image */
+static int snap_range_ok(const struct snap_reader *sr, uint64_t off,
+			 uint64_t num, size_t size)
+{
+	return off <= sr->size && num <= (sr->size - off) / size;
+}
+
+/* return string at strtab offset off or NULL if invalid */
+static const char *snap_str(const struct snap_reader *sr, uint32_t off)
+{
+	if (off >= sr->hdr->strtab_len)
+		return NULL;
+
+	return (const char *)sr->img + sr->hdr->strtab_off + off;
+}
+
+static int snap_check(struct snap_reader *sr)
+{
+	const struct snap_hdr *hdr = sr->hdr;
+	uint32_t i;
+
+	if (sr->size < sizeof(*hdr) ||
+	    memcmp(hdr->magic, SNAP_MAGIC, sizeof(hdr->magic)) != 0) {
+		logf_err(sr->nd, "invalid snapshot image");
+		return EINVALID_ARG;
+	}
+
+	if (hdr->version != SNAP_VERSION || hdr->ptr_size != sizeof(void *)) {
+		logf_err(sr->nd, "incompatible snapshot version %u or pointer size %u",
+			 hdr->version, hdr->ptr_size);
+		return EINVALID_ARG;
+	}
+
+	if (!snap_range_ok(sr, hdr->modules_off, hdr->num_modules, sizeof(struct snap_module)) ||
+	    !snap_range_ok(sr, hdr->blocks_off, hdr->num_blocks, sizeof(struct snap_block)) ||
+	    !snap_range_ok(sr, hdr->configs_off, hdr->num_configs, sizeof(struct snap_config)) ||
+	    !snap_range_ok(sr, hdr->conns_off, hdr->num_conns, sizeof(struct snap_conn)) ||
+	    !snap_range_ok(sr, hdr->relocs_off, hdr->num_relocs, sizeof(struct snap_reloc)) ||
+	    !snap_range_ok(sr, hdr->strtab_off, hdr->strtab_len, 1) ||
+	    !snap_range_ok(sr, hdr->data_off, hdr->data_len, 1) ||
+	    hdr->strtab_len == 0 ||
+	    sr->img[hdr->strtab_off + hdr->strtab_len - 1] != '\0') {
+		logf_err(sr->nd, "corrupt snapshot image");
+		return EINVALID_ARG;
+	}
+
+	sr->modules = (const void *)(sr->img + hdr->modules_off);
+	sr->blocks = (const void *)(sr->img + hdr->blocks_off);
+	sr->configs = (const void *)(sr->img + hdr->configs_off);
+	sr->conns = (const void *)(sr->img + hdr->conns_off);
+	sr->relocs = (const void *)(sr->img + hdr->relocs_off);
+
+	for (i = 0; i < hdr->num_configs; i++) {
+		const struct snap_config *sc = &sr->configs[i];
+
+		if (sc->block >= hdr->num_blocks || snap_str(sr, sc->name) == NULL ||
+		    (sc->shared != SNAP_NONE && sc->shared >= i) ||
+		    sc->type_size < 0 || sc->len < 0 || sc->data > hdr->data_len)
+			goto out_corrupt;
+
+		/* type_size * len must not overflow */
+		if (sc->len > 0 && (uint64_t)sc->type_size > UINT64_MAX / (uint64_t)sc->len)
+			goto out_corrupt;
+
+		if ((uint64_t)sc->type_size * (uint64_t)sc->len > hdr->data_len - sc->data)
+			goto out_corrupt;
+	}
+
+	for (i = 0; i < hdr->num_relocs; i++) {
+		const struct snap_reloc *rel = &sr->relocs[i];
+
+		if (rel->config >= hdr->num_configs || rel->block >= hdr->num_blocks ||
+		    sr->configs[rel->config].shared != SNAP_NONE ||
+		    rel->offset + sizeof(void *) >
+		    (uint64_t)(sr->configs[rel->config].type_size * sr->configs[rel->config].len))
+			goto out_corrupt;
+	}
+
+	for (i = 0; i < hdr->num_conns; i++) {
+		const struct snap_conn *conn = &sr->conns[i];
+
+		if (conn->block >= hdr->num_blocks || conn->iblock >= hdr->num_blocks ||
+		    snap_str(sr, conn->port) == NULL)
+			goto out_corrupt;
+	}
+
+	for (i = 0; i < hdr->num_blocks; i++) {
+		if (snap_str(sr, sr->blocks[i].type) == NULL ||
+		    snap_str(sr, sr->blocks[i].name) == NULL)
+			goto out_corrupt;
+	}
+
+	for (i = 0; i < hdr->num_modules; i++) {
+		if (snap_str(sr, sr->modules[i].id) == NULL)
+			goto out_corrupt;
+	}
+
+	return 0;
+
+out_corrupt:
+	logf_err(sr->nd, "corrupt snapshot image");
+	return EINVALID_ARG;
+}
+
+/* check all config types against the types known to the node */
+static int snap_check_types(struct snap_reader *sr)
+{
+	char hashstr[UBX_TYPE_HASHSTR_LEN + 1];
+	const struct snap_config *sc;
+	const ubx_type_t *t;
+	uint32_t i;
+	int j;
+
+	for (i = 0; i < sr->hdr->num_configs; i++) {
+		sc = &sr->configs[i];
+
+		if (sc->shared != SNAP_NONE)
+			continue;
+
+		t = ubx_type_get_by_hash(sr->nd, sc->hash);
+
+		if (t == NULL || t->size != sc->type_size) {
+			for (j = 0; j < UBX_TYPE_HASH_LEN; j++)
+				sprintf(&hashstr[j * 2], "%02x", sc->hash[j]);
+
+			logf_err(sr->nd, "config %s.%s: %s type %s (size %ld)",
+				 snap_str(sr, sr->blocks[sc->block].name),
+				 snap_str(sr, sc->name),
+				 t ? "size mismatch of" : "unknown",
+				 t ? t->name : hashstr, (long)sc->type_size);
+			return ETYPE_MISMATCH;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * snap_apply_configs - apply configs that exist and are not yet applied
+ * @sr: reader
+ * @late: if true, fail on non-existing configs
+ * @return 0 or <0 in case of error
+ */
+static int snap_apply_configs(struct snap_reader *sr, int late)
+{
+	int ret;
+	uint32_t i;
+	ubx_config_t *c;
+	ubx_block_t *b;
+	const struct snap_config *sc;
+	const struct snap_reloc *rel;
+
+	for (i = 0; i < sr->hdr->num_configs; i++) {
+		if (sr->cfgs[i] != NULL)
+			continue;
+
+		sc = &sr->configs[i];
+		b = sr->blks[sc->block];
+		c = ubx_config_get(b, snap_str(sr, sc->name));
+
+		if (c == NULL || (sc->shared != SNAP_NONE && sr->cfgs[sc->shared] == NULL)) {
+			if (!late)
+				continue;
+
+			ubx_err(b, "snapshot restore: no config %s", snap_str(sr, sc->name));
+			return EINVALID_CONFIG;
+		}
+
+		if (sc->shared != SNAP_NONE) {
+			ret = ubx_config_assign(c, sr->cfgs[sc->shared]->value);
+			if (ret)
+				return ret;
+
+			sr->cfgs[i] = c;
+			continue;
+		}
+
+		if (memcmp(c->type->hash, sc->hash, UBX_TYPE_HASH_LEN) != 0) {
+			ubx_err(b, "snapshot restore: config %s type mismatch (%s)",
+				c->name, c->type->name);
+			return ETYPE_MISMATCH;
+		}
+
+		if (c->value->len != sc->len) {
+			ret = ubx_data_resize(c->value, sc->len);
+			if (ret)
+				return ret;
+		}
+
+		memcpy(c->value->data, sr->img + sr->hdr->data_off + sc->data,
+		       sc->type_size * sc->len);
+
+		for (rel = sr->relocs; rel < sr->relocs + sr->hdr->num_relocs; rel++) {
+			if (rel->config != i)
+				continue;
+
+			memcpy((uint8_t *)c->value->data + rel->offset,
+			       &sr->blks[rel->block], sizeof(void *));
+		}
+
+		sr->cfgs[i] = c;
+	}
+
+	return 0;
+}
+
+static int snap_restore(struct snap_reader *sr)
+{
+	int ret;
+	uint32_t i;
+	ubx_port_t *p;
+	const char *id;
+	const struct snap_block *sb;
+	const struct snap_conn *conn;
+
+	ret = snap_check(sr);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < sr->hdr->num_modules; i++) {
+		id = snap_str(sr, sr->modules[i].id);
+
+		if (ubx_module_get(sr->nd, id) != NULL)
+			continue;
+
+		ret = ubx_module_load(sr->nd, id);
+		if (ret)
+			return ret;
+	}
+
+	/* fail before creating any blocks */
+	ret = snap_check_types(sr);
+	if (ret)
+		return ret;
+
+	sr->blks = calloc(sr->hdr->num_blocks, sizeof(ubx_block_t *));
+	sr->cfgs = calloc(sr->hdr->num_configs, sizeof(ubx_config_t *));
+
+	if ((sr->blks == NULL && sr->hdr->num_blocks > 0) ||
+	    (sr->cfgs == NULL && sr->hdr->num_configs > 0))
+		return EOUTOFMEM;
+
+	for (i = 0; i < sr->hdr->num_blocks; i++) {
+		sb = &sr->blocks[i];
+		sr->blks[i] = ubx_block_create(sr->nd, snap_str(sr, sb->type),
+					       snap_str(sr, sb->name));
+
+		if (sr->blks[i] == NULL) {
+			logf_err(sr->nd, "failed to create block %s [%s]",
+				 snap_str(sr, sb->name), snap_str(sr, sb->type));
+			return EINVALID_BLOCK_TYPE;
+		}
+	}
+
+	ret = snap_apply_configs(sr, 0);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < sr->hdr->num_blocks; i++) {
+		if (sr->blocks[i].state == BLOCK_STATE_PREINIT)
+			continue;
+
+		ret = ubx_block_init(sr->blks[i]);
+		if (ret) {
+			logf_err(sr->nd, "failed to init block %s", sr->blks[i]->name);
+			return ret;
+		}
+	}
+
+	/* configs added in init */
+	ret = snap_apply_configs(sr, 1);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < sr->hdr->num_conns; i++) {
+		conn = &sr->conns[i];
+		p = ubx_port_get(sr->blks[conn->block], snap_str(sr, conn->port));
+
+		if (p == NULL) {
+			ubx_err(sr->blks[conn->block], "snapshot restore: no port %s",
+				snap_str(sr, conn->port));
+			return EINVALID_PORT;
+		}
+
+		if (conn->dir == SNAP_CONN_OUT)
+			ret = ubx_port_connect_out(p, sr->blks[conn->iblock]);
+		else
+			ret = ubx_port_connect_in(p, sr->blks[conn->iblock]);
+
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+/**
+ * ubx_node_restore - restore a snapshot image into a node
+ *
+ * Load the modules that are not yet loaded, check the types of all
+ * configs, create, configure and initialize the blocks and connect
+ * them. On failure, the node may contain partially restored blocks
+ * and should be cleaned up.
+ *
+ * @nd: node to restore into
+ * @file: image created by ubx_node_snapshot
+ * @return 0 or <0 in case of error
+ */
+int ubx_node_restore(ubx_node_t *nd, const char *file)
+{
+	int fd, ret = EINVALID_ARG;
+	struct snap_reader sr;
+	struct stat st;
+	void *img;
+
+	memset(&sr, 0x0, sizeof(sr));
+	sr.nd = nd;
+
+	fd = open(file, O_RDONLY);
+
+	if (fd < 0) {
+		logf_err(nd, "failed to open %s: %m", file);
+		goto out;
+	}
+
+	if (fstat(fd, &st) < 0 || st.st_size == 0) {
+		logf_err(nd, "invalid snapshot file %s", file);
+		goto out_close;
+	}
+
+	img = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	if (img == MAP_FAILED) {
+		logf_err(nd, "failed to map %s: %m", file);
+		goto out_close;
+	}
+
+	sr.img = img;
+	sr.size = st.st_size;
+	sr.hdr = img;
+
+	ret = snap_restore(&sr);
+
+	if (ret == 0)
+		logf_info(nd, "restored snapshot %s: %u blocks, %u configs",
+			  file, sr.hdr->num_blocks, sr.hdr->num_configs);
+
+	free(sr.blks);
+	free(sr.cfgs);
+	munmap(img, st.st_size);
+out_close:
+	close(fd);
+out:
+	return ret;
+}
@@ -237,11 +237,17 @@ typedef struct ubx_config {
  * @CONFIG_ATTR_CHECKLATE: perform checking of min and max before
  *			   start instead of before init hook
  *
+ * @CONFIG_ATTR_RUNTIME: config may be updated while the block is
+ *			 active. The block must load it with
+ *			 ubx_config_acquire, the Lua set_config then
+ *			 updates it with ubx_config_publish.
+ *
  * The first 8 bit are reserved, the others can be used freely.
  */
 enum {
 	CONFIG_ATTR_CLONED = 	1<<0,
 	CONFIG_ATTR_CHECKLATE = 1<<1,
+	CONFIG_ATTR_RUNTIME =	1<<2,
 	/* ... */
 	CONFIG_ATTR_RESERVED =	1<<7,
 };
@@ -276,6 +282,70 @@ enum {
 	BLOCK_STATE_ACTIVE
 };
 
+/* memory region attributes */
+enum {
+	MEM_ATTR_HUGE		= 1 << 0,	/* request huge pages */
+	MEM_ATTR_HUGETLB	= 1 << 1,	/* backed by explicit huge pages */
+	MEM_ATTR_THP		= 1 << 2,	/* advised transparent huge pages */
+	MEM_ATTR_MMAP		= 1 << 3,	/* owned, allocated with mmap */
+	MEM_ATTR_MALLOC		= 1 << 4,	/* owned, allocated with calloc */
+	MEM_ATTR_ARENA		= 1 << 5,	/* carved from the block's arena */
+};
+
+/**
+ * struct ubx_mem_region - memory region of a block
+ *
+ * Blocks register their (large) buffers to have these prefaulted
+ * before starting (see ubx_node_prepare_rt) or allocate these with
+ * ubx_block_mem_alloc.
+ *
+ * @addr: start of region
+ * @len: length in bytes
+ * @attrs: MEM_ATTR_* describing the backing of the region
+ * @next: linked list ptr
+ */
+struct ubx_mem_region {
+	void *addr;
+	size_t len;
+	uint32_t attrs;
+	struct ubx_mem_region *next;
+};
+
+/**
+ * struct ubx_mem_arena - contiguous memory shared by several blocks
+ *
+ * Holds the buffers of the blocks assigned to it (see
+ * ubx_block_mem_arena_set) in the order these are allocated. Used
+ * to place the buffers used by one trigger thread next to each other.
+ *
+ * @name: name of the arena (e.g. of the trigger)
+ * @addr: start of arena
+ * @len: length in bytes
+ * @used: bytes carved from the arena
+ * @attrs: MEM_ATTR_* describing the backing of the arena
+ * @next: linked list ptr
+ */
+struct ubx_mem_arena {
+	char name[UBX_BLOCK_NAME_MAXLEN + 1];
+	uint8_t *addr;
+	size_t len;
+	size_t used;
+	uint32_t attrs;
+	struct ubx_mem_arena *next;
+};
+
+/**
+ * struct ubx_cfg_reader - reader of published config values
+ *
+ * @epoch: node epoch at entering the current read section (0 if
+ *	   not in a read section)
+ * @next: linked list ptr
+ */
+struct ubx_cfg_reader {
+	unsigned long epoch;
+	struct ubx_cfg_reader *next;
+};
+
 /**
  * struct ubx_block - microblx function block
  * @name: block name
@@ -293,12 +363,20 @@ enum {
  * @stop: stop hook
  * @cleanup: cleanup hook
  * @step: step hook (only BLOCK_TYPE_COMPUTATION only)
+ * @step_batch: optional hook to process n steps at once (only BLOCK_TYPE_COMPUTATION)
  * @stat_num_steps: step count statistics (only BLOCK_TYPE_COMPUTATION)
+ * @cfg_reader: config read section of ubx_cblock_step (only BLOCK_TYPE_COMPUTATION)
  * @read: read hook (only BLOCK_TYPE_INTERACTION)
  * @write: write hook (only BLOCK_TYPE_INTERACTION)
+ * @read_batch: optional hook to read up to num samples (only BLOCK_TYPE_INTERACTION)
+ * @write_batch: optional hook to write num samples (only BLOCK_TYPE_INTERACTION)
+ * @credits: optional hook to return the number of samples that can be written without loss (only BLOCK_TYPE_INTERACTION)
+ * @pending: optional hook to return the number of samples available for reading (only BLOCK_TYPE_INTERACTION)
  * @stat_num_reads: read count statistics (only BLOCK_TYPE_INTERACTION)
  * @stat_num_writes: wrte count statistics (only BLOCK_TYPE_INTERACTION)
  * @private_data: pointer to block instance state
+ * @mem_regions: buffers to prefault by ubx_node_prepare_rt
+ * @mem_arena: arena to allocate buffers from (or NULL)
  * @hh UT_hash_handle
  */
 typedef struct ubx_block {
@@ -326,7 +404,9 @@ typedef struct ubx_block {
 		/* COMP_TYPE_COMPUTATION */
 		struct {
 			void (*step)(struct ubx_block *cblock);
+			void (*step_batch)(struct ubx_block *cblock, unsigned int n);
 			unsigned long stat_num_steps;
+			struct ubx_cfg_reader cfg_reader;
 		};
 
 		/* COMP_TYPE_INTERACTION */
@@ -335,12 +415,20 @@ typedef struct ubx_block {
 				     ubx_data_t *value);
 			void (*write)(struct ubx_block *iblock,
 				      const ubx_data_t *value);
+			long (*read_batch)(struct ubx_block *iblock,
+					   ubx_data_t *value, long num);
+			void (*write_batch)(struct ubx_block *iblock,
+					    const ubx_data_t *value, long num);
+			long (*credits)(struct ubx_block *iblock);
+			long (*pending)(struct ubx_block *iblock);
 			unsigned long stat_num_reads;
 			unsigned long stat_num_writes;
 		};
 	};
 
 	void *private_data;
+	struct ubx_mem_region *mem_regions;
+	struct ubx_mem_arena *mem_arena;
 	UT_hash_handle hh;
 
 } ubx_block_t;
@@ -369,6 +457,9 @@ typedef struct ubx_module {
 enum {
 	ND_MLOCK_ALL = 1 << 0,
 	ND_DUMPABLE =  1 << 1,
+	ND_VIRTUAL_TIME = 1 << 2,
+	ND_PREPARE_RT = 1 << 3,
+	ND_HUGEPAGES = 1 << 4,
 };
 
 /**
@@ -385,6 +476,11 @@ enum {
  * @loglevel: global loglevel
  * @log: pointer to log function
  * @log_data: private state of log function
+ * @cfg_rcu: state for lock-free config updates (see ubx_rcu.c)
+ * @clock: node clock (see ubx_clock.c)
+ * @clock_data: private state of the node clock
+ * @data_pool: pool for allocating ubx_data (see ubx_data_pool.c)
+ * @mem_arenas: list of block memory arenas (see ubx_prepare_rt.c)
  */
 typedef struct ubx_node {
 	const char name[UBX_NODE_NAME_MAXLEN + 1];
@@ -397,8 +493,34 @@ typedef struct ubx_node {
 	int loglevel;
 	void (*log)(const struct ubx_node *inf, const struct ubx_log_msg *msg);
 	void *log_data;
+	struct ubx_cfg_rcu *cfg_rcu;
+	const struct ubx_clock *clock;
+	void *clock_data;
+	struct ubx_data_pool *data_pool;
+	struct ubx_mem_arena *mem_arenas;
 } ubx_node_t;
 
+/**
+ * struct ubx_data_pool_stats - statistics of a ubx_data pool
+ *
+ * @size: size of the pool in bytes
+ * @used: bytes of the pool carved into blocks
+ * @in_use: bytes currently allocated
+ * @peak: high-water mark of in_use
+ * @allocs: allocations served by the pool
+ * @sys_allocs: allocations that fell back to calloc
+ * @failed: allocations that failed as the pool was sealed
+ */
+struct ubx_data_pool_stats {
+	size_t size;
+	size_t used;
+	size_t in_use;
+	size_t peak;
+	unsigned long allocs;
+	unsigned long sys_allocs;
+	unsigned long failed;
+};
+
 
 /**
  * struct ubx_timespec
@@ -414,6 +536,23 @@ struct ubx_timespec {
 	long nsec;
 };
 
+/**
+ * struct ubx_clock - node clock
+ *
+ * @name: name of the clock
+ * @gettime: get the current time
+ * @nanosleep: sleep (flags as for clock_nanosleep)
+ * @attach: attach the calling thread (optional)
+ * @detach: detach the calling thread (optional)
+ */
+struct ubx_clock {
+	const char *name;
+	int (*gettime)(ubx_node_t *nd, struct ubx_timespec *uts);
+	int (*nanosleep)(ubx_node_t *nd, int flags, struct ubx_timespec *uts);
+	void (*attach)(ubx_node_t *nd);
+	void (*detach)(ubx_node_t *nd);
+};
+
 /**
  * struct ubx_log_msg - ubx log message
  * @level: log level (%UBX_LL_ERR, ...)
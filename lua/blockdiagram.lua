@@ -8,9 +8,11 @@
 -- SPDX-License-Identifier: BSD-3-Clause
 --
 
+local ffi = require "ffi"
 local ubx = require "ubx"
 local umf = require "umf"
 local utils = require "utils"
+local reflect = require "reflect"
 local has_json, json = pcall(require, "cjson")
 local strict = require "strict"
 
@@ -21,6 +23,7 @@ local foreach = utils.foreach
 local ts = tostring
 local fmt = string.format
 local insert = table.insert
+local concat = table.concat
 local safets = ubx.safe_tostr
 
 -- node configuration
@@ -35,25 +38,37 @@ local yellow=ubx.yellow
 local magenta=ubx.magenta
 
 local crit, err, warn, notice, info = nil, nil, nil, nil, nil
+local info_enabled = function() return false end
 
 local function stderr(msg)
    if USE_STDERR then utils.stderr(msg) end
 end
 
+--- Check whether messages of the given level will be logged
+-- This allows skipping expensive arguments such as utils.tab2str.
+-- @param nd node whose loglevel applies
+-- @param level loglevel
+-- @return true if enabled
+local function log_enabled(nd, level)
+   return USE_STDERR or (nd ~= nil and level <= nd.loglevel)
+end
+
 --- Create logging helper functions.
+-- Messages below the node loglevel are dropped before formatting.
 local function def_loggers(nd, src)
-   err = function(format, ...)
-      local msg = fmt(format, unpack{...}); stderr(msg); ubx.err(nd, src, msg)
-   end
-   warn = function(format, ...)
-      local msg = fmt(format, unpack{...}); stderr(msg); ubx.warn(nd, src, msg)
-   end
-   notice = function(format, ...)
-      local msg = fmt(format, unpack{...}); stderr(msg); ubx.notice(nd, src, msg)
-   end
-   info = function(format, ...)
-      local msg = fmt(format, unpack{...}); stderr(msg); ubx.info(nd, src, msg)
+   local function logger(level, logfun)
+      return function(format, ...)
+	 if not log_enabled(nd, level) then return end
+	 local msg = fmt(format, ...); stderr(msg); logfun(nd, src, msg)
+      end
    end
+
+   info_enabled = function() return log_enabled(nd, ffi.C.UBX_LOGLEVEL_INFO) end
+
+   err = logger(ffi.C.UBX_LOGLEVEL_ERR, ubx.err)
+   warn = logger(ffi.C.UBX_LOGLEVEL_WARN, ubx.warn)
+   notice = logger(ffi.C.UBX_LOGLEVEL_NOTICE, ubx.notice)
+   info = logger(ffi.C.UBX_LOGLEVEL_INFO, ubx.info)
 end
 
 local function err_exit(code, format, ...)
@@ -62,9 +77,12 @@ local function err_exit(code, format, ...)
 end
 
 --- Return the block table identified by bfqn at the level of sys
+-- Passing the same cache table to a series of lookups replaces the
+-- linear search of the blocks by a lookup in a per system index.
 -- @param sys system
 -- @param bfqn block fqn string
-local function blocktab_get(sys, bfqn)
+-- @param cache optional table to cache the block indices in
+local function blocktab_get(sys, bfqn, cache)
    local s = sys
 
    -- first index to the right subsystem
@@ -77,10 +95,24 @@ local function blocktab_get(sys, bfqn)
    end
 
    -- then locate the right block
-   for _,v in pairs(s.blocks) do
-      if v.name==bname then return v end
+   if not cache then
+      for _,v in pairs(s.blocks) do
+	 if v.name==bname then return v end
+      end
+      return false
    end
-   return false
+
+   local idx = cache[s]
+
+   if not idx then
+      idx = {}
+      for _,v in pairs(s.blocks or {}) do
+	 if idx[v.name] == nil then idx[v.name] = v end
+      end
+      cache[s] = idx
+   end
+
+   return idx[bname] or false
 end
 
 --- Check whether val is a nodeconfig reference
@@ -115,10 +147,12 @@ end
 local function mapobj_bf(func, root_sys, systab)
    local res = {}
    local queue = { root_sys }
+   local head = 1
 
    -- breadth first
-   while #queue > 0 do
-      local next_sys = table.remove(queue, 1) -- pop
+   while head <= #queue do
+      local next_sys = queue[head] -- pop
+      head = head + 1
 
       -- process all nc's of s
       foreach(
@@ -261,12 +295,13 @@ local subsystems_spec = TableSpec {
 -- Check that hash references are valid
 local function sys_check_block_ref(class, sys, vres)
    local res = true
+   local cache = {}
 
    local function check_config(c,_,s)
       local function check_hash(val, tab, key)
 	 local name = string.match(val, ".*#([%w_%-%/]+)")
 	 if not name then return end
-	 local bt = blocktab_get(s, name)
+	 local bt = blocktab_get(s, name, cache)
 	 if not bt then
 	    umf.add_msg(vres, "err", "unable to resolve block ref "..val)
 	    res = false
@@ -358,15 +393,17 @@ end
 -- checking will be done in the check function
 -- @param root_sys
 local function resolve_refs(root_sys)
+   local cache = {}
+
    local function connref_resolve(sys, connref)
       local bref, portname = unpack(utils.split(connref, "%."))
-      local btab = blocktab_get(sys, bref)
+      local btab = blocktab_get(sys, bref, cache)
       return btab, portname
    end
 
    mapconfigs(
       function(c,_,p)
-	 c._tgt = blocktab_get(p, c.name)
+	 c._tgt = blocktab_get(p, c.name, cache)
       end, root_sys)
 
    mapconns(
@@ -653,9 +690,12 @@ local function build_nodecfg_tab(nd, root_sys)
       local d = ubx.data_alloc(nd, cfg.type, 1)
       ubx.data_set(d, cfg.config, true)
       NC[name] = d
-      info("creating node config %s [%s] %s",
-	   blue(name), magenta(cfg.type),
-	   yellow(utils.tab2str(cfg.config)))
+
+      if info_enabled() then
+	 info("creating node config %s [%s] %s",
+	      blue(name), magenta(cfg.type),
+	      yellow(utils.tab2str(cfg.config)))
+      end
    end
 
    mapndconfigs(create_nc, root_sys)
@@ -706,9 +746,11 @@ local function apply_cfg_val(b, name, val, NC)
       if not NC[nodecfg] then
 	 err_exit(1, "invalid node config reference '%s'", val)
       end
-      info("nodecfg %s.%s with %s %s",
-	   green(blkfqn), blue(name), yellow(nodecfg),
-	   yellow(utils.tab2str(NC[nodecfg])))
+      if info_enabled() then
+	 info("nodecfg %s.%s with %s %s",
+	      green(blkfqn), blue(name), yellow(nodecfg),
+	      yellow(utils.tab2str(NC[nodecfg])))
+      end
 
       local ret = ubx.config_assign(blkcfg, NC[nodecfg])
       if ret < 0 then
@@ -718,7 +760,9 @@ local function apply_cfg_val(b, name, val, NC)
 		  ubx.retval_tostr[ret])
       end
    else -- regular config
-      info("cfg %s.%s: %s", green(blkfqn), blue(name), yellow(utils.tab2str(val)))
+      if info_enabled() then
+	 info("cfg %s.%s: %s", green(blkfqn), blue(name), yellow(utils.tab2str(val)))
+      end
       ubx.set_config(b, name, val)
    end
 end
@@ -870,78 +914,455 @@ local function configure_blocks(nd, root_sys, NC)
 
 end
 
---- Connect blocks
--- @param nd node_info
--- @param root_sys root system
-local function connect_blocks(nd, root_sys)
-   local function do_connect(c, i, p)
-      local srcblk = c._src._fqn
-      local srcport = c._srcport
-      local tgtblk = c._tgt._fqn
-      local tgtport = c._tgtport
+--- Check if a block is a pipelined ptrig
+-- @param b block
+-- @return true or false
+local function is_pipeline(b)
+   if b.prototype == nil or safets(b.prototype.name) ~= "std_triggers/ptrig" then
+      return false
+   end
+   local c = ubx.config_get(b, "pipeline")
+   return c ~= nil and c.value ~= nil and c:tolua() == 1
+end
 
-      -- are we connecting to an interaction?
-      if srcport==nil then
-	 -- src is interaction, target a port
-	 local ib = ubx.block_get(nd, srcblk)
+--- Get the trigger chains of a block
+-- @param b block
+-- @return list of lists of triggered block names or nil if b is not a trigger
+local function trig_chains(b)
+   local triggee_ptr = ffi.typeof("struct ubx_triggee*")
+   local c0 = ubx.config_get(b, "chain0")
 
-	 if ib==nil then
-	    err_exit(1, "do_connect: unknown src block %s", srcblk)
-	 end
+   if c0 == nil or safets(c0.type.name) ~= "struct ubx_triggee" then return end
+
+   local num_chains = ubx.config_get(b, "num_chains")
+   num_chains = (num_chains ~= nil and num_chains.value ~= nil) and num_chains:tolua() or 1
 
-	 if not ubx.is_iblock_instance(ib) then
-	    err_exit(1, "%s is not a valid iblock instance", srcblk)
+   local res = {}
+   for i=0,num_chains-1 do
+      local chain = {}
+      local c = ubx.config_get(b, "chain"..ts(i))
+      if c ~= nil and c.value ~= nil then
+	 local tgs = ffi.cast(triggee_ptr, c.value.data)
+	 for j=0,tonumber(c.value.len)-1 do
+	    chain[#chain+1] = safets(tgs[j].b.name)
 	 end
+      end
+      res[#res+1] = chain
+   end
+   return res
+end
 
-	 local btgt = ubx.block_get(nd, tgtblk)
-	 local ptgt = ubx.port_get(btgt, tgtport)
+--- Determine the pipeline stage of each block
+-- @param nd node_info
+-- @return table of blockname to { trig=trigname, stage=N }
+local function pipeline_stages(nd)
+   local res = {}
 
-	 if ubx.port_connect_in(ptgt, ib) ~= 0 then
-	    err_exit(1, "failed to connect interaction %s to port %s.%s",
-			srcblk, tgtblk, tgtport)
-	 end
-	 info("connecting %s (iblock) ->  %s.%s", srcblk, tgtblk, tgtport)
-      elseif tgtport==nil then
-	 -- src is a port, target is an interaction
-	 local ib = ubx.block_get(nd, tgtblk)
+   ubx.blocks_map(nd, function(b)
+		     local trig = safets(b.name)
+		     for i,chain in ipairs(trig_chains(b) or {}) do
+			for _,name in ipairs(chain) do
+			   res[name] = { trig=trig, stage=i-1 }
+			end
+		     end
+		  end, is_pipeline)
 
-	 if ib==nil then
-	    err_exit(1, "do_connect: unknown tgt block %s", tgtblk)
-	 end
+   return res
+end
+
+--- Check if a connection crosses two stages of a pipelined ptrig
+-- @param stages result of pipeline_stages
+-- @param srcblk name of source block
+-- @param tgtblk name of target block
+-- @return true or false
+local function is_handoff(stages, srcblk, tgtblk)
+   local ssrc, stgt = stages[srcblk], stages[tgtblk]
+   return ssrc ~= nil and stgt ~= nil and ssrc.trig == stgt.trig and ssrc.stage ~= stgt.stage
+end
 
-	 if not ubx.is_iblock_instance(ib) then
-	    err_exit(1, "%s not a valid iblock instance", tgtblk)
+--- Determine the trigger thread of each block
+-- Blocks triggered by a ptrig, directly or via nested triggers, are
+-- assigned to its thread (or the thread of the pipeline stage) and
+-- numbered in chain execution order.
+-- @param nd node_info
+-- @return table of blockname to { thread=threadname, pos=N }
+local function chain_order(nd)
+   local res = {}
+
+   local function visit(thread, b, pos)
+      for _,chain in ipairs(trig_chains(b) or {}) do
+	 for _,name in ipairs(chain) do
+	    if not res[name] then
+	       pos = pos + 1
+	       res[name] = { thread=thread, pos=pos }
+	       pos = visit(thread, ubx.block_get(nd, name), pos)
+	    end
 	 end
+      end
+      return pos
+   end
 
-	 local bsrc = ubx.block_get(nd, srcblk)
-	 local psrc = ubx.port_get(bsrc, srcport)
+   local function is_ptrig(b)
+      return b.prototype ~= nil and safets(b.prototype.name) == "std_triggers/ptrig"
+   end
+
+   ubx.blocks_map(nd, function(b)
+		     local trig = safets(b.name)
+		     if not is_pipeline(b) then
+			visit(trig, b, 0)
+			return
+		     end
+		     for i,chain in ipairs(trig_chains(b)) do
+			local thread = fmt("%s.chain%d", trig, i-1)
+			for pos,name in ipairs(chain) do
+			   res[name] = { thread=thread, pos=pos }
+			end
+		     end
+		  end, is_ptrig)
+
+   return res
+end
+
+--- Compute the buffer size of a connection
+-- Mirrors the allocations of lfds_cyclic (buffer_len + 1 elements
+-- with a header, aligned to 16 bytes), handoff (two slots) and
+-- simple_fifo (fifo_size bytes), each rounded up to a cache line as
+-- by ubx_block_mem_alloc.
+-- @param ibtype iblock type of the connection
+-- @param size sample size in bytes (fifo_size for simple_fifo)
+-- @param bufflen buffer length (lfds_cyclic only)
+-- @return size in bytes
+local function conn_buffer_size(ibtype, size, bufflen)
+   local function cl_align(x) return math.ceil(x / 64) * 64 end
+
+   if ibtype == "std_triggers/handoff" then return 2 * cl_align(size) end
+   if ibtype == "examples/simple_fifo" then return cl_align(size) end
+
+   local elem = math.ceil((size + ffi.sizeof("long")) / 16) * 16
+   return cl_align((bufflen + 1) * elem)
+end
 
-	 if ubx.port_connect_out(psrc, ib) ~= 0 then
-	    err_exit(1, "failed to connect %s.%s to %s (iblock)",
-		     srcblk, srcport, tgtblk)
+--- Get the fifo_size of a simple_fifo iblock
+-- @param ib iblock
+-- @return size in bytes (the default of simple_fifo if unset)
+local function fifo_size(ib)
+   local c = ubx.config_get(ib, "fifo_size")
+   if c == nil or c.value == nil or c.value.len == 0 then return 16 end
+   return c:tolua()
+end
+
+--- Plan the memory of the connection buffers
+-- Creates one arena per trigger thread holding the buffers of the
+-- connections written (or else read) by the blocks of that thread
+-- in chain execution order. Explicit simple_fifo iblocks are placed
+-- at the position of the first ordered block connected to them.
+-- Connections to or from other explicit iblocks and between blocks
+-- not triggered by a ptrig are not planned.
+-- @param nd node_info
+-- @param root_sys root system
+-- @return list of { conn=, arena=, iblock= } in the order to connect
+local function plan_memory(nd, root_sys)
+   local stages = pipeline_stages(nd)
+   local order = chain_order(nd)
+   local plan, sizes, fifos = {}, {}, {}
+
+   local function plan_fifo(c, ibname, bname)
+      local o = order[bname]
+      local ib = ubx.block_get(nd, ibname)
+      if not o or ib == nil or fifos[ibname] then return end
+      if safets(ib.prototype.name) ~= "examples/simple_fifo" then return end
+
+      fifos[ibname] = true
+      plan[#plan+1] = { conn=c, iblock=ib, thread=o.thread, pos=o.pos, idx=#plan+1 }
+      sizes[o.thread] = (sizes[o.thread] or 0) +
+	 conn_buffer_size("examples/simple_fifo", fifo_size(ib))
+   end
+
+   mapconns(function(c)
+	       local srcblk, tgtblk = c._src._fqn, c._tgt._fqn
+	       if c._srcport == nil then return plan_fifo(c, srcblk, tgtblk) end
+	       if c._tgtport == nil then return plan_fifo(c, tgtblk, srcblk) end
+
+	       local o = order[srcblk] or order[tgtblk]
+	       if not o then return end
+
+	       local bsrc, btgt = ubx.block_get(nd, srcblk), ubx.block_get(nd, tgtblk)
+	       if bsrc == nil or btgt == nil then return end
+
+	       local p1, p2 = ubx.port_get(bsrc, c._srcport), ubx.port_get(btgt, c._tgtport)
+	       if p1 == nil or p2 == nil then return end
+
+	       local size = math.min(tonumber(p1.out_data_len), tonumber(p2.in_data_len)) *
+		  tonumber(p1.out_type.size)
+	       local ibtype = is_handoff(stages, srcblk, tgtblk) and
+		  "std_triggers/handoff" or "lfds_buffers/cyclic"
+
+	       plan[#plan+1] = { conn=c, thread=o.thread, pos=o.pos, idx=#plan+1 }
+	       sizes[o.thread] = (sizes[o.thread] or 0) +
+		  conn_buffer_size(ibtype, size, c.buffer_length or 1)
+	    end, root_sys)
+
+   table.sort(plan, function(a, b)
+		 if a.thread ~= b.thread then return a.thread < b.thread end
+		 if a.pos ~= b.pos then return a.pos < b.pos end
+		 return a.idx < b.idx
+   end)
+
+   local arenas = {}
+   for thread, size in pairs(sizes) do
+      info("planned %d bytes arena for %s", size, thread)
+      arenas[thread] = ubx.mem_arena_create(nd, thread, size)
+   end
+
+   for _,p in ipairs(plan) do p.arena = arenas[p.thread] end
+
+   return plan
+end
+
+--- Create a single connection
+-- Connections between two stages of a pipelined ptrig use a handoff
+-- iblock instead of a lfds_cyclic buffer.
+-- @param nd node_info
+-- @param c connection table
+-- @param stages result of pipeline_stages (optional)
+-- @param arena memory arena for the buffer (optional)
+local function do_connect(nd, c, stages, arena)
+   local srcblk = c._src._fqn
+   local srcport = c._srcport
+   local tgtblk = c._tgt._fqn
+   local tgtport = c._tgtport
+
+   -- are we connecting to an interaction?
+   if srcport==nil then
+      -- src is interaction, target a port
+      local ib = ubx.block_get(nd, srcblk)
+
+      if ib==nil then
+	 err_exit(1, "do_connect: unknown src block %s", srcblk)
+      end
+
+      if not ubx.is_iblock_instance(ib) then
+	 err_exit(1, "%s is not a valid iblock instance", srcblk)
+      end
+
+      local btgt = ubx.block_get(nd, tgtblk)
+      local ptgt = ubx.port_get(btgt, tgtport)
+
+      if ubx.port_connect_in(ptgt, ib) ~= 0 then
+	 err_exit(1, "failed to connect interaction %s to port %s.%s",
+		     srcblk, tgtblk, tgtport)
+      end
+      info("connecting %s (iblock) ->  %s.%s", srcblk, tgtblk, tgtport)
+   elseif tgtport==nil then
+      -- src is a port, target is an interaction
+      local ib = ubx.block_get(nd, tgtblk)
+
+      if ib==nil then
+	 err_exit(1, "do_connect: unknown tgt block %s", tgtblk)
+      end
+
+      if not ubx.is_iblock_instance(ib) then
+	 err_exit(1, "%s not a valid iblock instance", tgtblk)
+      end
+
+      local bsrc = ubx.block_get(nd, srcblk)
+      local psrc = ubx.port_get(bsrc, srcport)
+
+      if ubx.port_connect_out(psrc, ib) ~= 0 then
+	 err_exit(1, "failed to connect %s.%s to %s (iblock)",
+		  srcblk, srcport, tgtblk)
+      end
+      info("connecting %s.%s -> %s (iblock)", srcblk, srcport, tgtblk)
+   else
+      -- both src and target are ports
+      local bufflen = c.buffer_length or 1
+
+      info("connecting %s.%s -[%d]-> %s.%s",
+	   srcblk, srcport, bufflen, tgtblk, tgtport)
+
+      local bsrc = ubx.block_get(nd, srcblk)
+      local btgt = ubx.block_get(nd, tgtblk)
+
+      if bsrc==nil then
+	 err_exit(1, "ERR: src block %s not found", srcblk)
+      end
+
+      if btgt==nil then
+	 err_exit(1, "ERR: tgt block %s not found", tgtblk)
+      end
+
+      stages = stages or pipeline_stages(nd)
+
+      if is_handoff(stages, srcblk, tgtblk) then
+	 local ssrc, stgt = stages[srcblk], stages[tgtblk]
+	 local p1 = ubx.port_get(bsrc, srcport)
+	 local p2 = ubx.port_get(btgt, tgtport)
+
+	 if p1 == nil or p2 == nil then
+	    err_exit(1, "do_connect: invalid port %s.%s or %s.%s",
+		     srcblk, srcport, tgtblk, tgtport)
 	 end
-	 info("connecting %s.%s -> %s (iblock)", srcblk, srcport, tgtblk)
+
+	 notice("connecting %s.%s -[handoff]-> %s.%s (%s stage %d -> %d, +1 period latency)",
+		srcblk, srcport, tgtblk, tgtport, ssrc.trig, ssrc.stage, stgt.stage)
+
+	 ubx.conn_uni(bsrc, srcport, btgt, tgtport, "std_triggers/handoff",
+		      { type_name=safets(p1.out_type.name),
+			data_len=math.min(tonumber(p1.out_data_len),
+					  tonumber(p2.in_data_len)) },
+		      nil, arena)
       else
-	 -- both src and target are ports
-	 local bufflen = c.buffer_length or 1
+	 ubx.conn_lfds_cyclic(bsrc, srcport, btgt, tgtport, bufflen, nil, arena)
+      end
+   end
+end
 
-	 info("connecting %s.%s -[%d]-> %s.%s",
-	      srcblk, srcport, bufflen, tgtblk, tgtport)
+--- Connect the record/recorder and record/replay stream ports
+-- The docstring of each stream port s<N> is the name "block.port" of
+-- the recorded port. Recorded out-ports are connected directly to
+-- the recorder, recorded in-ports via the out-ports that feed them.
+-- Replay streams are connected to the recorded in-port if that exists
+-- and is not connected yet.
+-- @param nd node_info
+local function connect_recorders(nd)
+   local function is_type(name)
+      return function(b)
+	 return b.prototype ~= nil and safets(b.prototype.name) == name
+      end
+   end
 
-	 local bsrc = ubx.block_get(nd, srcblk)
-	 local btgt = ubx.block_get(nd, tgtblk)
+   local function is_stream(p) return safets(p.name):match("^s%d+$") ~= nil end
 
-	 if bsrc==nil then
-	    err_exit(1, "ERR: src block %s not found", srcblk)
-	 end
+   local function get_buffer_len(b)
+      local c = ubx.config_get(b, "buffer_len")
+      return (c.value ~= nil) and c:tolua() or 16
+   end
 
-	 if btgt==nil then
-	    err_exit(1, "ERR: tgt block %s not found", tgtblk)
-	 end
-	 ubx.conn_lfds_cyclic(bsrc, srcport, btgt, tgtport, bufflen)
+   -- split "block.port" and return block and port
+   local function lookup(name)
+      local bname, pname = name:match("^(.+)%.([^%.]+)$")
+      if not bname then return end
+      local b = ubx.block_get(nd, bname)
+      if b == nil then return end
+      local p = ubx.port_get(b, pname)
+      if p == nil then return end
+      return b, p
+   end
+
+   -- return the out-ports {b, p} writing to the in-port p
+   local function producers(p)
+      local res = {}
+      local incoming = {}
+      for _,n in ipairs(ubx.port_conns_totab(p).incoming) do incoming[n] = true end
+
+      ubx.blocks_map(nd, function(b)
+			ubx.ports_foreach(b, function(op)
+					     for _,n in ipairs(ubx.port_conns_totab(op).outgoing) do
+						if incoming[n] then
+						   res[#res+1] = { b=b, p=op }
+						   return
+						end
+					     end
+					  end, ubx.is_outport)
+		     end, ubx.is_cblock_instance)
+      return res
+   end
+
+   local function tap(rec, p)
+      local recname = safets(rec.name)
+      local pname = safets(p.name)
+      local name = safets(p.doc)
+      local b, tp = lookup(name)
+      local len = get_buffer_len(rec)
+
+      if b == nil then
+	 err_exit(1, "%s: invalid recorded port %s", recname, name)
+      end
+
+      if ubx.is_outport(tp) then
+	 info("recording %s -[%d]-> %s.%s", name, len, recname, pname)
+	 ubx.conn_lfds_cyclic(b, safets(tp.name), rec, pname, len)
+	 return
+      end
+
+      local prods = producers(tp)
+
+      if #prods == 0 then
+	 warn("%s: recorded in-port %s is not connected", recname, name)
+      end
+
+      for _,pr in ipairs(prods) do
+	 info("recording %s (via %s.%s) -[%d]-> %s.%s", name,
+	      safets(pr.b.name), safets(pr.p.name), len, recname, pname)
+	 ubx.conn_lfds_cyclic(pr.b, safets(pr.p.name), rec, pname, len)
       end
    end
-   mapconns(do_connect, root_sys)
+
+   local function replay(rp, p)
+      local name = safets(p.doc)
+      local b, tp = lookup(name)
+
+      if b == nil or not ubx.is_inport(tp) then return end
+
+      local conns = ubx.port_conns_totab(tp)
+      if #conns.incoming > 0 then return end
+
+      info("replaying %s.%s -> %s", safets(rp.name), safets(p.name), name)
+      ubx.conn_lfds_cyclic(rp, safets(p.name), b, safets(tp.name), get_buffer_len(rp))
+   end
+
+   -- collect first, connecting adds iblocks to the node
+   local recs = ubx.blocks_map(nd, function(b) return b end, is_type("record/recorder"))
+   local reps = ubx.blocks_map(nd, function(b) return b end, is_type("record/replay"))
+
+   for _,rec in ipairs(recs) do
+      ubx.ports_foreach(rec, function(p) tap(rec, p) end, is_stream)
+   end
+
+   for _,rp in ipairs(reps) do
+      ubx.ports_foreach(rp, function(p) replay(rp, p) end, is_stream)
+   end
+end
+
+--- Move the buffer of an initialized iblock to an arena
+-- The iblock is reinitialized, so this must be done before it is
+-- connected.
+-- @param ib iblock
+-- @param arena memory arena
+local function iblock_arena_set(ib, arena)
+   local name = safets(ib.name)
+
+   if ubx.block_cleanup(ib) ~= 0 then
+      err_exit(1, "failed to cleanup iblock %s", name)
+   end
+
+   ubx.block_mem_arena_set(ib, arena)
+
+   if ubx.block_init(ib) ~= 0 then
+      err_exit(1, "failed to reinitialize iblock %s", name)
+   end
+end
+
+--- Connect blocks
+-- Planned connections are made first and in the planned order, so
+-- that their buffers are carved from the arenas in that order.
+-- @param nd node_info
+-- @param root_sys root system
+-- @param plan result of plan_memory (optional)
+local function connect_blocks(nd, root_sys, plan)
+   local stages = pipeline_stages(nd)
+   local planned = {}
+
+   for _,p in ipairs(plan or {}) do
+      if p.iblock then iblock_arena_set(p.iblock, p.arena) end
+      do_connect(nd, p.conn, stages, p.arena)
+      planned[p.conn] = true
+   end
+
+   mapconns(function(c)
+	       if not planned[c] then do_connect(nd, c, stages) end
+	    end, root_sys)
+   connect_recorders(nd)
 end
 
 --- Merge one system into another
@@ -981,13 +1402,47 @@ function system.merge(self, sys)
    do_merge(self, sys)
 end
 
+--- Return the resident set size of the process
+-- @return RSS in KiB or 0 if unknown
+local function rss_kib()
+   local f = io.open("/proc/self/status")
+   if not f then return 0 end
+   local rss = string.match(f:read("*a"), "VmRSS:%s*(%d+)")
+   f:close()
+   return tonumber(rss) or 0
+end
+
 --- Launch a blockdiagram system
+-- If t.restore is set, the node is restored from the given snapshot
+-- image instead of being instantiated from the model. If t.snapshot
+-- is set, a snapshot of the configured node is written to the given
+-- file before starting. If t.prepare_rt is set, the node is prepared
+-- for realtime before starting (see ubx.node_prepare_rt), reserving
+-- t.rt_heap_reserve bytes of heap. If t.data_pool is set, ubx_data
+-- are allocated from a pool of t.data_pool bytes. If t.mem_plan is
+-- set, the connection buffers used by each trigger thread are placed
+-- in one arena in chain execution order (see plan_memory).
 -- @param self system specification to load
 -- @param t configuration table
 -- @return nd node handle
 function system.launch(self, t)
+   local ts_prev = ffi.new("struct ubx_timespec")
+   local ts_cur = ffi.new("struct ubx_timespec")
+   local phases = {}
+
+   -- record the duration since the previous phase and the memory
+   -- use (Lua heap and RSS in KiB) at its end
+   local function phase_done(name)
+      ubx.clock_mono_gettime(ts_cur)
+      phases[#phases+1] = { name=name, dur=ts_cur - ts_prev,
+			    lua_mem=collectgarbage("count"), rss=rss_kib() }
+      ffi.copy(ts_prev, ts_cur, ffi.sizeof(ts_cur))
+   end
+
+   ubx.clock_mono_gettime(ts_prev)
 
    if self:validate(false) > 0 then self:validate(true) os.exit(1) end
+   phase_done("validate")
 
    -- fire it up
    t = t or {}
@@ -997,23 +1452,1044 @@ function system.launch(self, t)
    local nd = ubx.node_create(t.nodename,
 			      { loglevel=t.loglevel,
 				mlockall=t.mlockall,
-				dumpable=t.dumpable })
+				dumpable=t.dumpable,
+				virtual_time=t.virtual_time,
+				prepare_rt=t.prepare_rt,
+				hugepages=t.hugepages,
+				data_pool=t.data_pool })
 
    def_loggers(nd, "launch")
-   import_modules(nd, self)
+   phase_done("node_create")
+
+   if t.restore then
+      info("restoring snapshot %s", t.restore)
+      ubx.node_restore(nd, t.restore)
+      phase_done("restore")
+   else
+      import_modules(nd, self)
+      phase_done("import_modules")
+      create_blocks(nd, self)
+      phase_done("create_blocks")
+      _NC = build_nodecfg_tab(nd, self)
+      phase_done("build_nodecfg")
+      configure_blocks(nd, self, _NC)
+      phase_done("configure_blocks")
+      local plan
+      if t.mem_plan then
+	 plan = plan_memory(nd, self)
+	 phase_done("plan_memory")
+      end
+      connect_blocks(nd, self, plan)
+      phase_done("connect_blocks")
+   end
+
+   if t.snapshot then
+      info("writing snapshot %s", t.snapshot)
+      ubx.node_snapshot(nd, t.snapshot)
+      phase_done("snapshot")
+   end
+
+   late_checks(t, nd)
+   phase_done("late_checks")
+
+   if t.prepare_rt then
+      ubx.node_prepare_rt(nd, t.rt_heap_reserve)
+      phase_done("prepare_rt")
+   end
+
+   if not t.nostart then
+      system.startup(self, nd)
+      phase_done("startup")
+   end
+
+   local total = 0
+   for _,p in ipairs(phases) do
+      info("launch phase %-16s %10.3f ms %10d KiB lua %10d KiB rss",
+	   p.name, p.dur * 1000, p.lua_mem, p.rss)
+      total = total + p.dur
+   end
+   info("launch total %10.3f ms", total * 1000)
+
+   -- optionally return the phase durations in t.phases
+   if t.timing then t.phases = phases end
+
+   return nd
+end
+
+
+---
+--- Incremental updates
+---
+
+--- Normalize a config value for comparison.
+-- Both unresolved #blockname references and resolved block pointers
+-- are converted to "#<block fqn>".
+-- @param val config value
+-- @param sys system owning the configuration
+-- @return normalized value
+local function cfgval_norm(val, sys)
+   if type(val) == 'string' then
+      local name = string.match(val, ".*#([%w_%-%/]+)")
+      if name then return "#"..sys._fqn..name end
+      return val
+   elseif type(val) == 'cdata' and ffi.istype("ubx_block_t*", val) then
+      return "#"..safets(val.name)
+   elseif type(val) == 'table' then
+      local res = {}
+      for k,v in pairs(val) do res[k] = cfgval_norm(v, sys) end
+      return res
+   end
+   return val
+end
+
+--- Compare two (normalized) values recursively
+local function val_equal(a, b)
+   if type(a) ~= 'table' or type(b) ~= 'table' then return a == b end
+   for k,v in pairs(a) do
+      if not val_equal(v, b[k]) then return false end
+   end
+   for k,_ in pairs(b) do
+      if a[k] == nil then return false end
+   end
+   return true
+end
+
+--- Return the effective configs of all blocks
+-- Like in configure_blocks, configs higher in the hierarchy take
+-- precedence.
+-- @param root_sys system
+-- @return { [blockfqn] = { [cfgname] = { cfg=cfg, norm=normval } } }
+local function effective_configs(root_sys)
+   local res = {}
+   mapconfigs(
+      function(cfg, _, s)
+	 if not cfg._tgt then return end
+	 local bcfg = res[cfg._tgt._fqn] or {}
+	 res[cfg._tgt._fqn] = bcfg
+	 for name,val in pairs(cfg.config) do
+	    if bcfg[name] == nil then
+	       bcfg[name] = { cfg=cfg, norm=cfgval_norm(val, s) }
+	    end
+	 end
+      end, root_sys)
+   return res
+end
+
+--- Return the effective node configs (higher ones shadow lower ones)
+local function effective_nodecfgs(root_sys)
+   local res = {}
+   mapndconfigs(
+      function(nc, name)
+	 if res[name] == nil then res[name] = nc end
+      end, root_sys)
+   return res
+end
+
+--- Return a unique key for a connection
+local function conn_key(c)
+   return fmt("%s%s->%s%s[%s]",
+	      c._src._fqn, c._srcport and "."..c._srcport or "",
+	      c._tgt._fqn, c._tgtport and "."..c._tgtport or "",
+	      ts(c.buffer_length or 1))
+end
+
+--- Check if a normalized value contains a reference to one of blks
+local function refs_block(norm, blks)
+   if type(norm) == 'string' then
+      local fqn = string.match(norm, "^#(.+)$")
+      return fqn ~= nil and blks[fqn] ~= nil
+   elseif type(norm) == 'table' then
+      for _,v in pairs(norm) do
+	 if refs_block(v, blks) then return true end
+      end
+   end
+   return false
+end
+
+--- Compute the changes required to transform system self into new
+--
+-- The resulting plan contains the following lists:
+--
+--  - imports: modules to import
+--  - nodecfgs: names of new or changed node configs
+--  - conns_rm: connections to remove
+--  - blocks_rm: blocks to remove (also if their type changed)
+--  - blocks_add: blocks to create
+--  - configs: configs to set { fqn=, name=, cfg= } (existing blocks)
+--  - reinit: existing blocks to reinitialize due to config changes
+--  - conns_add: connections to create
+--  - stop: blocks (i.e. triggers) to stop during the update because
+--    they reference affected blocks via #blockname
+--  - warnings: list of strings
+--
+-- @param self running system
+-- @param new new system
+-- @return plan table
+function system.diff(self, new)
+   local plan = { imports={}, nodecfgs={}, conns_rm={}, blocks_rm={}, blocks_add={},
+		  configs={}, reinit={}, conns_add={}, stop={}, warnings={} }
+
+   -- imports
+   local old_imports = {}
+   mapimports(function(m) old_imports[m] = true end, self)
+   mapimports(
+      function(m)
+	 if old_imports[m] then return end
+	 old_imports[m] = true
+	 plan.imports[#plan.imports+1] = m
+      end, new)
+
+   -- blocks
+   local old_blocks, new_blocks, rm, add = {}, {}, {}, {}
+   mapblocks(function(b) old_blocks[b._fqn] = b end, self)
+   mapblocks(function(b) new_blocks[b._fqn] = b end, new)
+
+   mapblocks(
+      function(b)
+	 local nb = new_blocks[b._fqn]
+	 if nb == nil or nb.type ~= b.type then
+	    plan.blocks_rm[#plan.blocks_rm+1] = b._fqn
+	    rm[b._fqn] = true
+	 end
+      end, self)
+
+   mapblocks(
+      function(b)
+	 local ob = old_blocks[b._fqn]
+	 if ob == nil or ob.type ~= b.type then
+	    plan.blocks_add[#plan.blocks_add+1] = b
+	    add[b._fqn] = true
+	 end
+      end, new)
+
+   -- node configs
+   local old_ncs, new_ncs, nc_changed = effective_nodecfgs(self), effective_nodecfgs(new), {}
+   for name, nc in pairs(new_ncs) do
+      local onc = old_ncs[name]
+      if onc == nil or onc.type ~= nc.type or not val_equal(onc.config, nc.config) then
+	 nc_changed[name] = true
+	 plan.nodecfgs[#plan.nodecfgs+1] = name
+      end
+   end
+
+   -- configs of existing blocks
+   local old_cfgs, new_cfgs, reinit = effective_configs(self), effective_configs(new), {}
+
+   mapblocks(
+      function(b)
+	 local fqn = b._fqn
+	 if add[fqn] then return end
+	 local ocfg, ncfg = old_cfgs[fqn] or {}, new_cfgs[fqn] or {}
+
+	 for name, c in pairs(ncfg) do
+	    local oc = ocfg[name]
+	    local ncref = check_noderef(c.norm)
+	    if oc == nil or not val_equal(oc.norm, c.norm) or (ncref and nc_changed[ncref]) then
+	       plan.configs[#plan.configs+1] = { fqn=fqn, name=name, cfg=c.cfg }
+	       if not reinit[fqn] then
+		  reinit[fqn] = true
+		  plan.reinit[#plan.reinit+1] = fqn
+	       end
+	    end
+	 end
+
+	 for name,_ in pairs(ocfg) do
+	    if ncfg[name] == nil then
+	       plan.warnings[#plan.warnings+1] =
+		  fmt("config %s.%s removed from model, keeping current value", fqn, name)
+	    end
+	 end
+      end, new)
+
+   -- connections
+   local old_conns, new_conns = {}, {}
+   mapconns(function(c) old_conns[conn_key(c)] = c end, self)
+   mapconns(function(c) new_conns[conn_key(c)] = c end, new)
+
+   -- endpoints of changed connections
+   local conn_blks = {}
+
+   mapconns(
+      function(c)
+	 if new_conns[conn_key(c)] == nil or rm[c._src._fqn] or rm[c._tgt._fqn] then
+	    plan.conns_rm[#plan.conns_rm+1] = c
+	    conn_blks[c._src._fqn] = true
+	    conn_blks[c._tgt._fqn] = true
+	 end
+      end, self)
+
+   mapconns(
+      function(c)
+	 if old_conns[conn_key(c)] == nil or add[c._src._fqn] or add[c._tgt._fqn] then
+	    plan.conns_add[#plan.conns_add+1] = c
+	    conn_blks[c._src._fqn] = true
+	    conn_blks[c._tgt._fqn] = true
+	 end
+      end, new)
+
+   -- blocks referencing affected blocks (i.e. triggers)
+   local affected = {}
+   for fqn,_ in pairs(rm) do affected[fqn] = true end
+   for fqn,_ in pairs(reinit) do affected[fqn] = true end
+   for fqn,_ in pairs(conn_blks) do affected[fqn] = true end
+
+   local stop = {}
+   for _, cfgs in ipairs{ old_cfgs, new_cfgs } do
+      for fqn, bcfg in pairs(cfgs) do
+	 if not stop[fqn] and not rm[fqn] and not add[fqn] and not reinit[fqn] then
+	    for _,c in pairs(bcfg) do
+	       if refs_block(c.norm, affected) then
+		  stop[fqn] = true
+		  plan.stop[#plan.stop+1] = fqn
+		  break
+	       end
+	    end
+	 end
+      end
+   end
+
+   return plan
+end
+
+--- Convert an update plan to a string
+-- @param plan plan returned by system.diff
+-- @return string
+local function plan_tostr(plan)
+   local res = {}
+   local function add(action, format, ...)
+      res[#res+1] = fmt("%-10s ", action)..fmt(format, ...)
+   end
+   local function conn_str(c)
+      return fmt("%s%s -> %s%s", c._src._fqn, c._srcport and "."..c._srcport or "",
+		 c._tgt._fqn, c._tgtport and "."..c._tgtport or "")
+   end
+
+   for _,w in ipairs(plan.warnings) do add("warning", "%s", w) end
+   for _,m in ipairs(plan.imports) do add("import", "%s", m) end
+   for _,n in ipairs(plan.nodecfgs) do add("nodecfg", "%s", n) end
+   for _,b in ipairs(plan.stop) do add("stop", "%s", b) end
+   for _,b in ipairs(plan.reinit) do add("stop", "%s", b) end
+   for _,c in ipairs(plan.conns_rm) do add("disconnect", "%s", conn_str(c)) end
+   for _,b in ipairs(plan.blocks_rm) do add("remove", "%s", b) end
+   for _,b in ipairs(plan.blocks_add) do add("create", "%s [%s]", b._fqn, b.type) end
+   for _,c in ipairs(plan.configs) do
+      add("config", "%s.%s = %s", c.fqn, c.name, utils.tab2str(c.cfg.config[c.name]))
+   end
+   for _,b in ipairs(plan.reinit) do add("reinit", "%s", b) end
+   for _,c in ipairs(plan.conns_add) do add("connect", "%s", conn_str(c)) end
+   for _,b in ipairs(plan.blocks_add) do add("start", "%s", b._fqn) end
+   for _,b in ipairs(plan.reinit) do add("restart", "%s", b) end
+   for _,b in ipairs(plan.stop) do add("restart", "%s", b) end
+
+   if #res == 0 then return "no changes" end
+   return concat(res, "\n")
+end
+
+--- Remove a connection from a node
+-- @param nd node
+-- @param c connection table
+local function do_disconnect(nd, c)
+   local srcport, tgtport = c._srcport, c._tgtport
+   local bsrc = ubx.block_get(nd, c._src._fqn)
+   local btgt = ubx.block_get(nd, c._tgt._fqn)
+
+   if srcport == nil then
+      ubx.port_disconnect_in(ubx.port_get(btgt, tgtport), bsrc)
+   elseif tgtport == nil then
+      ubx.port_disconnect_out(ubx.port_get(bsrc, srcport), btgt)
+   else
+      -- find the iblock created for this connection
+      local psrc, ptgt = ubx.port_get(bsrc, srcport), ubx.port_get(btgt, tgtport)
+      local i = 0
+      while psrc.out_interaction ~= nil and psrc.out_interaction[i] ~= nil do
+	 local ib = psrc.out_interaction[i]
+	 local j = 0
+	 while ptgt.in_interaction ~= nil and ptgt.in_interaction[j] ~= nil do
+	    if ptgt.in_interaction[j] == ib then
+	       local ibname = safets(ib.name)
+	       if ubx.ports_disconnect(psrc, ptgt, ib) ~= 0 then
+		  error(fmt("failed to disconnect %s.%s -> %s.%s",
+			    c._src._fqn, srcport, c._tgt._fqn, tgtport))
+	       end
+	       ubx.block_unload(nd, ibname)
+	       return
+	    end
+	    j = j + 1
+	 end
+	 i = i + 1
+      end
+      warn("disconnect: no connection %s.%s -> %s.%s found",
+	   c._src._fqn, srcport, c._tgt._fqn, tgtport)
+   end
+end
+
+--- Return the connections of all ports of b
+-- @return list of { port=name, ib=iblock, out=bool }
+local function block_conns(b)
+   local res = {}
+   ubx.ports_foreach(b, function(p)
+      for _,dir in ipairs{ "in", "out" } do
+	 local arr = p[dir.."_interaction"]
+	 local i = 0
+	 while arr ~= nil and arr[i] ~= nil do
+	    res[#res+1] = { port=safets(p.name), ib=arr[i], out=(dir=="out") }
+	    i = i + 1
+	 end
+      end
+   end)
+   return res
+end
+
+--- Restore connections of b that were lost (e.g. dynamic ports)
+local function block_conns_restore(b, conns)
+   for _,c in ipairs(block_conns(b)) do
+      for i,oc in ipairs(conns) do
+	 if oc.port == c.port and oc.ib == c.ib and oc.out == c.out then
+	    conns[i] = false
+	 end
+      end
+   end
+
+   for _,c in ipairs(conns) do
+      if c then
+	 local p = ubx.port_get(b, c.port)
+	 local ret = c.out and ubx.port_connect_out(p, c.ib) or ubx.port_connect_in(p, c.ib)
+	 if ret ~= 0 then
+	    error(fmt("failed to reconnect %s.%s", safets(b.name), c.port))
+	 end
+      end
+   end
+end
+
+--- Update a running node to a new system
+--
+-- Computes the difference to the new system (see system.diff) and
+-- applies only the required changes: new modules are imported,
+-- removed blocks and connections are removed, new blocks are created
+-- and configured and blocks with changed configs are reinitialized
+-- (i.e. stopped, cleaned up, configured, initialized and restarted
+-- with their connections preserved). Triggers and other blocks
+-- referencing affected blocks are stopped during the update. All
+-- other blocks keep running.
+--
+-- @param self system currently running in nd
+-- @param nd node
+-- @param new new system
+-- @param t table with options: dryrun (only compute the plan), verbose
+--          (print the plan)
+-- @return plan table, plan string
+function system.update(self, nd, new, t)
+   t = t or {}
+
+   if new:validate(false) > 0 then
+      new:validate(true)
+      error("update: invalid system")
+   end
+
+   local plan = system.diff(self, new)
+   local planstr = plan_tostr(plan)
+
+   if t.verbose then print(planstr) end
+   if t.dryrun then return plan, planstr end
+
+   def_loggers(nd, "update")
+
+   local function tostate(fqn, state)
+      local ret = ubx.block_tostate(ubx.block_get(nd, fqn), state)
+      if ret ~= 0 then
+	 error(fmt("update: failed to bring block %s to state %s: %s",
+		   fqn, state, ubx.retval_tostr[ret] or ts(ret)))
+      end
+   end
+
+   for _,m in ipairs(plan.imports) do ubx.load_module(nd, m) end
+
+   -- stop referencing blocks and blocks to reinit
+   local restart = {}
+   for _,lst in ipairs{ plan.stop, plan.reinit } do
+      for _,fqn in ipairs(lst) do
+	 local b = ubx.block_get(nd, fqn)
+	 if b.block_state == ffi.C.BLOCK_STATE_ACTIVE then
+	    info("stopping block %s", fqn)
+	    restart[#restart+1] = b
+	    tostate(fqn, 'inactive')
+	 end
+      end
+   end
+
+   for _,c in ipairs(plan.conns_rm) do do_disconnect(nd, c) end
+
+   for _,fqn in ipairs(plan.blocks_rm) do
+      info("removing block %s", fqn)
+      ubx.block_unload(nd, fqn)
+   end
+
+   for _,b in ipairs(plan.blocks_add) do
+      info("creating block %s [%s]", green(b._fqn), blue(b.type))
+      ubx.block_create(nd, b.type, b._fqn)
+   end
+
+   -- node configs: reuse the unchanged ones to keep them shared
+   local NC, nc_changed = {}, {}
+   for _,name in ipairs(plan.nodecfgs) do nc_changed[name] = true end
+
+   mapndconfigs(
+      function(nc, name)
+	 if NC[name] then return end
+	 if _NC and _NC[name] and not nc_changed[name] then
+	    NC[name] = _NC[name]
+	 else
+	    local d = ubx.data_alloc(nd, nc.type, 1)
+	    ubx.data_set(d, nc.config, true)
+	    NC[name] = d
+	 end
+      end, new)
+
+   -- resolve #blockname of the configs to apply
+   local add = {}
+   for _,b in ipairs(plan.blocks_add) do add[b._fqn] = true end
+
+   mapconfigs(
+      function(c, i, s)
+	 if add[c._tgt._fqn] then preproc_configs(nd, c, s, i) end
+      end, new)
+
+   for _,c in ipairs(plan.configs) do
+      if not c.cfg._preproc then
+	 preproc_configs(nd, c.cfg, c.cfg._parent)
+	 c.cfg._preproc = true
+      end
+   end
+
+   local configured, nonexist = {}, {}
+
+   -- configure and init new blocks
+   mapconfigs(
+      function(c)
+	 if add[c._tgt._fqn] then
+	    apply_config(c, ubx.block_get(nd, c._tgt._fqn), NC, configured, nonexist)
+	 end
+      end, new)
+
+   for _,b in ipairs(plan.blocks_add) do tostate(b._fqn, 'inactive') end
+
+   mapconfigs(
+      function(c)
+	 if add[c._tgt._fqn] then
+	    reapply_config(c, ubx.block_get(nd, c._tgt._fqn), NC, configured, nonexist)
+	 end
+      end, new)
+
+   -- reinitialize blocks with changed configs
+   for _,fqn in ipairs(plan.reinit) do
+      local b = ubx.block_get(nd, fqn)
+      local conns = block_conns(b)
+      local late = {}
+
+      info("reinitializing block %s", fqn)
+      tostate(fqn, 'preinit')
+
+      for _,c in ipairs(plan.configs) do
+	 if c.fqn == fqn then
+	    if ubx.block_config_get(b, c.name) == nil then
+	       late[#late+1] = c
+	    else
+	       apply_cfg_val(b, c.name, c.cfg.config[c.name], NC)
+	    end
+	 end
+      end
+
+      tostate(fqn, 'inactive')
+
+      for _,c in ipairs(late) do
+	 if ubx.block_config_get(b, c.name) == nil then
+	    error(fmt("update: block %s has no config %s", fqn, c.name))
+	 end
+	 apply_cfg_val(b, c.name, c.cfg.config[c.name], NC)
+      end
+
+      block_conns_restore(b, conns)
+   end
+
+   for _,c in ipairs(plan.conns_add) do do_connect(nd, c) end
+
+   -- start new passive, then new active blocks, then restart the
+   -- stopped ones
+   local function start(b)
+      info("starting block %s", green(safets(b.name)))
+      tostate(safets(b.name), 'active')
+   end
+
+   for _,active in ipairs{ false, true } do
+      for _,btab in ipairs(plan.blocks_add) do
+	 local b = ubx.block_get(nd, btab._fqn)
+	 if ubx.block_isactive(b) == active then start(b) end
+      end
+   end
+
+   for _,b in ipairs(restart) do start(b) end
+
+   _NC = NC
+   return plan, planstr
+end
+
+---
+--- C code generation
+---
+
+-- prefix for struct tags of model types in the generated code, to
+-- avoid clashes with definitions from included headers
+local CGEN_PFX = "usc_"
+
+--- Escape a string for use as a C string literal.
+local function cgen_str(str)
+   return '"'..str:gsub('[%c"\\]',
+			function(c) return fmt("\\%03o", string.byte(c)) end)..'"'
+end
+
+--- Generate a C initializer for a cdata value.
+-- @param val value (number or cdata) to convert
+-- @param refct reflect ctype of val
+-- @param blkvar function(bname) returning the C expression for a block
+-- @return C initializer string
+local function cgen_init(val, refct, blkvar)
+   if refct.what == 'field' then refct = refct.type end
+
+   if refct.what == 'int' or refct.what == 'enum' then
+      if type(val) == 'boolean' then return val and "1" or "0" end
+      if type(val) == 'cdata' then return ts(val) end -- 64bit: 1ULL
+      return fmt("%d", val)
+   elseif refct.what == 'float' then
+      val = tonumber(val)
+      if val ~= val then return "NAN" end
+      if val == math.huge then return "INFINITY" end
+      if val == -math.huge then return "-INFINITY" end
+      return fmt("%.17g", val)
+   elseif refct.what == 'struct' then
+      local res = {}
+      for m in refct:members() do
+	 res[#res+1] = fmt(".%s = %s", m.name, cgen_init(val[m.name], m, blkvar))
+      end
+      return "{ "..concat(res, ", ").." }"
+   elseif refct.what == 'array' then
+      local elem = refct.element_type
+      local num = refct.size / elem.size
+      if elem.what == 'int' and elem.size == 1 then
+	 return cgen_str(ffi.string(val, num):match("^[^%z]*"))
+      end
+      local res = {}
+      for i=0,num-1 do res[#res+1] = cgen_init(val[i], elem, blkvar) end
+      return "{ "..concat(res, ", ").." }"
+   elseif refct.what == 'ptr' then
+      if val == nil then return "NULL" end
+      local elem = refct.element_type
+      if elem.what == 'struct' and elem.name == 'ubx_block' then
+	 return blkvar(safets(val.name))
+      end
+      error(fmt("cgen: unsupported pointer to %s %s", ts(elem.what), ts(elem.name)))
+   end
+   error(fmt("cgen: unsupported ctype %s", ts(refct.what)))
+end
+
+--- Generate the C declaration of a struct type
+-- All struct tags of model types are prefixed with CGEN_PFX.
+-- @param typ ubx_type_t
+-- @param struct_types table of known struct type names
+-- @return declaration string
+local function cgen_struct_decl(typ, struct_types)
+   local def = safets(ffi.cast("char*", typ.private_data))
+   local res = {}
+
+   -- strip preprocessor directives (include guards etc)
+   for l in def:gmatch("[^\n]+") do
+      if not l:match("^%s*#") then res[#res+1] = l end
+   end
+   def = concat(res, "\n")
+
+   return (def:gsub("struct%s+([%w_]+)",
+		    function(tag)
+		       if struct_types["struct "..tag] then return "struct "..CGEN_PFX..tag end
+		    end))
+end
+
+--- Return the C type name used in the generated code for type t
+local function cgen_type_name(t)
+   local name = safets(t.name)
+   if t.type_class == ffi.C.TYPE_CLASS_STRUCT then
+      return (name:gsub("^struct%s+", "struct "..CGEN_PFX))
+   end
+   return name
+end
+
+--- Compile a system into a C program.
+--
+-- The system is instantiated, configured and initialized (but not
+-- started) in order to obtain the types and values of all
+-- configurations (including dynamically created ones) and all
+-- connections. From this state, a C program is generated that
+-- makes the corresponding libubx calls in the same order as
+-- system.launch and has no Lua dependency.
+--
+-- @param self system to compile
+-- @param t configuration table (nodename, loglevel, mlockall, dumpable, virtual_time, prepare_rt, rt_heap_reserve, hugepages, data_pool)
+-- @return string with C program
+function system.compile(self, t)
+   if self:validate(false) > 0 then self:validate(true) os.exit(1) end
+
+   t = t or {}
+   t.nodename = t.nodename or "n"
+   USE_STDERR = t.use_stderr or false
+
+   local nd = ubx.node_create(t.nodename, { loglevel=t.loglevel })
+   def_loggers(nd, "compile")
+
+   -- modules in load order
+   local modules, loaded = {}, {}
+   mapimports(
+      function(m)
+	 if loaded[m] then return end
+	 modules[#modules+1] = ubx.load_module(nd, m)
+	 loaded[m] = true
+      end, self)
+
    create_blocks(nd, self)
+
+   -- blocks in creation order and configs existing before init
+   local blocks, blkidx, modelblks, preinit = {}, {}, {}, {}
+
+   local function add_block(b)
+      local name = safets(b.name)
+      if blkidx[name] then return end
+      blocks[#blocks+1] = b
+      blkidx[name] = #blocks - 1
+   end
+
+   mapblocks(
+      function(btab)
+	 add_block(get_ubx_block(nd, btab))
+	 modelblks[btab._fqn] = true
+      end, self)
+
+   for _,b in ipairs(blocks) do
+      ubx.configs_map(b, function(c) preinit[safets(b.name).."."..safets(c.name)] = true end)
+   end
+
+   -- the configs set by the model
+   local modelcfgs = {}
+   mapconfigs(
+      function(cfg)
+	 for name,_ in pairs(cfg.config) do modelcfgs[cfg._tgt._fqn.."."..name] = true end
+      end, self)
+
    _NC = build_nodecfg_tab(nd, self)
    configure_blocks(nd, self, _NC)
    connect_blocks(nd, self)
-   late_checks(t, nd)
 
-   if not t.nostart then system.startup(self, nd) end
+   -- add the blocks created during connect (i.e. iblocks)
+   ubx.blocks_map(nd, add_block, ubx.is_instance)
 
-   return nd
+   if #blocks == 0 then
+      ubx.node_rm(nd)
+      error("cgen: system has no blocks")
+   end
+
+   local function blkvar(name)
+      if not blkidx[name] then error("cgen: unknown block "..name) end
+      return fmt("blk[%d]", blkidx[name])
+   end
+
+   -- struct types known to the node
+   local struct_types = {}
+   ubx.types_foreach(nd,
+		     function(typ) struct_types[safets(typ.name)] = typ end,
+		     function(typ) return typ.type_class == ffi.C.TYPE_CLASS_STRUCT end)
+
+   local structs, structs_done = {}, {}
+
+   -- emit a struct type declaration including its dependencies
+   local function use_type(typ)
+      local name = safets(typ.name)
+      if typ.type_class ~= ffi.C.TYPE_CLASS_STRUCT or structs_done[name] then return end
+      structs_done[name] = true
+      local decl = cgen_struct_decl(typ, struct_types)
+      for tag in decl:gmatch("struct%s+"..CGEN_PFX.."([%w_]+)") do
+	 local dep = struct_types["struct "..tag]
+	 if dep then use_type(dep) end
+      end
+      structs[#structs+1] = decl
+   end
+
+   -- generate the statements to set all configs
+   local early, late, shared = {}, {}, {}
+
+   for _,b in ipairs(blocks) do
+      local bname = safets(b.name)
+      local modelblk = modelblks[bname]
+
+      ubx.configs_map(b, function(c)
+	 local cname = safets(c.name)
+	 local cfqn = bname.."."..cname
+
+	 -- skip unconfigured configs and configs of model blocks
+	 -- not set by the model
+	 if c.value == nil or c.value.len == 0 then return end
+	 if modelblk and not modelcfgs[cfqn] then return end
+
+	 -- blocks created during connect are configured before init
+	 local out = (preinit[cfqn] or not modelblk) and early or late
+	 local vkey = ts(ffi.cast("void*", c.value))
+
+	 -- shared node config data
+	 if shared[vkey] then
+	    out[#out+1] = fmt("\tif (usc_cfg_share(%s, %s, %s, %s))\n\t\tgoto out;\n",
+			      blkvar(bname), cgen_str(cname),
+			      blkvar(shared[vkey].bname), cgen_str(shared[vkey].cname))
+	    return
+	 end
+	 shared[vkey] = { bname=bname, cname=cname }
+
+	 use_type(c.type)
+
+	 local ctname = cgen_type_name(c.type)
+	 local d = c.value
+	 local len = tonumber(d.len)
+	 local dptr = ubx.data_to_cdata(d)
+	 local inits = {}
+
+	 if c.type.type_class == ffi.C.TYPE_CLASS_BASIC and safets(c.type.name) == 'char' then
+	    inits = { cgen_str(ffi.string(d.data, len):match("^[^%z]*")) }
+	 else
+	    local refct = reflect.typeof(dptr).element_type
+	    for j=0,len-1 do inits[#inits+1] = cgen_init(dptr[j], refct, blkvar) end
+	    inits = { "{ "..concat(inits, ", ").." }" }
+	 end
+
+	 out[#out+1] = fmt("\t{\n\t\t%s v[%d] = %s;\n\n"..
+			      "\t\tif (usc_cfg_set(%s, %s, %s, sizeof(v[0]), v, %d))\n"..
+			      "\t\t\tgoto out;\n\t}\n",
+			   ctname, len, inits[1], blkvar(bname), cgen_str(cname),
+			   cgen_str(safets(c.type.name)), len)
+      end)
+   end
+
+   -- connections
+   local conns = {}
+   for _,b in ipairs(blocks) do
+      ubx.ports_foreach(b, function(p)
+	 local pname = safets(p.name)
+	 local i = 0
+	 while p.out_interaction ~= nil and p.out_interaction[i] ~= nil do
+	    conns[#conns+1] = fmt("\tif (usc_connect(%s, %s, %s, 1))\n\t\tgoto out;\n",
+				  blkvar(safets(b.name)), cgen_str(pname),
+				  blkvar(safets(p.out_interaction[i].name)))
+	    i = i + 1
+	 end
+	 i = 0
+	 while p.in_interaction ~= nil and p.in_interaction[i] ~= nil do
+	    conns[#conns+1] = fmt("\tif (usc_connect(%s, %s, %s, 0))\n\t\tgoto out;\n",
+				  blkvar(safets(b.name)), cgen_str(pname),
+				  blkvar(safets(p.in_interaction[i].name)))
+	    i = i + 1
+	 end
+      end)
+   end
+
+   local blktab = {}
+   for _,b in ipairs(blocks) do
+      blktab[#blktab+1] = fmt("\t{ %s, %s },", cgen_str(safets(b.prototype.name)), cgen_str(safets(b.name)))
+   end
+
+   local attrs = {}
+   if t.mlockall then attrs[#attrs+1] = "ND_MLOCK_ALL" end
+   if t.dumpable then attrs[#attrs+1] = "ND_DUMPABLE" end
+   if t.virtual_time then attrs[#attrs+1] = "ND_VIRTUAL_TIME" end
+   if t.prepare_rt then attrs[#attrs+1] = "ND_PREPARE_RT" end
+   if t.hugepages then attrs[#attrs+1] = "ND_HUGEPAGES" end
+
+   local modtab = {}
+   for _,m in ipairs(modules) do modtab[#modtab+1] = "\t"..cgen_str(m).."," end
+
+   local res, str = utils.preproc([=[
+/*
+ * generated by ubx-launch -compile
+ * model: $(model)
+ *
+ * DO NOT EDIT: regenerate from the model instead.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+
+#include <ubx/ubx.h>
+
+@ for _,s in ipairs(structs) do
+$(s)
+
+@ end
+static const char *modules[] = {
+@ for _,m in ipairs(modtab) do
+$(m)
+@ end
+};
+
+/* { type, name } of all blocks */
+static const char *blocks[][2] = {
+@ for _,b in ipairs(blktab) do
+$(b)
+@ end
+};
+
+/* set a config and check its type */
+static int usc_cfg_set(ubx_block_t *b, const char *name, const char *type_name,
+		       size_t elem_size, const void *val, long len)
+{
+	ubx_config_t *c = ubx_config_get(b, name);
+
+	if (c == NULL) {
+		ubx_err(b, "usc: no config %s", name);
+		return EINVALID_CONFIG;
+	}
+
+	if (strcmp(c->type->name, type_name) != 0 || (size_t)c->type->size != elem_size) {
+		ubx_err(b, "usc: config %s: type mismatch %s vs %s",
+			name, c->type->name, type_name);
+		return ETYPE_MISMATCH;
+	}
+
+	if (c->value->len != len && ubx_data_resize(c->value, len) != 0)
+		return EOUTOFMEM;
+
+	memcpy(c->value->data, val, elem_size * len);
+	return 0;
+}
+
+/* assign the value of config src.src_name to b.name (node configs) */
+static int usc_cfg_share(ubx_block_t *b, const char *name,
+			 ubx_block_t *src, const char *src_name)
+{
+	ubx_config_t *c = ubx_config_get(b, name);
+	ubx_config_t *csrc = ubx_config_get(src, src_name);
+
+	if (c == NULL || csrc == NULL) {
+		ubx_err(b, "usc: failed to share config %s", name);
+		return EINVALID_CONFIG;
+	}
+
+	return ubx_config_assign(c, csrc->value);
+}
+
+static int usc_connect(ubx_block_t *b, const char *pname, ubx_block_t *ib, int out)
+{
+	ubx_port_t *p = ubx_port_get(b, pname);
+
+	if (p == NULL) {
+		ubx_err(b, "usc: no port %s", pname);
+		return EINVALID_PORT;
+	}
+
+	return out ? ubx_port_connect_out(p, ib) : ubx_port_connect_in(p, ib);
+}
+
+int main(void)
+{
+	int ret = EXIT_FAILURE;
+	unsigned int i;
+	ubx_node_t nd;
+	ubx_block_t *blk[ARRAY_SIZE(blocks)];
+
+	memset(&nd, 0x0, sizeof(nd));
+	nd.loglevel = $(loglevel);
+
+	if (ubx_node_init(&nd, $(nodename), $(attrs)) != 0) {
+		fprintf(stderr, "failed to init node\n");
+		exit(EXIT_FAILURE);
+	}
+
+@ if data_pool > 0 then
+	if (ubx_data_pool_init(&nd, $(data_pool)) != 0)
+		goto out;
+
+@ end
+
+	for (i = 0; i < ARRAY_SIZE(modules); i++) {
+		if (ubx_module_load(&nd, modules[i]) != 0) {
+			ubx_log(UBX_LOGLEVEL_ERR, &nd, __func__, "failed to load module %s", modules[i]);
+			goto out;
+		}
+	}
+
+	for (i = 0; i < ARRAY_SIZE(blocks); i++) {
+		blk[i] = ubx_block_create(&nd, blocks[i][0], blocks[i][1]);
+		if (blk[i] == NULL) {
+			ubx_log(UBX_LOGLEVEL_ERR, &nd, __func__, "failed to create block %s", blocks[i][1]);
+			goto out;
+		}
+	}
+
+	/* configure */
+@ for _,c in ipairs(early) do
+$(c)
+@ end
+	for (i = 0; i < ARRAY_SIZE(blocks); i++) {
+		if (ubx_block_init(blk[i]) != 0) {
+			ubx_log(UBX_LOGLEVEL_ERR, &nd, __func__, "failed to init block %s", blocks[i][1]);
+			goto out;
+		}
+	}
+
+	/* configs created during init */
+@ for _,c in ipairs(late) do
+$(c)
+@ end
+	/* connect */
+@ for _,c in ipairs(conns) do
+$(c)
+@ end
+@ if prepare_rt then
+	if (ubx_node_prepare_rt(&nd, $(heap_reserve)) < 0)
+		goto out;
+
+@ end
+	/* start all passive, then all active blocks */
+	for (i = 0; i < 2 * ARRAY_SIZE(blocks); i++) {
+		ubx_block_t *b = blk[i % ARRAY_SIZE(blocks)];
+		int active = (b->attrs & BLOCK_ATTR_ACTIVE) ? 1 : 0;
+
+		if (active != (int)(i / ARRAY_SIZE(blocks)) || b->block_state == BLOCK_STATE_ACTIVE)
+			continue;
+
+		if (ubx_block_start(b) != 0) {
+			ubx_log(UBX_LOGLEVEL_ERR, &nd, __func__, "failed to start block %s", b->name);
+			goto out;
+		}
+	}
+
+	ubx_wait_sigint(UINT_MAX);
+	ret = EXIT_SUCCESS;
+ out:
+	ubx_node_rm(&nd);
+	return ret;
+}
+]=], { ipairs=ipairs, table=table, structs=structs, modtab=modtab, blktab=blktab,
+       early=early, late=late, conns=conns,
+       model=t.model or "", nodename=cgen_str(t.nodename),
+       loglevel=t.loglevel or 0,
+       attrs=(#attrs > 0) and concat(attrs, " | ") or "0",
+       prepare_rt=t.prepare_rt, heap_reserve=t.rt_heap_reserve or 0,
+       data_pool=t.data_pool or 0 })
+
+   if not res then error("cgen: failed to generate C code: "..ts(str)) end
+
+   ubx.node_rm(nd)
+   return str
 end
 
 -- exports
 M.is_system = is_system
+M.plan_tostr = plan_tostr
 M.system = system
 M.system_spec = system_spec
 M.load = load
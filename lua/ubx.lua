@@ -136,6 +136,71 @@ local ubx = nil
 local prefixes = { "/usr", "/usr/local" }
 local core_prefix = nil
 
+--- Return the directory for caching the preprocessed FFI headers.
+-- Can be overridden with UBX_FFI_CACHE. An empty UBX_FFI_CACHE
+-- disables caching.
+-- @return directory or nil
+local function ffi_cache_dir()
+   local dir = os.getenv("UBX_FFI_CACHE")
+   if dir then
+      if dir == "" then return nil end
+      return dir
+   end
+   local base = os.getenv("XDG_CACHE_HOME")
+   if not base then
+      local home = os.getenv("HOME")
+      if not home then return nil end
+      base = home.."/.cache"
+   end
+   return base.."/microblx"
+end
+
+--- Return the preprocessed headers, either from the cache or by
+-- preprocessing and caching them.
+-- The cache file is keyed by the ubx_version and the md5 of the raw
+-- headers, so that a rebuild with changed headers is never served a
+-- stale cache entry.
+-- @param lib ffi library handle of libubx
+-- @param raw concatenated raw headers
+-- @return preprocessed headers string
+local function ffi_headers_get(lib, raw)
+   local dir = ffi_cache_dir()
+   if not dir then return preproc(raw) end
+
+   -- private declarations which don't collide with the headers
+   ffi.cdef [[
+   const char *__ubx_ffi_cache_version(void) __asm__("ubx_version");
+   void __ubx_ffi_cache_md5(const unsigned char *input, int len, unsigned char output[16]) __asm__("md5");
+   ]]
+
+   local hash = ffi.new("unsigned char[16]")
+   lib.__ubx_ffi_cache_md5(raw, #raw, hash)
+
+   local file = fmt("%s/ffi-%s-%s.h", dir,
+		    ffi.string(lib.__ubx_ffi_cache_version()),
+		    utils.str_to_hexstr(ffi.string(hash, 16)))
+
+   local f = io.open(file, "rb")
+   if f then
+      local hdr = f:read("*all")
+      f:close()
+      return hdr
+   end
+
+   local hdr = preproc(raw)
+
+   -- cache is best effort: write to tmp file and rename atomically
+   os.execute(fmt("mkdir -p '%s' 2>/dev/null", dir))
+   local tmp = fmt("%s.%d.%s.tmp", file, os.time(), string.sub(ts({}), 8))
+   f = io.open(tmp, "wb")
+   if f then
+      f:write(hdr)
+      f:close()
+      os.rename(tmp, file)
+   end
+   return hdr
+end
+
 
 --- Load ubx into the luajit ffi
 local function load_ubx_ffi()
@@ -167,12 +232,14 @@ local function load_ubx_ffi()
    void *realloc(void *ptr, size_t size);
    ]]
 
-   -- load headers and ubx lib
+   -- load ubx lib and headers
+   ubx = ffi.load(core_prefix.."/"..ubx_ffi_lib)
+
+   local raw = {}
    for _,h in ipairs(ubx_ffi_headers) do
-      ffi.cdef(preproc(read_file(core_prefix.."/"..h)))
+      raw[#raw+1] = read_file(core_prefix.."/"..h)
    end
-
-   ubx = ffi.load(core_prefix.."/"..ubx_ffi_lib)
+   ffi.cdef(ffi_headers_get(ubx, concat(raw, "\n")))
 
    setmetatable(M, { __index=function(t,k) return ubx["ubx_"..k] end })
    M.ubx = ubx
@@ -263,6 +330,28 @@ function M.clock_mono_gettime(ts)
    return ts
 end
 
+--- Retrieve the current time of the node clock.
+-- This is the virtual time for nodes created with virtual_time.
+-- @param nd node
+-- @param ts struct ubx_timespec out parameter (optional)
+-- @return struct ubx_timespec with current time
+function M.node_gettime(nd, ts)
+   ts = ts or ffi.new("struct ubx_timespec")
+   ubx.ubx_node_gettime(nd, ts)
+   return ts
+end
+
+--- Sleep on the node clock.
+-- For nodes with virtual time, this returns as soon as the virtual
+-- time has advanced by the given duration.
+-- @param nd node
+-- @param sec seconds (may be fractional)
+function M.node_sleep(nd, sec)
+   local s = math.floor(sec)
+   local ts = ffi.new("struct ubx_timespec", s, (sec - s) * time.ns_per_s)
+   ubx.ubx_node_nanosleep(nd, 0, ts)
+end
+
 local function to_sec(sec, nsec)
    return tonumber(sec)+tonumber(nsec)/time.ns_per_s
 end
@@ -314,8 +403,14 @@ function M.node_create(name, params)
    local attrs=0
    if params.mlockall then attrs = bit.bor(attrs, ffi.C.ND_MLOCK_ALL) end
    if params.dumpable then attrs = bit.bor(attrs, ffi.C.ND_DUMPABLE) end
+   if params.virtual_time then attrs = bit.bor(attrs, ffi.C.ND_VIRTUAL_TIME) end
+   if params.prepare_rt then attrs = bit.bor(attrs, ffi.C.ND_PREPARE_RT) end
+   if params.hugepages then attrs = bit.bor(attrs, ffi.C.ND_HUGEPAGES) end
    if params.loglevel then nd.loglevel = params.loglevel end
    assert(ubx.ubx_node_init(nd, name, attrs)==0, "node_create failed")
+   if params.data_pool then
+      assert(ubx.ubx_data_pool_init(nd, params.data_pool)==0, "data_pool_init failed")
+   end
    return nd
 end
 
@@ -336,7 +431,8 @@ function M.load_module(nd, libfile)
 	    error(red("loading module ", true)..magenta(modpath)..red(" failed", true))
 	 end
 	 info(nd, "lua", "loaded module "..modpath)
-	 M.ffi_load_types(nd)
+	 if M.lazy_types then M.ffi_register_types(nd)
+	 else M.ffi_load_types(nd) end
 	 return modpath
       end
    end
@@ -372,6 +468,122 @@ function M.node_cleanup(nd)
    collectgarbage("collect")
 end
 
+--- Write a snapshot image of a configured node.
+-- All blocks must be in state preinit or inactive.
+-- @param nd node info
+-- @param file image file to write
+function M.node_snapshot(nd, file)
+   local ret = ubx.ubx_node_snapshot(nd, file)
+   if ret ~= 0 then
+      error("node_snapshot failed: "..(M.retval_tostr[ret] or ts(ret)))
+   end
+end
+
+--- Restore a snapshot image into a node.
+-- Loads modules, creates, configures, initializes and connects all
+-- blocks of the image. Blocks are not started.
+-- @param nd node info
+-- @param file image file created by node_snapshot
+function M.node_restore(nd, file)
+   local ret = ubx.ubx_node_restore(nd, file)
+   if ret ~= 0 then
+      error("node_restore failed: "..(M.retval_tostr[ret] or ts(ret)))
+   end
+   if M.lazy_types then M.ffi_register_types(nd)
+   else M.ffi_load_types(nd) end
+end
+
+--- Prepare a configured node for realtime operation.
+-- Tunes malloc, reserves heap and prefaults the buffers registered
+-- by the blocks. Should be called before starting the node.
+-- @param nd node info
+-- @param heap_reserve bytes of heap to reserve (default: 0)
+-- @return number of bytes prefaulted
+function M.node_prepare_rt(nd, heap_reserve)
+   local ret = tonumber(ubx.ubx_node_prepare_rt(nd, heap_reserve or 0))
+   if ret < 0 then
+      error("node_prepare_rt failed: "..(M.retval_tostr[ret] or ts(ret)))
+   end
+   return ret
+end
+
+--- Get the statistics of the ubx_data pool of a node.
+-- @param nd node info
+-- @return table with fields size, used, in_use, peak (bytes) and
+-- allocs, sys_allocs, failed or nil if the node has no data pool
+function M.data_pool_stats(nd)
+   local st = ffi.new("struct ubx_data_pool_stats")
+   if ubx.ubx_data_pool_stats(nd, st) ~= 0 then return end
+   return {
+      size=tonumber(st.size), used=tonumber(st.used),
+      in_use=tonumber(st.in_use), peak=tonumber(st.peak),
+      allocs=tonumber(st.allocs), sys_allocs=tonumber(st.sys_allocs),
+      failed=tonumber(st.failed),
+   }
+end
+
+local function mem_pages(attrs)
+   if bit.band(attrs, ffi.C.MEM_ATTR_HUGETLB) ~= 0 then return "hugetlb"
+   elseif bit.band(attrs, ffi.C.MEM_ATTR_THP) ~= 0 then return "thp" end
+   return "regular"
+end
+
+--- Get the memory regions of a block.
+-- These are the buffers registered with ubx_block_mem_register or
+-- allocated with ubx_block_mem_alloc.
+-- @param b block
+-- @return list of { len=, pages=, arena= } tables, pages is one of
+-- "hugetlb", "thp" or "regular", arena is the name of the arena the
+-- region was carved from (if any)
+function M.block_mem_regions(b)
+   local res = {}
+   local r = b.mem_regions
+   while r ~= nil do
+      local arena
+      if bit.band(r.attrs, ffi.C.MEM_ATTR_ARENA) ~= 0 then
+	 arena = M.safe_tostr(b.mem_arena.name)
+      end
+      res[#res+1] = { len=tonumber(r.len), pages=mem_pages(r.attrs), arena=arena }
+      r = r.next
+   end
+   return res
+end
+
+--- Create a memory arena for block buffers.
+-- @param nd node info
+-- @param name name of the arena
+-- @param len size in bytes
+-- @return arena
+function M.mem_arena_create(nd, name, len)
+   local a = ubx.ubx_mem_arena_create(nd, name, len)
+   if a == nil then error("mem_arena_create: failed to create arena "..ts(name)) end
+   return a
+end
+
+--- Assign a block to a memory arena.
+-- Must be called before initializing the block.
+-- @param b block
+-- @param arena arena created with mem_arena_create
+function M.block_mem_arena_set(b, arena)
+   if ubx.ubx_block_mem_arena_set(b, arena) ~= 0 then
+      error("block_mem_arena_set: failed to set arena of "..M.safe_tostr(b.name))
+   end
+end
+
+--- Get the memory arenas of a node.
+-- @param nd node info
+-- @return list of { name=, len=, used=, pages= } tables
+function M.mem_arenas(nd)
+   local res = {}
+   local a = nd.mem_arenas
+   while a ~= nil do
+      res[#res+1] = { name=M.safe_tostr(a.name), len=tonumber(a.len),
+		      used=tonumber(a.used), pages=mem_pages(a.attrs) }
+      a = a.next
+   end
+   return res
+end
+
 --- Create a new computational block.
 -- @param nd node_info ptr
 -- @param type of block to create
@@ -733,34 +945,83 @@ function M.data_alloc(nd, type_name, num)
    return M.__data_alloc(t, num)
 end
 
---- Load the registered C types into the luajit ffi.
--- @param nd node_info_t*
-function M.ffi_load_types(nd)
+--- Registry of struct types known to the luajit ffi.
+-- ffi_types maps a type name to the (not yet preprocessed) struct
+-- definition as long as it has not been cdef'd and to true
+-- afterwards. Types are only cdef'd on first use via M.ctypes or
+-- type_to_ctype, so that launching does not pay for cdef'ing all
+-- registered types in every Lua state.
+local ffi_types = {}
 
-   local function ffi_struct_type_is_loaded(t)
-      return pcall(ffi.typeof, ffi.string(t.name))
+--- cdef a registered struct type (and the types it depends on).
+-- @param name type name
+local function ffi_type_load(name)
+   local def = ffi_types[name]
+   if def == nil or def == true then return end
+   ffi_types[name] = true
+
+   -- already defined elsewhere (e.g. by the core headers)?
+   if pcall(ffi.typeof, name) then return end
+
+   local struct_str = preproc(def)
+
+   -- load dependencies first, they are referenced either by
+   -- struct tag or by typedef name
+   for id in struct_str:gmatch("[%a_][%w_]*") do
+      if ffi_types["struct "..id] then ffi_type_load("struct "..id)
+      elseif id ~= name and ffi_types[id] then ffi_type_load(id) end
    end
 
-   local function ffi_load_no_ns(t)
-      if t.type_class==ubx.TYPE_CLASS_STRUCT and t.private_data~=nil then
-	 local struct_str = preproc(ffi.string(t.private_data))
-	 local ret, err = pcall(ffi.cdef, struct_str)
-	 if ret==false then
-	    error(fmt("loading type %s: %s", M.safe_tostr(t.name), err))
-	 end
-      end
+   local ret, err = pcall(ffi.cdef, struct_str)
+   if ret==false then
+      error(fmt("loading type %s: %s", name, err))
+   end
+end
+
+--- Lazily loaded ffi ctypes of registered types
+-- Indexing with a type name will cdef the type if required and
+-- return its ffi ctype, e.g. ubx.ctypes["struct kdl_vector"]
+M.ctypes = setmetatable({}, {
+   __index = function(tab, name)
+      ffi_type_load(name)
+      local ct = ffi.typeof(name)
+      rawset(tab, name, ct)
+      return ct
    end
+})
 
-   local typ_list = {}
+--- Register the node's struct types with the ffi type registry.
+-- This does not cdef the types. That happens lazily on first use.
+-- @param nd node
+function M.ffi_register_types(nd)
    M.types_foreach(nd,
-		   function (typ) typ_list[#typ_list+1] = typ end,
-		   function(t) return
-			 t.type_class==ffi.C.TYPE_CLASS_STRUCT and
-			 (not ffi_struct_type_is_loaded(t))
+		   function (t)
+		      ffi_types[ffi.string(t.name)] = ffi.string(t.private_data)
+		   end,
+		   function(t)
+		      return t.type_class==ffi.C.TYPE_CLASS_STRUCT and
+			 t.private_data~=nil and
+			 ffi_types[ffi.string(t.name)] == nil
 		   end)
+end
+
+--- If true, load_module only registers types instead of cdef'ing them
+-- eagerly. Lazy loading is transparent for types used through the
+-- ubx API and M.ctypes, however using an unloaded type directly via
+-- ffi (e.g. ffi.new("struct foo")) requires ffi_load_types first.
+M.lazy_types = false
+
+--- Load the registered C types into the luajit ffi.
+-- @param nd node_info_t*
+function M.ffi_load_types(nd)
+   M.ffi_register_types(nd)
 
-   table.sort(typ_list, function (tr1,tr2) return tr1.seqid<tr2.seqid end)
-   utils.foreach(ffi_load_no_ns, typ_list)
+   local pending = {}
+   for name,def in pairs(ffi_types) do
+      if def ~= true then pending[#pending+1] = name end
+   end
+   table.sort(pending)
+   utils.foreach(ffi_type_load, pending)
 end
 
 
@@ -784,16 +1045,7 @@ function M.data_tolua(d)
    if d.type.type_class==ubx.TYPE_CLASS_BASIC and len>1 and M.safe_tostr(d.type.name)=='char' then
       res=M.safe_tostr(d.data)
    else
-      local ptrname
-      -- TODO: simplify this and pcall ffi.new. If it fails, the type
-      -- is probably unknown, and running ubx.ffi_load_types may help.
-
-      if d.type.type_class==ubx.TYPE_CLASS_STRUCT then
-	 ptrname = ffi.string(d.type.name).."*"
-      else -- BASIC:
-	 ptrname = ffi.string(d.type.name).."*"
-      end
-      local dptr = ffi.new(ptrname, d.data)
+      local dptr = ffi.cast(M.type_to_ctype(d.type, true), d.data)
 
       if len>1 then
 	 res = {}
@@ -837,10 +1089,19 @@ local function type_to_ctype_str(t, ptr, fixed_len)
    error("__type_to_ctype_str: unknown type_class")
 end
 
--- memoize?
+-- memoized ctypes, indexed by ctype string
+local ctype_cache = {}
+
 function M.type_to_ctype(t, ptr, fixed_len)
    local ctstr=type_to_ctype_str(t, ptr, fixed_len)
-   return ffi.typeof(ctstr)
+   local ct = ctype_cache[ctstr]
+   if ct then return ct end
+   if t.type_class==ffi.C.TYPE_CLASS_STRUCT then
+      ffi_type_load(ffi.string(t.name))
+   end
+   ct = ffi.typeof(ctstr)
+   ctype_cache[ctstr] = ct
+   return ct
 end
 
 --- Transform an ubx_data_t* to a lua FFI ctype
@@ -884,6 +1145,13 @@ function M.data_set(d, val, resize)
    local val_type=type(val)
 
    if val_type=='table' then
+      -- resize once for the array part instead of once per element
+      local arrlen = (val[0] == nil) and #val or #val+1
+      if resize and arrlen > d.len then
+	 M.data_resize(d, arrlen)
+	 d_cdata = M.data_to_cdata(d)
+      end
+
       for k,v in pairs(val) do
 	 if type(k)~='number' then
 	    if d.len < 1 then
@@ -994,10 +1262,38 @@ function M.config_isnull(c)
    return M.data_isnull(c.value)
 end
 
+--- Publish a new configuration value.
+-- Instead of modifying the current value in place, a copy is
+-- created, updated with val and atomically swapped in (see
+-- ubx_config_publish). This is safe for configs of running blocks
+-- that load them with ubx_config_acquire (see CONFIG_ATTR_RUNTIME).
+-- @param c config
+-- @param val value to assign (must follow luajit FFI initialization rules)
+-- @return cdata ptr of the contained type
+function M.config_publish(c, val)
+   local old = c.value
+   local d = M.__data_alloc(c.type, tonumber(old.len))
+   if old.len > 0 then ffi.copy(d.data, old.data, M.data_size(old)) end
+   local ptr = M.data_set(d, val, true)
+   local ret = ubx.ubx_config_publish(c, d)
+   if ret ~= 0 then
+      error(fmt("config_publish: failed to publish %s.%s: %s",
+		M.safe_tostr(c.block.name), M.safe_tostr(c.name),
+		M.retval_tostr[ret] or ts(ret)))
+   end
+   return ptr
+end
+
 --- Set a configuration value
+-- Configs with CONFIG_ATTR_RUNTIME of active blocks are updated using
+-- config_publish, all others are modified in place.
 -- @param c config
 -- @param val value to assign (must follow luajit FFI initialization rules)
 function M.config_set(c, val)
+   if c.block.block_state == ffi.C.BLOCK_STATE_ACTIVE and
+      bit.band(c.attrs, ffi.C.CONFIG_ATTR_RUNTIME) ~= 0 then
+      return M.config_publish(c, val)
+   end
    return M.data_set(c.value, val, true)
 end
 
@@ -1007,10 +1303,10 @@ end
 -- @param name name of configuration value
 -- @param val value to assign (must follow luajit FFI initialization rules)
 function M.set_config(b, name, val)
-   local d = ubx.ubx_config_get_data(b, name)
-   if d == nil then error("set_config: unknown config '"..name.."'") end
+   local c = ubx.ubx_config_get(b, name)
+   if c == nil then error("set_config: unknown config '"..name.."'") end
    -- print("configuring ".. ffi.string(b.name).."."..name.." with value "..utils.tab2str(val))
-   return M.data_set(d, val, true)
+   return M.config_set(c, val)
 end
 
 --- Configure a block with a table of configuration values.
@@ -1242,6 +1538,96 @@ function M.port_write_read(p, wdat, rdat)
    return M.port_read(p, rdat)
 end
 
+------------------------------------------------------------------------------
+--                   Pre-bound port objects
+------------------------------------------------------------------------------
+
+-- A port object caches the read and write samples of a port together
+-- with typed views of their payload. In steady state, reading and
+-- writing boils down to a direct FFI call of __port_read or
+-- __port_write without any allocation, so that these calls can be
+-- compiled into traces. The views remain owned by the port object
+-- and are overwritten by the next read, respectively write.
+
+local port_obj_mt = {}
+port_obj_mt.__index = port_obj_mt
+
+--- Read a sample into the cached read sample.
+-- @param po port object
+-- @return number of elements read (<=0 if no data)
+-- @return typed cdata view of the cached sample
+function port_obj_mt.read(po)
+   return tonumber(ubx.__port_read(po.port, po.rsample)), po.rdata
+end
+
+--- Write a value via the cached write sample.
+-- If val is nil, the current content of the write view po.wdata is
+-- written. Numbers and cdata values are assigned to the first
+-- element, strings are copied into char arrays and tables are
+-- assigned element by element.
+-- @param po port object
+-- @param val value to write (optional)
+function port_obj_mt.write(po, val)
+   local wdata = po.wdata
+   local vt = type(val)
+
+   if vt == 'number' then
+      wdata[0] = val
+   elseif vt == 'cdata' then
+      if M.is_data(val) then
+	 ubx.__port_write(po.port, val)
+	 return
+      end
+      wdata[0] = val
+   elseif vt == 'string' then
+      if #val >= po.wlen then
+	 error(fmt("port_obj %s: string of len %d exceeds sample len %d",
+		   po.name, #val, po.wlen))
+      end
+      ffi.copy(wdata, val)
+   elseif vt == 'table' then
+      if val[1] ~= nil then
+	 for i=1,#val do wdata[i-1] = val[i] end
+      else
+	 for k,v in pairs(val) do wdata[0][k] = v end
+      end
+   elseif val ~= nil then
+      error(fmt("port_obj %s: can't write value of type %s", po.name, vt))
+   end
+   ubx.__port_write(po.port, po.wsample)
+end
+
+function port_obj_mt.__tostring(po)
+   return "port_obj: "..po.name
+end
+
+--- Bind a port to a port object.
+-- The samples are allocated once here and reused by all subsequent
+-- po:read() and po:write() calls.
+-- @param p ubx_port_t
+-- @param rlen array len of the read sample (default: in_data_len)
+-- @param wlen array len of the write sample (default: out_data_len)
+-- @return port object
+function M.port_bind(p, rlen, wlen)
+   if not M.is_port(p) then error("port_bind: invalid port") end
+
+   local po = { port=p, name=M.safe_tostr(p.name) }
+
+   if M.is_inport(p) then
+      po.rsample = M.__data_alloc(p.in_type, rlen or p.in_data_len)
+      po.rdata = M.data_to_cdata(po.rsample)
+      po.rlen = tonumber(po.rsample.len)
+   end
+
+   if M.is_outport(p) then
+      po.wsample = M.__data_alloc(p.out_type, wlen or p.out_data_len)
+      po.wdata = M.data_to_cdata(po.wsample)
+      po.wlen = tonumber(po.wsample.len)
+   end
+
+   return setmetatable(po, port_obj_mt)
+end
+
 function M.port_out_size(p)
    if p==nil then error("port_out_size: port is nil") end
    if not M.is_outport(p) then error("port "..M.safe_tostr(p.name).." is not an outport") end
@@ -1338,6 +1724,7 @@ local ubx_port_mt = {
       read = M.port_read,
       write_read = M.port_write_read,
       read_timed = M.port_read_timed,
+      bind = M.port_bind,
    },
 }
 ffi.metatype("struct ubx_port", ubx_port_mt)
@@ -1654,7 +2041,8 @@ end
 -- @param iblock_type type of interaction to use
 -- @param configuration for interaction.
 -- @param dont_start if true, then don't start the interaction (stays stopped)
-function M.conn_uni(b1, pname1, b2, pname2, iblock_type, iblock_config, dont_start)
+-- @param mem_arena optional arena to allocate the interaction buffers from
+function M.conn_uni(b1, pname1, b2, pname2, iblock_type, iblock_config, dont_start, mem_arena)
    local p1, p2, nd, bname1, bname2
 
    if b1==nil or b2==nil then error("parameter 1 or 3 (ubx_block_t) is nil") end
@@ -1678,6 +2066,7 @@ function M.conn_uni(b1, pname1, b2, pname2, iblock_type, iblock_config, dont_sta
    -- create iblock, configure
    local ib = M.block_create(nd, iblock_type, iblock_name, iblock_config)
 
+   if mem_arena then M.block_mem_arena_set(ib, mem_arena) end
    M.block_init(ib)
 
    if M.ports_connect(p1, p2, ib) ~= 0 then
@@ -1709,7 +2098,8 @@ end
 -- @param pname2 name of port2
 -- @param element_num number of elements
 -- @param dont_start if true, interaction will not be started
-function M.conn_lfds_cyclic(b1, pname1, b2, pname2, element_num, dont_start)
+-- @param mem_arena optional arena to allocate the buffer from
+function M.conn_lfds_cyclic(b1, pname1, b2, pname2, element_num, dont_start, mem_arena)
    local p1, p2, len1, len2
 
    if b1==nil then error("conn_lfds_cyclic: block (arg 1) is nil") end
@@ -1751,7 +2141,7 @@ function M.conn_lfds_cyclic(b1, pname1, b2, pname2, element_num, dont_start)
    return M.conn_uni(b1, pname1, b2, pname2, "lfds_buffers/cyclic",
 		     { buffer_len=element_num,
 		       type_name=M.safe_tostr(p1.out_type.name),
-		       data_len=utils.min(len1, len2) }, dont_start)
+		       data_len=utils.min(len1, len2) }, dont_start, mem_arena)
 end
 
 --- Build a table of connections
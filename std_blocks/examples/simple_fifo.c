@@ -77,7 +77,8 @@ static int fifo_init(ubx_block_t *i)
 		goto out_free_priv_data;
 	}
 
-	bbi->buff = malloc(bbi->size);
+	/* carved from the block's memory arena if it has one */
+	bbi->buff = ubx_block_mem_alloc(i, bbi->size, 0);
 	if (bbi->buff == NULL) {
 		ubx_err(i, "failed to allocate fifo");
 		goto out_free_priv_data;
@@ -102,7 +103,7 @@ static void fifo_cleanup(ubx_block_t *i)
 {
 	struct fifo_block_info *bbi = (struct fifo_block_info *)i->private_data;
 
-	free(bbi->buff);
+	ubx_block_mem_free(i, bbi->buff);
 	free(bbi);
 }
 
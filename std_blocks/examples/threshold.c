@@ -118,7 +118,7 @@ void thres_step(ubx_block_t *b)
 			  *inf->threshold,
 			  (state == 1) ? "rising" : "falling");
 		ev.dir = state;
-		ubx_gettime(&ev.ts);
+		ubx_node_gettime(b->nd, &ev.ts);
 		write_thres_event(inf->pevent, &ev);
 	}
 
@@ -28,6 +28,7 @@ ubx_proto_config_t cyclic_config[] = {
 	{ .name = "buffer_len", .type_name = "uint32_t", .min = 1, .max = 1, .doc = "max number of data elements the buffer shall hold" },
 	{ .name = "allow_partial", .type_name = "int", .min = 0, .max = 1, .doc = "allow msgs with len<data_len. def: 0 (no)" },
 	{ .name = "loglevel_overruns", .type_name = "int", .min = 0, .max = 1, .doc = "loglevel for reporting overflows (default: NOTICE, -1 to disable)" },
+	{ .name = "hugepages", .type_name = "int", .min = 0, .max = 1, .doc = "back the ring by huge pages (default: 0, unless the node has ND_HUGEPAGES and the ring is large)" },
 	{ 0 },
 };
 
@@ -44,6 +45,11 @@ struct cyclic_block_info {
 	long buffer_len;		/* number of elements */
 
 	struct lfds611_ringbuffer_state *rbs;
+	long fill;			/* number of elements in rbs */
+
+	uint8_t *elems;			/* storage of the ring elements */
+	size_t elem_size;
+	long num_elems;			/* number of elements handed out */
 
 	int allow_partial;
 	unsigned long overruns;		/* stats */
@@ -60,16 +66,26 @@ int cyclic_data_elem_init(void **user_data, void *user_state)
 {
 	struct cyclic_block_info *inf = (struct cyclic_block_info *)user_state;
 
-	*user_data = calloc(1, inf->data_len * inf->type->size +
-			    sizeof(struct cyclic_elem_header));
+	/* the elements are taken from the contiguous storage allocated
+	 * in init, which should suffice for all. */
+	if (inf->num_elems <= inf->buffer_len) {
+		*user_data = inf->elems + inf->num_elems * inf->elem_size;
+		inf->num_elems++;
+	} else {
+		*user_data = calloc(1, inf->elem_size);
+	}
 
 	return (*user_data == NULL) ? 0 : 1;
 }
 
 void cyclic_data_elem_del(void *user_data, void *user_state)
 {
-	(void) user_state;
-	free(user_data);
+	struct cyclic_block_info *inf = (struct cyclic_block_info *)user_state;
+	uint8_t *elem = (uint8_t *)user_data;
+
+	if (elem < inf->elems ||
+	    elem >= inf->elems + (inf->buffer_len + 1) * inf->elem_size)
+		free(user_data);
 }
 
 
@@ -136,6 +152,23 @@ int cyclic_init(ubx_block_t *i)
 	ubx_debug(i, "alloc ringbuf of %lu x %s [%lu]",
 		  inf->buffer_len, type_name, inf->data_len);
 
+	/* read hugepages */
+	len = cfg_getptr_int(i, "hugepages", &ival);
+	assert(len >= 0);
+
+	/* storage for all elements (and one spare), aligned to 16
+	 * bytes. It is prefaulted when preparing for realtime. */
+	inf->elem_size = (inf->data_len * inf->type->size +
+			  sizeof(struct cyclic_elem_header) + 15) & ~15UL;
+
+	inf->elems = ubx_block_mem_alloc(i, (inf->buffer_len + 1) * inf->elem_size,
+					 (len > 0 && *ival) ? MEM_ATTR_HUGE : 0);
+
+	if (inf->elems == NULL) {
+		ret = EOUTOFMEM;
+		goto out_free_priv_data;
+	}
+
 	if (lfds611_ringbuffer_new(&inf->rbs, inf->buffer_len,
 				   cyclic_data_elem_init, inf) == 0) {
 		ubx_err(i, "EOUTOFMEM: ringbuf of %lu x %s [%lu]",
@@ -169,39 +202,45 @@ void cyclic_cleanup(ubx_block_t *i)
 
 	inf = (struct cyclic_block_info *)i->private_data;
 	lfds611_ringbuffer_delete(inf->rbs, cyclic_data_elem_del, inf);
+	ubx_block_mem_free(i, inf->elems);
 	free(inf);
 }
 
-/* write */
-void cyclic_write(ubx_block_t *i, const ubx_data_t *msg)
+/* check if msg can be stored in the buffer */
+static int cyclic_check_msg(ubx_block_t *i, const struct cyclic_block_info *inf,
+			    const ubx_data_t *msg)
 {
-	int ret;
-	long len;
-	struct cyclic_block_info *inf;
-	struct lfds611_freelist_element *elem;
-	struct cyclic_elem_header *hd;
-
-	inf = (struct cyclic_block_info *)i->private_data;
-
 	if (inf->type != msg->type) {
 		ubx_err(i, "invalid message type %s", msg->type->name);
-		goto out;
+		return EINVALID_TYPE;
 	}
 
 	if (inf->allow_partial) {
 		if (msg->len > inf->data_len) {
 			ubx_err(i, "msg array len too large: is: %lu, capacity: %lu",
 				msg->len, inf->data_len);
-			goto out;
+			return EINVALID_DATA_LEN;
 		}
 	} else {
 		if (msg->len != inf->data_len) {
 			ubx_err(i, "EINVALID_DATA_LEN: msg len %lu != data_len %lu",
 				msg->len, inf->data_len);
-			goto out;
+			return EINVALID_DATA_LEN;
 		}
 	}
 
+	return 0;
+}
+
+/* push a single (checked) sample */
+static void cyclic_push(ubx_block_t *i, struct cyclic_block_info *inf,
+			const void *data, long data_len)
+{
+	int ret;
+	long len;
+	struct lfds611_freelist_element *elem;
+	struct cyclic_elem_header *hd;
+
 	elem = lfds611_ringbuffer_get_write_element(inf->rbs, &elem, &ret);
 
 	if (ret) {
@@ -218,57 +257,142 @@ void cyclic_write(ubx_block_t *i, const ubx_data_t *msg)
 	/* write */
 	hd = lfds611_freelist_get_user_data_from_element(elem, NULL);
 
-	len = data_size(msg);
-	memcpy(hd->data, msg->data, len);
-	hd->data_len = msg->len;
+	len = data_len * inf->type->size;
+	memcpy(hd->data, data, len);
+	hd->data_len = data_len;
 
 	ubx_debug(i, "copying %ld bytes", len);
 
 	/* release element */
 	lfds611_ringbuffer_put_write_element(inf->rbs, elem);
 
- out:
-	return;
+	/* an overrun replaces the oldest element */
+	if (!ret)
+		__atomic_add_fetch(&inf->fill, 1, __ATOMIC_RELAXED);
 }
 
-/* where to check whether the msg->data len is long enough? */
-long cyclic_read(ubx_block_t *i, ubx_data_t *msg)
+/* pop a single sample, returns the array len or 0 if empty */
+static long cyclic_pop(ubx_block_t *i, struct cyclic_block_info *inf,
+		       void *data, long data_len)
 {
 	unsigned long readlen, readsz;
-	struct cyclic_block_info *inf;
 	struct lfds611_freelist_element *elem;
 	struct cyclic_elem_header *hd;
 
-	inf = (struct cyclic_block_info *)i->private_data;
-
-	if (inf->type != msg->type) {
-		ubx_err(i, "invalid message type %s", msg->type->name);
-		return EINVALID_TYPE;
-	}
-
 	if (lfds611_ringbuffer_get_read_element(inf->rbs, &elem) == NULL) {
 		return 0;
 	}
 
 	hd = lfds611_freelist_get_user_data_from_element(elem, NULL);
 
-	if (msg->len < hd->data_len) {
+	if (data_len < hd->data_len) {
 		ubx_err(i, "only copying %lu array elements of %lu",
-			msg->len, hd->data_len);
+			data_len, hd->data_len);
 	}
 
-	readlen = MIN(msg->len, hd->data_len);
+	readlen = MIN(data_len, hd->data_len);
 	readsz = inf->type->size * readlen;
 
 	ubx_debug(i, "%s: copying %ld bytes", i->name, readsz);
 
-	memcpy(msg->data, hd->data, readsz);
+	memcpy(data, hd->data, readsz);
 
 	lfds611_ringbuffer_put_read_element(inf->rbs, elem);
+	__atomic_sub_fetch(&inf->fill, 1, __ATOMIC_RELAXED);
 
 	return readlen;
 }
 
+/* write */
+void cyclic_write(ubx_block_t *i, const ubx_data_t *msg)
+{
+	struct cyclic_block_info *inf;
+
+	inf = (struct cyclic_block_info *)i->private_data;
+
+	if (cyclic_check_msg(i, inf, msg) != 0)
+		return;
+
+	cyclic_push(i, inf, msg->data, msg->len);
+}
+
+/* write num samples, checking the type and size only once */
+void cyclic_write_batch(ubx_block_t *i, const ubx_data_t *msg, long num)
+{
+	struct cyclic_block_info *inf;
+	const uint8_t *ptr = msg->data;
+
+	inf = (struct cyclic_block_info *)i->private_data;
+
+	if (cyclic_check_msg(i, inf, msg) != 0)
+		return;
+
+	for (long n = 0; n < num; n++, ptr += data_size(msg))
+		cyclic_push(i, inf, ptr, msg->len);
+}
+
+/* where to check whether the msg->data len is long enough? */
+long cyclic_read(ubx_block_t *i, ubx_data_t *msg)
+{
+	struct cyclic_block_info *inf;
+
+	inf = (struct cyclic_block_info *)i->private_data;
+
+	if (inf->type != msg->type) {
+		ubx_err(i, "invalid message type %s", msg->type->name);
+		return EINVALID_TYPE;
+	}
+
+	return cyclic_pop(i, inf, msg->data, msg->len);
+}
+
+/* read up to num samples */
+long cyclic_read_batch(ubx_block_t *i, ubx_data_t *msg, long num)
+{
+	long n;
+	struct cyclic_block_info *inf;
+	uint8_t *ptr = msg->data;
+
+	inf = (struct cyclic_block_info *)i->private_data;
+
+	if (inf->type != msg->type) {
+		ubx_err(i, "invalid message type %s", msg->type->name);
+		return EINVALID_TYPE;
+	}
+
+	for (n = 0; n < num; n++, ptr += data_size(msg)) {
+		if (cyclic_pop(i, inf, ptr, msg->len) == 0)
+			break;
+	}
+
+	return n;
+}
+
+/* number of samples that can be written without overrun */
+long cyclic_credits(ubx_block_t *i)
+{
+	long fill;
+	struct cyclic_block_info *inf;
+
+	inf = (struct cyclic_block_info *)i->private_data;
+	fill = __atomic_load_n(&inf->fill, __ATOMIC_RELAXED);
+
+	return (fill < inf->buffer_len) ? inf->buffer_len - fill : 0;
+}
+
+/* number of samples available for reading */
+long cyclic_pending(ubx_block_t *i)
+{
+	long fill;
+	struct cyclic_block_info *inf;
+
+	inf = (struct cyclic_block_info *)i->private_data;
+	fill = __atomic_load_n(&inf->fill, __ATOMIC_RELAXED);
+
+	/* a concurrent pop may be accounted before the push */
+	return (fill < 0) ? 0 : fill;
+}
+
 /* put everything together */
 ubx_proto_block_t cyclic_comp = {
 	.name = "lfds_buffers/cyclic",
@@ -283,6 +407,10 @@ ubx_proto_block_t cyclic_comp = {
 	/* iops */
 	.write = cyclic_write,
 	.read = cyclic_read,
+	.write_batch = cyclic_write_batch,
+	.read_batch = cyclic_read_batch,
+	.credits = cyclic_credits,
+	.pending = cyclic_pending,
 };
 
 int cyclic_mod_init(ubx_node_t *nd)
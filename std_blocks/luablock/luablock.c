@@ -8,8 +8,11 @@
 #include <lualib.h>
 #include <lua.h>
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
 
 #include "ubx.h"
 
@@ -17,6 +20,8 @@
 
 ubx_proto_port_t lua_ports[] = {
 	{ .name = "exec_str", .in_type_name = "char", .out_type_name = "int", .in_data_len = 16777216 },
+	{ .name = "gc_heap_kb", .out_type_name = "int", .doc = "Lua heap size in kB after the last step (of the whole state if lua_state is set)" },
+	{ .name = "gc_step_us", .out_type_name = "double", .doc = "duration of the GC step after the last step [us]" },
 	{ 0 }
 };
 
@@ -24,6 +29,14 @@ ubx_proto_config_t lua_conf[] = {
 	{ .name = "lua_file", .type_name = "char" },
 	{ .name = "lua_str", .type_name = "char" },
 	{ .name = "loglevel", .type_name = "int" },
+	{ .name = "ffi_step", .type_name = "int", .max = 1,
+	  .doc = "if 1, pass a table of pre-bound port objects to step (def: 0)" },
+	{ .name = "lua_state", .type_name = "char",
+	  .doc = "name of a Lua state shared with other luablocks triggered by the same thread" },
+	{ .name = "gc_step_kb", .type_name = "int", .max = 1,
+	  .doc = "if > 0, stop the automatic GC and run an incremental GC step of this size after each step (applies to the whole state if lua_state is set)" },
+	{ .name = "gc_budget_us", .type_name = "uint32_t", .max = 1,
+	  .doc = "if > 0, repeat GC steps after each step until this time budget is used (requires gc_step_kb)" },
 	{ 0 }
 };
 
@@ -32,10 +45,74 @@ char luablock_meta[] =
 	"  realtime=false,"
 	"}";
 
+/* hooks are resolved into registry references, so calling these
+ * does not require a lookup by name */
+enum luablock_hook {
+	HOOK_INIT,
+	HOOK_START,
+	HOOK_STEP,
+	HOOK_STOP,
+	HOOK_CLEANUP,
+	__HOOK_NUM
+};
+
+static const char *hook_names[] = {
+	[HOOK_INIT] = "init",
+	[HOOK_START] = "start",
+	[HOOK_STEP] = "step",
+	[HOOK_STOP] = "stop",
+	[HOOK_CLEANUP] = "cleanup",
+};
+
+/*
+ * Shared Lua states
+ *
+ * luablocks with the same lua_state config share one lua_State. Each
+ * block then runs in its own environment table, which falls back to
+ * the globals for reading, so that the libraries (and in particular
+ * ubx.lua with its FFI cdefs) are only loaded once. The blocks
+ * sharing a state must be triggered by the same thread, which is
+ * checked on the first step after starting. As the other hooks are
+ * called by the thread (de-)configuring the node, every use of a
+ * shared lua_State is serialized by its lock. Note that the GC of a
+ * shared state is shared too, so gc_step_kb of one block applies to
+ * all blocks of the state.
+ */
+struct lua_shared_state {
+	const ubx_node_t *nd;
+	char *name;
+	struct lua_State *L;
+	pthread_mutex_t lock;	/* serializes all use of L */
+	int refcnt;
+	int gc_stopped;	/* number of blocks that stopped the GC */
+	int num_active;	/* number of started blocks */
+	int owner_valid;
+	pthread_t owner;	/* thread stepping the blocks */
+	struct lua_shared_state *next;
+};
+
+static struct lua_shared_state *shared_states;
+static pthread_mutex_t shared_states_lock = PTHREAD_MUTEX_INITIALIZER;
+
 struct luablock_info {
 	struct ubx_node *ni;
 	struct lua_State *L;
+	struct lua_shared_state *shared;
+	int env_ref; /* block environment if shared, LUA_NOREF otherwise */
 	ubx_data_t *exec_str_buff;
+	const ubx_port_t *p_exec_str;
+	int hook_refs[__HOOK_NUM];
+	int ports_ref; /* table of pre-bound port objects for ffi_step */
+
+	int thread_checked; /* stepping thread checked since start */
+	int thread_ok;
+
+	/* GC control */
+	int gc_stopped;
+	int gc_step_kb;
+	uint32_t gc_budget_us;
+	ubx_port_t *p_gc_heap_kb;
+	ubx_port_t *p_gc_step_us;
 };
 
 const char *predef_hooks =
@@ -45,35 +122,214 @@ const char *predef_hooks =
 	"function stop(b) end\n"
 	"function cleanup(b) end\n";
 
+/* returns a function that creates a table of pre-bound port objects
+ * of the given block. exec_str is skipped to avoid allocating a
+ * second 16MB buffer. */
+const char *ffi_step_bind =
+	"return function(b)\n"
+	"   local ffi = require('ffi')\n"
+	"   local ubx = require('ubx')\n"
+	"   local ports = {}\n"
+	"   b = ffi.cast('ubx_block_t*', b)\n"
+	"   ubx.ffi_register_types(b.nd)\n"
+	"   ubx.ports_foreach(b,\n"
+	"      function(p) ports[ubx.safe_tostr(p.name)] = ubx.port_bind(p) end,\n"
+	"      function(p) return ubx.safe_tostr(p.name) ~= 'exec_str' end)\n"
+	"   return ports\n"
+	"end\n";
+
+/**
+ * push_env - push the block environment onto the stack
+ *
+ * @param inf
+ */
+static void push_env(struct luablock_info *inf)
+{
+	if (inf->env_ref != LUA_NOREF)
+		lua_rawgeti(inf->L, LUA_REGISTRYINDEX, inf->env_ref);
+	else
+		lua_pushvalue(inf->L, LUA_GLOBALSINDEX);
+}
+
+/**
+ * state_lock - lock the lua_State of a block if it is shared
+ *
+ * @param inf
+ */
+static void state_lock(struct luablock_info *inf)
+{
+	if (inf->shared)
+		pthread_mutex_lock(&inf->shared->lock);
+}
+
+static void state_unlock(struct luablock_info *inf)
+{
+	if (inf->shared)
+		pthread_mutex_unlock(&inf->shared->lock);
+}
+
+/**
+ * run_chunk - run the chunk on top of the stack in the block environment
+ *
+ * @param b
+ * @param loadret return value of the luaL_load* function
+ *
+ * @return 0 if Ok, non-zero otherwise. In this case, the error
+ * message is left on the stack.
+ */
+static int run_chunk(ubx_block_t *b, int loadret)
+{
+	struct luablock_info *inf = (struct luablock_info *)b->private_data;
+
+	if (loadret != 0)
+		return loadret;
+
+	if (inf->env_ref != LUA_NOREF) {
+		lua_rawgeti(inf->L, LUA_REGISTRYINDEX, inf->env_ref);
+		lua_setfenv(inf->L, -2);
+	}
+
+	return lua_pcall(inf->L, 0, 0, 0);
+}
+
+/**
+ * block_dostring - run a string in the block environment
+ *
+ * The block name is used as the chunk name, so Lua error messages can
+ * be attributed to the block even if the state is shared.
+ */
+static int block_dostring(ubx_block_t *b, const char *str)
+{
+	struct luablock_info *inf = (struct luablock_info *)b->private_data;
+	return run_chunk(b, luaL_loadbuffer(inf->L, str, strlen(str), b->name));
+}
+
+struct file_reader {
+	FILE *f;
+	int skipped; /* a leading #! line was skipped */
+	char buf[BUFSIZ];
+};
+
+static const char *read_file(lua_State *L, void *data, size_t *size)
+{
+	struct file_reader *fr = (struct file_reader *)data;
+	(void)L;
+
+	/* keep the line numbers of a skipped #! line */
+	if (fr->skipped) {
+		fr->skipped = 0;
+		*size = 1;
+		return "\n";
+	}
+
+	*size = fread(fr->buf, 1, sizeof(fr->buf), fr->f);
+	return (*size > 0) ? fr->buf : NULL;
+}
+
+/**
+ * block_dofile - run a file in the block environment
+ *
+ * Like block_dostring, the block name is used as the chunk name. As
+ * luaL_loadfile, a leading #! line is skipped.
+ */
+static int block_dofile(ubx_block_t *b, const char *file)
+{
+	int c, ret;
+	struct file_reader fr = { 0 };
+	struct luablock_info *inf = (struct luablock_info *)b->private_data;
+
+	fr.f = fopen(file, "r");
+	if (fr.f == NULL) {
+		lua_pushfstring(inf->L, "cannot open %s: %s", file, strerror(errno));
+		return LUA_ERRFILE;
+	}
+
+	c = getc(fr.f);
+	if (c == '#') {
+		while ((c = getc(fr.f)) != EOF && c != '\n')
+			;
+		fr.skipped = 1;
+	} else if (c != EOF) {
+		ungetc(c, fr.f);
+	}
+
+	ret = lua_load(inf->L, read_file, &fr, b->name);
+
+	if (ferror(fr.f)) {
+		lua_pop(inf->L, 1); /* chunk or error message */
+		lua_pushfstring(inf->L, "cannot read %s", file);
+		ret = LUA_ERRFILE;
+	}
+
+	fclose(fr.f);
+	return run_chunk(b, ret);
+}
+
+/**
+ * resolve_hooks - lookup the hook functions and store registry refs.
+ *
+ * This must be called whenever the global hook functions could have
+ * been redefined, i.e. after loading the Lua code, after init and
+ * after executing an exec_str.
+ *
+ * @param b
+ */
+void resolve_hooks(ubx_block_t *b)
+{
+	int i;
+	struct luablock_info *inf = (struct luablock_info *)b->private_data;
+
+	push_env(inf);
+
+	for (i = 0; i < __HOOK_NUM; i++) {
+		luaL_unref(inf->L, LUA_REGISTRYINDEX, inf->hook_refs[i]);
+		lua_getfield(inf->L, -1, hook_names[i]);
+
+		if (lua_isfunction(inf->L, -1)) {
+			inf->hook_refs[i] = luaL_ref(inf->L, LUA_REGISTRYINDEX);
+		} else {
+			inf->hook_refs[i] = LUA_NOREF;
+			lua_pop(inf->L, 1);
+		}
+	}
+
+	lua_pop(inf->L, 1); /* env */
+}
+
 /**
- * @brief: call a hook with fname.
+ * @brief: call a hook.
  *
  * @param block (is passed on a first arg)
- * @param fname name of function to call
- * @param require_fun raise an error if function fname does not exist.
+ * @param hook hook to call
+ * @param require_fun raise an error if the hook function does not exist.
  * @param require_res if 1, require a boolean valued result.
  * @return -1 in case of error, 0 otherwise.
  */
-int call_hook(ubx_block_t *b, const char *fname, int require_fun, int require_res)
+int call_hook(ubx_block_t *b, enum luablock_hook hook, int require_fun, int require_res)
 {
-	int ret = 0;
+	int ret = 0, num_args = 1;
 	struct luablock_info *inf = (struct luablock_info *)b->private_data;
 	int num_res = (require_res != 0) ? 1 : 0;
 
-	lua_getglobal(inf->L, fname);
-
-	if (lua_isnil(inf->L, -1)) {
-		lua_pop(inf->L, 1);
-		if (require_fun)
-			ubx_err(b, "%s: no (required) Lua function %s", b->name, fname);
-		else
-			goto out;
+	if (inf->hook_refs[hook] == LUA_NOREF) {
+		if (require_fun) {
+			ubx_err(b, "%s: no (required) Lua function %s", b->name, hook_names[hook]);
+			ret = -1;
+		}
+		goto out;
 	}
 
+	lua_rawgeti(inf->L, LUA_REGISTRYINDEX, inf->hook_refs[hook]);
 	lua_pushlightuserdata(inf->L, (void *)b);
 
-	if (lua_pcall(inf->L, 1, num_res, 0) != 0) {
-		ubx_err(b, "calling fun %s: %s", fname, lua_tostring(inf->L, -1));
+	if (hook == HOOK_STEP && inf->ports_ref != LUA_NOREF) {
+		lua_rawgeti(inf->L, LUA_REGISTRYINDEX, inf->ports_ref);
+		num_args++;
+	}
+
+	if (lua_pcall(inf->L, num_args, num_res, 0) != 0) {
+		ubx_err(b, "calling fun %s: %s", hook_names[hook], lua_tostring(inf->L, -1));
+		lua_pop(inf->L, 1); /* pop error msg */
 		ret = -1;
 		goto out;
 	}
@@ -81,7 +337,8 @@ int call_hook(ubx_block_t *b, const char *fname, int require_fun, int require_re
 	if (require_res) {
 		if (!lua_isboolean(inf->L, -1)) {
 			ubx_err(b, "%s: %s must return a bool but returned a %s",
-				b->name, fname, lua_typename(inf->L, lua_type(inf->L, -1)));
+				b->name, hook_names[hook], lua_typename(inf->L, lua_type(inf->L, -1)));
+			lua_pop(inf->L, 1);
 			ret = -1;
 			goto out;
 		}
@@ -92,54 +349,302 @@ int call_hook(ubx_block_t *b, const char *fname, int require_fun, int require_re
 	return ret;
 }
 
+/**
+ * bind_ports - create the table of pre-bound port objects for ffi_step
+ *
+ * @param b
+ * @return 0 if Ok, -1 otherwise
+ */
+int bind_ports(ubx_block_t *b)
+{
+	int ret = -1;
+	struct luablock_info *inf = (struct luablock_info *)b->private_data;
+
+	luaL_unref(inf->L, LUA_REGISTRYINDEX, inf->ports_ref);
+	inf->ports_ref = LUA_NOREF;
+
+	if (luaL_dostring(inf->L, ffi_step_bind) != 0) {
+		ubx_err(b, "failed to load ffi_step port binder: %s", lua_tostring(inf->L, -1));
+		lua_pop(inf->L, 1);
+		goto out;
+	}
+
+	lua_pushlightuserdata(inf->L, (void *)b);
+
+	if (lua_pcall(inf->L, 1, 1, 0) != 0) {
+		ubx_err(b, "failed to bind ports: %s", lua_tostring(inf->L, -1));
+		lua_pop(inf->L, 1);
+		goto out;
+	}
+
+	inf->ports_ref = luaL_ref(inf->L, LUA_REGISTRYINDEX);
+	ret = 0;
+ out:
+	return ret;
+}
+
 
 /**
- * init_lua_state - initalize lua_State and execute lua_file.
+ * new_lua_state - create and initialize a new lua_State
+ *
+ * @param b
+ * @return lua_State or NULL
+ */
+static lua_State *new_lua_state(ubx_block_t *b)
+{
+	lua_State *L = luaL_newstate();
+
+	if (L == NULL) {
+		ubx_err(b, "failed to alloc lua_State");
+		goto out;
+	}
+
+	luaL_openlibs(L);
+ out:
+	return L;
+}
+
+/**
+ * get_shared_state - lookup or create the shared state of the given name
+ *
+ * @param b
+ * @param name
+ * @return shared state with incremented refcnt or NULL
+ */
+static struct lua_shared_state *get_shared_state(ubx_block_t *b, const char *name)
+{
+	struct lua_shared_state *ss;
+
+	pthread_mutex_lock(&shared_states_lock);
+
+	for (ss = shared_states; ss != NULL; ss = ss->next) {
+		if (ss->nd == b->nd && strcmp(ss->name, name) == 0)
+			goto found;
+	}
+
+	ss = calloc(1, sizeof(struct lua_shared_state));
+	if (ss == NULL)
+		goto out_err;
+
+	ss->name = strdup(name);
+	if (ss->name == NULL)
+		goto out_free;
+
+	ss->L = new_lua_state(b);
+	if (ss->L == NULL)
+		goto out_free;
+
+	pthread_mutex_init(&ss->lock, NULL);
+	ss->nd = b->nd;
+	ss->next = shared_states;
+	shared_states = ss;
+	ubx_debug(b, "created shared lua_state %s", name);
+
+ found:
+	ss->refcnt++;
+	goto out;
+
+ out_free:
+	free(ss->name);
+	free(ss);
+ out_err:
+	ubx_err(b, "failed to create shared lua_state %s", name);
+	ss = NULL;
+ out:
+	pthread_mutex_unlock(&shared_states_lock);
+	return ss;
+}
+
+/**
+ * put_shared_state - drop a reference and close the state if unused
+ *
+ * @param ss
+ */
+static void put_shared_state(struct lua_shared_state *ss)
+{
+	struct lua_shared_state **ssp;
+
+	pthread_mutex_lock(&shared_states_lock);
+
+	if (--ss->refcnt > 0)
+		goto out;
+
+	for (ssp = &shared_states; *ssp != NULL; ssp = &(*ssp)->next) {
+		if (*ssp == ss) {
+			*ssp = ss->next;
+			break;
+		}
+	}
+
+	lua_close(ss->L);
+	pthread_mutex_destroy(&ss->lock);
+	free(ss->name);
+	free(ss);
+ out:
+	pthread_mutex_unlock(&shared_states_lock);
+}
+
+/**
+ * check_shared_thread - check that a shared state is used by one thread
+ *
+ * The first block stepped after starting records its thread, the
+ * other blocks of the state must then be stepped by the same thread
+ * until all are stopped.
+ *
+ * @param b
+ * @return 0 if OK, -1 if stepped by a different thread
+ */
+static int check_shared_thread(ubx_block_t *b)
+{
+	int ret = 0;
+	struct luablock_info *inf = (struct luablock_info *)b->private_data;
+	struct lua_shared_state *ss = inf->shared;
+
+	inf->thread_checked = 1;
+
+	pthread_mutex_lock(&shared_states_lock);
+
+	if (!ss->owner_valid) {
+		ss->owner = pthread_self();
+		ss->owner_valid = 1;
+	} else if (!pthread_equal(ss->owner, pthread_self())) {
+		ret = -1;
+	}
+
+	pthread_mutex_unlock(&shared_states_lock);
+
+	if (ret)
+		ubx_err(b, "lua_state %s is stepped by different threads, not stepping", ss->name);
+
+	return ret;
+}
+
+/**
+ * shared_active - account for starting and stopping a sharing block
  *
  * @param inf
+ * @param inc 1 for start, -1 for stop
+ */
+static void shared_active(struct luablock_info *inf, int inc)
+{
+	struct lua_shared_state *ss = inf->shared;
+
+	if (ss == NULL)
+		return;
+
+	pthread_mutex_lock(&shared_states_lock);
+
+	ss->num_active += inc;
+
+	if (ss->num_active == 0)
+		ss->owner_valid = 0;
+
+	pthread_mutex_unlock(&shared_states_lock);
+}
+
+/**
+ * release_lua_state - release the lua_State of a block
+ *
+ * @param inf
+ */
+static void release_lua_state(struct luablock_info *inf)
+{
+	if (inf->L == NULL)
+		return;
+
+	if (inf->shared) {
+		/* drop all references held by this block */
+		int i;
+
+		state_lock(inf);
+
+		for (i = 0; i < __HOOK_NUM; i++)
+			luaL_unref(inf->L, LUA_REGISTRYINDEX, inf->hook_refs[i]);
+
+		luaL_unref(inf->L, LUA_REGISTRYINDEX, inf->ports_ref);
+		luaL_unref(inf->L, LUA_REGISTRYINDEX, inf->env_ref);
+
+		state_unlock(inf);
+		put_shared_state(inf->shared);
+	} else {
+		lua_close(inf->L);
+	}
+
+	inf->L = NULL;
+}
+
+/**
+ * init_lua_state - initalize lua_State and execute lua_file.
+ *
+ * If lua_state is given, the named shared state is used and a private
+ * environment is created for the block. Otherwise the block gets its
+ * own lua_State.
+ *
+ * @param b
  * @param lua_file
+ * @param lua_str
+ * @param lua_state name of shared state or NULL
  *
  * @return 0 if Ok, -1 otherwise.
  */
 int init_lua_state(struct ubx_block *b,
-			  const char *lua_file,
-			  const char *lua_str)
+		   const char *lua_file,
+		   const char *lua_str,
+		   const char *lua_state)
 {
 	int ret = -1;
 	struct luablock_info *inf = (struct luablock_info *)b->private_data;
 
-	inf->L = luaL_newstate();
-	if (inf->L == NULL) {
-		ubx_err(b, "failed to alloc lua_State");
-		goto out;
-	}
+	if (lua_state) {
+		inf->shared = get_shared_state(b, lua_state);
+		if (inf->shared == NULL)
+			goto out;
 
-	luaL_openlibs(inf->L);
+		inf->L = inf->shared->L;
+		state_lock(inf);
+
+		/* env = setmetatable({}, { __index = _G }) */
+		lua_newtable(inf->L);
+		lua_newtable(inf->L);
+		lua_pushvalue(inf->L, LUA_GLOBALSINDEX);
+		lua_setfield(inf->L, -2, "__index");
+		lua_setmetatable(inf->L, -2);
+		inf->env_ref = luaL_ref(inf->L, LUA_REGISTRYINDEX);
+	} else {
+		inf->L = new_lua_state(b);
+		if (inf->L == NULL)
+			goto out;
+	}
 
-	ret = luaL_dostring(inf->L, predef_hooks);
+	ret = block_dostring(b, predef_hooks);
 	if (ret != 0) {
-		ubx_err(b, "failed to predefine hooks");
+		ubx_err(b, "failed to predefine hooks: %s", lua_tostring(inf->L, -1));
+		lua_pop(inf->L, 1);
 		goto out;
 	}
 
 	if (lua_file) {
-		ret = luaL_dofile(inf->L, lua_file);
+		ret = block_dofile(b, lua_file);
 		if (ret != 0) {
 			ubx_err(b, "Failed to load lua_file '%s': %s\n", lua_file, lua_tostring(inf->L, -1));
+			lua_pop(inf->L, 1);
 			goto out;
 		}
 	}
 
 	if (lua_str) {
-		ret = luaL_dostring(inf->L, lua_str);
+		ret = block_dostring(b, lua_str);
 		if (ret != 0) {
 			ubx_err(b, "Failed to load lua_str '%s': %s\n", lua_str, lua_tostring(inf->L, -1));
+			lua_pop(inf->L, 1);
 			goto out;
 		}
 	}
 
+	resolve_hooks(b);
 	ret = 0;
  out:
+	state_unlock(inf);
 	return ret;
 }
 
@@ -148,9 +653,10 @@ int luablock_init(ubx_block_t *b)
 {
 	const char *lua_file = NULL;
 	const char *lua_str = NULL;
+	const char *lua_state = NULL;
 	long len;
 
-	int ret = -EOUTOFMEM;
+	int i, ret = -EOUTOFMEM;
 	struct luablock_info *inf;
 
 	inf = calloc(1, sizeof(struct luablock_info));
@@ -159,6 +665,17 @@ int luablock_init(ubx_block_t *b)
 
 	b->private_data = inf;
 
+	for (i = 0; i < __HOOK_NUM; i++)
+		inf->hook_refs[i] = LUA_NOREF;
+
+	inf->ports_ref = LUA_NOREF;
+	inf->env_ref = LUA_NOREF;
+
+	/* ports are stored in a list and hence have stable addresses */
+	inf->p_exec_str = ubx_port_get(b, "exec_str");
+	inf->p_gc_heap_kb = ubx_port_get(b, "gc_heap_kb");
+	inf->p_gc_step_us = ubx_port_get(b, "gc_step_us");
+
 	len = cfg_getptr_char(b, "lua_file", &lua_file);
 	if (len < 0)
 		goto out_free1;
@@ -171,77 +688,292 @@ int luablock_init(ubx_block_t *b)
 
 	lua_str = (len > 0) ? lua_str : NULL;
 
+	len = cfg_getptr_char(b, "lua_state", &lua_state);
+	if (len < 0)
+		goto out_free1;
+
+	lua_state = (len > 0) ? lua_state : NULL;
+
 	inf->exec_str_buff = ubx_data_alloc(b->nd, "char", EXEC_STR_BUFF_SIZE);
 	if (inf->exec_str_buff == NULL) {
 		ubx_err(b, "failed to allocate exec_str buffer");
 		goto out_free1;
 	}
 
-	if (init_lua_state(b, lua_file, lua_str) != 0)
-		goto out_free2;
+	if (init_lua_state(b, lua_file, lua_str, lua_state) != 0)
+		goto out_free3;
+
+	state_lock(inf);
+	ret = call_hook(b, HOOK_INIT, 0, 1);
+
+	/* init may (re-)define hooks */
+	if (ret == 0)
+		resolve_hooks(b);
+
+	state_unlock(inf);
 
-	ret = call_hook(b, "init", 0, 1);
 	if (ret != 0)
-		goto out_free2;
+		goto out_free3;
 
 	/* Ok! */
 	ret = 0;
 	goto out;
 
- out_free2:
-	free(inf->exec_str_buff);
+ out_free3:
+	release_lua_state(inf);
+	ubx_data_free(inf->exec_str_buff);
  out_free1:
 	free(inf);
  out:
 	return ret;
 }
 
+/**
+ * gc_stop - stop the automatic GC
+ *
+ * For shared states, the GC remains stopped until all blocks that
+ * stopped it have called gc_restart.
+ *
+ * @param inf
+ */
+static void gc_stop(struct luablock_info *inf)
+{
+	int first = 1;
+
+	if (inf->gc_stopped)
+		return;
+
+	inf->gc_stopped = 1;
+
+	if (inf->shared) {
+		pthread_mutex_lock(&shared_states_lock);
+		first = (inf->shared->gc_stopped++ == 0);
+		pthread_mutex_unlock(&shared_states_lock);
+	}
+
+	if (first)
+		lua_gc(inf->L, LUA_GCSTOP, 0);
+}
+
+/**
+ * gc_restart - restart the automatic GC stopped by gc_stop
+ *
+ * @param inf
+ */
+static void gc_restart(struct luablock_info *inf)
+{
+	int last = 1;
+
+	if (!inf->gc_stopped)
+		return;
+
+	inf->gc_stopped = 0;
+
+	if (inf->shared) {
+		pthread_mutex_lock(&shared_states_lock);
+		last = (--inf->shared->gc_stopped == 0);
+		pthread_mutex_unlock(&shared_states_lock);
+	}
+
+	if (last)
+		lua_gc(inf->L, LUA_GCRESTART, 0);
+}
+
+/**
+ * gc_config - configure the Lua GC
+ *
+ * If gc_step_kb is > 0, the automatic GC is stopped and instead an
+ * incremental step is run after each step hook. The automatic GC is
+ * restarted when the block is stopped.
+ *
+ * @param b
+ * @return 0 if Ok, < 0 otherwise
+ */
+static int gc_config(ubx_block_t *b)
+{
+	int ret;
+	long len;
+	const int *gc_step_kb;
+	const uint32_t *gc_budget_us;
+	struct luablock_info *inf = (struct luablock_info *)b->private_data;
+
+	len = cfg_getptr_int(b, "gc_step_kb", &gc_step_kb);
+	if (len < 0) {
+		ret = len;
+		goto out;
+	}
+
+	inf->gc_step_kb = (len > 0) ? *gc_step_kb : 0;
+
+	len = cfg_getptr_uint32(b, "gc_budget_us", &gc_budget_us);
+	if (len < 0) {
+		ret = len;
+		goto out;
+	}
+
+	inf->gc_budget_us = (len > 0) ? *gc_budget_us : 0;
+
+	if (inf->gc_budget_us > 0 && inf->gc_step_kb <= 0) {
+		ubx_err(b, "EINVALID_CONFIG: gc_budget_us requires gc_step_kb > 0");
+		ret = EINVALID_CONFIG;
+		goto out;
+	}
+
+	/* for shared states, this applies to all blocks of the state */
+	if (inf->gc_step_kb > 0) {
+		gc_stop(inf);
+		ubx_info(b, "automatic GC stopped, gc_step_kb: %d, gc_budget_us: %u",
+			 inf->gc_step_kb, inf->gc_budget_us);
+	}
+
+	ret = 0;
+ out:
+	return ret;
+}
+
+/**
+ * gc_step - run the budgeted incremental GC and output statistics
+ *
+ * One step of gc_step_kb is always run. If a time budget is
+ * configured, steps are repeated until the budget is used up or a
+ * cycle was completed.
+ *
+ * @param b
+ */
+static void gc_step(ubx_block_t *b)
+{
+	int heap_kb;
+	double dur_us;
+	struct ubx_timespec ts_start, ts_cur, ts_dur;
+	struct luablock_info *inf = (struct luablock_info *)b->private_data;
+
+	ubx_gettime(&ts_start);
+
+	while (1) {
+		if (lua_gc(inf->L, LUA_GCSTEP, inf->gc_step_kb))
+			break; /* cycle finished */
+
+		ubx_gettime(&ts_cur);
+		ubx_ts_sub(&ts_cur, &ts_start, &ts_dur);
+
+		if (ubx_ts_to_us(&ts_dur) >= inf->gc_budget_us)
+			break;
+	}
+
+	ubx_gettime(&ts_cur);
+	ubx_ts_sub(&ts_cur, &ts_start, &ts_dur);
+
+	heap_kb = lua_gc(inf->L, LUA_GCCOUNT, 0);
+	dur_us = ubx_ts_to_double(&ts_dur) * 1000000;
+
+	write_int(inf->p_gc_heap_kb, &heap_kb);
+	write_double(inf->p_gc_step_us, &dur_us);
+}
+
 int luablock_start(ubx_block_t *b)
 {
-	return call_hook(b, "start", 0, 1);
+	int ret;
+	const int *ffi_step;
+	struct luablock_info *inf = (struct luablock_info *)b->private_data;
+
+	state_lock(inf);
+
+	ret = gc_config(b);
+	if (ret != 0)
+		goto out;
+
+	/* bind at start, since init may have added ports */
+	ret = cfg_getptr_int(b, "ffi_step", &ffi_step);
+	if (ret < 0)
+		goto out;
+
+	if (ret > 0 && *ffi_step) {
+		ret = bind_ports(b);
+		if (ret != 0)
+			goto out;
+	}
+
+	ret = call_hook(b, HOOK_START, 0, 1);
+	if (ret != 0)
+		goto out;
+
+	inf->thread_checked = 0;
+	shared_active(inf, 1);
+ out:
+	state_unlock(inf);
+	return ret;
 }
 
 /**
  * luablock_step - execute lua string and call step hook
  *
+ * The exec_str port is only polled if it is connected.
+ *
  * @param b
  */
 void luablock_step(ubx_block_t *b)
 {
-	int len = 0, ret;
+	int ret;
 	struct luablock_info *inf = (struct luablock_info *)b->private_data;
 
+	if (inf->shared) {
+		if (!inf->thread_checked)
+			inf->thread_ok = (check_shared_thread(b) == 0);
+
+		if (!inf->thread_ok)
+			return;
+	}
+
+	state_lock(inf);
+
 	/* any lua code to execute */
-	ubx_port_t *p_exec_str = ubx_port_get(b, "exec_str");
+	if (inf->p_exec_str->in_interaction != NULL &&
+	    __port_read(inf->p_exec_str, inf->exec_str_buff) > 0) {
+		ret = block_dostring(b, inf->exec_str_buff->data);
+		write_int(inf->p_exec_str, &ret);
 
-	len = __port_read(p_exec_str, inf->exec_str_buff);
-	if (len > 0) {
-		ret = luaL_dostring(inf->L, inf->exec_str_buff->data);
 		if (ret != 0) {
 			ubx_err(b, "Failed to exec_str: %s", lua_tostring(inf->L, -1));
+			lua_pop(inf->L, 1);
 			goto out;
 		}
+		resolve_hooks(b);
 	}
-	call_hook(b, "step", 0, 0);
+
+	call_hook(b, HOOK_STEP, 0, 0);
+
+	if (inf->gc_step_kb > 0)
+		gc_step(b);
  out:
-	/* TODO: fix this. realloc could have changed port addr */
-	if (len > 0) {
-		p_exec_str = ubx_port_get(b, "exec_str");
-		write_int(p_exec_str, &ret);
-	}
+	state_unlock(inf);
 }
 
 void luablock_stop(ubx_block_t *b)
 {
-	call_hook(b, "stop", 0, 0);
+	struct luablock_info *inf = (struct luablock_info *)b->private_data;
+
+	state_lock(inf);
+	call_hook(b, HOOK_STOP, 0, 0);
+	shared_active(inf, -1);
+
+	/* outside of the RT path, so do a full collection */
+	if (inf->gc_step_kb > 0)
+		lua_gc(inf->L, LUA_GCCOLLECT, 0);
+
+	gc_restart(inf);
+	state_unlock(inf);
 }
 
 void luablock_cleanup(ubx_block_t *b)
 {
 	struct luablock_info *inf = (struct luablock_info *)b->private_data;
 
-	call_hook(b, "cleanup", 0, 0);
-	lua_close(inf->L);
+	state_lock(inf);
+	call_hook(b, HOOK_CLEANUP, 0, 0);
+	gc_restart(inf);
+	state_unlock(inf);
+
+	release_lua_state(inf);
 	ubx_data_free(inf->exec_str_buff);
 	free(b->private_data);
 }
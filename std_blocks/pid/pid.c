@@ -18,10 +18,30 @@ struct pid_info
 
 	int has_err_prev;
 
-	const double *kp, *ki, *kd;
+	/* gains are copied from the configs, as published values are
+	 * freed once replaced. NULL if unset. */
+	double *kp, *ki, *kd;
+	double *kp_buf, *ki_buf, *kd_buf;
+	int kp_invalid, ki_invalid, kd_invalid;
+	const ubx_config_t *c_kp, *c_ki, *c_kd;
 	struct pid_port_cache ports;
 };
 
+/* check the length of a gain config */
+static int check_gain_len(const ubx_block_t *b, const ubx_config_t *c, long data_len)
+{
+	const void *ptr;
+	long len = ubx_config_acquire(c, &ptr);
+
+	if (len > 0 && len != data_len) {
+		ubx_err(b, "EINVALID_CONFIG_LEN: %s: actual: %lu, expected %lu",
+			c->name, len, data_len);
+		return EINVALID_CONFIG_LEN;
+	}
+
+	return 0;
+}
+
 /* init */
 int pid_init(ubx_block_t *b)
 {
@@ -54,39 +74,17 @@ int pid_init(ubx_block_t *b)
 		goto out;
 	}
 
-	/* Kp */
-	len = cfg_getptr_double(b, "Kp", &inf->kp);
-	if (len < 0)
-		goto out;
-
-	if (len > 0 && len != inf->data_len) {
-		ubx_err(b, "EINVALID_CONFIG_LEN: Kp: actual: %lu, expected %lu",
-			len, inf->data_len);
-		goto out;
-	}
-
-	/* Ki */
-	len = cfg_getptr_double(b, "Ki", &inf->ki);
-	if (len < 0)
-		goto out;
+	/* cache the gain configs, so that published updates can be
+	 * picked up in step */
+	inf->c_kp = ubx_config_get(b, "Kp");
+	inf->c_ki = ubx_config_get(b, "Ki");
+	inf->c_kd = ubx_config_get(b, "Kd");
 
-	if (len > 0 && len != inf->data_len) {
-		ubx_err(b, "EINVALID_CONFIG_LEN: Ki: actual: %lu, expected %lu",
-			len, inf->data_len);
-		goto out;
-	}
-
-	/* Kd */
-	len = cfg_getptr_double(b, "Kd", &inf->kd);
-	if (len < 0)
+	if (check_gain_len(b, inf->c_kp, inf->data_len) ||
+	    check_gain_len(b, inf->c_ki, inf->data_len) ||
+	    check_gain_len(b, inf->c_kd, inf->data_len))
 		goto out;
 
-	if (len > 0 && len != inf->data_len) {
-		ubx_err(b, "EINVALID_CONFIG_LEN: Kd: actual: %lu, expected %lu",
-			len, inf->data_len);
-		goto out;
-	}
-
 	/* allocate buffers */
 	inf->out = calloc(inf->data_len, sizeof(double));
 	inf->msr = calloc(inf->data_len, sizeof(double));
@@ -95,9 +93,13 @@ int pid_init(ubx_block_t *b)
 	inf->err_prev = calloc(inf->data_len, sizeof(double));
 	inf->integ = calloc(inf->data_len, sizeof(double));
 	inf->deriv = calloc(inf->data_len, sizeof(double));
+	inf->kp_buf = calloc(inf->data_len, sizeof(double));
+	inf->ki_buf = calloc(inf->data_len, sizeof(double));
+	inf->kd_buf = calloc(inf->data_len, sizeof(double));
 
 	if (! (inf->out && inf->msr && inf->des && inf->err &&
-	       inf->err_prev && inf->integ && inf->deriv)) {
+	       inf->err_prev && inf->integ && inf->deriv &&
+	       inf->kp_buf && inf->ki_buf && inf->kd_buf)) {
 		ubx_err(b, "EOUTOFMEM: failed to allocate buffers");
 		goto out_err;
 	}
@@ -113,6 +115,9 @@ out_err:
 	if (inf->err_prev) free(inf->err_prev);
 	if (inf->integ) free(inf->integ);
 	if (inf->deriv) free(inf->deriv);
+	if (inf->kp_buf) free(inf->kp_buf);
+	if (inf->ki_buf) free(inf->ki_buf);
+	if (inf->kd_buf) free(inf->kd_buf);
 out:
 	return ret;
 }
@@ -129,9 +134,44 @@ void pid_cleanup(ubx_block_t *b)
 	free(inf->err_prev);
 	free(inf->integ);
 	free(inf->deriv);
+	free(inf->kp_buf);
+	free(inf->ki_buf);
+	free(inf->kd_buf);
 	free(b->private_data);
 }
 
+/*
+ * acquire the current value of a gain config and copy it to buf.
+ * Values with an invalid length are ignored and the last valid value
+ * is kept. These are logged once and not in every step.
+ */
+static void acquire_gain(const ubx_block_t *b, const ubx_config_t *c,
+			 long data_len, double *buf, double **gain, int *invalid)
+{
+	long len;
+	const void *ptr;
+
+	len = ubx_config_acquire(c, &ptr);
+
+	if (len != 0 && len != data_len) {
+		if (!*invalid)
+			ubx_err(b, "EINVALID_CONFIG_LEN: %s: actual: %lu, expected %lu, keeping last value",
+				c->name, len, data_len);
+		*invalid = 1;
+		return;
+	}
+
+	*invalid = 0;
+
+	if (len == 0) {
+		*gain = NULL;
+		return;
+	}
+
+	memcpy(buf, ptr, data_len * sizeof(double));
+	*gain = buf;
+}
+
 /* step */
 void pid_step(ubx_block_t *b)
 {
@@ -139,6 +179,11 @@ void pid_step(ubx_block_t *b)
 	long len_msr, len_des;
 	struct pid_info *inf = (struct pid_info*) b->private_data;
 
+	/* pick up updated gains */
+	acquire_gain(b, inf->c_kp, inf->data_len, inf->kp_buf, &inf->kp, &inf->kp_invalid);
+	acquire_gain(b, inf->c_ki, inf->data_len, inf->ki_buf, &inf->ki, &inf->ki_invalid);
+	acquire_gain(b, inf->c_kd, inf->data_len, inf->kd_buf, &inf->kd, &inf->kd_invalid);
+
 	len_msr = read_double_array(inf->ports.msr, inf->msr, inf->data_len);
 	len_des = read_double_array(inf->ports.des, inf->des, inf->data_len);
 
@@ -172,7 +217,7 @@ void pid_step(ubx_block_t *b)
 	/* compute error and proportional component */
 	for (int i=0; i<inf->data_len; i++) {
 		inf->err[i] = inf->des[i] - inf->msr[i];
-		inf->out[i] = inf->kp[i] * inf->err[i];
+		inf->out[i] = (inf->kp) ? inf->kp[i] * inf->err[i] : 0;
 	}
 
 	/* add integral component */
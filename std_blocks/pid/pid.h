@@ -14,9 +14,9 @@ char pid_meta[] =
 
 /* declaration of block configuration */
 ubx_proto_config_t pid_config[] = {
-	{ .name="Kp", .type_name = "double", .doc="P-gain (def: 0)" },
-	{ .name="Ki", .type_name = "double", .doc="I-gain (def: 0)" },
-	{ .name="Kd", .type_name = "double", .doc="D-gain (def: 0)" },
+	{ .name="Kp", .type_name = "double", .attrs = CONFIG_ATTR_RUNTIME, .doc="P-gain (def: 0)" },
+	{ .name="Ki", .type_name = "double", .attrs = CONFIG_ATTR_RUNTIME, .doc="I-gain (def: 0)" },
+	{ .name="Kd", .type_name = "double", .attrs = CONFIG_ATTR_RUNTIME, .doc="D-gain (def: 0)" },
 	{ .name="data_len", .type_name = "long", .doc="length of signal array (def: 1)" },
 	{ 0 },
 };
@@ -1,11 +1,15 @@
 #include "ramp.h"
 
+/* max number of samples written at once by step_batch */
+#define RAMP_BATCH_LEN	32
+
 /* define a structure for holding the block local state. By assigning an
  * instance of this struct to the block private_data pointer (see init), this
  * information becomes accessible within the hook functions.
  */
 struct ramp_info {
 	RAMP_T *cur;
+	RAMP_T *batch;
 	const RAMP_T *start;
 	const RAMP_T *slope;
 
@@ -46,10 +50,11 @@ int ramp_init(ubx_block_t *b)
 		goto out;
 
 	inf->cur = calloc(inf->data_len, sizeof(RAMP_T));
+	inf->batch = calloc(inf->data_len * RAMP_BATCH_LEN, sizeof(RAMP_T));
 
-	if (inf->cur == NULL) {
+	if (inf->cur == NULL || inf->batch == NULL) {
 		ubx_err(b, "EOUTOFMEM: failed to alloc buffer");
-		goto out;
+		goto out_free;
 	}
 
 	/* start config */
@@ -87,6 +92,7 @@ int ramp_init(ubx_block_t *b)
 
 out_free:
 	free(inf->cur);
+	free(inf->batch);
 out:
 	return ret;
 }
@@ -109,6 +115,7 @@ void ramp_cleanup(ubx_block_t *b)
 {
 	struct ramp_info *inf = (struct ramp_info *)b->private_data;
 	free(inf->cur);
+	free(inf->batch);
 	free(b->private_data);
 }
 
@@ -122,3 +129,26 @@ void ramp_step(ubx_block_t *b)
 	for (int i=0; i<inf->data_len; i++)
 		inf->cur[i] += inf->slope[i];
 }
+
+/* step_batch: compute and write up to RAMP_BATCH_LEN samples at once */
+void ramp_step_batch(ubx_block_t *b, unsigned int n)
+{
+	unsigned int num;
+	struct ramp_info *inf = (struct ramp_info *)b->private_data;
+
+	while (n > 0) {
+		num = MIN(n, RAMP_BATCH_LEN);
+
+		for (unsigned int k = 0; k < num; k++) {
+			RAMP_T *sample = &inf->batch[k * inf->data_len];
+
+			for (int i=0; i<inf->data_len; i++) {
+				sample[i] = inf->cur[i];
+				inf->cur[i] += inf->slope[i];
+			}
+		}
+
+		write_ramp_batch(inf->ports.out, inf->batch, inf->data_len, num);
+		n -= num;
+	}
+}
@@ -57,6 +57,7 @@ int ramp_init(ubx_block_t *b);
 int ramp_start(ubx_block_t *b);
 void ramp_cleanup(ubx_block_t *b);
 void ramp_step(ubx_block_t *b);
+void ramp_step_batch(ubx_block_t *b, unsigned int n);
 
 
 ubx_proto_block_t ramp_block = {
@@ -70,6 +71,7 @@ ubx_proto_block_t ramp_block = {
 	.start = ramp_start,
 	.cleanup = ramp_cleanup,
 	.step = ramp_step,
+	.step_batch = ramp_step_batch,
 };
 
 
@@ -0,0 +1,79 @@
+/*
+ * Recording and replaying of port traffic
+ *
+ * File format (host byte order):
+ *
+ *   struct ubxrec_hdr
+ *   struct ubxrec_stream [num_streams]
+ *   { struct ubxrec_sample, data padded to UBXREC_ALIGN } ...
+ *
+ * Samples are stored in the order they were recorded, hence their
+ * timestamps and step sequence numbers are monotonically increasing.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <stdint.h>
+#include "ubx.h"
+
+#define RECORDER_BLOCK_NAME	"record/recorder"
+#define REPLAY_BLOCK_NAME	"record/replay"
+
+#define UBXREC_MAGIC		"UBXREC"
+#define UBXREC_VERSION		2
+#define UBXREC_ALIGN		8
+
+/* "block.port" */
+#define UBXREC_STREAM_NAME_MAXLEN	(UBX_BLOCK_NAME_MAXLEN + 1 + UBX_PORT_NAME_MAXLEN)
+
+/* name of the port of stream N */
+#define UBXREC_PORT_FMT		"s%u"
+
+struct ubxrec_hdr {
+	char magic[8];
+	uint32_t version;
+	uint32_t num_streams;
+};
+
+/**
+ * struct ubxrec_stream - description of a recorded stream
+ * @name: name of the recorded port (block.port)
+ * @type_name: name of the type
+ * @type_hash: binary md5 hash of the type
+ * @type_size: size of the type
+ * @data_len: maximum array length of a sample
+ */
+struct ubxrec_stream {
+	char name[UBXREC_STREAM_NAME_MAXLEN + 1];
+	char type_name[UBX_TYPE_NAME_MAXLEN + 1];
+	uint8_t type_hash[UBX_TYPE_HASH_LEN];
+	uint32_t type_size;
+	uint32_t data_len;
+};
+
+/**
+ * struct ubxrec_sample - header of a recorded sample
+ * @ts: node time of recording [ns]
+ * @seq: sequence number of the recorder step
+ * @stream: index of the stream
+ * @len: array length of the sample data following the header
+ */
+struct ubxrec_sample {
+	uint64_t ts;
+	uint64_t seq;
+	uint32_t stream;
+	uint32_t len;
+};
+
+static inline size_t ubxrec_padded(size_t size)
+{
+	return (size + UBXREC_ALIGN - 1) & ~((size_t)UBXREC_ALIGN - 1);
+}
+
+int replay_register(ubx_node_t *nd);
+void replay_unregister(ubx_node_t *nd);
+
+#endif /* RECORD_H */
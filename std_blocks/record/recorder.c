@@ -0,0 +1,416 @@
+/*
+ * Recorder block: capture port traffic to a file
+ *
+ * For each recorded stream, the recorder adds an in-port s<N> whose
+ * docstring is the name of the recorded port. Out-ports are recorded
+ * by connecting them to s<N>, in-ports by connecting the out-ports
+ * that feed them (this is done automatically by blockdiagram). Each
+ * step, all samples pending on s<N> are written to the file along
+ * with the current node time.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#undef UBX_DEBUG
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "record.h"
+
+/* size of the stdio buffer of the recording */
+#define RECORDER_FILE_BUF	(256 * 1024)
+
+char recorder_meta[] =
+	"{ doc='record port traffic to a file for replaying with record/replay',"
+	"  realtime=false,"
+	"}";
+
+ubx_proto_config_t recorder_config[] = {
+	{ .name = "filename", .type_name = "char", .min = 1, .doc = "file to record to" },
+	{ .name = "ports", .type_name = "char", .min = 1, .doc = "space separated list of ports (block.port) or blocks (all in-ports) to record" },
+	{ .name = "buffer_len", .type_name = "uint32_t", .max = 1, .doc = "buffer length of the tap connections created by blockdiagram (def: 16)" },
+	{ .name = "loglevel", .type_name = "int" },
+	{ 0 },
+};
+
+/**
+ * struct recorder_stream
+ * @desc: stream description written to the file
+ * @p: in-port s<N>
+ * @sample: buffer to read samples to
+ */
+struct recorder_stream {
+	struct ubxrec_stream desc;
+	ubx_port_t *p;
+	ubx_data_t *sample;
+};
+
+struct recorder_info {
+	struct recorder_stream *streams;
+	uint32_t num_streams;
+
+	const char *filename;
+	FILE *fp;
+	char *fbuf;
+
+	uint64_t seq;
+	unsigned long num_samples;
+	unsigned long write_errors;
+};
+
+/* add a stream for the port p of block blk */
+static int recorder_add_stream(ubx_block_t *b, const ubx_block_t *blk, const ubx_port_t *p)
+{
+	int ret;
+	long data_len;
+	const ubx_type_t *type;
+	struct recorder_stream *s;
+	char pname[UBX_PORT_NAME_MAXLEN + 1];
+	struct recorder_info *inf = (struct recorder_info *)b->private_data;
+
+	if (port_is_out(p)) {
+		type = p->out_type;
+		data_len = p->out_data_len;
+	} else {
+		type = p->in_type;
+		data_len = p->in_data_len;
+	}
+
+	data_len = (data_len > 0) ? data_len : 1;
+
+	s = realloc(inf->streams, (inf->num_streams + 1) * sizeof(struct recorder_stream));
+
+	if (s == NULL) {
+		ubx_err(b, "EOUTOFMEM: failed to alloc stream %s.%s", blk->name, p->name);
+		return EOUTOFMEM;
+	}
+
+	inf->streams = s;
+	s = &inf->streams[inf->num_streams];
+	memset(s, 0, sizeof(struct recorder_stream));
+
+	snprintf(s->desc.name, sizeof(s->desc.name), "%s.%s", blk->name, p->name);
+	strncpy(s->desc.type_name, type->name, UBX_TYPE_NAME_MAXLEN);
+	memcpy(s->desc.type_hash, type->hash, UBX_TYPE_HASH_LEN);
+	s->desc.type_size = type->size;
+	s->desc.data_len = data_len;
+
+	s->sample = __ubx_data_alloc(type, data_len);
+
+	if (s->sample == NULL) {
+		ubx_err(b, "EOUTOFMEM: failed to alloc sample for %s", s->desc.name);
+		return EOUTOFMEM;
+	}
+
+	snprintf(pname, sizeof(pname), UBXREC_PORT_FMT, inf->num_streams);
+	inf->num_streams++;
+
+	ret = ubx_inport_add(b, pname, s->desc.name, 0, type->name, data_len);
+
+	if (ret != 0) {
+		ubx_err(b, "failed to add port %s for %s", pname, s->desc.name);
+		return ret;
+	}
+
+	ubx_debug(b, "%s: recording %s (%s[%ld])", pname, s->desc.name, type->name, data_len);
+	return 0;
+}
+
+/* add the streams for a ports config entry "block.port" or "block" */
+static int recorder_add_entry(ubx_block_t *b, char *entry)
+{
+	int ret;
+	char *dot;
+	const char *pname = NULL;
+	const ubx_block_t *blk;
+	const ubx_port_t *p;
+
+	dot = strrchr(entry, '.');
+
+	if (dot != NULL) {
+		*dot = '\0';
+		pname = dot + 1;
+	}
+
+	blk = ubx_block_get(b->nd, entry);
+
+	if (blk == NULL) {
+		ubx_err(b, "EINVALID_CONFIG: ports: no block %s", entry);
+		return EINVALID_CONFIG;
+	}
+
+	if (pname != NULL) {
+		p = ubx_port_get(blk, pname);
+
+		if (p == NULL) {
+			ubx_err(b, "EINVALID_CONFIG: ports: block %s has no port %s",
+				entry, pname);
+			return EINVALID_CONFIG;
+		}
+
+		return recorder_add_stream(b, blk, p);
+	}
+
+	/* record all in-ports */
+	DL_FOREACH(blk->ports, p) {
+		if (!port_is_in(p))
+			continue;
+
+		ret = recorder_add_stream(b, blk, p);
+
+		if (ret != 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+/* remove the streams and their ports */
+static void recorder_rm_streams(ubx_block_t *b)
+{
+	ubx_port_t *p = NULL, *ptmp = NULL;
+	struct recorder_info *inf = (struct recorder_info *)b->private_data;
+
+	DL_FOREACH_SAFE(b->ports, p, ptmp) {
+		if (port_is_dyn(p))
+			ubx_port_rm(b, p->name);
+	}
+
+	for (uint32_t i = 0; i < inf->num_streams; i++)
+		ubx_data_free(inf->streams[i].sample);
+
+	free(inf->streams);
+	inf->streams = NULL;
+	inf->num_streams = 0;
+}
+
+int recorder_init(ubx_block_t *b)
+{
+	long len;
+	int ret = EOUTOFMEM;
+	char *ports, *entry, *saveptr;
+	const char *ports_cfg;
+	char pname[UBX_PORT_NAME_MAXLEN + 1];
+	struct recorder_info *inf;
+
+	inf = calloc(1, sizeof(struct recorder_info));
+
+	if (inf == NULL) {
+		ubx_err(b, "EOUTOFMEM: failed to alloc recorder_info");
+		return EOUTOFMEM;
+	}
+
+	b->private_data = inf;
+
+	len = cfg_getptr_char(b, "filename", &inf->filename);
+	assert(len > 0);
+
+	len = cfg_getptr_char(b, "ports", &ports_cfg);
+	assert(len > 0);
+
+	ports = strdup(ports_cfg);
+
+	if (ports == NULL) {
+		ubx_err(b, "EOUTOFMEM: failed to dup ports config");
+		goto out_free;
+	}
+
+	ret = 0;
+
+	for (entry = strtok_r(ports, " \t\n,", &saveptr); entry != NULL;
+	     entry = strtok_r(NULL, " \t\n,", &saveptr)) {
+		ret = recorder_add_entry(b, entry);
+
+		if (ret != 0)
+			break;
+	}
+
+	free(ports);
+
+	if (ret != 0)
+		goto out_free;
+
+	if (inf->num_streams == 0) {
+		ubx_err(b, "EINVALID_CONFIG: ports: nothing to record");
+		ret = EINVALID_CONFIG;
+		goto out_free;
+	}
+
+	/* cache port ptrs after adding all ports */
+	for (uint32_t i = 0; i < inf->num_streams; i++) {
+		snprintf(pname, sizeof(pname), UBXREC_PORT_FMT, i);
+		inf->streams[i].p = ubx_port_get(b, pname);
+		assert(inf->streams[i].p);
+	}
+
+	return 0;
+
+ out_free:
+	recorder_rm_streams(b);
+	free(inf);
+	return ret;
+}
+
+int recorder_start(ubx_block_t *b)
+{
+	struct ubxrec_hdr hdr = { .magic = UBXREC_MAGIC, .version = UBXREC_VERSION };
+	struct recorder_info *inf = (struct recorder_info *)b->private_data;
+
+	inf->fp = fopen(inf->filename, "w");
+
+	if (inf->fp == NULL) {
+		ubx_err(b, "failed to open %s: %s", inf->filename, strerror(errno));
+		return -1;
+	}
+
+	inf->fbuf = malloc(RECORDER_FILE_BUF);
+
+	if (inf->fbuf != NULL)
+		setvbuf(inf->fp, inf->fbuf, _IOFBF, RECORDER_FILE_BUF);
+
+	hdr.num_streams = inf->num_streams;
+
+	if (fwrite(&hdr, sizeof(hdr), 1, inf->fp) != 1)
+		goto out_err;
+
+	for (uint32_t i = 0; i < inf->num_streams; i++) {
+		if (fwrite(&inf->streams[i].desc, sizeof(struct ubxrec_stream), 1, inf->fp) != 1)
+			goto out_err;
+	}
+
+	inf->seq = 0;
+	inf->num_samples = 0;
+	inf->write_errors = 0;
+
+	ubx_info(b, "recording %u streams to %s", inf->num_streams, inf->filename);
+	return 0;
+
+ out_err:
+	ubx_err(b, "failed to write header to %s: %s", inf->filename, strerror(errno));
+	fclose(inf->fp);
+	free(inf->fbuf);
+	inf->fp = NULL;
+	inf->fbuf = NULL;
+	return -1;
+}
+
+/* write a sample, return 0 if OK, -1 otherwise */
+static int recorder_write(FILE *fp, const struct ubxrec_sample *hdr, const void *data, size_t size)
+{
+	static const uint8_t pad[UBXREC_ALIGN];
+	size_t padlen = ubxrec_padded(size) - size;
+
+	if (fwrite(hdr, sizeof(*hdr), 1, fp) != 1 ||
+	    fwrite(data, 1, size, fp) != size ||
+	    fwrite(pad, 1, padlen, fp) != padlen)
+		return -1;
+
+	return 0;
+}
+
+/* write all pending samples of all streams */
+void recorder_step(ubx_block_t *b)
+{
+	long len;
+	size_t size;
+	struct ubx_timespec now;
+	struct ubxrec_sample hdr;
+	struct recorder_stream *s;
+	struct recorder_info *inf = (struct recorder_info *)b->private_data;
+
+	ubx_node_gettime(b->nd, &now);
+	hdr.ts = ubx_ts_to_ns(&now);
+	hdr.seq = inf->seq++;
+
+	for (uint32_t i = 0; i < inf->num_streams; i++) {
+		s = &inf->streams[i];
+		hdr.stream = i;
+
+		while ((len = __port_read(s->p, s->sample)) > 0) {
+			hdr.len = len;
+			size = len * s->desc.type_size;
+
+			if (recorder_write(inf->fp, &hdr, s->sample->data, size) != 0) {
+				/* only log the first error */
+				if (inf->write_errors++ == 0)
+					ubx_err(b, "failed to write %s: %s",
+						inf->filename, strerror(errno));
+				continue;
+			}
+
+			inf->num_samples++;
+		}
+
+		if (len < 0)
+			ubx_err(b, "failed to read %s: %ld", s->desc.name, len);
+	}
+}
+
+void recorder_stop(ubx_block_t *b)
+{
+	struct recorder_info *inf = (struct recorder_info *)b->private_data;
+
+	/* drain the remaining samples */
+	recorder_step(b);
+
+	if (fclose(inf->fp) != 0)
+		ubx_err(b, "failed to write %s: %s", inf->filename, strerror(errno));
+
+	free(inf->fbuf);
+	inf->fp = NULL;
+	inf->fbuf = NULL;
+
+	if (inf->write_errors > 0)
+		ubx_err(b, "failed to write %lu samples to %s",
+			inf->write_errors, inf->filename);
+
+	ubx_info(b, "recorded %lu samples to %s", inf->num_samples, inf->filename);
+}
+
+void recorder_cleanup(ubx_block_t *b)
+{
+	recorder_rm_streams(b);
+	free(b->private_data);
+}
+
+ubx_proto_block_t recorder_comp = {
+	.name = RECORDER_BLOCK_NAME,
+	.type = BLOCK_TYPE_COMPUTATION,
+	.meta_data = recorder_meta,
+	.configs = recorder_config,
+
+	.init = recorder_init,
+	.start = recorder_start,
+	.stop = recorder_stop,
+	.cleanup = recorder_cleanup,
+	.step = recorder_step,
+};
+
+int record_mod_init(ubx_node_t *nd)
+{
+	int ret;
+
+	ret = ubx_block_register(nd, &recorder_comp);
+
+	if (ret != 0)
+		return ret;
+
+	ret = replay_register(nd);
+
+	if (ret != 0)
+		ubx_block_unregister(nd, RECORDER_BLOCK_NAME);
+
+	return ret;
+}
+
+void record_mod_cleanup(ubx_node_t *nd)
+{
+	replay_unregister(nd);
+	ubx_block_unregister(nd, RECORDER_BLOCK_NAME);
+}
+
+UBX_MODULE_INIT(record_mod_init)
+UBX_MODULE_CLEANUP(record_mod_cleanup)
+UBX_MODULE_LICENSE_SPDX(BSD-3-Clause)
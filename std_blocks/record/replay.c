@@ -0,0 +1,428 @@
+/*
+ * Replay block: replay port traffic recorded by record/recorder
+ *
+ * The recording is loaded into memory in init and an out-port s<N>
+ * is added for each recorded stream. The docstring of s<N> is the
+ * name of the recorded port. If realtime is set, each step outputs
+ * all samples that are due according to the recorded timestamps
+ * relative to the start of the block. Otherwise, each step outputs
+ * the samples that were recorded in one step of the recorder (i.e.
+ * with the same step sequence number), so the recording is replayed
+ * as fast as the replay is triggered.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#undef UBX_DEBUG
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "record.h"
+
+char replay_meta[] =
+	"{ doc='replay port traffic recorded by record/recorder',"
+	"  realtime=true,"
+	"}";
+
+ubx_proto_config_t replay_config[] = {
+	{ .name = "filename", .type_name = "char", .min = 1, .doc = "recording to replay" },
+	{ .name = "realtime", .type_name = "int", .max = 1, .doc = "1: replay with the recorded timing, 0: one recorded step per step (def: 0)" },
+	{ .name = "loop", .type_name = "int", .max = 1, .doc = "restart at the end of the recording (def: 0)" },
+	{ .name = "buffer_len", .type_name = "uint32_t", .max = 1, .doc = "buffer length of the connections created by blockdiagram (def: 16)" },
+	{ .name = "loglevel", .type_name = "int" },
+	{ 0 },
+};
+
+ubx_proto_port_t replay_ports[] = {
+	{ .name = "eof", .out_type_name = "int", .doc = "1 is output once when the end of the recording is reached" },
+	{ 0 },
+};
+
+/**
+ * struct replay_stream
+ * @p: out-port s<N>
+ * @data: sample pointing to the recording
+ */
+struct replay_stream {
+	ubx_port_t *p;
+	ubx_data_t data;
+};
+
+/**
+ * struct replay_info
+ * @buf: the recording
+ * @first: first sample in buf
+ * @end: end of buf
+ * @cur: next sample to output
+ * @rec_start: timestamp of the first sample
+ * @start: node time at which the replay was (re)started
+ */
+struct replay_info {
+	uint8_t *buf;
+	const uint8_t *first;
+	const uint8_t *end;
+	const uint8_t *cur;
+
+	struct replay_stream *streams;
+	uint32_t num_streams;
+
+	int realtime;
+	int loop;
+	int eof;
+
+	uint64_t rec_start;
+	uint64_t start;
+
+	unsigned long num_samples;
+	ubx_port_t *p_eof;
+};
+
+/* load the file into memory */
+static int replay_load(ubx_block_t *b, const char *filename, uint8_t **buf, size_t *size)
+{
+	int ret = -1;
+	long len;
+	FILE *fp;
+
+	fp = fopen(filename, "r");
+
+	if (fp == NULL) {
+		ubx_err(b, "failed to open %s: %s", filename, strerror(errno));
+		return -1;
+	}
+
+	if (fseek(fp, 0, SEEK_END) != 0 || (len = ftell(fp)) < 0 ||
+	    fseek(fp, 0, SEEK_SET) != 0) {
+		ubx_err(b, "failed to determine size of %s: %s", filename, strerror(errno));
+		goto out;
+	}
+
+	*buf = malloc(len);
+
+	if (*buf == NULL) {
+		ubx_err(b, "EOUTOFMEM: failed to alloc %ld bytes for %s", len, filename);
+		ret = EOUTOFMEM;
+		goto out;
+	}
+
+	if (fread(*buf, 1, len, fp) != (size_t)len) {
+		ubx_err(b, "failed to read %s", filename);
+		free(*buf);
+		goto out;
+	}
+
+	*size = len;
+	ret = 0;
+ out:
+	fclose(fp);
+	return ret;
+}
+
+/* size of the sample at ptr */
+static inline size_t sample_size(const struct replay_info *inf, const uint8_t *ptr)
+{
+	const struct ubxrec_sample *hd = (const struct ubxrec_sample *)ptr;
+
+	return sizeof(struct ubxrec_sample) +
+		ubxrec_padded(hd->len * inf->streams[hd->stream].data.type->size);
+}
+
+/* check that all samples are valid, so that step needs not */
+static int replay_check_samples(ubx_block_t *b, struct replay_info *inf)
+{
+	const uint8_t *ptr = inf->first;
+	const struct ubxrec_sample *hd;
+	uint64_t last_ts = 0, last_seq = 0;
+
+	inf->num_samples = 0;
+
+	while (ptr < inf->end) {
+		hd = (const struct ubxrec_sample *)ptr;
+
+		if (ptr + sizeof(struct ubxrec_sample) > inf->end ||
+		    hd->stream >= inf->num_streams ||
+		    hd->len < 1 || hd->len > inf->streams[hd->stream].data.len ||
+		    hd->ts < last_ts || hd->seq < last_seq ||
+		    ptr + sample_size(inf, ptr) > inf->end) {
+			ubx_err(b, "invalid sample #%lu at offset %ld",
+				inf->num_samples, (long)(ptr - inf->buf));
+			return EINVALID_CONFIG;
+		}
+
+		last_ts = hd->ts;
+		last_seq = hd->seq;
+		ptr += sample_size(inf, ptr);
+		inf->num_samples++;
+	}
+
+	return 0;
+}
+
+/* add the streams and their out-ports */
+static int replay_add_streams(ubx_block_t *b, struct replay_info *inf, size_t size)
+{
+	int ret;
+	const struct ubxrec_hdr *hdr;
+	const struct ubxrec_stream *desc;
+	const ubx_type_t *type;
+	char pname[UBX_PORT_NAME_MAXLEN + 1];
+
+	hdr = (const struct ubxrec_hdr *)inf->buf;
+
+	if (size < sizeof(struct ubxrec_hdr) ||
+	    strncmp(hdr->magic, UBXREC_MAGIC, sizeof(hdr->magic)) != 0) {
+		ubx_err(b, "EINVALID_CONFIG: not a recording");
+		return EINVALID_CONFIG;
+	}
+
+	if (hdr->version != UBXREC_VERSION) {
+		ubx_err(b, "EINVALID_CONFIG: unsupported version %u", hdr->version);
+		return EINVALID_CONFIG;
+	}
+
+	if (size < sizeof(struct ubxrec_hdr) + hdr->num_streams * sizeof(struct ubxrec_stream)) {
+		ubx_err(b, "EINVALID_CONFIG: truncated recording");
+		return EINVALID_CONFIG;
+	}
+
+	inf->streams = calloc(hdr->num_streams, sizeof(struct replay_stream));
+
+	if (inf->streams == NULL) {
+		ubx_err(b, "EOUTOFMEM: failed to alloc streams");
+		return EOUTOFMEM;
+	}
+
+	desc = (const struct ubxrec_stream *)(inf->buf + sizeof(struct ubxrec_hdr));
+
+	for (uint32_t i = 0; i < hdr->num_streams; i++, desc++) {
+		type = ubx_type_get(b->nd, desc->type_name);
+
+		if (type == NULL) {
+			ubx_err(b, "EINVALID_TYPE: %s: type %s not registered",
+				desc->name, desc->type_name);
+			return EINVALID_TYPE;
+		}
+
+		if (memcmp(type->hash, desc->type_hash, UBX_TYPE_HASH_LEN) != 0) {
+			ubx_err(b, "EINVALID_TYPE: %s: type %s differs from the recorded one",
+				desc->name, desc->type_name);
+			return EINVALID_TYPE;
+		}
+
+		if (type->size != desc->type_size || desc->data_len < 1) {
+			ubx_err(b, "EINVALID_TYPE: %s: invalid size of %s",
+				desc->name, desc->type_name);
+			return EINVALID_TYPE;
+		}
+
+		snprintf(pname, sizeof(pname), UBXREC_PORT_FMT, i);
+
+		ret = ubx_outport_add(b, pname, desc->name, 0, type->name, desc->data_len);
+
+		if (ret != 0) {
+			ubx_err(b, "failed to add port %s for %s", pname, desc->name);
+			return ret;
+		}
+
+		inf->streams[i].data.type = type;
+		inf->streams[i].data.len = desc->data_len;
+		inf->num_streams++;
+
+		ubx_debug(b, "%s: replaying %s (%s[%u])", pname, desc->name,
+			  type->name, desc->data_len);
+	}
+
+	/* cache port ptrs after adding all ports */
+	for (uint32_t i = 0; i < inf->num_streams; i++) {
+		snprintf(pname, sizeof(pname), UBXREC_PORT_FMT, i);
+		inf->streams[i].p = ubx_port_get(b, pname);
+		assert(inf->streams[i].p);
+	}
+
+	inf->first = (const uint8_t *)desc;
+	return 0;
+}
+
+/* remove the out-ports of the streams */
+static void replay_rm_streams(ubx_block_t *b)
+{
+	ubx_port_t *p = NULL, *ptmp = NULL;
+
+	DL_FOREACH_SAFE(b->ports, p, ptmp) {
+		if (port_is_dyn(p))
+			ubx_port_rm(b, p->name);
+	}
+}
+
+int replay_init(ubx_block_t *b)
+{
+	long len;
+	int ret;
+	size_t size;
+	const int *val;
+	const char *filename;
+	struct replay_info *inf;
+
+	inf = calloc(1, sizeof(struct replay_info));
+
+	if (inf == NULL) {
+		ubx_err(b, "EOUTOFMEM: failed to alloc replay_info");
+		return EOUTOFMEM;
+	}
+
+	b->private_data = inf;
+
+	len = cfg_getptr_char(b, "filename", &filename);
+	assert(len > 0);
+
+	len = cfg_getptr_int(b, "realtime", &val);
+	assert(len >= 0);
+	inf->realtime = (len > 0) ? *val : 0;
+
+	len = cfg_getptr_int(b, "loop", &val);
+	assert(len >= 0);
+	inf->loop = (len > 0) ? *val : 0;
+
+	ret = replay_load(b, filename, &inf->buf, &size);
+
+	if (ret != 0)
+		goto out_free;
+
+	inf->end = inf->buf + size;
+
+	ret = replay_add_streams(b, inf, size);
+
+	if (ret != 0)
+		goto out_free;
+
+	ret = replay_check_samples(b, inf);
+
+	if (ret != 0)
+		goto out_free;
+
+	inf->p_eof = ubx_port_get(b, "eof");
+	assert(inf->p_eof);
+
+	ubx_info(b, "loaded %lu samples of %u streams from %s",
+		 inf->num_samples, inf->num_streams, filename);
+
+	return 0;
+
+ out_free:
+	replay_rm_streams(b);
+	free(inf->streams);
+	free(inf->buf);
+	free(inf);
+	return ret;
+}
+
+/* (re)start replaying from the first sample */
+static void replay_rewind(ubx_block_t *b, struct replay_info *inf)
+{
+	struct ubx_timespec now;
+
+	ubx_node_gettime(b->nd, &now);
+
+	inf->cur = inf->first;
+	inf->start = ubx_ts_to_ns(&now);
+
+	if (inf->cur < inf->end)
+		inf->rec_start = ((const struct ubxrec_sample *)inf->cur)->ts;
+}
+
+int replay_start(ubx_block_t *b)
+{
+	struct replay_info *inf = (struct replay_info *)b->private_data;
+
+	replay_rewind(b, inf);
+	inf->eof = 0;
+
+	return 0;
+}
+
+/* output the sample at cur and advance */
+static inline void replay_output(struct replay_info *inf)
+{
+	struct replay_stream *s;
+	const struct ubxrec_sample *hd = (const struct ubxrec_sample *)inf->cur;
+
+	s = &inf->streams[hd->stream];
+	s->data.len = hd->len;
+	s->data.data = (void *)(inf->cur + sizeof(struct ubxrec_sample));
+
+	__port_write(s->p, &s->data);
+
+	inf->cur += sample_size(inf, inf->cur);
+}
+
+void replay_step(ubx_block_t *b)
+{
+	uint64_t until, seq;
+	struct ubx_timespec now;
+	struct replay_info *inf = (struct replay_info *)b->private_data;
+
+	if (inf->cur >= inf->end) {
+		if (inf->loop && inf->first < inf->end) {
+			replay_rewind(b, inf);
+		} else {
+			if (!inf->eof) {
+				inf->eof = 1;
+				write_int(inf->p_eof, &inf->eof);
+				ubx_info(b, "end of recording");
+			}
+			return;
+		}
+	}
+
+	if (inf->realtime) {
+		ubx_node_gettime(b->nd, &now);
+		until = inf->rec_start + ubx_ts_to_ns(&now) - inf->start;
+
+		while (inf->cur < inf->end &&
+		       ((const struct ubxrec_sample *)inf->cur)->ts <= until)
+			replay_output(inf);
+		return;
+	}
+
+	/* the samples of one recorder step */
+	seq = ((const struct ubxrec_sample *)inf->cur)->seq;
+
+	while (inf->cur < inf->end &&
+	       ((const struct ubxrec_sample *)inf->cur)->seq == seq)
+		replay_output(inf);
+}
+
+void replay_cleanup(ubx_block_t *b)
+{
+	struct replay_info *inf = (struct replay_info *)b->private_data;
+
+	replay_rm_streams(b);
+	free(inf->streams);
+	free(inf->buf);
+	free(inf);
+}
+
+ubx_proto_block_t replay_comp = {
+	.name = REPLAY_BLOCK_NAME,
+	.type = BLOCK_TYPE_COMPUTATION,
+	.meta_data = replay_meta,
+	.configs = replay_config,
+	.ports = replay_ports,
+
+	.init = replay_init,
+	.start = replay_start,
+	.cleanup = replay_cleanup,
+	.step = replay_step,
+};
+
+int replay_register(ubx_node_t *nd)
+{
+	return ubx_block_register(nd, &replay_comp);
+}
+
+void replay_unregister(ubx_node_t *nd)
+{
+	ubx_block_unregister(nd, REPLAY_BLOCK_NAME);
+}
@@ -129,7 +129,7 @@ int common_config_chains(const ubx_block_t *b, struct ubx_chain *chain, int num_
 	int tstats_mode, tstats_skip_first;
 	double output_rate;
 
-	ubx_port_t *p_tstats;
+	ubx_port_t *p_tstats, *p_rtcheck;
 	char chain_id[UBX_BLOCK_NAME_MAXLEN+1];
 
 	/* tstats_mode */
@@ -151,11 +151,15 @@ int common_config_chains(const ubx_block_t *b, struct ubx_chain *chain, int num_
 	p_tstats = ubx_port_get(b, "tstats");
 	assert(p_tstats);
 
+	/* rtcheck port (optional) */
+	p_rtcheck = ubx_port_get(b, "rtcheck");
+
 	/* initialize all chains */
 	for (i = 0; i < num_chains; i++) {
 		chain[i].tstats_mode = tstats_mode;
 		chain[i].tstats_skip_first = tstats_skip_first;
 		chain[i].p_tstats = p_tstats;
+		chain[i].p_rtcheck = p_rtcheck;
 
 		snprintf(chain_id, UBX_BLOCK_NAME_MAXLEN, CHAIN_NAME_FMT, i);
 
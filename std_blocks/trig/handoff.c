@@ -0,0 +1,238 @@
+/*
+ * Handoff iblock for pipelined ptrig chains
+ *
+ * A handoff connects two stages of a pipelined ptrig (see the
+ * pipeline config of ptrig). It holds two slots: the producing stage
+ * writes to the back slot, while the consuming stage reads the front
+ * slot. Both stages run concurrently, so the slots are only swapped
+ * by the ptrig between two periods (handoff_swap), when no stage is
+ * running. Hence a sample written in period N is read in period N+1,
+ * regardless of the timing of the two stages.
+ *
+ * Only the last sample written in a period is handed off and it can
+ * be read once.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#undef UBX_DEBUG
+
+#include <stdlib.h>
+
+#include "handoff.h"
+
+char handoff_meta[] =
+	"{ doc='double buffer for handing off data between pipeline stages',"
+	"  realtime=true,"
+	"}";
+
+ubx_proto_config_t handoff_config[] = {
+	{ .name = "type_name", .type_name = "char", .min = 1, .doc = "name of registered microblx type to transport" },
+	{ .name = "data_len", .type_name = "long", .max = 1, .doc = "array length of data (default: 1)" },
+	{ 0 },
+};
+
+ubx_proto_port_t handoff_ports[] = {
+	{ .name = "overwrites", .out_type_name = "unsigned long", .doc = "number of samples overwritten before being handed off" },
+	{ 0 },
+};
+
+/**
+ * struct handoff_info
+ * @type: type of data
+ * @data_len: capacity (array length) of each slot
+ * @slot: the two data slots
+ * @len: array length of the sample in each slot
+ * @front: index of the slot read by the consumer
+ * @fresh: front contains a sample that was not read yet
+ * @written: back was written in the current period
+ * @overwrites: number of overwritten samples
+ */
+struct handoff_info {
+	const ubx_type_t *type;
+	long data_len;
+
+	void *slot[2];
+	long len[2];
+	int front;
+	int fresh;
+	int written;
+
+	unsigned long overwrites;
+	ubx_port_t *p_overwrites;
+};
+
+int handoff_init(ubx_block_t *i)
+{
+	int ret = EINVALID_CONFIG;
+	long len;
+	const long *data_len;
+	const char *type_name;
+	struct handoff_info *inf;
+
+	inf = calloc(1, sizeof(struct handoff_info));
+
+	if (inf == NULL) {
+		ubx_err(i, "EOUTOFMEM: failed to alloc handoff_info");
+		return EOUTOFMEM;
+	}
+
+	i->private_data = inf;
+
+	len = cfg_getptr_char(i, "type_name", &type_name);
+	assert(len >= 0);
+
+	inf->type = ubx_type_get(i->nd, type_name);
+
+	if (inf->type == NULL) {
+		ubx_err(i, "EINVALID_CONFIG: unknown type %s", type_name);
+		goto out_free;
+	}
+
+	len = cfg_getptr_long(i, "data_len", &data_len);
+	assert(len >= 0);
+
+	inf->data_len = (len > 0) ? *data_len : 1;
+
+	if (inf->data_len < 1) {
+		ubx_err(i, "EINVALID_CONFIG: data_len %ld", inf->data_len);
+		goto out_free;
+	}
+
+	/* freed by the core if init fails */
+	inf->slot[0] = ubx_block_mem_alloc(i, inf->data_len * inf->type->size, 0);
+	inf->slot[1] = ubx_block_mem_alloc(i, inf->data_len * inf->type->size, 0);
+
+	if (inf->slot[0] == NULL || inf->slot[1] == NULL) {
+		ubx_err(i, "EOUTOFMEM: failed to alloc slots");
+		ret = EOUTOFMEM;
+		goto out_free;
+	}
+
+	inf->p_overwrites = ubx_port_get(i, "overwrites");
+	assert(inf->p_overwrites);
+
+	return 0;
+
+ out_free:
+	free(inf);
+	return ret;
+}
+
+void handoff_cleanup(ubx_block_t *i)
+{
+	struct handoff_info *inf = (struct handoff_info *)i->private_data;
+
+	ubx_block_mem_free(i, inf->slot[0]);
+	ubx_block_mem_free(i, inf->slot[1]);
+	free(inf);
+}
+
+void handoff_write(ubx_block_t *i, const ubx_data_t *msg)
+{
+	int back;
+	struct handoff_info *inf = (struct handoff_info *)i->private_data;
+
+	if (inf->type != msg->type) {
+		ubx_err(i, "invalid message type %s", msg->type->name);
+		return;
+	}
+
+	if (msg->len > inf->data_len) {
+		ubx_err(i, "msg array len too large: is: %lu, capacity: %lu",
+			msg->len, inf->data_len);
+		return;
+	}
+
+	back = !inf->front;
+
+	if (inf->written) {
+		inf->overwrites++;
+		write_ulong(inf->p_overwrites, &inf->overwrites);
+	}
+
+	memcpy(inf->slot[back], msg->data, data_size(msg));
+	inf->len[back] = msg->len;
+	inf->written = 1;
+}
+
+long handoff_read(ubx_block_t *i, ubx_data_t *msg)
+{
+	long readlen;
+	struct handoff_info *inf = (struct handoff_info *)i->private_data;
+
+	if (inf->type != msg->type) {
+		ubx_err(i, "invalid message type %s", msg->type->name);
+		return EINVALID_TYPE;
+	}
+
+	if (!inf->fresh)
+		return PORT_READ_NODATA;
+
+	readlen = MIN(msg->len, inf->len[inf->front]);
+
+	if (readlen < inf->len[inf->front]) {
+		ubx_err(i, "only copying %lu array elements of %lu",
+			msg->len, inf->len[inf->front]);
+	}
+
+	memcpy(msg->data, inf->slot[inf->front], readlen * inf->type->size);
+	inf->fresh = 0;
+
+	return readlen;
+}
+
+/**
+ * handoff_is - check if a block is a handoff iblock
+ */
+int handoff_is(const ubx_block_t *b)
+{
+	return b->prototype != NULL &&
+		strcmp(b->prototype->name, HANDOFF_BLOCK_NAME) == 0;
+}
+
+/**
+ * handoff_swap - hand off the sample written in the current period
+ *
+ * Must only be called while neither producer nor consumer are
+ * running.
+ */
+void handoff_swap(ubx_block_t *b)
+{
+	struct handoff_info *inf = (struct handoff_info *)b->private_data;
+
+	if (b->block_state != BLOCK_STATE_ACTIVE)
+		return;
+
+	if (inf->written) {
+		inf->front = !inf->front;
+		inf->fresh = 1;
+		inf->written = 0;
+	} else {
+		inf->fresh = 0;
+	}
+}
+
+ubx_proto_block_t handoff_comp = {
+	.name = HANDOFF_BLOCK_NAME,
+	.type = BLOCK_TYPE_INTERACTION,
+	.meta_data = handoff_meta,
+	.configs = handoff_config,
+	.ports = handoff_ports,
+
+	.init = handoff_init,
+	.cleanup = handoff_cleanup,
+
+	.write = handoff_write,
+	.read = handoff_read,
+};
+
+int handoff_register(ubx_node_t *nd)
+{
+	return ubx_block_register(nd, &handoff_comp);
+}
+
+void handoff_unregister(ubx_node_t *nd)
+{
+	ubx_block_unregister(nd, HANDOFF_BLOCK_NAME);
+}
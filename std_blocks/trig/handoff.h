@@ -0,0 +1,20 @@
+/*
+ * Handoff iblock for pipelined ptrig chains
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include "ubx.h"
+
+#define HANDOFF_BLOCK_NAME	"std_triggers/handoff"
+
+int handoff_register(ubx_node_t *nd);
+void handoff_unregister(ubx_node_t *nd);
+
+int handoff_is(const ubx_block_t *b);
+void handoff_swap(ubx_block_t *b);
+
+#endif /* HANDOFF_H */
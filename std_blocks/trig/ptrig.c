@@ -21,10 +21,13 @@
 
 #include <pthread.h>
 #include <limits.h>	/* PTHREAD_STACK_MIN */
+#include <unistd.h>
+#include <sys/mman.h>
 
 #include "ubx.h"
 #include "trig_utils.h"
 #include "common.h"
+#include "handoff.h"
 
 #include "types/ptrig_period.h"
 #include "types/ptrig_period.h.hexarr"
@@ -33,6 +36,9 @@
 #define	THREAD_STOP_TIMEOUT_US	50000
 #define	THREAD_STOP_RETRIES	20
 
+/* stack below the current frame left untouched when prefaulting */
+#define STACK_PREFAULT_MARGIN	8192
+
 char ptrig_meta[] =
 	"{ doc='pthread based trigger',"
 	"  realtime=true,"
@@ -41,6 +47,7 @@ char ptrig_meta[] =
 ubx_proto_port_t ptrig_ports[] = {
 	{ .name = "active_chain", .in_type_name = "int", .doc = "switch the active trigger chain" },
 	{ .name = "tstats", .out_type_name = "struct ubx_tstat", .doc = "out port for timing statistics" },
+	{ .name = "rtcheck", .out_type_name = "struct ubx_rtcheck", .doc = "blocks that page faulted or allocated in step (tstats_mode 3)" },
 	{ .name = "shutdown", .in_type_name = "int", .doc = "input port for stopping ptrig" },
 	{ 0 },
 };
@@ -64,8 +71,13 @@ ubx_proto_config_t ptrig_config[] = {
 	{ .name = "thread_name", .type_name = "char", .doc = "thread name (for dbg), default is block name" },
 	{ .name = "autostop_steps", .type_name = "int64_t", .doc = "if set and > 0, block stops itself after X steps", .max=1 },
 	{ .name = "num_chains", .type_name = "int", .max = 1, .doc = "number of trigger chains (def: 1)" },
+	{ .name = "pipeline", .type_name = "int", .max = 1, .doc = "if 1, run the chains as pipeline stages in parallel threads (def: 0)" },
+#ifdef CONFIG_PTHREAD_SETAFFINITY
+	{ .name = "stage_affinity", .type_name = "int", .doc = "CPU to pin each pipeline stage thread to" },
+#endif
+	{ .name = "throughput", .type_name = "int", .max = 1, .doc = "if 1, step ready blocks as fast as possible and only sleep for a period when idle (def: 0)" },
 
-	{ .name = "tstats_mode", .type_name = "int", .doc = "enable timing statistics over all blocks", },
+	{ .name = "tstats_mode", .type_name = "int", .doc = "0: off (def), 1: global only, 2: per block, 3: per block and page fault/allocation checks", },
 	{ .name = "tstats_profile_path", .type_name = "char", .doc = "directory to write the timing stats file to" },
 	{ .name = "tstats_output_rate", .type_name = "double", .doc = "throttle output on tstats port" },
 	{ .name = "tstats_skip_first", .type_name = "int", .doc = "skip N steps before acquiring stats" },
@@ -77,7 +89,8 @@ ubx_proto_config_t ptrig_config[] = {
 /* used by the thread to reports it's actual state */
 enum thread_state {
 	THREAD_INACTIVE,
-	THREAD_ACTIVE
+	THREAD_ACTIVE,
+	THREAD_EXITED
 };
 
 const char* schedpol_tostr(unsigned int schedpol)
@@ -94,6 +107,18 @@ const char* schedpol_tostr(unsigned int schedpol)
 	}
 }
 
+/**
+ * struct ptrig_stage - pipeline stage
+ * @tid: thread running the stage
+ * @idx: stage number, i.e. index of the chain to trigger
+ * @b: ptrig block
+ */
+struct ptrig_stage {
+	pthread_t tid;
+	int idx;
+	ubx_block_t *b;
+};
+
 /**
  * block info
  */
@@ -106,6 +131,10 @@ struct ptrig_inf {
 
 	pthread_mutex_t mutex;
 	pthread_cond_t active_cond;
+	pthread_cond_t thread_cond;	/* signals thread_state changes */
+	unsigned long thread_activations;
+	int thread_exit;	/* requests the thread to exit */
+	int unconfig_pending;	/* stop timed out, chains still configured */
 
 	const struct ptrig_period *period;
 
@@ -116,6 +145,23 @@ struct ptrig_inf {
 	int64_t autostop_steps;
 
 	ubx_port_t *p_actchain;
+
+	/* pipeline mode */
+	int pipeline;
+	int stages_run;		/* set once init succeeded */
+	int stages_exit;
+	int num_stages;		/* number of stage threads created */
+	pthread_cond_t stages_cond;
+	struct ptrig_stage *stages;
+	pthread_barrier_t stage_start;
+	pthread_barrier_t stage_done;
+
+	ubx_block_t **handoffs;
+	long num_handoffs;
+	unsigned long pipe_overruns;
+
+	/* throughput mode */
+	int throughput;
 };
 
 
@@ -128,10 +174,347 @@ inline void tsnorm(struct timespec *ts)
 	}
 }
 
+/*
+ * prefault (and lock) the stack of the calling thread
+ *
+ * The unused part of the stack below the current frame is written
+ * page by page, so that the first cycles don't page fault. Only
+ * the calling thread can safely do this, hence this is called by
+ * the ptrig and stage threads upon startup if the node was created
+ * with ND_PREPARE_RT.
+ */
+static void prefault_stack(ubx_block_t *b, int stage)
+{
+	int ret;
+	void *stackaddr;
+	size_t stacksize, pages = 0;
+	size_t pagesize = sysconf(_SC_PAGESIZE);
+	pthread_attr_t attr;
+	volatile char *p, *end;
+
+	ret = pthread_getattr_np(pthread_self(), &attr);
+
+	if (ret != 0) {
+		ubx_err(b, "pthread_getattr_np failed: %s", strerror(ret));
+		return;
+	}
+
+	ret = pthread_attr_getstack(&attr, &stackaddr, &stacksize);
+	pthread_attr_destroy(&attr);
+
+	if (ret != 0) {
+		ubx_err(b, "pthread_attr_getstack failed: %s", strerror(ret));
+		return;
+	}
+
+	end = (char *)__builtin_frame_address(0) - STACK_PREFAULT_MARGIN;
+
+	for (p = stackaddr; p < end; p += pagesize, pages++)
+		*p = 0;
+
+	/* already locked with ND_MLOCK_ALL */
+	if (!(b->nd->attrs & ND_MLOCK_ALL) && mlock(stackaddr, stacksize) != 0)
+		ubx_notice(b, "failed to mlock stack: %s", strerror(errno));
+
+	if (stage < 0)
+		ubx_info(b, "prefaulted %zu KiB of %zu KiB stack",
+			 pages * pagesize / 1024, stacksize / 1024);
+	else
+		ubx_info(b, "stage %i: prefaulted %zu KiB of %zu KiB stack",
+			 stage, pages * pagesize / 1024, stacksize / 1024);
+}
+
+/* stage thread entry: trigger the stage's chain once per period */
+static void *stage_startup(void *arg)
+{
+	int run;
+	struct ptrig_stage *stage = (struct ptrig_stage *)arg;
+	ubx_block_t *b = stage->b;
+	struct ptrig_inf *inf = (struct ptrig_inf *)b->private_data;
+
+	if (b->nd->attrs & ND_PREPARE_RT)
+		prefault_stack(b, stage->idx);
+
+	/* wait until init has succeeded, as the barriers are only
+	 * complete once all stages were created */
+	pthread_mutex_lock(&inf->mutex);
+
+	while (!inf->stages_run && !inf->stages_exit)
+		pthread_cond_wait(&inf->stages_cond, &inf->mutex);
+
+	run = inf->stages_run;
+	pthread_mutex_unlock(&inf->mutex);
+
+	/* init failed */
+	if (!run)
+		pthread_exit(NULL);
+
+	while (1) {
+		pthread_barrier_wait(&inf->stage_start);
+
+		if (inf->stages_exit)
+			break;
+
+		if (ubx_chain_trigger(&inf->chains[stage->idx]) != 0)
+			ubx_err(b, "ubx_chain_trigger failed for stage %i", stage->idx);
+
+		pthread_barrier_wait(&inf->stage_done);
+	}
+
+	pthread_exit(NULL);
+}
+
+/*
+ * run all stages for one period and hand off the data written by
+ * each stage to the next one.
+ */
+static void pipeline_trigger(ubx_block_t *b, const struct ubx_timespec *deadline)
+{
+	struct ubx_timespec now;
+	struct ptrig_inf *inf = (struct ptrig_inf *)b->private_data;
+
+	pthread_barrier_wait(&inf->stage_start);
+	pthread_barrier_wait(&inf->stage_done);
+
+	/* all stages are idle now */
+	for (long i = 0; i < inf->num_handoffs; i++)
+		handoff_swap(inf->handoffs[i]);
+
+	ubx_node_gettime(b->nd, &now);
+
+	if (ubx_ts_cmp(&now, deadline) > 0) {
+		inf->pipe_overruns++;
+		ubx_notice(b, "pipeline overrun #%lu", inf->pipe_overruns);
+	}
+}
+
+/* add the handoff iblocks connected to the given block */
+static int collect_handoffs(ubx_block_t *b, const ubx_block_t *blk)
+{
+	long n;
+	const ubx_port_t *p;
+	const ubx_block_t **iaptr, **arrs[2];
+	ubx_block_t **tmp;
+	struct ptrig_inf *inf = (struct ptrig_inf *)b->private_data;
+
+	DL_FOREACH(blk->ports, p) {
+		arrs[0] = p->in_interaction;
+		arrs[1] = p->out_interaction;
+
+		for (int i = 0; i < 2; i++) {
+			for (iaptr = arrs[i]; iaptr != NULL && *iaptr != NULL; iaptr++) {
+				if (!handoff_is(*iaptr))
+					continue;
+
+				for (n = 0; n < inf->num_handoffs; n++) {
+					if (inf->handoffs[n] == *iaptr)
+						break;
+				}
+
+				if (n < inf->num_handoffs)
+					continue;
+
+				tmp = realloc(inf->handoffs,
+					      (inf->num_handoffs + 1) * sizeof(ubx_block_t *));
+				if (tmp == NULL)
+					return EOUTOFMEM;
+
+				inf->handoffs = tmp;
+				inf->handoffs[inf->num_handoffs++] = (ubx_block_t *)*iaptr;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/* collect the handoffs of all stages and report the latency */
+static int pipeline_config(ubx_block_t *b)
+{
+	int ret;
+	struct ptrig_inf *inf = (struct ptrig_inf *)b->private_data;
+
+	free(inf->handoffs);
+	inf->handoffs = NULL;
+	inf->num_handoffs = 0;
+	inf->pipe_overruns = 0;
+
+	for (int i = 0; i < inf->num_chains; i++) {
+		for (int j = 0; j < inf->chains[i].triggees_len; j++) {
+			ret = collect_handoffs(b, inf->chains[i].triggees[j].b);
+
+			if (ret != 0) {
+				ubx_err(b, "EOUTOFMEM: failed to collect handoffs");
+				return ret;
+			}
+		}
+	}
+
+	ubx_info(b, "pipeline: %i stages, %ld handoffs, added latency %i periods (%lus:%luus)",
+		 inf->num_chains, inf->num_handoffs, inf->num_chains - 1,
+		 (inf->period->sec * (inf->num_chains - 1)) +
+		 (inf->period->usec * (inf->num_chains - 1)) / USEC_PER_SEC,
+		 (inf->period->usec * (inf->num_chains - 1)) % USEC_PER_SEC);
+
+	return 0;
+}
+
+/*
+ * create the stage threads. These wait for pipeline_run or are
+ * stopped and joined by pipeline_cleanup, also if creating the
+ * threads failed midway.
+ */
+static int pipeline_init(ubx_block_t *b)
+{
+	int ret;
+	long len;
+	const char *threadname;
+	char name[16];
+	struct ptrig_inf *inf = (struct ptrig_inf *)b->private_data;
+
+	len = cfg_getptr_char(b, "thread_name", &threadname);
+	assert(len >= 0);
+	threadname = (len > 0) ? threadname : b->name;
+
+#ifdef CONFIG_PTHREAD_SETAFFINITY
+	const int *aff;
+	len = cfg_getptr_int(b, "stage_affinity", &aff);
+	assert(len >= 0);
+
+	if (len > 0 && len != inf->num_chains) {
+		ubx_err(b, "EINVALID_CONFIG: stage_affinity len %ld != num_chains %i",
+			len, inf->num_chains);
+		return EINVALID_CONFIG;
+	}
+#endif
+
+	inf->stages = calloc(inf->num_chains, sizeof(struct ptrig_stage));
+
+	if (inf->stages == NULL) {
+		ubx_err(b, "EOUTOFMEM: failed to alloc stages");
+		return EOUTOFMEM;
+	}
+
+	/* all stages and the ptrig thread */
+	pthread_cond_init(&inf->stages_cond, NULL);
+	pthread_barrier_init(&inf->stage_start, NULL, inf->num_chains + 1);
+	pthread_barrier_init(&inf->stage_done, NULL, inf->num_chains + 1);
+
+	for (int i = 0; i < inf->num_chains; i++) {
+		inf->stages[i].idx = i;
+		inf->stages[i].b = b;
+
+		ret = pthread_create(&inf->stages[i].tid, &inf->attr,
+				     stage_startup, &inf->stages[i]);
+
+		if (ret != 0) {
+			ubx_err(b, "pthread_create of stage %i failed: %s", i, strerror(ret));
+			return ret;
+		}
+
+		inf->num_stages++;
+
+#ifdef CONFIG_PTHREAD_SETNAME
+		snprintf(name, sizeof(name), "%.11s/s%i", threadname, i);
+
+		if (pthread_setname_np(inf->stages[i].tid, name))
+			ubx_err(b, "failed to set thread_name of stage %i", i);
+#else
+		(void)name;
+#endif
+
+#ifdef CONFIG_PTHREAD_SETAFFINITY
+		if (len > 0) {
+			cpu_set_t cpuset;
+			CPU_ZERO(&cpuset);
+			CPU_SET(aff[i], &cpuset);
+
+			ubx_info(b, "setting affinity of stage %i to CPU core %i", i, aff[i]);
+
+			ret = pthread_setaffinity_np(inf->stages[i].tid,
+						     sizeof(cpu_set_t), &cpuset);
+			if (ret != 0) {
+				ubx_err(b, "pthread_setaffinity_np failed: %s", strerror(ret));
+				return ret;
+			}
+		}
+#endif
+	}
+
+	return 0;
+}
+
+/* let the stage threads wait for the first period */
+static void pipeline_run(ubx_block_t *b)
+{
+	struct ptrig_inf *inf = (struct ptrig_inf *)b->private_data;
+
+	pthread_mutex_lock(&inf->mutex);
+	inf->stages_run = 1;
+	pthread_cond_broadcast(&inf->stages_cond);
+	pthread_mutex_unlock(&inf->mutex);
+}
+
+/* stop and join the stage threads */
+static void pipeline_cleanup(ubx_block_t *b)
+{
+	int ret;
+	struct ptrig_inf *inf = (struct ptrig_inf *)b->private_data;
+
+	if (inf->stages == NULL)
+		return;
+
+	pthread_mutex_lock(&inf->mutex);
+	inf->stages_exit = 1;
+	pthread_cond_broadcast(&inf->stages_cond);
+	pthread_mutex_unlock(&inf->mutex);
+
+	/* running stages are waiting on stage_start */
+	if (inf->stages_run)
+		pthread_barrier_wait(&inf->stage_start);
+
+	for (int i = 0; i < inf->num_stages; i++) {
+		ret = pthread_join(inf->stages[i].tid, NULL);
+		if (ret != 0)
+			ubx_err(b, "pthread_join of stage %i failed: %s", i, strerror(ret));
+	}
+
+	pthread_barrier_destroy(&inf->stage_start);
+	pthread_barrier_destroy(&inf->stage_done);
+	pthread_cond_destroy(&inf->stages_cond);
+
+	free(inf->stages);
+	free(inf->handoffs);
+	inf->stages = NULL;
+	inf->handoffs = NULL;
+}
+
+/*
+ * request the thread to exit and join it
+ *
+ * The thread exits once it is waiting to be activated, so a
+ * running cycle is completed first.
+ */
+static void thread_join(ubx_block_t *b)
+{
+	int ret;
+	struct ptrig_inf *inf = (struct ptrig_inf *)b->private_data;
+
+	pthread_mutex_lock(&inf->mutex);
+	inf->thread_exit = 1;
+	pthread_cond_signal(&inf->active_cond);
+	pthread_mutex_unlock(&inf->mutex);
+
+	ret = pthread_join(inf->tid, NULL);
+	if (ret != 0)
+		ubx_err(b, "pthread_join failed: %s", strerror(ret));
+}
+
 /* thread entry */
 void *thread_startup(void *arg)
 {
-	int ret;
+	int ret, idle;
+	long steps;
 	ubx_block_t *b;
 	struct ptrig_inf *inf;
 	struct ubx_timespec next, period;
@@ -142,12 +525,23 @@ void *thread_startup(void *arg)
 	period.sec = inf->period->sec;
 	period.nsec = inf->period->usec * NSEC_PER_USEC;
 
+	if (b->nd->attrs & ND_PREPARE_RT)
+		prefault_stack(b, -1);
+
 	while (1) {
 
 		pthread_mutex_lock(&inf->mutex);
 
 		while (inf->state != BLOCK_STATE_ACTIVE) {
 
+			if (inf->thread_exit) {
+				pthread_mutex_unlock(&inf->mutex);
+				goto out;
+			}
+
+			if (inf->thread_state == THREAD_ACTIVE)
+				ubx_node_clock_detach(b->nd);
+
 			common_output_stats(b, inf->chains, inf->num_chains);
 			common_log_stats(b, inf->chains, inf->num_chains);
 
@@ -159,25 +553,41 @@ void *thread_startup(void *arg)
 			inf->thread_state = THREAD_INACTIVE;
 			pthread_cond_wait(&inf->active_cond, &inf->mutex);
 		}
+		if (inf->thread_state == THREAD_INACTIVE)
+			ubx_node_clock_attach(b->nd);
+
+		/* attached now: let ptrig_start return */
 		inf->thread_state = THREAD_ACTIVE;
+		inf->thread_activations++;
+		pthread_cond_broadcast(&inf->thread_cond);
 		pthread_mutex_unlock(&inf->mutex);
 
-		ret = ubx_gettime(&next);
+		ret = ubx_node_gettime(b->nd, &next);
 
 		if (ret) {
-			ubx_err(b, "ubx_gettime failed: %s", strerror(errno));
+			ubx_err(b, "ubx_node_gettime failed: %s", strerror(errno));
 			goto out;
 		}
 
-		common_read_actchain(b, inf->p_actchain, inf->num_chains, &inf->actchain);
+		ubx_ts_add(&next, &period, &next);
+		idle = 0;
 
-		if (ubx_chain_trigger(&inf->chains[inf->actchain]) != 0)
-			ubx_err(b, "ubx_chain_trigger failed for chain%i", inf->actchain);
+		if (inf->pipeline) {
+			pipeline_trigger(b, &next);
+		} else if (inf->throughput) {
+			common_read_actchain(b, inf->p_actchain, inf->num_chains, &inf->actchain);
 
-		ubx_ts_add(&next, &period, &next);
+			steps = ubx_chain_trigger_ready(&inf->chains[inf->actchain]);
+			idle = (steps == 0);
+		} else {
+			common_read_actchain(b, inf->p_actchain, inf->num_chains, &inf->actchain);
+
+			if (ubx_chain_trigger(&inf->chains[inf->actchain]) != 0)
+				ubx_err(b, "ubx_chain_trigger failed for chain%i", inf->actchain);
+		}
 
 		/* check autostop_steps */
-		if (inf->autostop_steps > 0) {
+		if (!idle && inf->autostop_steps > 0) {
 			if (--inf->autostop_steps == 0) {
 				ubx_info(b, "autostop_steps reached 0, stopping block");
 
@@ -191,7 +601,11 @@ void *thread_startup(void *arg)
 			}
 		}
 
-		ret = ubx_nanosleep(TIMER_ABSTIME, &next);
+		/* in throughput mode, only sleep if no block was ready */
+		if (inf->throughput && !idle)
+			continue;
+
+		ret = ubx_node_nanosleep(b->nd, TIMER_ABSTIME, &next);
 
 		if (ret) {
 			ubx_err(b, "clock_nanosleep failed: %s", strerror(errno));
@@ -200,7 +614,15 @@ void *thread_startup(void *arg)
 	}
 
  out:
-	/* block on cond var that signals block is running */
+	pthread_mutex_lock(&inf->mutex);
+
+	if (inf->thread_state == THREAD_ACTIVE)
+		ubx_node_clock_detach(b->nd);
+
+	inf->thread_state = THREAD_EXITED;
+	pthread_cond_broadcast(&inf->thread_cond);
+	pthread_mutex_unlock(&inf->mutex);
+
 	pthread_exit(NULL);
 }
 
@@ -210,12 +632,30 @@ int ptrig_handle_config(ubx_block_t *b)
 	int ret = -EINVALID_CONFIG;
 	unsigned int schedpol;
 	const int64_t *autostop_steps;
+	const int *pipeline, *throughput;
 	const char *schedpol_str;
 	const size_t *stacksize = NULL;
 	const int *prio;
 	struct sched_param sched_param; /* prio */
 	struct ptrig_inf *inf = (struct ptrig_inf *)b->private_data;
 
+	/* pipeline */
+	len = cfg_getptr_int(b, "pipeline", &pipeline);
+	assert(len >= 0);
+
+	inf->pipeline = (len > 0) ? *pipeline : 0;
+
+	/* throughput */
+	len = cfg_getptr_int(b, "throughput", &throughput);
+	assert(len >= 0);
+
+	inf->throughput = (len > 0) ? *throughput : 0;
+
+	if (inf->pipeline && inf->throughput) {
+		ubx_err(b, "EINVALID_CONFIG: pipeline and throughput are mutually exclusive");
+		goto out;
+	}
+
 	/* autostop_steps */
 	len = cfg_getptr_int64(b, "autostop_steps", &autostop_steps);
 	assert(len >= 0);
@@ -349,6 +789,7 @@ int ptrig_init(ubx_block_t *b)
 	inf->state = BLOCK_STATE_INACTIVE;
 
 	pthread_cond_init(&inf->active_cond, NULL);
+	pthread_cond_init(&inf->thread_cond, NULL);
 	pthread_mutex_init(&inf->mutex, NULL);
 	pthread_attr_init(&inf->attr);
 	pthread_attr_setdetachstate(&inf->attr, PTHREAD_CREATE_JOINABLE);
@@ -358,12 +799,19 @@ int ptrig_init(ubx_block_t *b)
 		goto out_err;
 	}
 
+	/* create stage threads */
+	if (inf->pipeline) {
+		ret = pipeline_init(b);
+		if (ret != 0)
+			goto out_stages;
+	}
+
 	/* create thread */
 	ret = pthread_create(&inf->tid, &inf->attr, thread_startup, b);
 
 	if (ret != 0) {
 		ubx_err(b, "pthread_create failed: %s", strerror(ret));
-		goto out_err;
+		goto out_stages;
 	}
 
 #ifdef CONFIG_PTHREAD_SETNAME
@@ -397,17 +845,30 @@ int ptrig_init(ubx_block_t *b)
 		if (ret != 0) {
 			ubx_err(b, "pthread_setaffinity_np failed: %s", strerror(ret));
 			ret = -1;
-			goto out_err;
+			goto out_thread;
 		}
 	} else {
 		ubx_debug(b, "setting no thread affinity");
 	}
 #endif
 
+	if (inf->pipeline)
+		pipeline_run(b);
+
 	/* OK */
 	ret = 0;
 	goto out;
 
+#ifdef CONFIG_PTHREAD_SETAFFINITY
+ out_thread:
+	thread_join(b);
+#endif
+ out_stages:
+	pipeline_cleanup(b);
+	pthread_attr_destroy(&inf->attr);
+	pthread_cond_destroy(&inf->active_cond);
+	pthread_cond_destroy(&inf->thread_cond);
+	pthread_mutex_destroy(&inf->mutex);
  out_err:
 	free(b->private_data);
  out:
@@ -417,21 +878,54 @@ int ptrig_init(ubx_block_t *b)
 int ptrig_start(ubx_block_t *b)
 {
 	int ret;
+	unsigned long activations;
 	struct ptrig_inf *inf;
 
 	inf = (struct ptrig_inf *)b->private_data;
 
+	/* the previous stop timed out */
+	if (inf->unconfig_pending) {
+		pthread_mutex_lock(&inf->mutex);
+		ret = (inf->thread_state == THREAD_ACTIVE) ? -1 : 0;
+		pthread_mutex_unlock(&inf->mutex);
+
+		if (ret != 0) {
+			ubx_err(b, "thread is still running from before stop");
+			goto out;
+		}
+
+		common_unconfig(inf->chains, inf->num_chains);
+		inf->unconfig_pending = 0;
+	}
+
 	ret = common_config_chains(b, inf->chains, inf->num_chains);
 
 	if (ret != 0)
 		goto out;
 
+	if (inf->pipeline) {
+		ret = pipeline_config(b);
+		if (ret != 0)
+			goto out;
+	}
+
 	pthread_mutex_lock(&inf->mutex);
 	inf->state = BLOCK_STATE_ACTIVE;
 	pthread_cond_signal(&inf->active_cond);
+
+	/* wait until the thread is running and hence attached to the
+	 * node clock, so that a virtual clock does not advance before */
+	activations = inf->thread_activations;
+
+	while (inf->thread_activations == activations &&
+	       inf->thread_state != THREAD_EXITED)
+		pthread_cond_wait(&inf->thread_cond, &inf->mutex);
+
+	ret = (inf->thread_state == THREAD_EXITED) ? -1 : 0;
 	pthread_mutex_unlock(&inf->mutex);
 
-	ret = 0;
+	if (ret != 0)
+		ubx_err(b, "thread has exited");
 out:
 	return ret;
 }
@@ -454,33 +948,34 @@ void ptrig_stop(ubx_block_t *b)
 
 	/* wait some time for thread to shutdown cleanly */
 	for (int i=THREAD_STOP_RETRIES; i>=0; i--) {
-		if (inf->thread_state == THREAD_INACTIVE)
-			return;
+		if (inf->thread_state != THREAD_ACTIVE)
+			goto out;
 		usleep(THREAD_STOP_TIMEOUT_US);
 	}
-	ubx_warn(b, "timeout waiting for pthread to stop");
 
+	/* the thread may still be triggering the chains */
+	ubx_warn(b, "timeout waiting for pthread to stop, not unconfiguring chains");
+	inf->unconfig_pending = 1;
+	return;
+
+ out:
 	common_unconfig(inf->chains, inf->num_chains);
 }
 
 void ptrig_cleanup(ubx_block_t *b)
 {
-	int ret;
-
 	struct ptrig_inf *inf = (struct ptrig_inf *)b->private_data;
 
+	pthread_mutex_lock(&inf->mutex);
 	inf->state = BLOCK_STATE_PREINIT;
+	pthread_mutex_unlock(&inf->mutex);
 
-	ret = pthread_cancel(inf->tid);
+	thread_join(b);
 
-	if (ret != 0)
-		ubx_err(b, "pthread_cancel failed: %s", strerror(ret));
-
-	/* join */
-	ret = pthread_join(inf->tid, NULL);
-	if (ret != 0)
-		ubx_err(b, "pthread_join failed: %s", strerror(ret));
+	if (inf->unconfig_pending)
+		common_unconfig(inf->chains, inf->num_chains);
 
+	pipeline_cleanup(b);
 	pthread_attr_destroy(&inf->attr);
 
 	/* even though we call ubx_chain_init in start, it is OK to do
@@ -525,6 +1020,14 @@ int ptrig_mod_init(ubx_node_t *nd)
 	if (ret != 0) {
 		ubx_log(UBX_LOGLEVEL_ERR, nd, __func__,
 			"failed to register ptrig block");
+		goto out;
+	}
+
+	ret = handoff_register(nd);
+
+	if (ret != 0) {
+		ubx_log(UBX_LOGLEVEL_ERR, nd, __func__,
+			"failed to register handoff block");
 	}
  out:
 	return ret;
@@ -535,6 +1038,7 @@ void ptrig_mod_cleanup(ubx_node_t *nd)
 	for (unsigned int i=0; i<ARRAY_SIZE(ptrig_types); i++)
 		ubx_type_unregister(nd, ptrig_types[i].name);
 
+	handoff_unregister(nd);
 	ubx_block_unregister(nd, "std_triggers/ptrig");
 }
 
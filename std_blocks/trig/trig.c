@@ -20,13 +20,16 @@ char trig_meta[] =
 ubx_proto_port_t trig_ports[] = {
 	{ .name = "active_chain", .in_type_name = "int", .doc = "switch the active trigger chain" },
 	{ .name = "tstats", .out_type_name = "struct ubx_tstat", .doc = "timing statistics (if enabled)"},
+	{ .name = "rtcheck", .out_type_name = "struct ubx_rtcheck", .doc = "blocks that page faulted or allocated in step (tstats_mode 3)"},
 	{ 0 },
 };
 
 /* configuration */
 ubx_proto_config_t trig_config[] = {
 	{ .name = "num_chains", .type_name = "int", .max = 1, .doc = "number of trigger chains. def: 1" },
-	{ .name = "tstats_mode", .type_name = "int", .max = 1, .doc = "0: off (def), 1: global only, 2: per block", },
+	{ .name = "throughput", .type_name = "int", .max = 1, .doc = "if 1, step ready blocks until no more progress is possible. def: 0" },
+	{ .name = "max_steps", .type_name = "int64_t", .max = 1, .doc = "throughput mode: max flow controlled block steps per trigger. def: 0 (unlimited)" },
+	{ .name = "tstats_mode", .type_name = "int", .max = 1, .doc = "0: off (def), 1: global only, 2: per block, 3: per block and page fault/allocation checks", },
 	{ .name = "tstats_profile_path", .type_name = "char", .doc = "directory to write the timing stats file to" },
 	{ .name = "tstats_output_rate", .type_name = "double", .max = 1, .doc = "throttle output on tstats port" },
 	{ .name = "tstats_skip_first", .type_name = "int", .max=1, .doc = "skip N steps before acquiring stats" },
@@ -40,6 +43,8 @@ ubx_proto_config_t trig_config[] = {
  * @chains: pointer to array of struct ubx_chain of size num_chains
  * @actchain: active chain
  * @p_actchain: pointer to active_chain port
+ * @throughput: throughput mode enabled
+ * @max_steps: max number of block steps per trigger in throughput mode
  */
 struct block_info {
 	struct ubx_chain *chains;
@@ -47,8 +52,23 @@ struct block_info {
 
 	int actchain;
 	ubx_port_t *p_actchain;
+
+	int throughput;
+	int64_t max_steps;
 };
 
+/* step ready blocks until no more progress or max_steps is reached */
+static void trig_throughput(struct block_info *inf)
+{
+	long ret;
+	int64_t steps = 0;
+
+	do {
+		ret = ubx_chain_trigger_ready(&inf->chains[inf->actchain]);
+		steps += ret;
+	} while (ret > 0 && (inf->max_steps <= 0 || steps < inf->max_steps));
+}
+
 
 /* step */
 void trig_step(ubx_block_t *b)
@@ -57,6 +77,11 @@ void trig_step(ubx_block_t *b)
 
 	common_read_actchain(b, inf->p_actchain, inf->num_chains, &inf->actchain);
 
+	if (inf->throughput) {
+		trig_throughput(inf);
+		return;
+	}
+
 	if (ubx_chain_trigger(&inf->chains[inf->actchain]) != 0)
 		ubx_err(b, "ubx_chain_trigger failed for chain%i", inf->actchain);
 }
@@ -83,12 +108,23 @@ int trig_init(ubx_block_t *b)
 
 int trig_start(ubx_block_t *b)
 {
+	long len;
+	const int *throughput;
+	const int64_t *max_steps;
 	struct block_info *inf = (struct block_info *)b->private_data;
 
 	/* cache active chain port */
 	inf->p_actchain = ubx_port_get(b, "active_chain");
 	assert(inf->p_actchain != NULL);
 
+	len = cfg_getptr_int(b, "throughput", &throughput);
+	assert(len >= 0);
+	inf->throughput = (len > 0) ? *throughput : 0;
+
+	len = cfg_getptr_int64(b, "max_steps", &max_steps);
+	assert(len >= 0);
+	inf->max_steps = (len > 0) ? *max_steps : 0;
+
 	return common_config_chains(b, inf->chains, inf->num_chains);
 }
 
@@ -0,0 +1,26 @@
+#ifndef RTCHECK_H
+#define RTCHECK_H
+
+/**
+ * struct ubx_rtcheck - realtime violations of a block
+ *
+ * @id: chain and block name
+ * @steps: number of checked steps
+ * @viol: number of steps with page faults or allocations
+ * @minflt: minor page faults during steps
+ * @majflt: major page faults during steps
+ * @mallocs: malloc, calloc, realloc and aligned allocations during steps
+ * @frees: free calls during steps
+ */
+struct ubx_rtcheck
+{
+	char id[UBX_TSTAT_ID_MAXLEN + 1];
+	unsigned long steps;
+	unsigned long viol;
+	unsigned long minflt;
+	unsigned long majflt;
+	unsigned long mallocs;
+	unsigned long frees;
+};
+
+#endif /* RTCHECK_H */
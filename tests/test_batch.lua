@@ -0,0 +1,86 @@
+local lu = require("luaunit")
+local ubx = require("ubx")
+local bd = require("blockdiagram")
+local ffi = require("ffi")
+local tu = require("tests.testutils")
+
+local assert_equals = lu.assert_equals
+local range = tu.range
+
+local NUM = 40
+
+local sys = bd.system {
+   imports = { "stdtypes", "ramp_int32", "lfds_cyclic", "trig" },
+   blocks = {
+      { name="ramp", type="ramp_int32" },
+      { name="trig", type="std_triggers/trig" },
+   },
+   configurations = {
+      { name="ramp", config = { start=0, slope=1 } },
+      { name="trig", config = { chain0={ { b="#ramp", num_steps=NUM } } } },
+   },
+}
+
+local nd, ramp, p_out
+
+-- read num samples using __port_read_batch
+local function read_batch(p, num)
+   local d = ubx.data_alloc(nd, "int32_t", num)
+   d.len = 1
+   local cnt = tonumber(ubx.ubx.__port_read_batch(p, d, num))
+   local res = {}
+   local ptr = ffi.cast("int32_t*", d.data)
+   for i=0,cnt-1 do res[#res+1] = ptr[i] end
+   return res
+end
+
+TestBatch = {}
+
+tu.launch_fixture(TestBatch, sys, { nodename="batch" },
+		  function(n)
+		     nd = n
+		     ramp = nd:b("ramp")
+		     p_out = ubx.port_clone_conn(ramp, "out", 2*NUM)
+		  end)
+
+-- step_batch must produce the same samples as individual steps
+function TestBatch:test_step_batch()
+   assert_equals(ubx.cblock_step_batch(ramp, NUM), 0)
+   assert_equals(tonumber(ramp.stat_num_steps), NUM)
+   assert_equals(read_batch(p_out, 2*NUM), range(0, NUM-1))
+
+   ramp:do_step()
+   assert_equals(read_batch(p_out, 2*NUM), { NUM })
+end
+
+function TestBatch:test_read_batch_partial()
+   assert_equals(read_batch(p_out, 4), {})
+
+   ubx.cblock_step_batch(ramp, 10)
+   assert_equals(read_batch(p_out, 4), range(0, 3))
+   assert_equals(read_batch(p_out, 4), range(4, 7))
+   assert_equals(read_batch(p_out, 4), range(8, 9))
+   assert_equals(read_batch(p_out, 4), {})
+end
+
+-- num_steps > 1 of a chain is run via step_batch
+function TestBatch:test_chain_num_steps()
+   nd:b("trig"):do_step()
+   assert_equals(tonumber(ramp.stat_num_steps), NUM)
+   assert_equals(read_batch(p_out, 2*NUM), range(0, NUM-1))
+end
+
+-- iblocks without read_batch and write_batch hooks are read and
+-- written sample by sample
+function TestBatch:test_fallback()
+   local ib = ffi.cast("ubx_block_t*", p_out.in_interaction[0])
+   ib.read_batch = nil
+   ib.write_batch = nil
+
+   ubx.cblock_step_batch(ramp, 10)
+   assert_equals(read_batch(p_out, 4), range(0, 3))
+   assert_equals(read_batch(p_out, 8), range(4, 9))
+   assert_equals(read_batch(p_out, 4), {})
+end
+
+os.exit( lu.LuaUnit.run() )
@@ -8,6 +8,8 @@ ubx.color=false
 local assert_not_nil = luaunit.assert_not_nil
 local assert_equals = luaunit.assert_equals
 local assert_error_msg_equals = luaunit.assert_error_msg_equals
+local assert_error_msg_contains = luaunit.assert_error_msg_contains
+local assert_true = luaunit.assert_true
 
 local NUM_BLOCKS = 10
 
@@ -147,4 +149,94 @@ function test_resolve_block_hash_invalid()
 		 "err @ : unable to resolve block ref #g1")
 end
 
+--- Test resolving references into and within subsystems
+function test_resolve_subsys_refs()
+   local function subsys()
+      return bd.system {
+	 blocks = {
+	    { name = "r1", type = "ramp_int32" },
+	    { name = "r2", type = "ramp_int32" },
+	 },
+	 configurations = {
+	    { name = "r2", config = { start=1, slope=2 } },
+	 },
+      }
+   end
+
+   local sys = bd.system {
+      imports = { "stdtypes", "ramp_int32", "trig" },
+      subsystems = { s1 = subsys(), s2 = subsys() },
+      blocks = { { name = "t1", type = "std_triggers/trig" } },
+      configurations = {
+	 { name = "s1/r1", config = { start=0, slope=1 } },
+	 { name="t1",
+	    config = {
+	       chain0 = {
+		  { b="#s1/r1", num_steps=1, measure=0 },
+		  { b="#s2/r2", num_steps=1, measure=0 } } } } } }
+
+   assert_equals(sys:validate(false), 0)
+   assert_equals(sys.configurations[1]._tgt, sys.subsystems.s1.blocks[1])
+   assert_equals(sys.subsystems.s2.configurations[1]._tgt, sys.subsystems.s2.blocks[2])
+
+   local nd = sys:launch{ nodename="test_resolve_subsys_refs", nostart=true }
+   assert_not_nil(nd)
+   ubx.node_cleanup(nd)
+end
+
+--- Test that compiling a system generates the same blocks,
+--- connections and configs as launching it
+local sys_compile = bd.system {
+   imports = { "stdtypes", "ramp_double", "math_double", "lfds_cyclic" },
+   blocks = {
+      { name="ramp", type="ramp_double" },
+      { name="math", type="math_double" },
+   },
+   connections = {
+      { src="ramp.out", tgt="math.x", buffer_length=4 },
+   },
+   configurations = {
+      { name="ramp", config = { start=-math.huge, slope=math.huge } },
+      { name="math", config = { func="fabs" } },
+   },
+}
+
+function test_compile()
+   local src = sys_compile:compile{ nodename="test_compile" }
+   local nd = sys_compile:launch{ nodename="test_compile_launch", nostart=true }
+   local num = 0
+
+   local function has(str)
+      return src:find(str, 1, true) ~= nil
+   end
+
+   ubx.blocks_map(nd, function(b)
+		     local entry = string.format('{ "%s", "%s" },',
+						 ubx.safe_tostr(b.prototype.name),
+						 ubx.safe_tostr(b.name))
+		     assert_true(has(entry), "block missing: "..entry)
+		     num = num + 1
+		  end, ubx.is_instance)
+
+   local blocks = src:match("static const char %*blocks%[%]%[2%] = {\n(.-)};")
+   local _, count = blocks:gsub("\n", "")
+   assert_equals(count, num)
+
+   -- ramp.out and math.x are connected to the iblock
+   local _, conns = src:gsub("usc_connect%(blk", "")
+   assert_equals(conns, 2)
+
+   assert_true(has("v[1] = { -INFINITY }"))
+   assert_true(has("v[1] = { INFINITY }"))
+   assert_true(has('"fabs"'))
+
+   ubx.node_rm(nd)
+end
+
+function test_compile_no_blocks()
+   local sys = bd.system { imports = { "stdtypes" } }
+   assert_error_msg_contains("cgen: system has no blocks",
+			     function() sys:compile{ nodename="test_compile_empty" } end)
+end
+
 os.exit( luaunit.LuaUnit.run() )
@@ -0,0 +1,162 @@
+local lu = require("luaunit")
+local ubx = require("ubx")
+local bd = require("blockdiagram")
+local ffi = require("ffi")
+
+local assert_equals = lu.assert_equals
+local assert_true = lu.assert_true
+
+local sys = bd.system {
+   imports = { "stdtypes", "lfds_cyclic", "pid" },
+   blocks = { { name = "pid1", type = "pid" } },
+   configurations = {
+      { name = "pid1", config = { Kp = 2 } }
+   }
+}
+
+local nd, pid1, pmsr, pdes, pout
+
+-- step pid1 with msr=1 and des=2 (i.e. err=1) and return the output
+local function step()
+   pmsr:write(1)
+   pdes:write(2)
+   pid1:do_step()
+   local len, val = pout:read()
+   assert_equals(tonumber(len), 1)
+   return val:tolua()
+end
+
+TestConfigPublish = {}
+
+function TestConfigPublish:setup()
+   nd = sys:launch{ nodename="publish", loglevel=ffi.C.UBX_LOGLEVEL_WARN }
+   pid1 = nd:b("pid1")
+   pmsr = ubx.port_clone_conn(pid1, "msr", 1, nil, 4, 0)
+   pdes = ubx.port_clone_conn(pid1, "des", 1, nil, 4, 0)
+   pout = ubx.port_clone_conn(pid1, "out", nil, 1, 4, 0)
+end
+
+function TestConfigPublish:teardown()
+   ubx.node_rm(nd)
+end
+
+function TestConfigPublish:test_update_active()
+   assert_equals(pid1:get_block_state(), 'active')
+   assert_equals(step(), 2)
+
+   local old = pid1:c("Kp").value
+   ubx.set_config(pid1, "Kp", 4)
+
+   assert_true(pid1:c("Kp").value ~= old)
+   assert_equals(pid1:c("Kp"):tolua(), 4)
+   assert_equals(step(), 4)
+end
+
+-- configs without CONFIG_ATTR_RUNTIME are still set in place, as
+-- blocks like ramp hold pointers to them while running
+function TestConfigPublish:test_update_in_place()
+   ubx.load_module(nd, "ramp_double")
+   ubx.load_module(nd, "ptrig")
+
+   local ramp = ubx.block_create(nd, "ramp_double", "ramp1", { start=0, slope=1 })
+   assert_equals(ubx.block_init(ramp), 0)
+   assert_equals(ubx.block_start(ramp), 0)
+
+   local trig = ubx.block_create(nd, "std_triggers/ptrig", "trig1",
+				 { period={ sec=0, usec=1000 },
+				   chain0={ { b=ramp, num_steps=1 } } })
+   assert_equals(ubx.block_init(trig), 0)
+   assert_equals(ubx.block_start(trig), 0)
+
+   local old = ramp:c("slope").value
+   ubx.set_config(ramp, "slope", 2)
+   ubx.clock_mono_sleep(0, 10*1000*1000)
+   ubx.config_reclaim(nd)
+
+   assert_equals(ramp:c("slope").value, old)
+   assert_equals(ramp:c("slope"):tolua(), 2)
+
+   assert_equals(ubx.block_stop(trig), 0)
+end
+
+function TestConfigPublish:test_type_mismatch()
+   local d = ubx.data_alloc(nd, "int", 1)
+   assert_equals(ubx.ubx.ubx_config_publish(pid1:c("Kp"), d), ffi.C.ETYPE_MISMATCH)
+   assert_equals(step(), 2)
+end
+
+function TestConfigPublish:test_invalid_len()
+   assert_equals(step(), 2)
+
+   -- the last valid gain is used and remains valid after the
+   -- invalid value replaced it
+   ubx.set_config(pid1, "Kp", { 3, 4 })
+   assert_equals(step(), 2)
+   ubx.config_reclaim(nd)
+   assert_equals(step(), 2)
+
+   ubx.set_config(pid1, "Kp", 6)
+   assert_equals(step(), 6)
+end
+
+-- blocks stepped with ubx_cblock_step run in a read section
+local reclaim_in_step = [[
+local ffi = require("ffi")
+local ubx = require("ubx")
+local p_res
+
+function init(b)
+   ubx.outport_add(b, "res", "values reclaimed during step", 0, "int", 1)
+   p_res = ubx.port_get(b, "res")
+   return true
+end
+
+function step(b)
+   b = ffi.cast("ubx_block_t*", b)
+   ubx.set_config(ubx.block_get(b.nd, "pid1"), "Kp", 7)
+   ubx.port_write(p_res, ubx.config_reclaim(b.nd))
+end
+]]
+
+function TestConfigPublish:test_cblock_step()
+   ubx.load_module(nd, "luablock")
+   local lb = ubx.block_create(nd, "lua/luablock", "lb1", { lua_str=reclaim_in_step })
+   assert_equals(ubx.block_init(lb), 0)
+   local pres = ubx.port_clone_conn(lb, "res", nil, 1, 4, 0)
+   assert_equals(ubx.block_start(lb), 0)
+
+   assert_equals(ubx.cblock_step(lb), 0)
+   local len, val = pres:read()
+   assert_equals(tonumber(len), 1)
+   assert_equals(val:tolua(), 0)
+
+   assert_equals(ubx.config_reclaim(nd), 1)
+   assert_equals(step(), 7)
+end
+
+function TestConfigPublish:test_grace_period()
+   local r = ffi.new("struct ubx_cfg_reader")
+   ubx.cfg_reader_register(nd, r)
+
+   -- a value replaced during a read section must not be freed
+   ubx.cfg_read_enter(nd, r)
+   ubx.set_config(pid1, "Kp", 3)
+   assert_equals(ubx.config_reclaim(nd), 0)
+   ubx.cfg_read_exit(r)
+
+   -- but afterwards
+   assert_equals(ubx.config_reclaim(nd), 1)
+
+   -- a reader entering after publishing does not delay reclamation
+   ubx.cfg_read_enter(nd, r)
+   ubx.set_config(pid1, "Kp", 5)
+   ubx.cfg_read_exit(r)
+   ubx.cfg_read_enter(nd, r)
+   assert_equals(ubx.config_reclaim(nd), 1)
+   ubx.cfg_read_exit(r)
+
+   ubx.cfg_reader_unregister(nd, r)
+   assert_equals(step(), 5)
+end
+
+os.exit( lu.LuaUnit.run() )
@@ -3,6 +3,8 @@ local ffi=require"ffi"
 local ubx=require"ubx"
 
 local assert_equals = lu.assert_equals
+local assert_true = lu.assert_true
+local assert_false = lu.assert_false
 
 local nd=ubx.node_create("data_init_test")
 
@@ -169,4 +171,57 @@ function test_data_resize()
    -- ubx.data_free(d)
 end
 
+function test_data_resize_zero_indexed()
+   local d=ubx.data_alloc(nd, "int", 2)
+   local conf = {}
+   for i=0,999 do conf[i] = i * 3 end
+
+   ubx.data_set(d, conf, true)
+
+   local ptr = ffi.cast("int*", d.data)
+   assert_equals(tonumber(d.len), 1000)
+   assert_equals(ptr[0], 0)
+   assert_equals(ptr[1], 3)
+   assert_equals(ptr[999], 2997)
+end
+
+function test_data_pool()
+   local pnd=ubx.node_create("data_pool_test", { data_pool=64*1024 })
+   ubx.load_module(pnd, "stdtypes")
+
+   local d=ubx.data_alloc(pnd, "int", 10)
+   local conf = {}
+   for i=0,999 do conf[i] = i end
+   ubx.data_set(d, conf, true)
+
+   local ptr = ffi.cast("int*", d.data)
+   assert_equals(tonumber(d.len), 1000)
+   assert_equals(ptr[999], 999)
+
+   local st = ubx.data_pool_stats(pnd)
+   assert_equals(st.size, 64*1024)
+   assert_equals(st.sys_allocs, 0)
+   assert_true(st.allocs >= 3)
+   assert_true(st.peak >= 4000)
+
+   -- too large for the pool: falls back to calloc until sealed
+   local big = ubx.data_alloc(pnd, "int", 100000)
+   assert_equals(ubx.data_pool_stats(pnd).sys_allocs, 1)
+   big = nil
+   collectgarbage()
+
+   ubx.node_prepare_rt(pnd)
+   assert_false(pcall(ubx.data_alloc, pnd, "int", 100000))
+   assert_equals(ubx.data_pool_stats(pnd).failed, 1)
+
+   -- served from the free lists
+   d = nil
+   collectgarbage()
+   d = ubx.data_alloc(pnd, "int", 1000)
+   assert_equals(ubx.data_pool_stats(pnd).used, st.used)
+
+   assert_equals(ubx.data_pool_stats(nd), nil)
+   ubx.node_rm(pnd)
+end
+
 os.exit( lu.LuaUnit.run() )
@@ -0,0 +1,44 @@
+#!/usr/bin/luajit
+
+local lu=require"luaunit"
+local ffi=require"ffi"
+local ubx=require"ubx"
+
+local assert_equals = lu.assert_equals
+local assert_true = lu.assert_true
+local assert_false = lu.assert_false
+
+ubx.lazy_types = true
+
+local nd = ubx.node_create("test_ffi_types")
+ubx.load_module(nd, "stdtypes")
+ubx.load_module(nd, "testtypes")
+
+TestFFITypes = {}
+
+function TestFFITypes:test_lazy()
+   -- not yet loaded by load_module
+   assert_false(pcall(ffi.typeof, "struct kdl_frame"))
+   assert_false(pcall(ffi.typeof, "struct kdl_vector"))
+
+   local ct = ubx.ctypes["struct kdl_frame"]
+   assert_equals(ffi.sizeof(ct), ubx.type_size(nd, "struct kdl_frame"))
+
+   -- dependencies were loaded too
+   assert_true(pcall(ffi.typeof, "struct kdl_vector"))
+   assert_true(pcall(ffi.typeof, "struct kdl_rotation"))
+end
+
+function TestFFITypes:test_data_api()
+   local d = ubx.data_alloc(nd, "struct test_trig_conf")
+   d:set({ benchmark = 3 })
+   assert_true(pcall(ffi.typeof, "struct test_trig_conf"))
+   assert_equals(d:tolua().benchmark, 3)
+end
+
+function TestFFITypes:test_load_all()
+   ubx.ffi_load_types(nd)
+   assert_true(pcall(ffi.typeof, "struct kdl_frame"))
+end
+
+os.exit( lu.LuaUnit.run() )
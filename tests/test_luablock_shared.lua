@@ -0,0 +1,217 @@
+#!/usr/bin/luajit
+
+local lu=require"luaunit"
+local ubx=require"ubx"
+
+local assert_equals = lu.assert_equals
+local assert_true = lu.assert_true
+
+local nd = ubx.node_create("test_luablock_shared")
+
+ubx.load_module(nd, "stdtypes")
+ubx.load_module(nd, "luablock")
+ubx.load_module(nd, "lfds_cyclic")
+ubx.load_module(nd, "ptrig")
+
+-- each block counts its steps in a global and outputs it
+local counter_code = [[
+local ubx=require "ubx"
+local p_cnt
+
+function init(b)
+   ubx.outport_add(b, "cnt", "step counter", 0, "int", 1)
+   p_cnt = ubx.port_get(b, "cnt"):bind()
+   cnt = 0
+   return true
+end
+
+function step(b)
+   cnt = cnt + $INC
+   p_cnt:write(cnt)
+end
+]]
+
+local function create(name, inc, state)
+   local code = counter_code:gsub("%$INC", tostring(inc))
+   local b = ubx.block_create(nd, "lua/luablock", name, { lua_str=code, lua_state=state })
+   assert_equals(ubx.block_init(b), 0)
+   local p = ubx.port_bind(ubx.port_clone_conn(b, "cnt", 4))
+   assert_equals(ubx.block_start(b), 0)
+   return b, p
+end
+
+TestLuablockShared = {}
+
+function TestLuablockShared:test_isolation()
+   local b1, p1 = create("lb1", 1, "s1")
+   local b2, p2 = create("lb2", 10, "s1")
+
+   for i=1,100 do
+      ubx.cblock_step(b1)
+      ubx.cblock_step(b2)
+      local len1, v1 = p1:read()
+      local len2, v2 = p2:read()
+      assert_true(len1 > 0 and len2 > 0)
+      assert_equals(v1[0], i)
+      assert_equals(v2[0], i*10)
+   end
+end
+
+-- blocks of a shared state must be stepped by the same thread
+function TestLuablockShared:test_threads()
+   local b1, p1 = create("lb_thr1", 1, "s_thr")
+   local b2, p2 = create("lb_thr2", 1, "s_thr")
+
+   local trig = ubx.block_create(nd, "std_triggers/ptrig", "trig_thr",
+				 { period={ sec=0, usec=1000 },
+				   chain0={ { b=b1, num_steps=1 } } })
+   assert_equals(ubx.block_init(trig), 0)
+   assert_equals(ubx.block_start(trig), 0)
+   ubx.clock_mono_sleep(0, 50*1000*1000)
+
+   -- b1 is stepped by the ptrig thread, so b2 is rejected
+   local len = p1:read()
+   assert_true(len > 0)
+   ubx.cblock_step(b2)
+   len = p2:read()
+   assert_equals(len, 0)
+
+   ubx.block_unload(nd, "trig_thr")
+   ubx.block_unload(nd, "lb_thr1")
+   ubx.block_unload(nd, "lb_thr2")
+end
+
+-- hooks of other blocks of the state may run while it is stepped
+function TestLuablockShared:test_hooks_while_stepped()
+   local b1, p1 = create("lb_hk1", 1, "s_hk")
+
+   local trig = ubx.block_create(nd, "std_triggers/ptrig", "trig_hk",
+				 { period={ sec=0, usec=100 },
+				   chain0={ { b=b1, num_steps=1 } } })
+   assert_equals(ubx.block_init(trig), 0)
+   assert_equals(ubx.block_start(trig), 0)
+
+   for i=1,50 do
+      local name = "lb_hk_"..i
+      create(name, 1, "s_hk")
+      ubx.block_unload(nd, name)
+   end
+
+   assert_equals(ubx.block_stop(trig), 0)
+
+   -- b1 kept counting in its own environment
+   local len, v = p1:read()
+   assert_true(len > 0)
+   local last = v[0]
+
+   while true do
+      len, v = p1:read()
+      if len <= 0 then break end
+      assert_equals(v[0], last + 1)
+      last = v[0]
+   end
+
+   ubx.block_unload(nd, "trig_hk")
+   ubx.block_unload(nd, "lb_hk1")
+end
+
+-- lua_file chunks are named after the block
+function TestLuablockShared:test_file_chunkname()
+   local file = os.tmpname()
+   local f = io.open(file, "w")
+   f:write("#!/usr/bin/luajit\n",
+	   "function init(b) return debug.getinfo(1, 'S').source == 'lb_file' end\n")
+   f:close()
+
+   local b = ubx.block_create(nd, "lua/luablock", "lb_file",
+			      { lua_file=file, lua_state="s1" })
+   local ret = ubx.block_init(b)
+   os.remove(file)
+   assert_equals(ret, 0)
+   ubx.block_unload(nd, "lb_file")
+end
+
+function TestLuablockShared:test_load_error()
+   local b = ubx.block_create(nd, "lua/luablock", "lb_err",
+			      { lua_str="function step(b) end end", lua_state="s1" })
+   assert_true(ubx.block_init(b) ~= 0)
+end
+
+-- outputs whether the automatic GC of the state is running
+local gc_code = [[
+local ubx=require "ubx"
+local p_run
+
+function init(b)
+   ubx.outport_add(b, "gc_running", "automatic GC running", 0, "int", 1)
+   p_run = ubx.port_get(b, "gc_running"):bind()
+   return true
+end
+
+function step(b)
+   p_run:write(collectgarbage("isrunning") and 1 or 0)
+end
+]]
+
+local function create_gc(name, state, gc_step_kb)
+   local b = ubx.block_create(nd, "lua/luablock", name,
+			      { lua_str=gc_code, lua_state=state, gc_step_kb=gc_step_kb })
+   assert_equals(ubx.block_init(b), 0)
+   local p = ubx.port_bind(ubx.port_clone_conn(b, "gc_running", 4))
+   return b, p
+end
+
+-- step b and return the gc_running output
+local function gc_running(b, p)
+   ubx.cblock_step(b)
+   local len, v = p:read()
+   assert_true(len > 0)
+   return v[0]
+end
+
+TestLuablockGC = {}
+
+function TestLuablockGC:test_stop_restart()
+   local b, p = create_gc("lb_gc", nil, 1)
+
+   assert_equals(ubx.block_start(b), 0)
+   assert_equals(gc_running(b, p), 0)
+   assert_equals(ubx.block_stop(b), 0)
+
+   -- restarted on stop
+   ubx.set_config(b, "gc_step_kb", 0)
+   assert_equals(ubx.block_start(b), 0)
+   assert_equals(gc_running(b, p), 1)
+   assert_equals(ubx.block_stop(b), 0)
+end
+
+function TestLuablockGC:test_shared()
+   local b1 = create_gc("lb_gc1", "s_gc", 1)
+   local b2, p2 = create_gc("lb_gc2", "s_gc", 0)
+
+   assert_equals(ubx.block_start(b2), 0)
+   assert_equals(gc_running(b2, p2), 1)
+
+   -- the GC config applies to the whole state
+   assert_equals(ubx.block_start(b1), 0)
+   assert_equals(gc_running(b2, p2), 0)
+
+   assert_equals(ubx.block_stop(b1), 0)
+   assert_equals(gc_running(b2, p2), 1)
+
+   ubx.block_unload(nd, "lb_gc1")
+   assert_equals(gc_running(b2, p2), 1)
+
+   -- restarted on cleanup if start failed after stopping it
+   local b3 = ubx.block_create(nd, "lua/luablock", "lb_gc3",
+			       { lua_str="function start(b) return false end",
+				 lua_state="s_gc", gc_step_kb=1 })
+   assert_equals(ubx.block_init(b3), 0)
+   assert_true(ubx.block_start(b3) ~= 0)
+   assert_equals(gc_running(b2, p2), 0)
+
+   ubx.block_unload(nd, "lb_gc3")
+   assert_equals(gc_running(b2, p2), 1)
+end
+
+os.exit( lu.LuaUnit.run() )
@@ -0,0 +1,154 @@
+#!/usr/bin/luajit
+
+local lu=require"luaunit"
+local ffi=require"ffi"
+local ubx=require"ubx"
+
+local assert_equals = lu.assert_equals
+local assert_true = lu.assert_true
+
+local nd = ubx.node_create("test_port_obj")
+
+ubx.load_module(nd, "stdtypes")
+ubx.load_module(nd, "testtypes")
+ubx.load_module(nd, "luablock")
+ubx.load_module(nd, "lfds_cyclic")
+
+local lua_testcomp = [[
+local ubx=require "ubx"
+local ffi=require "ffi"
+local vin, vout
+
+function init(b)
+   b=ffi.cast("ubx_block_t*", b)
+   ubx.ffi_load_types(b.nd)
+
+   ubx.inport_add(b, "vec_in", "vector in", 0, "struct kdl_vector", 1)
+   ubx.outport_add(b, "vec_out", "vector out", 0, "struct kdl_vector", 1)
+
+   vin = ubx.port_bind(ubx.port_get(b, "vec_in"))
+   vout = ubx.port_get(b, "vec_out"):bind()
+   return true
+end
+
+function step(b)
+   local len, v = vin:read()
+   if len <= 0 then return end
+   local w = vout.wdata
+   w.x=v.x*2; w.y=v.y*2; w.z=v.z*2;
+   vout:write()
+end
+
+function cleanup(b)
+   ubx.port_rm(b, "vec_in")
+   ubx.port_rm(b, "vec_out")
+end
+]]
+
+local lb1=ubx.block_create(nd, "lua/luablock", "lb1", { lua_str=lua_testcomp } )
+assert_equals(ubx.block_init(lb1), 0)
+
+local p_vec_out = ubx.port_clone_conn(lb1, "vec_in", 4)
+local p_vec_in = ubx.port_clone_conn(lb1, "vec_out", 4)
+
+assert_equals(ubx.block_start(lb1), 0)
+
+TestPortObj = {}
+
+function TestPortObj:test_comm()
+   local pin = ubx.port_bind(p_vec_in)
+   local pout = ubx.port_bind(p_vec_out)
+
+   for i=1,10000 do
+      pout:write({x=i, y=-i, z=i*0.5})
+      ubx.cblock_step(lb1)
+      local len, v = pin:read()
+      assert_true(len > 0, "test block produced no output")
+      assert_equals(v.x, i*2)
+      assert_equals(v.y, -i*2)
+      assert_equals(v.z, i)
+   end
+end
+
+function TestPortObj:test_no_data()
+   local pin = ubx.port_bind(p_vec_in)
+   local len = pin:read()
+   assert_true(len <= 0)
+end
+
+-- connect a new in- and outport of lb1 via a lfds_cyclic buffer and
+-- return port objects for both
+local function loopback(name, type_name, data_len)
+   local ib = ubx.block_create(nd, "lfds_buffers/cyclic", name.."_buf",
+			       { type_name=type_name, data_len=data_len, buffer_len=4 })
+   assert_equals(ubx.block_init(ib), 0)
+   assert_equals(ubx.block_start(ib), 0)
+
+   assert_equals(ubx.outport_add(lb1, name.."_out", "", 0, type_name, data_len), 0)
+   assert_equals(ubx.inport_add(lb1, name.."_in", "", 0, type_name, data_len), 0)
+   assert_equals(ubx.port_connect_out(ubx.port_get(lb1, name.."_out"), ib), 0)
+   assert_equals(ubx.port_connect_in(ubx.port_get(lb1, name.."_in"), ib), 0)
+
+   return ubx.port_bind(ubx.port_get(lb1, name.."_out")),
+      ubx.port_bind(ubx.port_get(lb1, name.."_in"))
+end
+
+function TestPortObj:test_scalar()
+   local wo, ri = loopback("int", "int32_t", 1)
+   wo:write(4711)
+   local len, v = ri:read()
+   assert_equals(len, 1)
+   assert_equals(v[0], 4711)
+end
+
+function TestPortObj:test_array()
+   local wo, ri = loopback("arr", "double", 3)
+   wo:write({1.5, 2.5, 3.5})
+   local len, v = ri:read()
+   assert_equals(len, 3)
+   assert_equals(v[0], 1.5)
+   assert_equals(v[2], 3.5)
+end
+
+function TestPortObj:test_string()
+   local wo, ri = loopback("str", "char", 16)
+   wo:write("hello")
+   local len, v = ri:read()
+   assert_equals(len, 16)
+   assert_equals(ffi.string(v), "hello")
+   assert_equals(pcall(wo.write, wo, string.rep("x", 16)), false)
+end
+
+-- ffi_step mode: step receives the pre-bound port objects
+local lua_ffi_step = [[
+local ubx=require "ubx"
+
+function init(b)
+   ubx.inport_add(b, "cnt_in", "", 0, "uint32_t", 1)
+   ubx.outport_add(b, "cnt_out", "", 0, "uint32_t", 1)
+   return true
+end
+
+function step(b, ports)
+   local len, v = ports.cnt_in:read()
+   if len > 0 then ports.cnt_out:write(v[0] + 1) end
+end
+]]
+
+function TestPortObj:test_ffi_step()
+   local lb2=ubx.block_create(nd, "lua/luablock", "lb2", { lua_str=lua_ffi_step, ffi_step=1 } )
+   assert_equals(ubx.block_init(lb2), 0)
+   local pout = ubx.port_bind(ubx.port_clone_conn(lb2, "cnt_in", 4))
+   local pin = ubx.port_bind(ubx.port_clone_conn(lb2, "cnt_out", 4))
+   assert_equals(ubx.block_start(lb2), 0)
+
+   for i=1,1000 do
+      pout:write(i)
+      ubx.cblock_step(lb2)
+      local len, v = pin:read()
+      assert_equals(len, 1)
+      assert_equals(v[0], i+1)
+   end
+end
+
+os.exit( lu.LuaUnit.run() )
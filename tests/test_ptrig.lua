@@ -367,6 +367,300 @@ function TestPtrig:TestMultichainPtrig()
    ubx.node_rm(nd)
 end
 
+--
+-- ptrig pipeline
+--
+
+-- like count_num_trigs, but expects the ramp value of the previous
+-- period
+local count_pipelined = [[
+local ubx=require "ubx"
+
+local p_ramp_cnt, p_test_result
+
+function init(b)
+   ubx.inport_add(b, "ramp_cnt", "ramp counter in", 0, "uint64_t", 1)
+   ubx.outport_add(b, "test_result", "test results", 0, "int", 1)
+   p_ramp_cnt = ubx.port_get(b, "ramp_cnt")
+   p_test_result = ubx.port_get(b, "test_result")
+   return true
+end
+
+local trig_cnt = 0
+local test_result = 999
+
+function step(b)
+   local len, res = p_ramp_cnt:read()
+   if trig_cnt == 0 then
+      if len ~= 0 then test_result = -1 end
+   elseif len ~= 1 or res:tolua() ~= trig_cnt - 1 then
+      test_result = -2
+   end
+
+   ubx.port_write(p_test_result, test_result)
+
+   trig_cnt=trig_cnt+1
+end
+
+function cleanup(b)
+   ubx.port_rm(b, "ramp_cnt")
+   ubx.port_rm(b, "test_result")
+end
+]]
+
+local sys5 = bd.system {
+   imports = { "stdtypes", "ptrig", "ramp_uint64", "lfds_cyclic", "luablock" },
+   blocks = {
+      { name="ramp", type="ramp_uint64" },
+      { name="tester", type="lua/luablock" },
+      { name="trig", type="std_triggers/ptrig" },
+   },
+   connections = {
+      { src="ramp.out", tgt="tester.ramp_cnt" },
+   },
+
+   configurations = {
+      { name="ramp", config = { start=0, slope=1 } },
+      { name="tester", config = { lua_str=count_pipelined } },
+      { name="trig", config = { period = {sec=0, usec=10000 },
+				pipeline=1,
+				num_chains=2,
+				chain0={ { b="#ramp" } },
+				chain1={ { b="#tester" } } } },
+   },
+}
+
+function TestPtrig:TestPipeline()
+   local nd = sys5:launch{ nostart=true, loglevel=LOGLEVEL, nodename='sys5' }
+
+   local ib = ubx.port_get(nd:b("ramp"), "out").out_interaction[0]
+   assert_equals(ubx.safe_tostr(ib.prototype.name), "std_triggers/handoff")
+
+   local p_result = ubx.port_clone_conn(nd:b("tester"), "test_result")
+   sys5:startup(nd)
+   ubx.clock_mono_sleep(1)
+   nd:b("trig"):do_stop()
+   local _, res = p_result:read()
+   assert_equals(res:tolua(), 999)
+   ubx.node_rm(nd)
+end
+
+--
+-- rtcheck: page fault and allocation checks
+--
+
+-- touches 4 MiB of fresh memory in each step
+local alloc_block = [[
+local ffi=require "ffi"
+
+function step(b)
+   local buf = ffi.new("uint8_t[?]", 4*1024*1024)
+   buf = nil
+   collectgarbage()
+end
+]]
+
+local sys6 = bd.system {
+   imports = { "stdtypes", "trig", "lfds_cyclic", "luablock", "cconst" },
+   blocks = {
+      { name="alloc", type="lua/luablock" },
+      { name="const", type="consts/cconst" },
+      { name="trig", type="std_triggers/trig" },
+   },
+   configurations = {
+      { name="alloc", config = { lua_str=alloc_block } },
+      { name="const", config = { type_name="int", value=1000 } },
+      { name="trig", config = { tstats_mode=3,
+				tstats_skip_first=10,
+				chain0={
+				   { b="#const" },
+				   { b="#alloc" } } } },
+   },
+}
+
+function TestPtrig:TestRtcheck()
+   local nd = sys6:launch{ loglevel=LOGLEVEL, nodename='sys6' }
+   local p_rtcheck = ubx.port_clone_conn(nd:b("trig"), "rtcheck", 64)
+   local p_const = ubx.port_clone_conn(nd:b("const"), "out")
+   local b_trig = nd:b("trig")
+
+   for _=1,20 do
+      b_trig:do_step()
+      p_const:read()
+   end
+
+   local res = {}
+   while true do
+      local cnt, rc = p_rtcheck:read()
+      if cnt <= 0 then break end
+      rc = rc:tolua()
+      res[rc.id] = rc
+   end
+
+   local rc = res['chain0,alloc']
+   assert_true(rc ~= nil, "no rtcheck violations of block alloc")
+   -- only the last 10 of the 20 steps are checked
+   assert_true(rc.viol >= 1 and rc.viol <= rc.steps and rc.steps <= 10)
+   assert_true(rc.minflt > 0)
+   assert_equals(res['chain0,const'], nil)
+
+   ubx.node_rm(nd)
+end
+
+local sys7 = bd.system {
+   imports = { "stdtypes", "ptrig", "lfds_cyclic", "ramp_uint64" },
+   blocks = {
+      { name="ramp", type="ramp_uint64" },
+      { name="buf", type="lfds_buffers/cyclic" },
+      { name="trig", type="std_triggers/ptrig" },
+   },
+   configurations = {
+      { name="buf", config = { type_name="double", data_len=1024, buffer_len=16 } },
+      { name="trig", config = { period = {sec=0, usec=10000 },
+				stacksize=1024*1024,
+				chain0={ { b="#ramp" } } } },
+   },
+}
+
+function TestPtrig:TestPrepareRt()
+   local conf = { loglevel=LOGLEVEL, nodename='sys7', timing=true, nostart=true,
+		  prepare_rt=true, rt_heap_reserve=1024*1024 }
+   local nd = sys7:launch(conf)
+
+   local phase
+   for _,p in ipairs(conf.phases) do
+      if p.name == "prepare_rt" then phase = p end
+   end
+   assert_true(phase ~= nil, "no prepare_rt launch phase")
+
+   -- 16 elements of 8 KiB and the heap reserve
+   local bytes = ubx.node_prepare_rt(nd, 1024*1024)
+   assert_true(bytes >= 16 * 8 * 1024 + 1024 * 1024)
+
+   -- the buffers of active blocks are not prefaulted
+   sys7:startup(nd)
+   assert_equals(ubx.node_prepare_rt(nd), 0)
+
+   ubx.node_rm(nd)
+end
+
+local sys8 = bd.system {
+   imports = { "stdtypes", "lfds_cyclic" },
+   blocks = {
+      { name="buf", type="lfds_buffers/cyclic" },
+   },
+   configurations = {
+      { name="buf", config = { type_name="double", data_len=1024, buffer_len=16, hugepages=1 } },
+   },
+}
+
+function TestPtrig:TestHugepages()
+   local nd = sys8:launch{ loglevel=LOGLEVEL, nodename='sys8', nostart=true }
+   local regions = ubx.block_mem_regions(nd:b("buf"))
+   local hps = tonumber(ubx.ubx.ubx_hugepage_size())
+
+   -- the ring is rounded up to the huge page size, but depending on
+   -- the system may be backed by regular pages
+   assert_equals(#regions, 1)
+   assert_true(regions[1].len >= 17 * (8 * 1024 + 16))
+   assert_equals(regions[1].len % hps, 0)
+   assert_true(regions[1].pages == "hugetlb" or regions[1].pages == "thp" or
+		  regions[1].pages == "regular")
+
+   ubx.node_rm(nd)
+end
+
+local sys9 = bd.system {
+   imports = { "stdtypes", "ptrig", "trig", "lfds_cyclic", "ramp_double", "math_double" },
+   blocks = {
+      { name="ramp", type="ramp_double" },
+      { name="m1", type="math_double" },
+      { name="m2", type="math_double" },
+      { name="m3", type="math_double" },
+      { name="trig", type="std_triggers/trig" },
+      { name="ptrig", type="std_triggers/ptrig" },
+   },
+   connections = {
+      { src="m1.y", tgt="m2.x", buffer_length=4 },
+      { src="ramp.out", tgt="m1.x" },
+      { src="m2.y", tgt="m3.x" },
+   },
+   configurations = {
+      { name="m1", config = { func="fabs" } },
+      { name="m2", config = { func="fabs" } },
+      { name="m3", config = { func="fabs" } },
+      { name="trig", config = { chain0={ { b="#ramp" }, { b="#m1" } } } },
+      { name="ptrig", config = { period = {sec=0, usec=10000 },
+				 chain0={ { b="#trig" }, { b="#m2" } } } },
+   },
+}
+
+function TestPtrig:TestMemPlan()
+   local conf = { loglevel=LOGLEVEL, nodename='sys9', timing=true, nostart=true, mem_plan=true }
+   local nd = sys9:launch(conf)
+
+   local phase
+   for _,p in ipairs(conf.phases) do
+      if p.name == "plan_memory" then phase = p end
+   end
+   assert_true(phase ~= nil, "no plan_memory launch phase")
+
+   -- m3 is not triggered, but reads from m2
+   local arenas = ubx.mem_arenas(nd)
+   assert_equals(#arenas, 1)
+   assert_equals(arenas[1].name, "ptrig")
+
+   -- rings of ramp.out and m2.y with 2 elements of 16 bytes, of
+   -- m1.y with 5, each aligned to a cache line
+   local size = 64 + 128 + 64
+   assert_equals(arenas[1].used, size)
+   assert_true(arenas[1].len >= size)
+
+   local num = 0
+   ubx.blocks_map(nd, function(b)
+		     for _,r in ipairs(ubx.block_mem_regions(b)) do
+			assert_equals(r.arena, "ptrig")
+			num = num + 1
+		     end
+		  end, ubx.is_iblock_instance)
+   assert_equals(num, 3)
 
+   ubx.node_rm(nd)
+end
+
+local sys10 = bd.system {
+   imports = { "stdtypes", "ptrig", "lfds_cyclic", "ramp_double", "math_double", "simple_fifo" },
+   blocks = {
+      { name="ramp", type="ramp_double" },
+      { name="fifo", type="examples/simple_fifo" },
+      { name="m1", type="math_double" },
+      { name="ptrig", type="std_triggers/ptrig" },
+   },
+   connections = {
+      { src="ramp.out", tgt="fifo" },
+      { src="fifo", tgt="m1.x" },
+   },
+   configurations = {
+      { name="fifo", config = { fifo_size=100 } },
+      { name="m1", config = { func="fabs" } },
+      { name="ptrig", config = { period = {sec=0, usec=10000 },
+				 chain0={ { b="#ramp" }, { b="#m1" } } } },
+   },
+}
+
+-- explicit simple_fifo iblocks are placed in the arena too
+function TestPtrig:TestMemPlanFifo()
+   local nd = sys10:launch{ loglevel=LOGLEVEL, nodename='sys10', nostart=true, mem_plan=true }
+
+   local arenas = ubx.mem_arenas(nd)
+   assert_equals(#arenas, 1)
+   assert_equals(arenas[1].used, 128)
+
+   local regions = ubx.block_mem_regions(nd:b("fifo"))
+   assert_equals(#regions, 1)
+   assert_equals(regions[1].arena, "ptrig")
+
+   ubx.node_rm(nd)
+end
 
 os.exit( luaunit.LuaUnit.run() )
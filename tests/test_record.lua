@@ -0,0 +1,88 @@
+local lu = require("luaunit")
+local ubx = require("ubx")
+local bd = require("blockdiagram")
+local ffi = require("ffi")
+local tu = require("tests.testutils")
+
+local assert_equals = lu.assert_equals
+local range, drain = tu.range, tu.drain
+
+local NUM_STEPS = 5
+
+local file = os.tmpname()
+
+-- record the out-port ramp.out and the in-port math.x
+local rec_sys = bd.system {
+   imports = { "stdtypes", "trig", "ramp_double", "math_double", "lfds_cyclic", "record" },
+   blocks = {
+      { name="ramp", type="ramp_double" },
+      { name="math", type="math_double" },
+      { name="rec", type="record/recorder" },
+      { name="trig", type="std_triggers/trig" },
+   },
+   connections = {
+      { src="ramp.out", tgt="math.x" },
+   },
+   configurations = {
+      { name="ramp", config = { start=0, slope=1 } },
+      { name="math", config = { func="fabs" } },
+      { name="rec", config = { filename=file, ports="ramp.out math.x" } },
+      { name="trig", config = { chain0={ { b="#ramp" }, { b="#math" }, { b="#rec" } } } },
+   },
+}
+
+-- replay into math.x, which is connected automatically
+local rep_sys = bd.system {
+   imports = { "stdtypes", "trig", "math_double", "lfds_cyclic", "record" },
+   blocks = {
+      { name="math", type="math_double" },
+      { name="rep", type="record/replay" },
+      { name="trig", type="std_triggers/trig" },
+   },
+   configurations = {
+      { name="math", config = { func="fabs" } },
+      { name="rep", config = { filename=file } },
+      { name="trig", config = { chain0={ { b="#rep" }, { b="#math" } } } },
+   },
+}
+
+TestRecord = {}
+
+function TestRecord:setup()
+   local nd = rec_sys:launch{ nodename="record", loglevel=ffi.C.UBX_LOGLEVEL_WARN }
+   for _=1,NUM_STEPS do nd:b("trig"):do_step() end
+   ubx.node_rm(nd)
+end
+
+function TestRecord:teardown()
+   os.remove(file)
+end
+
+function TestRecord:test_replay()
+   local nd = rep_sys:launch{ nodename="replay", loglevel=ffi.C.UBX_LOGLEVEL_WARN }
+   local rep = nd:b("rep")
+
+   assert_equals(rep:p("s0"):get_doc(), "ramp.out")
+   assert_equals(rep:p("s1"):get_doc(), "math.x")
+
+   local p_out = ubx.port_clone_conn(rep, "s0", NUM_STEPS)
+   local p_y = ubx.port_clone_conn(nd:b("math"), "y", NUM_STEPS)
+   local p_eof = ubx.port_clone_conn(rep, "eof", 1)
+
+   -- each step replays one step of the recorder
+   for i=1,NUM_STEPS do
+      nd:b("trig"):do_step()
+      assert_equals(drain(p_y), { i-1 })
+   end
+
+   assert_equals(drain(p_out), range(0, NUM_STEPS-1))
+   assert_equals(drain(p_eof), {})
+
+   nd:b("trig"):do_step()
+   assert_equals(drain(p_eof), { 1 })
+   assert_equals(drain(p_y), {})
+
+   ubx.node_rm(nd)
+end
+
+os.exit( lu.LuaUnit.run() )
@@ -0,0 +1,64 @@
+local lu = require("luaunit")
+local ubx = require("ubx")
+local bd = require("blockdiagram")
+local ffi = require("ffi")
+
+local assert_equals = lu.assert_equals
+local assert_true = lu.assert_true
+
+-- a ramp triggered at 1 kHz
+local sys = bd.system {
+   imports = { "stdtypes", "ptrig", "ramp_uint64", "lfds_cyclic" },
+   blocks = {
+      { name="ramp", type="ramp_uint64" },
+      { name="trig", type="std_triggers/ptrig" },
+   },
+   configurations = {
+      { name="ramp", config = { start=0, slope=1 } },
+      { name="trig", config = { period = {sec=0, usec=1000 },
+				chain0={ { b="#ramp" } } } },
+   },
+}
+
+local nd
+
+TestRewire = {}
+
+function TestRewire:setup()
+   nd = sys:launch{ nodename="rewire", loglevel=ffi.C.UBX_LOGLEVEL_WARN }
+end
+
+function TestRewire:teardown()
+   sys:pulldown(nd)
+end
+
+-- repeatedly add and remove taps to the ramp output while the
+-- trigger keeps running
+function TestRewire:test_tap_running()
+   local ramp = nd:b("ramp")
+   local pout = ubx.port_get(ramp, "out")
+   local last = -1
+
+   for i=1,50 do
+      local tap = ubx.port_clone_conn(ramp, "out", 16)
+      local ib = tap.in_interaction[0]
+      local ibname = ubx.safe_tostr(ib.name)
+
+      ubx.clock_mono_sleep(0, 5*1000*1000)
+
+      local len, val = tap:read()
+      assert_true(len > 0, "no data on tap "..i)
+      assert_true(val:tolua() > last)
+      last = val:tolua()
+
+      assert_equals(ubx.ports_disconnect(pout, tap, ib), 0)
+      ubx.block_stop(ib)
+      ubx.block_cleanup(ib)
+      ubx.block_rm(nd, ibname)
+
+      assert_true(pout.out_interaction == nil)
+      assert_equals(nd:b("trig"):get_block_state(), 'active')
+   end
+end
+
+os.exit( lu.LuaUnit.run() )
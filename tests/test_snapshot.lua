@@ -0,0 +1,116 @@
+local lu = require("luaunit")
+local ubx = require("ubx")
+local bd = require("blockdiagram")
+local ffi = require("ffi")
+
+local assert_equals = lu.assert_equals
+local assert_true = lu.assert_true
+local assert_false = lu.assert_false
+
+local sys = bd.system {
+   imports = { "stdtypes", "random", "lfds_cyclic", "trig" },
+   blocks = {
+      { name = "rnd1", type="random/random" },
+      { name = "rnd2", type="random/random" },
+      { name = "trig", type="std_triggers/trig" },
+   },
+   node_configurations = {
+      rand_conf = { type="struct random_config", config={ min=222, max=333 } },
+   },
+   configurations = {
+      { name="rnd1", config = { loglevel=6, min_max_config="&rand_conf" } },
+      { name="rnd2", config = { min_max_config="&rand_conf" } },
+      { name="trig", config = { chain0={
+				   { b="#rnd1", num_steps=1, measure=0 },
+				   { b="#rnd2", num_steps=2, measure=0 } } } }
+   },
+   connections = {
+      { src="rnd1.rnd", tgt="rnd2.seed" }
+   },
+}
+
+local file = os.tmpname()
+
+TestSnapshot = {}
+
+function TestSnapshot:setup()
+   local nd = sys:launch{ nostart=true, snapshot=file,
+			  loglevel=ffi.C.UBX_LOGLEVEL_WARN }
+   sys:pulldown(nd)
+end
+
+function TestSnapshot:teardown()
+   os.remove(file)
+end
+
+function TestSnapshot:test_restore()
+   local nd = ubx.node_create("restored", { loglevel=ffi.C.UBX_LOGLEVEL_WARN })
+   ubx.node_restore(nd, file)
+
+   local rnd1, rnd2, trig = nd:b("rnd1"), nd:b("rnd2"), nd:b("trig")
+
+   for _,b in ipairs{ rnd1, rnd2, trig } do
+      assert_equals(b:get_block_state(), 'inactive')
+   end
+
+   assert_equals(rnd1:c("min_max_config"):tolua(), { min=222, max=333 })
+   assert_equals(rnd1:c("loglevel"):tolua(), 6)
+
+   -- node configs are still shared
+   assert_true(rnd1:c("min_max_config").value == rnd2:c("min_max_config").value)
+
+   -- block pointers are relocated to the restored blocks
+   local chain0 = ubx.data_to_cdata(trig:c("chain0").value)
+   assert_true(chain0[0].b == rnd1)
+   assert_true(chain0[1].b == rnd2)
+   assert_equals(chain0[1].num_steps, 2)
+
+   -- connections
+   local p = ubx.port_get(rnd1, "rnd")
+   assert_true(p.out_interaction ~= nil and p.out_interaction[0] ~= nil)
+   assert_true(p.out_interaction[0] == ubx.port_get(rnd2, "seed").in_interaction[0])
+
+   ubx.node_rm(nd)
+end
+
+function TestSnapshot:test_type_mismatch()
+   local nd = ubx.node_create("mismatch", { loglevel=ffi.C.UBX_LOGLEVEL_CRIT })
+   ubx.load_module(nd, "stdtypes")
+   ubx.load_module(nd, "random")
+
+   -- replace the hash of struct random_config in the image
+   local hash = ffi.string(ubx.type_get(nd, "struct random_config").hash, 16)
+   local fd = assert(io.open(file, "rb"))
+   local img = fd:read("*a")
+   fd:close()
+
+   local s, e = string.find(img, hash, 1, true)
+   assert_true(s ~= nil, "type hash not found in image")
+   img = img:sub(1, s-1)..string.rep("\0", 16)..img:sub(e+1)
+
+   fd = assert(io.open(file, "wb"))
+   fd:write(img)
+   fd:close()
+
+   assert_false(pcall(ubx.node_restore, nd, file))
+
+   -- no blocks may have been created
+   assert_false(pcall(ubx.block_get, nd, "rnd1"))
+   ubx.node_rm(nd)
+end
+
+function TestSnapshot:test_corrupt()
+   local fd = assert(io.open(file, "rb"))
+   local img = fd:read("*a")
+   fd:close()
+
+   fd = assert(io.open(file, "wb"))
+   fd:write(img:sub(1, 100))
+   fd:close()
+
+   local nd = ubx.node_create("corrupt", { loglevel=ffi.C.UBX_LOGLEVEL_CRIT })
+   assert_false(pcall(ubx.node_restore, nd, file))
+   ubx.node_rm(nd)
+end
+
+os.exit( lu.LuaUnit.run() )
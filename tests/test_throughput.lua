@@ -0,0 +1,94 @@
+local lu = require("luaunit")
+local ubx = require("ubx")
+local bd = require("blockdiagram")
+local ffi = require("ffi")
+local tu = require("tests.testutils")
+
+local assert_equals = lu.assert_equals
+local range, drain = tu.range, tu.drain
+
+-- ramp -> [4] -> math -> [OUT_LEN] -> p_y
+local OUT_LEN = 8
+
+local sys = bd.system {
+   imports = { "stdtypes", "trig", "ramp_double", "math_double", "lfds_cyclic" },
+   blocks = {
+      { name="ramp", type="ramp_double" },
+      { name="math", type="math_double" },
+      { name="trig", type="std_triggers/trig" },
+   },
+   connections = {
+      { src="ramp.out", tgt="math.x", buffer_length=4 },
+   },
+   configurations = {
+      { name="ramp", config = { start=0, slope=1 } },
+      { name="math", config = { func="fabs" } },
+      { name="trig", config = { throughput=1,
+				chain0={ { b="#ramp" }, { b="#math" } } } },
+   },
+}
+
+local nd, p_y
+
+TestThroughput = {}
+
+tu.launch_fixture(TestThroughput, sys, { nodename="throughput" },
+		  function(n)
+		     nd = n
+		     p_y = ubx.port_clone_conn(nd:b("math"), "y", OUT_LEN)
+		  end)
+
+-- stepping stops when all buffers are full, without losing samples
+function TestThroughput:test_backpressure()
+   local ramp, math = nd:b("ramp"), nd:b("math")
+
+   nd:b("trig"):do_step()
+   assert_equals(tonumber(math.stat_num_steps), OUT_LEN)
+   assert_equals(tonumber(ramp.stat_num_steps), OUT_LEN + 4)
+   assert_equals(drain(p_y), range(0, OUT_LEN-1))
+
+   nd:b("trig"):do_step()
+   assert_equals(tonumber(ramp.stat_num_steps), 2*OUT_LEN + 4)
+   assert_equals(drain(p_y), range(OUT_LEN, 2*OUT_LEN-1))
+end
+
+function TestThroughput:test_max_steps()
+   local trig = nd:b("trig")
+
+   trig:do_stop()
+   ubx.set_config(trig, "max_steps", 3)
+   trig:do_start()
+
+   -- one pass steps ramp and math once
+   trig:do_step()
+   assert_equals(tonumber(nd:b("ramp").stat_num_steps), 2)
+   assert_equals(drain(p_y), { 0, 1 })
+end
+
+-- a block without flow controlled ports does not count as progress
+function TestThroughput:test_no_flowctrl()
+   local sys_free = bd.system {
+      imports = { "stdtypes", "trig", "ramp_double" },
+      blocks = {
+	 { name="free", type="ramp_double" },
+	 { name="trig", type="std_triggers/trig" },
+      },
+      configurations = {
+	 { name="trig", config = { throughput=1, chain0={ { b="#free" } } } },
+      },
+   }
+
+   local nd_free = sys_free:launch{ nodename="throughput_free",
+				    loglevel=ffi.C.UBX_LOGLEVEL_WARN }
+
+   -- returns after a single pass
+   nd_free:b("trig"):do_step()
+   assert_equals(tonumber(nd_free:b("free").stat_num_steps), 1)
+
+   nd_free:b("trig"):do_step()
+   assert_equals(tonumber(nd_free:b("free").stat_num_steps), 2)
+
+   ubx.node_rm(nd_free)
+end
+
+os.exit( lu.LuaUnit.run() )
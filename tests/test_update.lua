@@ -0,0 +1,109 @@
+local lu = require("luaunit")
+local ubx = require("ubx")
+local bd = require("blockdiagram")
+local ffi = require("ffi")
+
+local assert_equals = lu.assert_equals
+local assert_true = lu.assert_true
+
+ubx.color=false
+
+-- generate a model with the given rnd2 config and optionally a third
+-- block connected to rnd2
+local function gen_sys(rnd2_min, with_rnd3)
+   local sys = {
+      imports = { "stdtypes", "random", "lfds_cyclic", "trig" },
+      blocks = {
+	 { name = "rnd1", type="random/random" },
+	 { name = "rnd2", type="random/random" },
+	 { name = "trig", type="std_triggers/trig" },
+      },
+      configurations = {
+	 { name="rnd1", config = { min_max_config = { min=1, max=2 } } },
+	 { name="rnd2", config = { min_max_config = { min=rnd2_min, max=100 } } },
+	 { name="trig", config = { chain0={
+				      { b="#rnd1", num_steps=1, measure=0 },
+				      { b="#rnd2", num_steps=1, measure=0 } } } }
+      },
+      connections = {
+	 { src="rnd1.rnd", tgt="rnd2.seed" }
+      },
+   }
+
+   if with_rnd3 then
+      table.insert(sys.blocks, { name = "rnd3", type="random/random" })
+      table.insert(sys.configurations,
+		   { name="rnd3", config = { min_max_config = { min=7, max=8 } } })
+      table.insert(sys.connections, { src="rnd2.rnd", tgt="rnd3.seed" })
+   end
+
+   return bd.system(sys)
+end
+
+local nd, sys
+
+TestUpdate = {}
+
+function TestUpdate:setup()
+   sys = gen_sys(3)
+   nd = sys:launch{ loglevel=ffi.C.UBX_LOGLEVEL_WARN }
+end
+
+function TestUpdate:teardown()
+   sys:pulldown(nd)
+end
+
+function TestUpdate:test_nochange()
+   local plan, str = sys:update(nd, gen_sys(3), { dryrun=true })
+   assert_equals(str, "no changes")
+   assert_equals(#plan.reinit, 0)
+   assert_equals(#plan.stop, 0)
+end
+
+function TestUpdate:test_dryrun()
+   local plan = sys:update(nd, gen_sys(5, true), { dryrun=true })
+
+   assert_equals(plan.reinit, { "rnd2" })
+   assert_equals(plan.stop, { "trig" })
+   assert_equals(#plan.blocks_add, 1)
+   assert_equals(#plan.conns_add, 1)
+
+   -- nothing applied
+   assert_equals(nd:b("rnd2"):c("min_max_config"):tolua(), { min=3, max=100 })
+   assert_true(not pcall(ubx.block_get, nd, "rnd3"))
+end
+
+function TestUpdate:test_apply()
+   local rnd1, rnd2 = nd:b("rnd1"), nd:b("rnd2")
+   local new = gen_sys(5, true)
+
+   sys:update(nd, new)
+
+   -- unaffected blocks are not recreated
+   assert_true(nd:b("rnd1") == rnd1)
+   assert_true(nd:b("rnd2") == rnd2)
+
+   assert_equals(rnd2:c("min_max_config"):tolua(), { min=5, max=100 })
+   assert_equals(nd:b("rnd3"):c("min_max_config"):tolua(), { min=7, max=8 })
+
+   for _,b in ipairs{ "rnd1", "rnd2", "rnd3", "trig" } do
+      assert_equals(nd:b(b):get_block_state(), 'active')
+   end
+
+   -- the connection of the reinitialized block was preserved
+   assert_true(ubx.port_get(rnd2, "seed").in_interaction[0] ~= nil)
+   assert_true(ubx.port_get(rnd2, "rnd").out_interaction[0] ~= nil)
+
+   -- and back again
+   sys = new
+   local new2 = gen_sys(3)
+   new:update(nd, new2)
+   sys = new2
+
+   assert_true(not pcall(ubx.block_get, nd, "rnd3"))
+   local p = ubx.port_get(rnd2, "rnd")
+   assert_true(p.out_interaction == nil or p.out_interaction[0] == nil)
+   assert_equals(rnd2:c("min_max_config"):tolua(), { min=3, max=100 })
+end
+
+os.exit( lu.LuaUnit.run() )
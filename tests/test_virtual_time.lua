@@ -0,0 +1,76 @@
+local lu = require("luaunit")
+local ubx = require("ubx")
+local bd = require("blockdiagram")
+local ffi = require("ffi")
+
+local assert_equals = lu.assert_equals
+local assert_true = lu.assert_true
+local assert_almost_equals = lu.assert_almost_equals
+
+-- 100 steps at 10 Hz, i.e. 9.9 s
+local sys = bd.system {
+   imports = { "stdtypes", "ptrig", "ramp_uint64", "lfds_cyclic" },
+   blocks = {
+      { name="ramp", type="ramp_uint64" },
+      { name="trig", type="std_triggers/ptrig" },
+   },
+   configurations = {
+      { name="ramp", config = { start=0, slope=1 } },
+      { name="trig", config = { period = {sec=0, usec=100000 },
+				autostop_steps=100,
+				chain0={ { b="#ramp" } } } },
+   },
+}
+
+TestVirtualTime = {}
+
+function TestVirtualTime:test_ptrig()
+   local nd = sys:launch{ nodename="vtime", nostart=true, virtual_time=true,
+			  loglevel=ffi.C.UBX_LOGLEVEL_WARN }
+   local p_out = ubx.port_clone_conn(nd:b("ramp"), "out")
+
+   local vstart = ubx.node_gettime(nd)
+   local wstart = ubx.clock_mono_gettime()
+
+   sys:startup(nd)
+
+   -- wait for autostop
+   while nd:b("trig"):get_block_state() == 'active' do
+      ubx.clock_mono_sleep(0, 10*1000*1000)
+      assert_true(ubx.clock_mono_gettime() - wstart < 5, "timeout")
+   end
+
+   assert_almost_equals(ubx.node_gettime(nd) - vstart, 9.9, 1e-9)
+
+   local len, val = p_out:read()
+   assert_equals(tonumber(len), 1)
+   assert_equals(val:tolua(), 99)
+
+   -- an unattached sleeper is woken up exactly at its wakeup time
+   vstart = ubx.node_gettime(nd)
+   ubx.node_sleep(nd, 2.5)
+   assert_almost_equals(ubx.node_gettime(nd) - vstart, 2.5, 1e-9)
+
+   sys:pulldown(nd)
+end
+
+-- the ptrig is attached when start returns, so the clock does not
+-- advance past its first period without it
+function TestVirtualTime:test_start_attach()
+   local nd = sys:launch{ nodename="vtime_attach", nostart=true, virtual_time=true,
+			  loglevel=ffi.C.UBX_LOGLEVEL_WARN }
+   local p_out = ubx.port_clone_conn(nd:b("ramp"), "out")
+
+   sys:startup(nd)
+
+   -- steps at 0, 0.1, 0.2 and 0.3 s
+   ubx.node_sleep(nd, 0.35)
+
+   local len, val = p_out:read()
+   assert_equals(tonumber(len), 1)
+   assert_equals(val:tolua(), 3)
+
+   sys:pulldown(nd)
+end
+
+os.exit( lu.LuaUnit.run() )
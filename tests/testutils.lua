@@ -0,0 +1,58 @@
+--
+-- Helpers shared by the luaunit tests
+--
+-- Tests are run from the top level directory (see run_tests.sh), so
+-- this module is loaded with require("tests.testutils").
+--
+
+local ubx = require("ubx")
+local ffi = require("ffi")
+
+local M = {}
+
+--- Return the list of integers from..to
+-- @param from first value
+-- @param to last value
+-- @return table
+function M.range(from, to)
+   local res = {}
+   for i=from,to do res[#res+1] = i end
+   return res
+end
+
+--- Read all samples available on a port object
+-- @param p port object (see ubx.port_bind)
+-- @return list of the samples converted to Lua
+function M.drain(p)
+   local res = {}
+   while true do
+      local len, val = p:read()
+      if len <= 0 then break end
+      res[#res+1] = val:tolua()
+   end
+   return res
+end
+
+--- Define setup and teardown of a test class to launch a system
+-- Each test gets a freshly launched node, which is removed after
+-- the test. The loglevel defaults to UBX_LOGLEVEL_WARN.
+-- @param tc test class table
+-- @param sys system to launch
+-- @param conf launch configuration
+-- @param init optional function(nd) called after launching
+function M.launch_fixture(tc, sys, conf, init)
+   local nd
+
+   conf.loglevel = conf.loglevel or ffi.C.UBX_LOGLEVEL_WARN
+
+   function tc:setup()
+      nd = sys:launch(conf)
+      if init then init(nd) end
+   end
+
+   function tc:teardown()
+      ubx.node_rm(nd)
+   end
+end
+
+return M